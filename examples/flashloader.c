@@ -0,0 +1,223 @@
+/* A RAM-resident loader stub for compressed Flash programming. The host (the
+ * bmflash utility) uploads this stub into the RAM of the target, and then
+ * passes it batches of compressed data (in the LZ4 block format). The stub
+ * decompresses each block and programs it into Flash memory, with an
+ * MCU-specific routine, flash_program().
+ *
+ * To build the stub, link it with an implementation of flash_program() for
+ * the MCU, at address 0, with the header at the start of the image. A linker
+ * script for this is:
+ *
+ *   SECTIONS {
+ *     . = 0;
+ *     .text : { KEEP(*(.header)) *(.text*) *(.rodata*) }
+ *     /DISCARD/ : { *(.data*) *(.bss*) *(.ARM.*) }
+ *   }
+ *
+ * and the commands are:
+ *
+ *   arm-none-eabi-gcc -mthumb -mcpu=cortex-m0 -Os -ffreestanding -nostdlib
+ *                     -fno-tree-loop-distribute-patterns -T flashloader.ld
+ *                     -o flashloader.elf flashloader.c flash_mcu.c
+ *   arm-none-eabi-objcopy -O binary flashloader.elf "<MCU family>.bin"
+ *
+ * bmflash looks for the binary image in the "bmloader" subdirectory of its
+ * configuration directory, with the MCU family name (as reported by the Black
+ * Magic Probe) as the filename.
+ *
+ * Compile with -DSTANDALONE to build a test program for the host, where the
+ * Flash memory is simulated (the LZ4 compressor of the host is needed too).
+ *
+ *
+ * Copyright 2022 CompuPhase
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#include <stdint.h>
+#include "flashloader.h"
+
+/* translation of a target address to a pointer; a simulator may override it */
+#if defined STANDALONE
+  #define SIM_RAM_SIZE      (80 * 1024)
+  static uint32_t sim_ram[SIM_RAM_SIZE / 4];
+  #define LOADER_PTR(addr)  ((uint8_t*)sim_ram + (addr))
+#elif !defined LOADER_PTR
+  #define LOADER_PTR(addr)  ((uint8_t*)(uintptr_t)(addr))
+#endif
+
+#if defined __arm__
+__attribute__((section(".header"), used))
+const FLASHLOADER_HDR flashloader_header = {
+  FLASHLOADER_MAGIC, (uint32_t)flashloader, FLASHLOADER_VERSION, FLASHLOADER_ALIGN
+};
+#endif
+
+/* lz4_length() reads the extension bytes of a length field; it returns 0 if
+   the data runs past the end */
+static uint32_t lz4_length(const uint8_t **src, const uint8_t *end, uint32_t length)
+{
+  uint8_t b;
+  do {
+    if (*src >= end)
+      return 0;
+    b = *(*src)++;
+    length += b;
+  } while (b == 255);
+  return length;
+}
+
+/* lz4_unpack() decompresses a block in the LZ4 block format; it returns the
+   size of the decompressed data, or 0 on error */
+static uint32_t lz4_unpack(const uint8_t *src, uint32_t srclen, uint8_t *dest, uint32_t destsize)
+{
+  const uint8_t *end = src + srclen;
+  uint32_t pos = 0;
+
+  while (src < end) {
+    uint32_t token = *src++;
+    uint32_t length = token >> 4;
+    uint32_t offset;
+    if (length == 15 && (length = lz4_length(&src, end, length)) == 0)
+      return 0;
+    if (length > (uint32_t)(end - src) || pos + length > destsize)
+      return 0;
+    while (length-- > 0)
+      dest[pos++] = *src++;
+    if (src >= end)
+      break;  /* last sequence has no match */
+    if (end - src < 2)
+      return 0;
+    offset = src[0] | (src[1] << 8);
+    src += 2;
+    if (offset == 0 || offset > pos)
+      return 0;
+    length = token & 0x0f;
+    if (length == 15 && (length = lz4_length(&src, end, length)) == 0)
+      return 0;
+    length += 4;
+    if (pos + length > destsize)
+      return 0;
+    while (length-- > 0) {
+      dest[pos] = dest[pos - offset];
+      pos++;
+    }
+  }
+  return pos;
+}
+
+uint32_t flashloader(FLASHLOADER_JOB *job)
+{
+  const FLASHLOADER_RECORD *rec;
+  uint8_t *work = LOADER_PTR(job->work);
+
+  #if defined __arm__
+    __asm volatile ("cpsid i");   /* no interrupt handlers of the application */
+  #endif
+
+  job->status = FLASHLOADER_OK;
+  for (rec = (const FLASHLOADER_RECORD*)LOADER_PTR(job->records); rec->size != 0; ) {
+    const uint8_t *packed = (const uint8_t*)(rec + 1);
+    if (rec->size > job->worksize
+        || lz4_unpack(packed, rec->packed, work, job->worksize) != rec->size)
+    {
+      job->status = FLASHLOADER_ERR_DATA;
+      break;
+    }
+    if (!flash_program(rec->address, work, rec->size)) {
+      job->status = FLASHLOADER_ERR_PROGRAM;
+      break;
+    }
+    rec = (const FLASHLOADER_RECORD*)(packed + ((rec->packed + 3) & ~3));
+  }
+  return job->status;
+}
+
+
+#if defined STANDALONE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../source/lz4block.h"
+
+#define FLASH_BASE  0x08000000
+#define FLASH_SIZE  (64 * 1024)
+#define WORK_SIZE   4096
+
+static uint8_t flash[FLASH_SIZE];
+
+int flash_program(uint32_t address, const uint8_t *data, uint32_t size)
+{
+  uint32_t idx;
+  if (address < FLASH_BASE || address + size > FLASH_BASE + FLASH_SIZE
+      || (address % FLASHLOADER_ALIGN) != 0 || (size % FLASHLOADER_ALIGN) != 0)
+    return 0;
+  for (idx = 0; idx < size; idx++)
+    flash[address - FLASH_BASE + idx] &= data[idx]; /* programming only clears bits */
+  return 1;
+}
+
+int main(void)
+{
+  static uint8_t image[FLASH_SIZE];
+  uint32_t idx, pos, offs, work, records;
+  FLASHLOADER_JOB job;
+
+  /* make an image that compresses moderately */
+  srand(1);
+  for (idx = 0; idx < FLASH_SIZE; idx++)
+    image[idx] = (rand() % 4 == 0) ? (uint8_t)rand() : (uint8_t)(idx / 64);
+  memset(flash, 0xff, sizeof flash);
+
+  /* RAM layout: work buffer, then the records */
+  work = 0;
+  records = WORK_SIZE;
+
+  /* pack the image in records of the work buffer size */
+  offs = records;
+  for (pos = 0; pos < FLASH_SIZE; pos += WORK_SIZE) {
+    FLASHLOADER_RECORD *rec = (FLASHLOADER_RECORD*)LOADER_PTR(offs);
+    rec->address = FLASH_BASE + pos;
+    rec->size = WORK_SIZE;
+    rec->packed = (uint32_t)lz4_compress(image + pos, WORK_SIZE, (uint8_t*)(rec + 1),
+                                         SIM_RAM_SIZE - offs - 2 * sizeof(FLASHLOADER_RECORD));
+    if (rec->packed == 0) {
+      printf("FAILED: simulated RAM too small\n");
+      return EXIT_FAILURE;
+    }
+    offs += sizeof(FLASHLOADER_RECORD) + ((rec->packed + 3) & ~3);
+  }
+  memset(LOADER_PTR(offs), 0, sizeof(FLASHLOADER_RECORD));
+
+  job.status = ~0;
+  job.records = records;
+  job.work = work;
+  job.worksize = WORK_SIZE;
+  if (flashloader(&job) != FLASHLOADER_OK || job.status != FLASHLOADER_OK) {
+    printf("FAILED: status %u\n", (unsigned)job.status);
+    return EXIT_FAILURE;
+  }
+  if (memcmp(flash, image, FLASH_SIZE) != 0) {
+    printf("FAILED: Flash contents differ\n");
+    return EXIT_FAILURE;
+  }
+  printf("OK: %u bytes in %u bytes of records\n", (unsigned)FLASH_SIZE, (unsigned)(offs - records));
+  return EXIT_SUCCESS;
+}
+
+#endif /* STANDALONE */
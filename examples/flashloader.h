@@ -0,0 +1,98 @@
+/* A RAM-resident loader stub for compressed Flash programming. The host (the
+ * bmflash utility) uploads this stub into the RAM of the target, and then
+ * passes it batches of compressed data (in the LZ4 block format). The stub
+ * decompresses each block and programs it into Flash memory, with an
+ * MCU-specific routine.
+ *
+ * The stub is entered (by the host) with r0 pointing to a FLASHLOADER_JOB
+ * structure, and it returns to a breakpoint that the host has set up. It uses
+ * no global or static data, so it runs at any address.
+ *
+ *
+ * Copyright 2022 CompuPhase
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#ifndef __FLASHLOADER_H
+#define __FLASHLOADER_H
+
+#include <stdint.h>
+
+#define FLASHLOADER_MAGIC   0x4c504d42  /* "BMPL" */
+#define FLASHLOADER_VERSION 1
+
+/* required alignment (and size granularity) for flash_program(); the host
+   pads each block with 0xff bytes to this alignment */
+#if !defined FLASHLOADER_ALIGN
+  #define FLASHLOADER_ALIGN 256
+#endif
+
+enum {
+  FLASHLOADER_OK = 0,
+  FLASHLOADER_ERR_DATA,     /* invalid compressed data, or work buffer too small */
+  FLASHLOADER_ERR_PROGRAM,  /* flash_program() failed */
+};
+
+/* The header is at the very start of the binary image of the stub. */
+typedef struct {
+  uint32_t magic;     /* FLASHLOADER_MAGIC */
+  uint32_t entry;     /* offset of flashloader() from the start of the image */
+  uint32_t version;   /* FLASHLOADER_VERSION */
+  uint32_t align;     /* FLASHLOADER_ALIGN */
+} FLASHLOADER_HDR;
+
+/* The job is set up by the host, and r0 points to it on entry. */
+typedef struct {
+  uint32_t status;    /* result, set by the stub */
+  uint32_t records;   /* address of the first record */
+  uint32_t work;      /* address of the work buffer (for decompressed data) */
+  uint32_t worksize;  /* size of the work buffer */
+} FLASHLOADER_JOB;
+
+/* Each record is followed by the compressed data, padded to a multiple of 4
+ * bytes; the next record follows. The list ends with a record with size 0.
+ */
+typedef struct {
+  uint32_t address;   /* destination address in Flash memory */
+  uint32_t size;      /* size of the decompressed data */
+  uint32_t packed;    /* size of the compressed data */
+} FLASHLOADER_RECORD;
+
+/** flashloader() is the entry point of the stub. It handles all records in
+ *  the job.
+ *
+ *  \param job  The job.
+ *
+ *  \return FLASHLOADER_OK on success, or an error code. The result is also
+ *          stored in the "status" field of the job.
+ */
+uint32_t flashloader(FLASHLOADER_JOB *job);
+
+/** flash_program() must write a block of data to Flash memory (that was
+ *  already erased by the host). It is MCU-specific, and it must be linked
+ *  with the stub.
+ *
+ *  \param address  The destination address, a multiple of FLASHLOADER_ALIGN.
+ *  \param data     The data to write.
+ *  \param size     The size of the data, a multiple of FLASHLOADER_ALIGN.
+ *
+ *  \return 1 on success, 0 on failure.
+ */
+int flash_program(uint32_t address, const uint8_t *data, uint32_t size);
+
+#endif /* __FLASHLOADER_H */
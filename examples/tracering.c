@@ -0,0 +1,381 @@
+/* A buffered, interrupt-safe transmit queue for the TRACESWO functions. Trace
+ * messages are stored in a ring buffer (without locking, and from any task or
+ * interrupt), and a low-priority "drain" function feeds these messages to the
+ * trace port (ITM, or the SPI or UART back-ends).
+ *
+ * Each message is stored as a header word, followed by the data packed in
+ * 32-bit words. A producer first reserves space for the complete message (with
+ * a compare-and-swap on the head index), then fills in the data and finally
+ * stores the header. The drain only transmits messages whose header has been
+ * stored, so a message that is interrupted half-way by a higher priority task
+ * is never sent incomplete.
+ *
+ * On the Cortex-M0/M0+ (ARMv6-M), which lack exclusive load/store
+ * instructions, the reservation is done with interrupts disabled, but only for
+ * the few instructions that update the head index.
+ *
+ * Compile with -DSTANDALONE to build a test program for the host, where
+ * threads act as producers and the trace port is simulated.
+ *
+ *
+ * Copyright 2020 CompuPhase
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include "tracering.h"
+
+#if (TRACERING_SIZE & (TRACERING_SIZE - 1)) != 0
+  #error TRACERING_SIZE must be a power of 2
+#endif
+
+#define RING_MASK         (TRACERING_SIZE - 1)
+#define HDR_VALID         0x80000000UL
+#define HDR_MAKE(ch, sz)  (HDR_VALID | ((uint32_t)(sz) << 8) | ((uint32_t)(ch) & 0x1f))
+#define HDR_CHANNEL(h)    (int)((h) & 0x1f)
+#define HDR_SIZE(h)       (unsigned)(((h) >> 8) & 0xffff)
+#define RECORD_WORDS(sz)  (1 + ((sz) + 3) / 4)  /* header + data words */
+
+static volatile uint32_t ring[TRACERING_SIZE];
+static volatile uint32_t ring_head = 0;     /* reserved by the producers */
+static volatile uint32_t ring_tail = 0;     /* released by the drain */
+static volatile uint32_t ring_dropped = 0;  /* count of dropped messages */
+
+/* state of the drain (which runs in a single context) */
+static uint32_t drain_header = 0;     /* header of the message being transmitted */
+static unsigned drain_word = 0;       /* next data word in that message */
+static uint32_t drain_reported = 0;   /* dropped messages already reported */
+static char notice[48];               /* message with the count of dropped messages */
+static unsigned notice_length = 0, notice_pos = 0;
+
+#if defined __ARM_ARCH_6M__ || defined __ARM_ARCH_8M_BASE__
+
+static int ring_reserve(uint32_t words, uint32_t *pos)
+{
+  uint32_t primask = __get_PRIMASK();
+  int result = 0;
+  __disable_irq();
+  if (ring_head + words - ring_tail <= TRACERING_SIZE) {
+    *pos = ring_head;
+    ring_head += words;
+    result = 1;
+  } else {
+    ring_dropped += 1;
+  }
+  __set_PRIMASK(primask);
+  return result;
+}
+
+#else
+
+static int ring_reserve(uint32_t words, uint32_t *pos)
+{
+  uint32_t head = __atomic_load_n(&ring_head, __ATOMIC_RELAXED);
+  do {
+    if (head + words - __atomic_load_n(&ring_tail, __ATOMIC_ACQUIRE) > TRACERING_SIZE) {
+      __atomic_fetch_add(&ring_dropped, 1, __ATOMIC_RELAXED);
+      return 0;
+    }
+  } while (!__atomic_compare_exchange_n(&ring_head, &head, head + words, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+  *pos = head;
+  return 1;
+}
+
+#endif
+
+int tracering_bin(int channel, const unsigned char *data, unsigned size)
+{
+  uint32_t pos, idx, value, shift;
+  unsigned total = size;
+
+  if (size == 0)
+    return 1;
+  if (size > 0xffff || RECORD_WORDS(size) > TRACERING_SIZE / 2) {
+    /* message too big for the queue; drop it, so that one big message does
+       not stall all others */
+    #if defined __ARM_ARCH_6M__ || defined __ARM_ARCH_8M_BASE__
+      uint32_t primask = __get_PRIMASK();
+      __disable_irq();
+      ring_dropped += 1;
+      __set_PRIMASK(primask);
+    #else
+      __atomic_fetch_add(&ring_dropped, 1, __ATOMIC_RELAXED);
+    #endif
+    return 0;
+  }
+  if (!ring_reserve(RECORD_WORDS(size), &pos))
+    return 0;
+
+  /* pack the data in words, then store the header, which marks the message
+     as complete */
+  idx = pos + 1;
+  value = shift = 0;
+  while (size-- > 0) {
+    value |= (uint32_t)*data++ << shift;
+    shift += 8;
+    if (shift >= 32) {
+      ring[idx++ & RING_MASK] = value;
+      value = shift = 0;
+    }
+  }
+  if (shift > 0)
+    ring[idx & RING_MASK] = value;
+  __atomic_store_n(&ring[pos & RING_MASK], HDR_MAKE(channel, total), __ATOMIC_RELEASE);
+  return 1;
+}
+
+int tracering_sz(int channel, const char *msg)
+{
+  return tracering_bin(channel, (const unsigned char*)msg, strlen(msg));
+}
+
+uint32_t tracering_dropped(void)
+{
+  return __atomic_load_n(&ring_dropped, __ATOMIC_RELAXED);
+}
+
+static void notice_format(uint32_t count)
+{
+  static const char prefix[] = "overflow: ";
+  static const char suffix[] = " trace messages dropped\n";
+  char digits[12];
+  int len = 0;
+
+  do {
+    digits[len++] = (char)('0' + count % 10);
+    count /= 10;
+  } while (count > 0);
+  strcpy(notice, prefix);
+  notice_length = sizeof prefix - 1;
+  while (len > 0)
+    notice[notice_length++] = digits[--len];
+  memcpy(notice + notice_length, suffix, sizeof suffix - 1);
+  notice_length += sizeof suffix - 1;
+  notice_pos = 0;
+}
+
+unsigned tracering_drain(unsigned maxwords)
+{
+  unsigned count = 0;
+
+  while (maxwords == 0 || count < maxwords) {
+    if (notice_pos < notice_length) {
+      /* transmit the overflow notice */
+      uint32_t value = 0;
+      int size = (notice_length - notice_pos > 4) ? 4 : (int)(notice_length - notice_pos);
+      memcpy(&value, notice + notice_pos, size);  /* Little Endian */
+      if (!tracering_port(TRACERING_OVERFLOW_CHANNEL, value, size))
+        break;
+      notice_pos += size;
+    } else if (drain_header != 0) {
+      /* transmit the next word of the current message */
+      uint32_t tail = ring_tail;
+      unsigned total = HDR_SIZE(drain_header);
+      unsigned offset = (drain_word - 1) * 4;
+      int size = (total - offset > 4) ? 4 : (int)(total - offset);
+      if (!tracering_port(HDR_CHANNEL(drain_header), ring[(tail + drain_word) & RING_MASK], size))
+        break;
+      drain_word += 1;
+      if (offset + size >= total) {
+        /* message complete: clear it (so that stale data words are not taken
+           for a header later), then release the space to the producers */
+        uint32_t words = RECORD_WORDS(total), idx;
+        for (idx = 0; idx < words; idx++)
+          ring[(tail + idx) & RING_MASK] = 0;
+        __atomic_store_n(&ring_tail, tail + words, __ATOMIC_RELEASE);
+        drain_header = 0;
+      }
+    } else {
+      /* between messages, first report any dropped messages */
+      uint32_t dropped = tracering_dropped();
+      uint32_t tail = ring_tail;
+      if (dropped != drain_reported) {
+        notice_format(dropped - drain_reported);
+        drain_reported = dropped;
+        continue;
+      }
+      if (tail == __atomic_load_n(&ring_head, __ATOMIC_ACQUIRE))
+        break;  /* queue is empty */
+      drain_header = __atomic_load_n(&ring[tail & RING_MASK], __ATOMIC_ACQUIRE);
+      if ((drain_header & HDR_VALID) == 0) {
+        drain_header = 0;
+        break;  /* oldest message is still being stored */
+      }
+      drain_word = 1;
+      continue; /* a message always has data, so no word is transmitted yet */
+    }
+    count += 1;
+  }
+  return count;
+}
+
+#if !defined TRACERING_NO_ITM && !defined STANDALONE
+
+int tracering_port(int channel, uint32_t value, int size)
+{
+  (void)size;   /* the ITM data is always padded to 32-bit, like in traceswo_bin() */
+  if ((ITM->TCR & ITM_TCR_ITMENA) == 0UL ||   /* ITM tracing disabled */
+      (ITM->TER & (1 << channel)) == 0UL)     /* ITM channel disabled */
+    return 1;                                 /* data is discarded */
+  if (ITM->PORT[channel].u32 == 0UL)
+    return 0;                                 /* FIFO full, try again later */
+  ITM->PORT[channel].u32 = value;
+  return 1;
+}
+
+#endif /* !TRACERING_NO_ITM */
+
+
+#if defined STANDALONE
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define NUM_PRODUCERS 4
+
+/* the simulated port stores the bytes per channel, and it is randomly busy */
+static unsigned char *streams[32];
+static unsigned stream_length[32];
+static unsigned stream_size = 0;
+static unsigned port_seed = 1;
+
+int tracering_port(int channel, uint32_t value, int size)
+{
+  port_seed = port_seed * 1103515245u + 12345u;
+  if ((port_seed >> 16) % 8 == 0)
+    return 0;
+  if (streams[channel] != NULL && stream_length[channel] + size <= stream_size) {
+    memcpy(streams[channel] + stream_length[channel], &value, size);
+    stream_length[channel] += size;
+  }
+  return 1;
+}
+
+static volatile int producers_done = 0;
+static unsigned messages_per_producer = 100000;
+static unsigned producer_delay = 4;  /* yield after this many messages */
+
+/* each message holds a sequence number, a length and a pattern */
+static void *producer(void *arg)
+{
+  int channel = (int)(intptr_t)arg;
+  unsigned char msg[64];
+  unsigned seq;
+  for (seq = 0; seq < messages_per_producer; seq++) {
+    unsigned len = 1 + (seq * 7 + channel) % 50, idx;
+    memcpy(msg, &seq, 4);
+    msg[4] = (unsigned char)len;
+    for (idx = 0; idx < len; idx++)
+      msg[5 + idx] = (unsigned char)(seq + idx);
+    tracering_bin(channel, msg, 5 + len);
+    if (producer_delay > 0 && seq % producer_delay == 0)
+      sched_yield();  /* let the drain run */
+  }
+  return NULL;
+}
+
+static void *drain(void *arg)
+{
+  (void)arg;
+  while (!__atomic_load_n(&producers_done, __ATOMIC_ACQUIRE))
+    tracering_drain(16);
+  /* the simulated port may be busy, so tracering_drain() may return early */
+  while (ring_tail != ring_head || drain_header != 0 || notice_pos < notice_length
+         || drain_reported != tracering_dropped())
+    tracering_drain(0);
+  return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+  pthread_t threads[NUM_PRODUCERS], drainer;
+  unsigned long received = 0, reported = 0, errors = 0;
+  int ch;
+
+  if (argc > 1)
+    messages_per_producer = (unsigned)strtoul(argv[1], NULL, 10);
+  if (argc > 2)
+    producer_delay = (unsigned)strtoul(argv[2], NULL, 10);
+
+  stream_size = messages_per_producer * 64;
+  for (ch = 0; ch < NUM_PRODUCERS; ch++)
+    streams[ch] = malloc(stream_size);
+  streams[TRACERING_OVERFLOW_CHANNEL] = malloc(stream_size);
+
+  pthread_create(&drainer, NULL, drain, NULL);
+  for (ch = 0; ch < NUM_PRODUCERS; ch++)
+    pthread_create(&threads[ch], NULL, producer, (void*)(intptr_t)ch);
+  for (ch = 0; ch < NUM_PRODUCERS; ch++)
+    pthread_join(threads[ch], NULL);
+  __atomic_store_n(&producers_done, 1, __ATOMIC_RELEASE);
+  pthread_join(drainer, NULL);
+
+  /* check that all received messages are intact and in order */
+  for (ch = 0; ch < NUM_PRODUCERS; ch++) {
+    const unsigned char *ptr = streams[ch];
+    const unsigned char *end = ptr + stream_length[ch];
+    long prev = -1;
+    while (ptr < end) {
+      unsigned seq, len, idx;
+      memcpy(&seq, ptr, 4);
+      len = ptr[4];
+      if ((long)seq <= prev || len != 1 + (seq * 7 + ch) % 50) {
+        errors++;
+        break;
+      }
+      for (idx = 0; idx < len; idx++)
+        if (ptr[5 + idx] != (unsigned char)(seq + idx))
+          errors++;
+      prev = seq;
+      ptr += 5 + len;
+      received++;
+    }
+  }
+
+  /* sum the counts in the overflow notices */
+  if (stream_length[TRACERING_OVERFLOW_CHANNEL] < stream_size) {
+    char *ptr = (char*)streams[TRACERING_OVERFLOW_CHANNEL];
+    ptr[stream_length[TRACERING_OVERFLOW_CHANNEL]] = '\0';
+    while ((ptr = strstr(ptr, "overflow: ")) != NULL) {
+      ptr += 10;
+      reported += strtoul(ptr, &ptr, 10);
+    }
+  }
+
+  for (ch = 0; ch < 32; ch++)
+    if (streams[ch] != NULL)
+      free(streams[ch]);
+
+  printf("sent %lu, received %lu, dropped %lu (reported %lu), errors %lu\n",
+         (unsigned long)NUM_PRODUCERS * messages_per_producer, received,
+         (unsigned long)tracering_dropped(), reported, errors);
+  if (errors > 0 || reported != tracering_dropped()
+      || received + reported != (unsigned long)NUM_PRODUCERS * messages_per_producer)
+  {
+    printf("FAILED\n");
+    return EXIT_FAILURE;
+  }
+  printf("OK\n");
+  return EXIT_SUCCESS;
+}
+
+#endif /* STANDALONE */
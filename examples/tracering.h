@@ -0,0 +1,101 @@
+/* A buffered, interrupt-safe transmit queue for the TRACESWO functions. Trace
+ * messages are stored in a ring buffer (without locking, and from any task or
+ * interrupt), and a low-priority "drain" function feeds these messages to the
+ * trace port (ITM, or the SPI or UART back-ends).
+ *
+ * This decouples the code that produces trace messages from the speed of the
+ * trace wire: storing a message in the queue takes a few cycles per word,
+ * instead of waiting for the ITM port (or SPI/UART) to accept each word.
+ *
+ *
+ * Copyright 2020 CompuPhase
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#ifndef __TRACERING_H
+#define __TRACERING_H
+
+#include <stdint.h>
+
+/* size of the ring buffer in 32-bit words; must be a power of 2 */
+#if !defined TRACERING_SIZE
+  #define TRACERING_SIZE  256
+#endif
+
+/* channel on which the drain reports messages that were dropped because the
+   ring buffer was full; this channel should not be used for CTF streams */
+#if !defined TRACERING_OVERFLOW_CHANNEL
+  #define TRACERING_OVERFLOW_CHANNEL  31
+#endif
+
+/** tracering_bin() stores a buffer of data (which may contain embedded zeros)
+ *  in the queue. It may be called from any task or interrupt, and it never
+ *  waits for the trace port.
+ *
+ *  \param channel  The channel number (0..31).
+ *  \param data     The buffer to transmit.
+ *  \param size     The size of the data buffer.
+ *
+ *  \return 1 on success, 0 if the message was dropped because the queue is
+ *          full (or the message is too big for the queue).
+ */
+int tracering_bin(int channel, const unsigned char *data, unsigned size);
+
+/** tracering_sz() stores a zero-terminated string in the queue. This function
+ *  is built upon tracering_bin().
+ *
+ *  \param channel  The channel number (0..31).
+ *  \param msg      A zero-terminated string.
+ *
+ *  \return 1 on success, 0 if the message was dropped.
+ */
+int tracering_sz(int channel, const char *msg);
+
+/** tracering_drain() transmits queued messages, until the queue is empty, the
+ *  trace port is busy, or the maximum number of words is transmitted. It must
+ *  be called from a single context only, typically the idle hook of the RTOS
+ *  or a low-priority interrupt. If messages were dropped, it transmits a text
+ *  message with the count of dropped messages on channel
+ *  TRACERING_OVERFLOW_CHANNEL.
+ *
+ *  \param maxwords The maximum number of words to transmit, or 0 for no limit.
+ *
+ *  \return The number of words transmitted.
+ */
+unsigned tracering_drain(unsigned maxwords);
+
+/** tracering_dropped() returns the total number of messages that were dropped
+ *  because the queue was full.
+ */
+uint32_t tracering_dropped(void);
+
+/** tracering_port() must transmit a single word on the trace port. It is
+ *  called by tracering_drain() only. A default implementation for the ITM is
+ *  included; for the SPI or UART back-ends, define TRACERING_NO_ITM and
+ *  implement this function on top of traceswo_bin().
+ *
+ *  \param channel  The channel number (0..31).
+ *  \param value    The data, with the first byte in the low bits.
+ *  \param size     The number of valid bytes in "value" (1..4).
+ *
+ *  \return 1 if the word was transmitted, 0 if the port is busy (in which case
+ *          the same word is passed in again on the next call).
+ */
+int tracering_port(int channel, uint32_t value, int size);
+
+#endif /* __TRACERING_H */
@@ -50,7 +50,7 @@ enum {
 
 #define sizearray(a)                  (sizeof(a) / sizeof((a)[0]))
 
-static int get_symbol(ARMSTATE *state, uint32_t address);
+static const char *get_symbol(ARMSTATE *state, uint32_t address);
 
 static char const *conditions[] = {
   "eq", "ne",   /* Z flag */
@@ -284,10 +284,10 @@ static void append_comment_hex(ARMSTATE *state, uint32_t value)
 static void append_comment_symbol(ARMSTATE *state, uint32_t address)
 {
   assert(state != NULL);
-  if (state->add_cmt && state->symbolcount > 0) {
-    int i = get_symbol(state, address);
-    if (i >= 0)
-      append_comment(state, state->symbols[i].name, NULL);
+  if (state->add_cmt && (state->symbolcount > 0 || state->elfsymbolcount > 0)) {
+    const char *name = get_symbol(state, address);
+    if (name != NULL)
+      append_comment(state, name, NULL);
   }
 }
 
@@ -2968,17 +2968,40 @@ static const ENCODEMASK32 arm_table[] = {
   { 0x0f000000, 0x0f000000, arm_softintr },     /* software interrupt */
 };
 
-/** get_symbol() looks up a symbol; returns -1 if not found. The routine depends
- *  on the list being sorted (on address).
+/** find_symbol() returns the index of the first symbol at or above the
+ *  address (or the symbol count if there is none), with a binary search in the
+ *  list (which is sorted on address).
  */
-static int get_symbol(ARMSTATE *state, uint32_t address)
+static int find_symbol(ARMSTATE *state, uint32_t address)
+{
+  int low = 0;
+  int high = state->symbolcount;
+  while (low < high) {
+    int mid = low + (high - low) / 2;
+    if (state->symbols[mid].address < address)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+  return low;
+}
+
+/** get_symbol() looks up the name of the symbol at an address; returns NULL if
+ *  not found. The symbols that were added with disasm_symbol() go first, then
+ *  the symbol table of the ELF file is checked (if set). The routine depends
+ *  on both lists being sorted (on address).
+ */
+static const char *get_symbol(ARMSTATE *state, uint32_t address)
 {
-  int i;
-  for (i = 0; i < state->symbolcount && state->symbols[i].address < address; i++)
-    {}
+  int i = find_symbol(state, address);
   if (i < state->symbolcount && state->symbols[i].address == address)
-    return i;
-  return -1;
+    return state->symbols[i].name;
+  if (state->elfsymbols != NULL) {
+    const ELF_SYMBOL *sym = elf_symbol_at(state->elfsymbols, state->elfsymbolcount, address);
+    if (sym != NULL && sym->address == address)
+      return sym->name;
+  }
+  return NULL;
 }
 
 static void dump_word(ARMSTATE *state, uint32_t w)
@@ -3246,9 +3269,7 @@ void disasm_symbol(ARMSTATE *state, const char *name, uint32_t address, int mode
   assert(state != NULL);
 
   /* find the insertion point */
-  int pos;
-  for (pos = 0; pos < state->symbolcount && state->symbols[pos].address < address; pos++)
-    {}
+  int pos = find_symbol(state, address);
   if (pos >= state->symbolcount || state->symbols[pos].address != address) {
     /* no entry yet at this address */
     char *namecopy = strdup(name);
@@ -3285,6 +3306,24 @@ void disasm_symbol(ARMSTATE *state, const char *name, uint32_t address, int mode
   }
 }
 
+/** disasm_symtab() sets the symbol table of the ELF file, which is used for
+ *  the names of the functions and data objects that instructions refer to,
+ *  when the address is not in the list built with disasm_symbol().
+ *
+ *  \param state    The decoder state.
+ *  \param symbols  The symbol table, sorted on address (as elf_load_symtab()
+ *                  returns it). The table is not copied, so it must remain
+ *                  valid until it is replaced, or until disasm_cleanup().
+ *  \param count    The number of symbols in the table.
+ */
+void disasm_symtab(ARMSTATE *state, const ELF_SYMBOL *symbols, int count)
+{
+  assert(state != NULL);
+  assert(symbols != NULL || count == 0);
+  state->elfsymbols = symbols;
+  state->elfsymbolcount = count;
+}
+
 /** disarm_result() returns the text of the recently decoded instruction. You
  *  use this function when disassembling step-by-step with disasm_arm() and
  *  disasm_thumb().
@@ -3324,9 +3363,7 @@ bool disasm_buffer(ARMSTATE *state, const unsigned char *buffer, size_t buffersi
   assert(callback != NULL);
   /* find symbol for automatic mode switch, and set initial mode */
   int symbolindex = -1;
-  int i;
-  for (i = 0; i < state->symbolcount && state->symbols[i].address < state->address; i++)
-    {}
+  int i = find_symbol(state, state->address);
   if (i < state->symbolcount) {
     symbolindex = i;
     if (state->symbols[i].mode != ARMMODE_UNKNOWN)
@@ -3358,9 +3395,9 @@ bool disasm_buffer(ARMSTATE *state, const unsigned char *buffer, size_t buffersi
       uint32_t offset = state->ldr_addr - start_address;
       if (offset + 4 <= buffersize) {
         uint32_t address = *(uint32_t*)(buffer + offset);
-        int sym_idx = get_symbol(state, address);
-        if (sym_idx >= 0) {
-          append_comment(state, state->symbols[sym_idx].name, " -> ");
+        const char *name = get_symbol(state, address);
+        if (name != NULL) {
+          append_comment(state, name, " -> ");
         } else {
           char hex[40];
           sprintf(hex, "0x%x", address);
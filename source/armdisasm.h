@@ -20,6 +20,8 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdio.h>
+#include "elf.h"
 
 typedef struct {
   const char *name;
@@ -51,6 +53,8 @@ typedef struct {
   ARMSYMBOL *symbols; /**< list of functions */
   int symbolcount;    /**< number of valid entries in the symbol list */
   int symbolsize;     /**< number of allocated entries in the symbol list */
+  const ELF_SYMBOL *elfsymbols; /**< symbol table of the ELF file (sorted on address), or NULL */
+  int elfsymbolcount; /**< number of entries in the ELF symbol table */
 
   ARMPOOL *codepool;  /**< list of addresses with type */
   int poolcount;      /**< number of valid entries in the code map */
@@ -74,6 +78,7 @@ enum {
   ARMMODE_DATA,         /**< this symbol refers to a data object */
 };
 void disasm_symbol(ARMSTATE *state, const char *name, uint32_t address, int mode);
+void disasm_symtab(ARMSTATE *state, const ELF_SYMBOL *symbols, int count);
 void disasm_address(ARMSTATE *state, uint32_t address);
 
 bool disasm_thumb(ARMSTATE *state, uint16_t hw, uint16_t hw2);
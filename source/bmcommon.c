@@ -16,6 +16,7 @@
  * limitations under the License.
  */
 #include <assert.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #if defined WIN32 || defined _WIN32
@@ -95,3 +96,44 @@ int get_configfile(char *filename, size_t maxsize, const char *basename)
   return 1;
 }
 
+/* get_cachefile() returns the name of a cache file for a target file, in the
+   "cache" subdirectory of the application data. The name is the base name of
+   the target plus a hash on its full path, so that targets with the same name
+   in different projects get different cache files. */
+int get_cachefile(char *filename, size_t maxsize, const char *targetfile, const char *extension)
+{
+  const char *base;
+  unsigned hash = 2166136261u;  /* FNV-1a */
+  char name[100];
+
+  assert(filename != NULL);
+  assert(maxsize > 0);
+  assert(targetfile != NULL && extension != NULL);
+  *filename = '\0';
+  if (!folder_AppData(filename, maxsize))
+    return 0;
+
+  strlcat(filename, DIR_SEPARATOR "BlackMagic", maxsize);
+  #if defined _WIN32
+    mkdir(filename);
+  #else
+    mkdir(filename, S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH);
+  #endif
+  strlcat(filename, DIR_SEPARATOR "cache", maxsize);
+  #if defined _WIN32
+    mkdir(filename);
+  #else
+    mkdir(filename, S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH);
+  #endif
+
+  for (base = targetfile; *targetfile != '\0'; targetfile++) {
+    if (*targetfile == '/' || *targetfile == '\\' || *targetfile == ':')
+      base = targetfile + 1;
+    hash = (hash ^ (unsigned char)*targetfile) * 16777619u;
+  }
+  snprintf(name, sizeof name, "%.60s-%08x%s", base, hash, extension);
+  strlcat(filename, DIR_SEPARATOR, maxsize);
+  strlcat(filename, name, maxsize);
+  return 1;
+}
+
@@ -22,5 +22,6 @@ const char **get_probelist(int *probe, int *netprobe);
 void clear_probelist(const char **probelist, int netprobe);
 
 int get_configfile(char *filename, size_t maxsize, const char *basename);
+int get_cachefile(char *filename, size_t maxsize, const char *targetfile, const char *extension);
 
 #endif /* _BMCOMMON_H */
@@ -119,8 +119,8 @@ static char *translate_path(char *path, int native);
 static const char *source_getname(unsigned idx);
 static time_t file_timestamp(const char *path);
 
-static DWARF_LINELOOKUP dwarf_linetable = { NULL };
-static DWARF_SYMBOLLIST dwarf_symboltable = { NULL};
+static DWARF_LINETABLE dwarf_linetable = { NULL };
+static DWARF_SYMBOLTABLE dwarf_symboltable = { NULL};
 static DWARF_PATHLIST dwarf_filetable = { NULL};
 
 
@@ -151,6 +151,7 @@ typedef struct tagSWOSETTINGS {
   unsigned datasize;
   char metadata[_MAX_PATH];
   int force_plain;
+  int plugin;
   int enabled;
   int init_status;
 } SWOSETTINGS;
@@ -783,7 +784,7 @@ static void console_input(const char *text)
   console_add(text, STRFLG_INPUT);
 }
 
-static int console_autocomplete(char *text, size_t textsize, const DWARF_SYMBOLLIST *symboltable)
+static int console_autocomplete(char *text, size_t textsize, const DWARF_SYMBOLTABLE *symboltable)
 {
   typedef struct tagGDBCOMMAND {
     const char *command;
@@ -956,7 +957,8 @@ static int console_autocomplete(char *text, size_t textsize, const DWARF_SYMBOLL
               curfile = dwarf_fileindex_from_path(&dwarf_filetable, path);
               for (idx = 0; !result && (sym = dwarf_sym_from_index(symboltable, idx)) != 0; idx++) {
                 assert(sym->name != NULL);
-                if (strncmp(word, sym->name, len)== 0) {
+                const char *symname = demangle_cached(sym->name);
+                if (strncmp(word, symname, len)== 0) {
                   int match = 0;
                   if (match_var && DWARF_IS_VARIABLE(sym)) {
                     if (sym->scope == SCOPE_EXTERNAL
@@ -970,9 +972,9 @@ static int console_autocomplete(char *text, size_t textsize, const DWARF_SYMBOLL
                   }
                   if (match) {
                     if (first == NULL)
-                      first = sym->name;
+                      first = symname;
                     if (skip == 0) {
-                      strlcpy(word, sym->name, textsize - (word - text));
+                      strlcpy(word, symname, textsize - (word - text));
                       result = 1;
                     }
                     skip--;
@@ -1372,36 +1374,27 @@ static bool sourcefile_disassemble(const char *path, const SOURCEFILE *source, A
   assert(source != NULL);
   assert(armstate != NULL);
 
-  /* if not yet done, get the list of symbols from the ELF file; this is just
-     used to get the start addresses of the functions and to determine whether
-     to disassemble in Thumb mode or ARM mode; the function names are not
-     important (and therefore not demangled) */
+  /* if not yet done, get the list of symbols from the ELF file; this is used
+     to get the start addresses of the functions and to determine whether to
+     disassemble in Thumb mode or ARM mode; the disassembler also looks up the
+     names of data objects in this table (with a binary search) */
   if (elf_symbols == NULL) {
     FILE *fp = fopen(path, "rb");
     if (fp != NULL) {
-      int count = 0;
-      if (elf_load_symbols(fp, NULL, &count) == ELFERR_NONE && count > 0) {
-        elf_symbols = malloc(count * sizeof(ELF_SYMBOL));
-        if (elf_symbols != NULL) {
-          elf_load_symbols(fp, elf_symbols, &count);
-          elf_symbol_count = count;
-        }
-      }
+      elf_load_symtab(fp, &elf_symbols, &elf_symbol_count);
       fclose(fp);
     }
-    /* add all code symbols to the ARM debugger state */
+    /* add all code symbols to the ARM debugger state (the symbols are sorted
+       on address, so these are appended to the list of the disassembler) */
     disasm_init(armstate, DISASM_ADDRESS | DISASM_INSTR | DISASM_COMMENT);
     for (int i = 0; i < elf_symbol_count; i++) {
       if (elf_symbols[i].is_func) {
         uint32_t address = elf_symbols[i].address & ~1;
         int mode = (elf_symbols[i].address & 1) ? ARMMODE_THUMB : ARMMODE_ARM;
-        char demangled[256];
-        const char *name = elf_symbols[i].name;
-        if (demangle(demangled, sizeof(demangled), name))
-          name = demangled;
-        disasm_symbol(armstate, name, address, mode);
+        disasm_symbol(armstate, demangle_cached(elf_symbols[i].name), address, mode);
       }
     }
+    disasm_symtab(armstate, elf_symbols, elf_symbol_count);
     /* add SVD peripherals to the disassembler as well */
     const char *name;
     unsigned long address;
@@ -1417,19 +1410,17 @@ static bool sourcefile_disassemble(const char *path, const SOURCEFILE *source, A
   assert(source != NULL);
   SOURCELINE *item = source->root.next;
   int curline = 1;
-  for (DWARF_LINELOOKUP *lineaddr = dwarf_linetable.next; lineaddr != NULL; lineaddr = lineaddr->next) {
-    if (lineaddr->fileindex == fileidx) {
-      if (curline > lineaddr->line) {
-        item = source->root.next;
-        curline = 1;
-      }
-      while (curline < lineaddr->line) {
-        item = item->next;
-        curline += 1;
-      }
-      if (curline == lineaddr->line)
-        item->address = lineaddr->address;
+  for (const DWARF_LINELOOKUP *lineaddr = dwarf_line_from_fileline(&dwarf_linetable, fileidx, 1);
+       lineaddr != NULL;
+       lineaddr = dwarf_line_from_fileline(&dwarf_linetable, fileidx, lineaddr->line + 1))
+  {
+    while (item != NULL && curline < lineaddr->line) {
+      item = item->next;
+      curline += 1;
     }
+    if (item == NULL)
+      break;
+    item->address = lineaddr->address;
   }
 
   /* get the address range for the current file */
@@ -1576,7 +1567,6 @@ static void sources_clear(int freelists)
 
     if (elf_symbols != NULL) {
       assert(elf_symbol_count > 0);
-      elf_clear_symbols(elf_symbols, elf_symbol_count);
       free((void*)elf_symbols);
       elf_symbols = NULL;
       elf_symbol_count = 0;
@@ -3768,6 +3758,7 @@ static int save_settings(const char *filename, const char *entrypoint,
   ini_putl("SWO trace", "datasize", swo->datasize * 8, filename);
   ini_putl("SWO trace", "enabled", swo->enabled, filename);
   ini_puts("SWO trace", "ctf", swo->metadata, filename);
+  ini_putl("SWO trace", "ctf-plugin", swo->plugin, filename);
   for (idx = 0; idx < NUM_CHANNELS; idx++) {
     char key[32], value[128];
     struct nk_color color = channel_getcolor(idx);
@@ -3813,6 +3804,7 @@ static int load_settings(const char *filename, char *entrypoint, size_t entrypoi
   swo->force_plain = 0;
   swo->init_status = 0;
   ini_gets("SWO trace", "ctf", "", swo->metadata, sizearray(swo->metadata), filename);
+  swo->plugin = (int)ini_getl("SWO trace", "ctf-plugin", 0, filename);
   for (idx = 0; idx < NUM_CHANNELS; idx++) {
     #define SWO_TRACE_DEFAULT_COLOR 190
     char key[41], value[128];
@@ -4251,7 +4243,7 @@ static bool handle_disasm_cmd(const char *command, bool *curstate)
   return false;
 }
 
-static bool handle_list_cmd(const char *command, const DWARF_SYMBOLLIST *symboltable,
+static bool handle_list_cmd(const char *command, const DWARF_SYMBOLTABLE *symboltable,
                             const DWARF_PATHLIST *filetable)
 {
   command = skipwhite(command);
@@ -4940,6 +4932,20 @@ static int handle_trace_cmd(const char *command, SWOSETTINGS *swo)
   return 1; /* assume entire protocol changed */
 }
 
+/** ctf_load_plugin() loads the decoder plug-in for the TSDL file, but only if
+ *  plug-ins are enabled in the settings ("ctf-plugin" in section "SWO trace").
+ */
+static void ctf_load_plugin(const SWOSETTINGS *swo)
+{
+  char libpath[_MAX_PATH], msg[_MAX_PATH + 30];
+
+  assert(swo != NULL);
+  if (swo->plugin && ctf_decode_plugin(swo->metadata, libpath, sizearray(libpath))) {
+    sprintf(msg, "Loaded decoder plug-in %s\n", libpath);
+    console_add(msg, STRFLG_STATUS);
+  }
+}
+
 static void serial_info_mode(STRINGLIST *textroot)
 {
   char msg[_MAX_PATH + 20];
@@ -5584,7 +5590,9 @@ static void console_view(struct nk_context *ctx, APPSTATE *state,
                 ctf_parse_cleanup();
                 ctf_decode_cleanup();
                 ctf_error_notify(CTFERR_NONE, 0, NULL);
-                if (!ctf_parse_init(state->swo.metadata) || !ctf_parse_run())
+                if (ctf_parse_init(state->swo.metadata) && ctf_parse_run())
+                  ctf_load_plugin(&state->swo);
+                else
                   ctf_parse_cleanup();
               }
               serial_info_mode(NULL);
@@ -6535,9 +6543,21 @@ static void handle_stateaction(APPSTATE *state, enum nk_collapse_states tab_stat
           /* read the DWARF information (for function and variable lookup) */
           FILE *fp = fopen(state->Filename, "rb");
           if (fp != NULL) {
+            char cachefile[_MAX_PATH];
             int address_size;
-            if (!dwarf_read(fp, &dwarf_linetable, &dwarf_symboltable, &dwarf_filetable, &address_size))
+            if (!get_cachefile(cachefile, sizearray(cachefile), state->Filename, ".dwarf"))
+              *cachefile = '\0';
+            if (dwarf_read_cached(fp, (*cachefile != '\0') ? cachefile : NULL,
+                                  &dwarf_linetable, &dwarf_symboltable, &dwarf_filetable, &address_size)) {
+              char msg[200];
+              sprintf(msg, "DWARF loaded: lines %lu ms, info %lu ms, sort %lu ms, scopes %lu ms, index %lu ms, cache %lu ms\n",
+                      dwarf_phase_time(DWARF_PHASE_LINES), dwarf_phase_time(DWARF_PHASE_INFO),
+                      dwarf_phase_time(DWARF_PHASE_SORT), dwarf_phase_time(DWARF_PHASE_SCOPE),
+                      dwarf_phase_time(DWARF_PHASE_INDEX), dwarf_phase_time(DWARF_PHASE_CACHE));
+              console_add(msg, STRFLG_LOG);
+            } else {
               console_add("No DWARF debug information\n", STRFLG_ERROR);
+            }
             fclose(fp);
           }
           /* read a CMSIS "SVD" file if any was provided */
@@ -6548,7 +6568,9 @@ static void handle_stateaction(APPSTATE *state, enum nk_collapse_states tab_stat
             ctf_parse_cleanup();
             ctf_decode_cleanup();
             ctf_error_notify(CTFERR_NONE, 0, NULL);
-            if (!ctf_parse_init(state->swo.metadata) || !ctf_parse_run())
+            if (ctf_parse_init(state->swo.metadata) && ctf_parse_run())
+              ctf_load_plugin(&state->swo);
+            else
               ctf_parse_cleanup();
           }
           source_cursorfile = source_cursorline = 0;
@@ -7238,6 +7260,7 @@ static void handle_stateaction(APPSTATE *state, enum nk_collapse_states tab_stat
           for (int idx = 0; (stream = stream_by_seqnr(idx)) != NULL; idx++)
             if (stream->name != NULL && strlen(stream->name) > 0)
               channel_setname(idx, stream->name);
+          ctf_load_plugin(&state->swo);
         } else {
           ctf_parse_cleanup();
         }
@@ -7461,6 +7484,7 @@ int main(int argc, char *argv[])
   appstate.cmdline = malloc(CMD_BUFSIZE * sizeof(char));
   if (appstate.cmdline == NULL)
     return 1;
+  ctf_parse_setcache(1);  /* keep parsed TSDL metadata in a cache file */
   /* locate the configuration file for settings */
   get_configfile(txtConfigFile, sizearray(txtConfigFile), "bmdebug.ini");
 
@@ -7786,6 +7810,7 @@ int main(int argc, char *argv[])
   sources_clear(nk_true);
   bmscript_clear();
   dwarf_cleanup(&dwarf_linetable, &dwarf_symboltable, &dwarf_filetable);
+  demangle_cache_clear();
   disasm_cleanup(&appstate.armstate);
   tcpip_cleanup();
   sermon_close();
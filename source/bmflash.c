@@ -781,10 +781,14 @@ typedef struct tagAPPSTATE {
   int architecture;             /**< MCU architecture (index) */
   nk_bool tpwr;                 /**< option: tpwr (target power) */
   nk_bool fullerase;            /**< option: erase entire flash before download */
+  nk_bool differential;         /**< option: erase & write only changed sectors */
+  nk_bool verify;               /**< option: verify entire flash after download */
+  nk_bool compress;             /**< option: compressed download via a loader stub */
   nk_bool connect_srst;         /**< option: keep in reset during connect */
   nk_bool write_log;            /**< option: record downloads in log file */
   nk_bool print_time;           /**< option: print download time */
   int skip_download;            /**< do download+verify procedure without actually downloading */
+  char McuFamily[32];           /**< MCU family name, as reported by the probe */
   char IPaddr[64];              /**< IP address for network probe */
   char PostProcess[_MAX_PATH];  /**< path to post-process program */
   int serialize;                /**< serialization option */
@@ -844,6 +848,25 @@ static const char *architectures[] = { "Standard", "LPC8xx", "LPC11xx", "LPC15xx
                                        "LPC17xx", "LPC21xx", "LPC22xx", "LPC23xx",
                                        "LPC24xx", "LPC43xx" };
 
+/* loader_load() loads the loader stub for the MCU family, which must be in
+   the "bmloader" subdirectory of the configuration directory */
+static int loader_load(const char *mcufamily)
+{
+  char path[_MAX_PATH], *ptr;
+  size_t len;
+
+  if (mcufamily == NULL || strlen(mcufamily) == 0 || !folder_AppData(path, sizearray(path)))
+    return 0;
+  strlcat(path, DIR_SEPARATOR "BlackMagic" DIR_SEPARATOR "bmloader" DIR_SEPARATOR, sizearray(path));
+  len = strlen(path);
+  strlcat(path, mcufamily, sizearray(path));
+  for (ptr = path + len; *ptr != '\0'; ptr++)
+    if (*ptr == '/' || *ptr == '\\' || *ptr == ':')
+      *ptr = '-';   /* avoid directory separators in the filename */
+  strlcat(path, ".bin", sizearray(path));
+  return bmp_setloader(path);
+}
+
 static int load_targetparams(const char *filename, APPSTATE *state)
 {
   assert(filename != NULL);
@@ -863,6 +886,9 @@ static int load_targetparams(const char *filename, APPSTATE *state)
     state->architecture = 0;
   state->tpwr = (int)ini_getl("Flash", "tpwr", 0, filename);
   state->fullerase = (int)ini_getl("Flash", "full-erase", 0, filename);
+  state->differential = (int)ini_getl("Flash", "differential", 0, filename);
+  state->verify = (int)ini_getl("Flash", "verify", 1, filename);
+  state->compress = (int)ini_getl("Flash", "compress", 0, filename);
   ini_gets("Flash", "postprocess", "", state->PostProcess, sizearray(state->PostProcess), filename);
   state->serialize = (int)ini_getl("Serialize", "option", 0, filename);
   ini_gets("Serialize", "address", ".text:0", field, sizearray(field), filename);
@@ -975,6 +1001,12 @@ static void panel_options(struct nk_context *ctx, APPSTATE *state,
                      "Let the debug probe provide power to the target");
     checkbox_tooltip(ctx, "Full Flash erase before download", &state->fullerase, NK_TEXT_LEFT,
                      "Erase entire Flash memory, instead of only sectors that are overwritten");
+    checkbox_tooltip(ctx, "Only write changed sectors", &state->differential, NK_TEXT_LEFT,
+                     "Compare the CRC of each sector, and erase & write only sectors that differ");
+    checkbox_tooltip(ctx, "Verify after download", &state->verify, NK_TEXT_LEFT,
+                     "Compare the CRC of the entire Flash memory to the file after download");
+    checkbox_tooltip(ctx, "Compressed download", &state->compress, NK_TEXT_LEFT,
+                     "Send compressed data to a loader stub in RAM (requires a stub for the MCU)");
     checkbox_tooltip(ctx, "Reset target during connect", &state->connect_srst, NK_TEXT_LEFT,
                      "Keep target MCU reset while debug probe attaches");
     checkbox_tooltip(ctx, "Keep log of downloads", &state->write_log, NK_TEXT_LEFT,
@@ -1090,6 +1122,9 @@ static int handle_stateaction(APPSTATE *state, enum nk_collapse_states tab_state
       ini_puts("Flash", "architecture", field, state->ParamFile);
       ini_putl("Flash", "tpwr", state->tpwr, state->ParamFile);
       ini_putl("Flash", "full-erase", state->fullerase, state->ParamFile);
+      ini_putl("Flash", "differential", state->differential, state->ParamFile);
+      ini_putl("Flash", "verify", state->verify, state->ParamFile);
+      ini_putl("Flash", "compress", state->compress, state->ParamFile);
       ini_puts("Flash", "postprocess", state->PostProcess, state->ParamFile);
       ini_putl("Serialize", "option", state->serialize, state->ParamFile);
       sprintf(field, "%s:%s", state->Section, state->Address);
@@ -1115,6 +1150,7 @@ static int handle_stateaction(APPSTATE *state, enum nk_collapse_states tab_state
       state->is_attached = bmp_attach(state->tpwr, state->connect_srst, mcufamily, sizearray(mcufamily), NULL, 0);
       if (state->is_attached) {
         int arch;
+        strlcpy(state->McuFamily, mcufamily, sizearray(state->McuFamily));
         /* try exact match first */
         for (arch = 0; arch < sizearray(architectures); arch++)
           if (architecture_match(architectures[arch], mcufamily))
@@ -1215,6 +1251,14 @@ static int handle_stateaction(APPSTATE *state, enum nk_collapse_states tab_state
          this loop continues with updating the message log, while the download
          is in progress */
       if (state->coro_download == NULL) {
+        /* after a full erase, every sector must be written anyway */
+        bmp_setdifferential(state->differential && !state->fullerase);
+        bmp_setloader(NULL);
+        if (state->compress && !loader_load(state->McuFamily)) {
+          char msg[100];
+          sprintf(msg, "^3No loader stub for %s, using standard download\n", state->McuFamily);
+          log_addstring(msg);
+        }
         state->coro_download = coroutine((coro_proc)bmp_download);
         result = 0; /* preset for the case that the resumable() fails */
       }
@@ -1253,9 +1297,13 @@ static int handle_stateaction(APPSTATE *state, enum nk_collapse_states tab_state
       }
     }
     /* compare the checksum of Flash memory to the file */
-    if (state->architecture > 0)
-      bmp_runscript("memremap", architectures[state->architecture], NULL, NULL);
-    result = bmp_verify((state->fpWork != NULL)? state->fpWork : state->fpTgt);
+    if (state->verify) {
+      if (state->architecture > 0)
+        bmp_runscript("memremap", architectures[state->architecture], NULL, NULL);
+      result = bmp_verify((state->fpWork != NULL)? state->fpWork : state->fpTgt);
+    } else {
+      result = 1;
+    }
     state->curstate = result ? STATE_FINISH : STATE_IDLE;
     if (result && state->print_time) {
       char msg[100];
@@ -1383,6 +1431,7 @@ int main(int argc, char *argv[])
   /* global defaults */
   memset(&appstate, 0, sizeof appstate);
   appstate.curstate = STATE_INIT;
+  appstate.verify = nk_true;
   appstate.serialize = SER_NONE;
   appstate.SerialFmt = FMT_BIN;
   strcpy(appstate.Section, ".text");
@@ -21,10 +21,13 @@
   #define WIN32_LEAN_AND_MEAN
   #include <windows.h>
   #include <direct.h>
+  #include <sys/stat.h>
   #if defined __MINGW32__ || defined __MINGW64__ || defined _MSC_VER
     #include "strlcpy.h"
   #endif
   #if defined _MSC_VER
+    #include "c99_snprintf.h"
+    #define stat _stat
     #define strdup(s)         _strdup(s)
     #define stricmp(s1,s2)    _stricmp((s1),(s2))
     #define strnicmp(s1,s2,n) _strnicmp((s1),(s2),(n))
@@ -78,6 +81,8 @@ typedef struct tagSCRIPT {
   const char *name;
   const SCRIPTLINE *lines;
   size_t count;     /* number of lines in the lines array */
+  BMSCRIPT_OP *ops; /* compiled script (NULL if not yet compiled) */
+  size_t opcount;   /* number of operations in the ops array */
 } SCRIPT;
 
 typedef struct tagREG_CACHE {
@@ -209,7 +214,7 @@ static const SCRIPT_DEF script_defaults[] = {
 };
 
 
-static SCRIPT script_root = { NULL, NULL, NULL, 0 };
+static SCRIPT script_root = { NULL, NULL, NULL, 0, NULL, 0 };
 static REG_CACHE cache = { NULL, NULL, 0, 0 };
 
 
@@ -396,6 +401,10 @@ static const char *parseline(const char *line, const REG_DEF *registers, size_t
  *  \param mcu    The MCU family name. This parameter must be valid.
  *  \param arch   The Cortex architecture name (M0, M3, etc.). This parameter
  *                may be NULL.
+ *
+ *  \note The scripts are not parsed again when this function is called for
+ *        the same MCU and architecture, unless the support file was modified
+ *        in the mean time.
  */
 int bmscript_load(const char *mcu, const char *arch)
 {
@@ -406,19 +415,14 @@ int bmscript_load(const char *mcu, const char *arch)
   SCRIPT *script;
   char path[_MAX_PATH];
   char arch_name[50];
+  char key[100];
+  struct stat st;
   FILE *fp;
   unsigned idx;
+  int len;
 
-  /* the name in the root is set the the MCU name, to detect double loading of
-     the same script */
-  if (script_root.name != NULL && strcmp(script_root.name, mcu) == 0) {
-    idx = 0;
-    for (script = script_root.next; script != NULL; script = script->next)
-      idx++;
-    return idx;
-  }
-  bmscript_clear();  /* unload any scripts loaded at this point */
-
+  assert(mcu != NULL);
+  path[0] = '\0';
   if (folder_AppData(path, sizearray(path))) {
     strlcat(path, DIR_SEPARATOR "BlackMagic", sizearray(path));
     #if defined _MSC_VER
@@ -431,6 +435,23 @@ int bmscript_load(const char *mcu, const char *arch)
     strlcat(path, DIR_SEPARATOR "bmscript", sizearray(path));
   }
 
+  /* the name in the root is set to the MCU name (plus architecture and the
+     time stamp of the support file), to detect double loading of the same
+     script; a name that does not fit is not cached */
+  if (strlen(path) == 0 || stat(path, &st) != 0)
+    st.st_mtime = 0;
+  len = snprintf(key, sizearray(key), "%s:%s:%lx", mcu, (arch != NULL) ? arch : "",
+                 (unsigned long)st.st_mtime);
+  if (len < 0 || len >= (int)sizearray(key))
+    key[0] = '\0';
+  if (script_root.name != NULL && key[0] != '\0' && strcmp(script_root.name, key) == 0) {
+    idx = 0;
+    for (script = script_root.next; script != NULL; script = script->next)
+      idx++;
+    return idx;
+  }
+  bmscript_clear();  /* unload any scripts loaded at this point */
+
   /* create a list of registers, to use in script parsing
      first step: the hard-coded registers */
   for (idx = 0; idx < sizearray(register_defaults); idx++) {
@@ -558,6 +579,8 @@ int bmscript_load(const char *mcu, const char *arch)
               line_count = 0;
           }
           script->count = line_count;
+          script->ops = NULL;
+          script->opcount = 0;
           script->next = script_root.next;
           script_root.next = script;
         }
@@ -599,6 +622,8 @@ int bmscript_load(const char *mcu, const char *arch)
                 line_count = 0;
             }
             script->count = line_count;
+            script->ops = NULL;
+            script->opcount = 0;
             script->next = script_root.next;
             script_root.next = script;
           }
@@ -636,6 +661,8 @@ int bmscript_load(const char *mcu, const char *arch)
   free((void*)registers);
   /* free the temporary lines list */
   free((void*)lines);
+  if (key[0] != '\0')
+    script_root.name = strdup(key);
 
   /* count the scripts, for the return value */
   idx = 0;
@@ -655,6 +682,8 @@ void bmscript_clear(void)
     assert((script->count == 0 && script->lines == NULL) || (script->count > 0 && script->lines != NULL));
     if (script->count >0)
       free((void*)script->lines);
+    if (script->ops != NULL)
+      free((void*)script->ops);
     free(script);
   }
   if (script_root.name != NULL) {
@@ -789,3 +818,139 @@ int bmscript_line_fmt(const char *name, char *line, const unsigned long *params)
   return 0;
 }
 
+
+/* block_append() returns whether a script line with a plain assignment can be
+   appended to a block write; this is only done for 32-bit registers on
+   consecutive (aligned) addresses, so that the probe still writes each
+   register with a single 32-bit access */
+static int block_append(const BMSCRIPT_OP *op, const SCRIPTLINE *line)
+{
+  assert(op != NULL && line != NULL);
+  return !op->read
+         && (op->address & ~0xf) != SCRIPT_MAGIC
+         && (op->address & 3) == 0 && (op->size & 3) == 0
+         && op->size + line->size <= SCRIPT_MAXBLOCK
+         && op->lines + op->count == line
+         && line->oper == '=' && line->size == 4
+         && line->address == op->address + op->size;
+}
+
+/** bmscript_compile() returns a script as a list of read/write transactions.
+ *  The script is compiled on the first call, and the compiled form is kept
+ *  until the scripts are unloaded (with bmscript_clear(), or on loading the
+ *  scripts for a different MCU).
+ *
+ *  \param name     The name of the script.
+ *  \param ops      Will be set to the list of operations.
+ *  \param count    Will be set to the number of operations in the list.
+ *
+ *  \return 1 on success, 0 if no script matches (or on a memory allocation
+ *          failure).
+ *
+ *  \note A chain of read-modify-write lines on the same register is folded
+ *        into a single operation (one read and one write). Consecutive plain
+ *        assignments to adjacent 32-bit registers are folded into a single
+ *        block write. Lines are never re-ordered, and lines with a parameter
+ *        for the address are never folded.
+ */
+int bmscript_compile(const char *name, const BMSCRIPT_OP **ops, size_t *count)
+{
+  SCRIPT *script;
+
+  assert(name != NULL);
+  assert(ops != NULL && count != NULL);
+  for (script = script_root.next; script != NULL && stricmp(name, script->name) != 0; script = script->next)
+    {}
+  if (script == NULL)
+    return 0;     /* no script with matching name is found */
+
+  if (script->ops == NULL && script->count > 0) {
+    BMSCRIPT_OP *list = (BMSCRIPT_OP*)malloc(script->count * sizeof(BMSCRIPT_OP));
+    size_t idx, num;
+    if (list == NULL)
+      return 0;
+    num = 0;
+    for (idx = 0; idx < script->count; ) {
+      const SCRIPTLINE *line = &script->lines[idx];
+      size_t chain = 1;
+      if ((line->address & ~0xf) == SCRIPT_MAGIC) {
+        /* address is only known when the script runs, do not fold it */
+      } else if (line->oper != '=') {
+        while (idx + chain < script->count && chain < 0xffff
+               && script->lines[idx + chain].address == line->address
+               && script->lines[idx + chain].size == line->size
+               && script->lines[idx + chain].oper != '=')
+          chain++;
+      } else if (num > 0 && block_append(&list[num - 1], line)) {
+        list[num - 1].size += line->size;
+        list[num - 1].count += 1;
+        idx += 1;
+        continue;
+      }
+      list[num].address = line->address;
+      list[num].size = line->size;
+      list[num].read = (line->oper != '=');
+      list[num].count = (uint16_t)chain;
+      list[num].lines = line;
+      num += 1;
+      idx += chain;
+    }
+    script->ops = list;
+    script->opcount = num;
+  }
+
+  *ops = script->ops;
+  *count = script->opcount;
+  return 1;
+}
+
+/** bmscript_apply() applies the lines of a compiled operation to a buffer.
+ *
+ *  \param op       The operation (from the list returned by
+ *                  bmscript_compile()).
+ *  \param buffer   The memory contents, op->size bytes in little-endian
+ *                  format. If op->read is set, it must hold the current
+ *                  contents of the memory on entry. On return, it holds the
+ *                  data to write.
+ *  \param params   An optional array with parameters to the script.
+ */
+void bmscript_apply(const BMSCRIPT_OP *op, unsigned char *buffer, const unsigned long *params)
+{
+  unsigned idx, b;
+
+  assert(op != NULL && op->lines != NULL);
+  assert(buffer != NULL);
+  for (idx = 0; idx < op->count; idx++) {
+    const SCRIPTLINE *line = &op->lines[idx];
+    uint32_t value = line->value;
+    uint32_t cur = 0;
+    unsigned offset = 0;
+    if ((line->address & ~0xf) != SCRIPT_MAGIC)
+      offset = line->address - op->address;
+    assert(offset + line->size <= op->size);
+    if ((value & ~0xf) == SCRIPT_MAGIC) {
+      assert(params != NULL);
+      value = (uint32_t)params[value & 0xf];  /* replace value parameter */
+    }
+    for (b = 0; b < line->size; b++)
+      cur |= (uint32_t)buffer[offset + b] << (8 * b);
+    switch (line->oper) {
+    case '=':
+      cur = value;
+      break;
+    case '|':
+      cur |= value;
+      break;
+    case '&':
+      cur &= value;
+      break;
+    case '~':
+      cur &= ~value;
+      break;
+    default:
+      assert(0);
+    }
+    for (b = 0; b < line->size; b++)
+      buffer[offset + b] = (unsigned char)(cur >> (8 * b));
+  }
+}
@@ -20,6 +20,7 @@
 #ifndef _BMP_SCRIPT_H
 #define _BMP_SCRIPT_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 #if defined __cplusplus
@@ -27,6 +28,17 @@
 #endif
 
 #define SCRIPT_MAGIC  0x6dce7fd0  /**< magic value for parameter replacement */
+#define SCRIPT_MAXBLOCK 64        /**< max. size of a coalesced block write */
+
+struct tagSCRIPTLINE;
+
+typedef struct tagBMSCRIPT_OP { /* compiled script: one read/write transaction */
+  uint32_t address; /**< start address, or a parameter (SCRIPT_MAGIC) */
+  uint8_t size;     /**< number of bytes to write */
+  uint8_t read;     /**< 1 if the current contents must be read first */
+  uint16_t count;   /**< number of script lines folded into the operation */
+  const struct tagSCRIPTLINE *lines;
+} BMSCRIPT_OP;
 
 int bmscript_load(const char *mcu, const char *architecture);
 void bmscript_clear(void);
@@ -35,6 +47,9 @@ void bmscript_clearcache(void);
 int bmscript_line(const char *name, char *oper, uint32_t *address, uint32_t *value, uint8_t *size);
 int bmscript_line_fmt(const char *name, char *line, const unsigned long *params);
 
+int bmscript_compile(const char *name, const BMSCRIPT_OP **ops, size_t *count);
+void bmscript_apply(const BMSCRIPT_OP *op, unsigned char *buffer, const unsigned long *params);
+
 int architecture_match(const char *architecture, const char *mcufamily);
 
 #if defined __cplusplus
@@ -24,6 +24,7 @@
   #endif
 #else
   #include <unistd.h>
+  #include <sys/time.h>
   #include <bsd/string.h>
 #endif
 #include <assert.h>
@@ -39,6 +40,7 @@
 #include "crc32.h"
 #include "elf.h"
 #include "gdb-rsp.h"
+#include "lz4block.h"
 #include "picoro.h"
 #include "tcpip.h"
 #include "xmltractor.h"
@@ -58,9 +60,29 @@ typedef struct tagFLASHRGN {
 } FLASHRGN;
 #define MAX_FLASHRGN  8
 
+#define FLASH_WINDOW  4   /* max. number of vFlashWrite packets in flight (in no-ack mode) */
+#define READ_WINDOW   4   /* max. number of memory read requests in flight (in no-ack mode) */
+#define SCRIPT_WINDOW 4   /* max. number of script writes in flight (in no-ack mode) */
+#define VERIFY_WINDOW 4   /* max. number of qCRC requests in flight (in no-ack mode) */
+#define VERIFY_CHUNK  32768 /* size of the chunks for verification (rounded to whole Flash sectors) */
+
+/* loader stub, see examples/flashloader.h for the layout of the structures */
+#define LOADER_MAGIC    0x4c504d42  /* "BMPL" */
+#define LOADER_HDRSIZE  16
+#define LOADER_JOBSIZE  16
+#define LOADER_RECSIZE  12
+#define LOADER_STACK    256
+#define LOADER_TIMEOUT  10000
+
 static HCOM *hCom = NULL;
 static int CurrentProbe = -1;
 static int PacketSize = 0;
+static int BinaryUpload = 0;
+static int Differential = 0;
+static unsigned long RamAddress = 0;
+static unsigned long RamSize = 0;
+static unsigned char *LoaderImage = NULL;
+static unsigned long LoaderSize = 0;
 static FLASHRGN FlashRgn[MAX_FLASHRGN];
 static int FlashRgnCount = 0;
 
@@ -199,7 +221,16 @@ int bmp_connect(int probe, const char *ipaddress)
     buffer[size] = '\0';
     if ((ptr = strstr(buffer, "PacketSize=")) != NULL)
       PacketSize = (int)strtol(ptr + 11, NULL, 16);
+    BinaryUpload = (strstr(buffer, "binary-upload+") != NULL);
     gdbrsp_packetsize(PacketSize+16); /* allow for some margin */
+    /* switch to no-ack mode, so that bulk transfers skip the acknowledge on
+       every packet (and so that packets can be pipelined) */
+    if (strstr(buffer, "QStartNoAckMode+") != NULL) {
+      gdbrsp_xmit("QStartNoAckMode", -1);
+      size = gdbrsp_recv(buffer, sizearray(buffer), 500);
+      if (size == 2 && memcmp(buffer, "OK", size) == 0)
+        gdbrsp_noackmode(1);
+    }
     //??? check for "qXfer:memory-map:read+" as well
     /* connect to gdbserver */
     for (retry = 3; retry > 0; retry--) {
@@ -244,6 +275,7 @@ int bmp_disconnect(void)
     tcpip_close();
     result = 1;
   }
+  gdbrsp_noackmode(0);  /* the gdbserver drops out of no-ack mode on the next qSupported */
   return result;
 }
 
@@ -392,6 +424,7 @@ restart:
 
   /* check memory map and features of the target */
   FlashRgnCount = 0;
+  RamSize = 0;
   sprintf(buffer, "qXfer:memory-map:read::0,%x", PacketSize - 4);
   gdbrsp_xmit(buffer, -1);
   size = gdbrsp_recv(buffer, sizearray(buffer), 1000);
@@ -413,6 +446,17 @@ restart:
               && attrib->szvalue == 9 && strncmp(attrib->value, "blocksize", attrib->szvalue) == 0)
             FlashRgn[FlashRgnCount].blocksize = strtoul(prop->content, NULL, 0);
           FlashRgnCount += 1;
+        } else if (attrib != NULL && attrib->szvalue == 3 && strncmp(attrib->value, "ram", attrib->szvalue) == 0) {
+          /* keep the biggest RAM region (for a loader stub) */
+          unsigned long address = 0, size = 0;
+          if ((attrib = xt_find_attrib(node, "start")) != NULL)
+            address = strtoul(attrib->value, NULL, 0);
+          if ((attrib = xt_find_attrib(node, "length")) != NULL)
+            size = strtoul(attrib->value, NULL, 0);
+          if (size > RamSize) {
+            RamAddress = address;
+            RamSize = size;
+          }
         }
         node = xt_find_sibling(node, "memory");
       }
@@ -578,17 +622,571 @@ void bmp_progress_get(unsigned long *step, unsigned long *range)
     *range = download_numsteps;
 }
 
-int bmp_download(FILE *fp)
+static unsigned long clock_ms(void)
 {
-  bmp_progress_reset(0);
-  if (!bmp_isopen()) {
-    notice(BMPERR_NOCONNECT, "Not connected to Black Magic Probe");
+  #if defined _WIN32
+    return GetTickCount();
+  #else
+    struct timeval  tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000 + tv.tv_usec / 1000;
+  #endif
+}
+
+#if defined _WIN32
+  #define CLOCK_TICK  16  /* resolution of GetTickCount() (typical) */
+#else
+  #define CLOCK_TICK  1
+#endif
+
+/* throughput() formats the transfer rate for a notice (with a leading comma);
+   when the elapsed time is below the resolution of the clock, the rate cannot
+   be measured, and the string is empty */
+static const char *throughput(char *buffer, unsigned long bytes, unsigned long ms)
+{
+  double rate;
+
+  assert(buffer != NULL);
+  if (ms < CLOCK_TICK) {
+    *buffer = '\0';
+    return buffer;
+  }
+  rate = (bytes / 1024.0) / (ms / 1000.0);
+  if (rate >= 10240.0)
+    sprintf(buffer, ", %.2f MB/s", rate / 1024.0);
+  else
+    sprintf(buffer, ", %.1f KB/s", rate);
+  return buffer;
+}
+
+/* report_latency() logs the histogram of the round-trip times of the commands
+   since the previous report (or reset) */
+static void report_latency(void)
+{
+  unsigned long hist[GDBRSP_LATENCY_BUCKETS];
+  char line[512];
+  int idx, len;
+
+  gdbrsp_latency(hist, 1);
+  len = sprintf(line, "Round trips:");
+  for (idx = 0; idx < GDBRSP_LATENCY_BUCKETS; idx++) {
+    if (hist[idx] == 0)
+      continue;
+    if (idx < GDBRSP_LATENCY_BUCKETS - 1)
+      len += sprintf(line + len, " <%g ms: %lu,", 0.125 * (1 << idx), hist[idx]);
+    else
+      len += sprintf(line + len, " >%g ms: %lu,", 0.0625 * (1 << idx), hist[idx]);
+  }
+  if (line[len - 1] == ',')
+    line[len - 1] = '\0';
+  notice(BMPSTAT_NOTICE, "%s", line);
+}
+
+/* flash_blocksize() returns the number of bytes from the data that fit in a
+   packet of "room" bytes, after escaping; the block is a multiple of 16 bytes
+   (for guaranteed alignment), except for the last block of the segment */
+static unsigned flash_blocksize(const unsigned char *data, unsigned count, unsigned room)
+{
+  unsigned idx, length, fit;
+
+  fit = length = 0;
+  for (idx = 0; idx < count; idx++) {
+    length += 1;
+    if (data[idx] == '$' || data[idx] == '#' || data[idx] == '}')
+      length += 1;      /* these characters must be escaped */
+    if (length > room)
+      break;
+    if ((idx & 0x0f) == 0x0f || idx + 1 == count)
+      fit = idx + 1;
+  }
+  return fit;
+}
+
+/* flash_collect() reads replies on vFlashWrite packets until no more than
+   "keep" packets are outstanding; on an error reply, it drains all pending
+   replies and returns 0 */
+static int flash_collect(char *cmd, int pktsize, int *pending, int keep)
+{
+  int result = 1;
+
+  assert(pending != NULL);
+  while (*pending > keep) {
+    int rcvd = gdbrsp_recv(cmd, pktsize, 500);
+    *pending -= 1;
+    if (rcvd != 2 || memcmp(cmd, "OK", rcvd) != 0) {
+      result = 0;
+      keep = 0; /* drain all, but keep the error */
+    }
+  }
+  if (!result)
+    gdbrsp_clear();
+  return result;
+}
+
+enum {
+  WRITE_FLASH,  /* vFlashWrite packets */
+  WRITE_RAM,    /* X packets */
+};
+
+/* data_write() sends a range of data in vFlashWrite packets (for Flash
+   memory) or X packets (for RAM), keeping up to "window" packets in flight;
+   "pending" holds the number of packets for which the reply has not been
+   received yet */
+static int data_write(int type, const unsigned char *data, unsigned long address, unsigned long size,
+                      char *cmd, int pktsize, int window, int *pending)
+{
+  unsigned long pos;
+  unsigned numbytes;
+
+  for (pos = 0; pos < size; pos += numbytes) {
+    unsigned prefixlen;
+    if (type == WRITE_FLASH)
+      sprintf(cmd, "vFlashWrite:%x:", (unsigned)(address + pos));
+    else
+      sprintf(cmd, "X%x,%04x:", (unsigned)(address + pos), 0); /* length is set below */
+    prefixlen = strlen(cmd) + 4;  /* +1 for '$', +3 for '#nn' checksum */
+    /* make the block as big as fits in PacketSize after escaping (scanning
+       the data once) */
+    numbytes = flash_blocksize(data + pos, size - pos, pktsize - prefixlen);
+    assert(numbytes > 0 && numbytes <= 0xffff);
+    if (type == WRITE_RAM)
+      sprintf(cmd, "X%x,%04x:", (unsigned)(address + pos), numbytes);
+    memmove(cmd + (prefixlen - 4), data + pos, numbytes);
+    gdbrsp_xmit(cmd, (prefixlen - 4) + numbytes);
+    *pending += 1;
+    /* with packets in flight, the next packet is built while the probe
+       handles the earlier ones; only wait when the window is full */
+    if (!flash_collect(cmd, pktsize, pending, window - 1))
+      return 0;
+    bmp_progress_step(numbytes);
+    yield((void*)(intptr_t)1);
+  }
+  return 1;
+}
+
+/* region_overlap() returns the part of a segment (of "filesize" bytes at
+   "paddr") that lies in a Flash region, as the range "start" up to "end"; it
+   returns 0 if the segment and the region do not overlap */
+static int region_overlap(int rgn, unsigned long paddr, unsigned long filesize,
+                          unsigned long *start, unsigned long *end)
+{
+  unsigned long base = FlashRgn[rgn].address;
+  unsigned long top = base + FlashRgn[rgn].size;
+
+  assert(start != NULL && end != NULL);
+  if (filesize == 0 || paddr >= top || paddr + filesize <= base)
     return 0;
+  *start = (paddr > base) ? paddr : base;
+  *end = (paddr + filesize < top) ? paddr + filesize : top;
+  return 1;
+}
+
+/* region_image() returns the image of the loadable segments in a Flash
+   region (for a range of the given size), with all gaps set to the erased
+   state; the buffer must be freed; on failure, it reports the error and
+   returns NULL */
+static unsigned char *region_image(const ELF_IMAGE *elf, int rgn, unsigned long size)
+{
+  unsigned long base = FlashRgn[rgn].address;
+  unsigned char *image;
+  int segment, type;
+
+  image = malloc(size);
+  if (image == NULL) {
+    notice(BMPERR_MEMALLOC, "Memory allocation failure");
+    return NULL;
   }
-  if (FlashRgnCount == 0) {
-    notice(BMPERR_NOFLASH, "No Flash memory record");
+  memset(image, 0xff, size);
+  for (segment = 0; ; segment++) {
+    unsigned long fileoffs, filesize, paddr, start, end;
+    if (elf_image_segment(elf, segment, &type, &fileoffs, &filesize, NULL, &paddr, NULL) != ELFERR_NONE)
+      break;
+    if (type != 1 || !region_overlap(rgn, paddr, filesize, &start, &end) || start >= base + size)
+      continue;
+    if (fileoffs + filesize > elf->size) {
+      notice(BMPERR_GENERAL, "Segment %d lies outside the ELF file", segment);
+      free(image);
+      return NULL;
+    }
+    if (end > base + size)
+      end = base + size;  /* copy only the part that fits in the buffer */
+    memcpy(image + (start - base), elf->data + fileoffs + (start - paddr), end - start);
+  }
+  return image;
+}
+
+/* flash_differential() erases and writes only the Flash blocks (of the
+   region) whose contents differ from the ELF file; the CRC of each block of
+   the file is compared to the CRC that the target returns on a qCRC request
+   (in no-ack mode, up to "window" requests are kept in flight, and the CRC of
+   a block is calculated on the host while the probe handles the request) */
+static int flash_differential(const ELF_IMAGE *elf, int rgn, unsigned long topaddr, unsigned long numblocks,
+                              char *cmd, int pktsize, int window, unsigned long *written)
+{
+  unsigned long base = FlashRgn[rgn].address;
+  unsigned blocksize = FlashRgn[rgn].blocksize;
+  unsigned long block, next, tstamp, erased, skipped;
+  unsigned char *image, *dirty;
+  unsigned crc_src[FLASH_WINDOW];
+  char rate[32];
+  size_t rcvd;
+  int pending, crcwindow;
+
+  assert(written != NULL);
+  *written = 0;
+
+  /* build the image of the region, with all gaps set to the erased state */
+  image = region_image(elf, rgn, numblocks * blocksize);
+  if (image == NULL)
+    return 0;
+  dirty = malloc(numblocks);
+  if (dirty == NULL) {
+    notice(BMPERR_MEMALLOC, "Memory allocation failure");
+    free(image);
     return 0;
   }
+
+  /* compare the CRC of each block to the one in the target */
+  tstamp = clock_ms();
+  skipped = 0;
+  assert(window >= 1 && window <= FLASH_WINDOW);
+  crcwindow = window;
+  block = next = 0;
+  while (block < numblocks) {
+    unsigned crc_tgt;
+    while (next < numblocks && next - block < (unsigned long)crcwindow) {
+      sprintf(cmd, "qCRC:%lx,%x", base + next * blocksize, blocksize);
+      gdbrsp_xmit(cmd, -1);
+      crc_src[next % FLASH_WINDOW] = (unsigned)gdb_crc32((uint32_t)~0, image + next * blocksize, blocksize);
+      next++;
+    }
+    do {
+      rcvd = gdbrsp_recv(cmd, pktsize, 3000);
+    } while (rcvd > 0 && cmd[0] == 'o');  /* ignore console output */
+    if (rcvd == 0) {
+      /* on a time-out, a late reply would be taken for the reply on the next
+         request; wait until the replies stop coming in, and drop these */
+      while (gdbrsp_recv(cmd, pktsize, 3000) > 0)
+        /* nothing */;
+      gdbrsp_clear();
+      if (next - block > 1) {
+        /* re-issue the requests that were in flight, one at a time */
+        next = block;
+        crcwindow = 1;
+        continue;
+      }
+    }
+    cmd[(rcvd < (size_t)pktsize) ? rcvd : (size_t)pktsize - 1] = '\0';
+    crc_tgt = (rcvd >= 2 && cmd[0] == 'C') ? strtoul(cmd + 1, NULL, 16) : ~crc_src[block % FLASH_WINDOW];
+    dirty[block] = (crc_tgt != crc_src[block % FLASH_WINDOW]);
+    if (!dirty[block]) {
+      skipped += 1;
+      bmp_progress_step(blocksize);
+    }
+    block++;
+    yield((void*)(intptr_t)1);
+  }
+  tstamp = clock_ms() - tstamp;
+  notice(BMPSTAT_NOTICE, "Compare: %lu blocks in %lu ms%s%s", numblocks, tstamp,
+         throughput(rate, numblocks * blocksize, tstamp), (crcwindow > 1) ? " (pipelined)" : "");
+
+  /* erase and write runs of changed blocks */
+  erased = 0;
+  pending = 0;
+  tstamp = clock_ms();
+  for (block = 0; block < numblocks; ) {
+    unsigned long start, address, size;
+    if (!dirty[block]) {
+      block++;
+      continue;
+    }
+    for (start = block; block < numblocks && dirty[block]; block++)
+      /* nothing */;
+    address = base + start * blocksize;
+    size = (block - start) * blocksize;
+    sprintf(cmd, "vFlashErase:%lx,%lx", address, size);
+    gdbrsp_xmit(cmd, -1);
+    rcvd = gdbrsp_recv(cmd, pktsize, 500);
+    if (rcvd != 2 || memcmp(cmd, "OK", rcvd)!= 0) {
+      notice(BMPERR_FLASHERASE, "Flash erase failed");
+      free(image);
+      free(dirty);
+      return 0;
+    }
+    erased += size;
+    /* the tail of the last block (beyond the end of the file) stays erased */
+    if (address + size > topaddr)
+      size = topaddr - address;
+    if (!data_write(WRITE_FLASH, image + (address - base), address, size, cmd, pktsize, window, &pending)
+        || !flash_collect(cmd, pktsize, &pending, 0))
+    {
+      notice(BMPERR_FLASHWRITE, "Flash write failed");
+      free(image);
+      free(dirty);
+      return 0;
+    }
+    *written += size;
+  }
+  tstamp = clock_ms() - tstamp;
+  notice(BMPSTAT_NOTICE, "Erase+write: %lu KiB in %lu ms%s%s",
+         *written / 1024, tstamp, throughput(rate, *written, tstamp),
+         (window > 1) ? " (pipelined)" : "");
+  notice(BMPSTAT_NOTICE, "%lu of %lu blocks unchanged (skipped), %lu KiB erased",
+         skipped, numblocks, erased / 1024);
+
+  free(image);
+  free(dirty);
+  return 1;
+}
+
+static uint32_t get_le32(const unsigned char *p)
+{
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void put_le32(unsigned char *p, uint32_t value)
+{
+  p[0] = (unsigned char)(value & 0xff);
+  p[1] = (unsigned char)((value >> 8) & 0xff);
+  p[2] = (unsigned char)((value >> 16) & 0xff);
+  p[3] = (unsigned char)((value >> 24) & 0xff);
+}
+
+static int hex2byte_array(const char *hex, unsigned char *byte);
+
+/* reg_write() sets a register of the target (the value is sent in target
+   byte order) */
+static int reg_write(int regnum, uint32_t value, char *cmd, int pktsize)
+{
+  unsigned char bytes[4];
+  int rcvd;
+
+  put_le32(bytes, value);
+  sprintf(cmd, "P%x=%02x%02x%02x%02x", regnum, bytes[0], bytes[1], bytes[2], bytes[3]);
+  gdbrsp_xmit(cmd, -1);
+  rcvd = gdbrsp_recv(cmd, pktsize, 500);
+  return (rcvd == 2 && memcmp(cmd, "OK", rcvd) == 0);
+}
+
+/* flash_compressed() writes the data of a Flash region (that must already be
+   erased) through the loader stub: the data is compressed in chunks, a batch
+   of chunks is stored in RAM and the stub is run to decompress and program
+   the batch */
+static int flash_compressed(const ELF_IMAGE *elf, int rgn, unsigned long topaddr, unsigned long numblocks,
+                            char *cmd, int pktsize, int window, unsigned long *written)
+{
+  unsigned long base = FlashRgn[rgn].address;
+  unsigned long length, align, jobaddr, bkptaddr, work, records, recsize, stacktop, chunk;
+  unsigned long pos, packedtotal, tstamp;
+  unsigned char *image, *batch;
+  unsigned char buffer[LOADER_JOBSIZE];
+  char rate[32];
+  int pending, rcvd;
+
+  assert(LoaderImage != NULL);
+  assert(written != NULL);
+  *written = 0;
+  align = get_le32(LoaderImage + 12);
+  if (align == 0)
+    align = 1;
+  length = topaddr - base;
+  length = ((length + align - 1) / align) * align;  /* pad to the alignment */
+  if (length > numblocks * FlashRgn[rgn].blocksize)
+    length = numblocks * FlashRgn[rgn].blocksize;
+
+  /* RAM layout: stub, job, breakpoint, work buffer, records, stack; the work
+     buffer holds one (decompressed) chunk, the records must hold at least one
+     chunk that does not compress */
+  jobaddr = (RamAddress + LoaderSize + 3) & ~3;
+  bkptaddr = jobaddr + LOADER_JOBSIZE;
+  work = bkptaddr + 4;
+  stacktop = (RamAddress + RamSize) & ~7;
+  chunk = 0;
+  if (stacktop > work + LOADER_STACK) {
+    unsigned long avail = stacktop - LOADER_STACK - work;
+    unsigned long size;
+    for (size = 256; size <= 16384 && size + 2 * LOADER_RECSIZE + lz4_bound(size) + 4 <= avail; size *= 2)
+      chunk = size;
+  }
+  if (chunk == 0 || (chunk % align) != 0) {
+    notice(BMPERR_MEMALLOC, "Insufficient RAM for the loader stub");
+    return 0;
+  }
+  records = work + chunk;
+  recsize = stacktop - LOADER_STACK - records;
+
+  image = region_image(elf, rgn, numblocks * FlashRgn[rgn].blocksize);
+  if (image == NULL)
+    return 0;
+  batch = malloc(recsize);
+  if (batch == NULL) {
+    notice(BMPERR_MEMALLOC, "Memory allocation failure");
+    free(image);
+    return 0;
+  }
+
+  /* upload the stub and the breakpoint that it returns to */
+  pending = 0;
+  memset(buffer, 0, sizeof buffer);
+  buffer[1] = buffer[3] = 0xbe; /* bkpt #0, twice */
+  if (!data_write(WRITE_RAM, LoaderImage, RamAddress, LoaderSize, cmd, pktsize, window, &pending)
+      || !data_write(WRITE_RAM, buffer, bkptaddr, 4, cmd, pktsize, window, &pending)
+      || !flash_collect(cmd, pktsize, &pending, 0))
+  {
+    notice(BMPERR_FLASHWRITE, "Uploading loader stub failed");
+    free(image);
+    free(batch);
+    return 0;
+  }
+
+  tstamp = clock_ms();
+  packedtotal = 0;
+  for (pos = 0; pos < length; ) {
+    unsigned long offs, start = pos;
+    uint32_t status;
+    /* compress chunks into the batch, until it is full */
+    for (offs = 0; pos < length; ) {
+      unsigned long size = (length - pos < chunk) ? length - pos : chunk;
+      unsigned long packed;
+      if (offs + 2 * LOADER_RECSIZE + lz4_bound(size) + 4 > recsize)
+        break;
+      packed = lz4_compress(image + pos, size, batch + offs + LOADER_RECSIZE, recsize - offs - 2 * LOADER_RECSIZE);
+      assert(packed > 0);
+      put_le32(batch + offs, base + pos);
+      put_le32(batch + offs + 4, size);
+      put_le32(batch + offs + 8, packed);
+      offs += LOADER_RECSIZE + ((packed + 3) & ~3);
+      pos += size;
+    }
+    memset(batch + offs, 0, LOADER_RECSIZE);  /* terminating record */
+    offs += LOADER_RECSIZE;
+    packedtotal += offs;
+    /* store the batch and the job, then run the stub */
+    put_le32(buffer, ~0);
+    put_le32(buffer + 4, records);
+    put_le32(buffer + 8, work);
+    put_le32(buffer + 12, chunk);
+    if (!data_write(WRITE_RAM, batch, records, offs, cmd, pktsize, window, &pending)
+        || !data_write(WRITE_RAM, buffer, jobaddr, LOADER_JOBSIZE, cmd, pktsize, window, &pending)
+        || !flash_collect(cmd, pktsize, &pending, 0)
+        || !reg_write(0, jobaddr, cmd, pktsize)                           /* r0 = job */
+        || !reg_write(13, stacktop, cmd, pktsize)                         /* sp */
+        || !reg_write(14, bkptaddr | 1, cmd, pktsize)                     /* lr = breakpoint (Thumb) */
+        || !reg_write(15, RamAddress + (get_le32(LoaderImage + 4) & ~1), cmd, pktsize) /* pc */
+        || !reg_write(16, 0x01000000, cmd, pktsize))                      /* xPSR, Thumb bit */
+    {
+      notice(BMPERR_FLASHWRITE, "Transfer to loader stub failed");
+      free(image);
+      free(batch);
+      return 0;
+    }
+    gdbrsp_xmit("c", -1);
+    do {
+      rcvd = gdbrsp_recv(cmd, pktsize, LOADER_TIMEOUT);
+    } while (rcvd > 0 && cmd[0] == 'o');  /* ignore console output */
+    /* the stub must stop on the breakpoint (SIGTRAP) */
+    if (rcvd < 3 || (cmd[0] != 'T' && cmd[0] != 'S') || strncmp(cmd + 1, "05", 2) != 0) {
+      if (rcvd == 0)
+        bmp_break();
+      notice(BMPERR_FLASHWRITE, "Loader stub did not complete");
+      free(image);
+      free(batch);
+      return 0;
+    }
+    sprintf(cmd, "m%lx,4", jobaddr);
+    gdbrsp_xmit(cmd, -1);
+    rcvd = gdbrsp_recv(cmd, pktsize, 500);
+    status = ~0;
+    if (rcvd == 8) {
+      cmd[rcvd] = '\0';
+      hex2byte_array(cmd, buffer);
+      status = get_le32(buffer);
+    }
+    if (status != 0) {
+      notice(BMPERR_FLASHWRITE, "Flash write failed at 0x%x (loader status %d)",
+             (unsigned)(base + start), (int)status);
+      free(image);
+      free(batch);
+      return 0;
+    }
+    *written += pos - start;
+    bmp_progress_step(pos - start);
+    yield((void*)(intptr_t)1);
+  }
+  tstamp = clock_ms() - tstamp;
+  notice(BMPSTAT_NOTICE, "Write: %lu KiB (%lu KiB compressed) in %lu ms%s",
+         *written / 1024, packedtotal / 1024, tstamp, throughput(rate, *written, tstamp));
+
+  free(image);
+  free(batch);
+  return 1;
+}
+
+/** bmp_setloader() loads a loader stub for compressed downloads. When a stub
+ *  is set, bmp_download() uploads it to the RAM of the target, and sends the
+ *  data compressed, for the stub to decompress and program. See
+ *  examples/flashloader.c for building a stub for an MCU.
+ *
+ *  \param filename   The path to the binary image of the stub, or NULL to
+ *                    remove the stub (and use standard downloads).
+ *
+ *  \return 1 on success, 0 on failure (file not found, or not a valid stub).
+ *
+ *  \note The stub is not used in differential mode (see
+ *        bmp_setdifferential()).
+ */
+int bmp_setloader(const char *filename)
+{
+  FILE *fp;
+  long size;
+
+  if (LoaderImage != NULL) {
+    free(LoaderImage);
+    LoaderImage = NULL;
+    LoaderSize = 0;
+  }
+  if (filename == NULL || *filename == '\0')
+    return 1;
+
+  if ((fp = fopen(filename, "rb")) == NULL)
+    return 0;
+  fseek(fp, 0, SEEK_END);
+  size = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+  if (size > LOADER_HDRSIZE && size < 0x10000 && (LoaderImage = malloc(size)) != NULL) {
+    if (fread(LoaderImage, 1, size, fp) == (size_t)size
+        && get_le32(LoaderImage) == LOADER_MAGIC && get_le32(LoaderImage + 4) < (uint32_t)size)
+    {
+      LoaderSize = size;
+    } else {
+      free(LoaderImage);
+      LoaderImage = NULL;
+    }
+  }
+  fclose(fp);
+  return (LoaderImage != NULL);
+}
+
+/** bmp_setdifferential() sets whether bmp_download() erases and writes only
+ *  the Flash blocks that differ from the ELF file. In differential mode, the
+ *  CRC of every block is compared to the CRC that the target returns, which
+ *  is faster than a full download when only a few blocks changed (e.g. a
+ *  serial number or calibration data).
+ *
+ *  \param enable   Set to 1 for differential mode, or 0 for a full download.
+ *
+ *  \note Verification (with bmp_verify) of the entire image is still
+ *        recommended after a differential download.
+ */
+void bmp_setdifferential(int enable)
+{
+  Differential = (enable != 0);
+}
+
+/* download_image() downloads the loadable segments of a mapped ELF file into
+   the Flash regions (see bmp_download) */
+static int download_image(const ELF_IMAGE *elf)
+{
   int pktsize = (PacketSize > 0) ? PacketSize : 64;
   char *cmd = malloc((pktsize + 16) * sizeof(char));
   if (cmd == NULL) {
@@ -596,29 +1194,55 @@ int bmp_download(FILE *fp)
     return 0;
   }
 
-  assert(fp != NULL);
+  /* pipeline packets if the connection is in no-ack mode */
+  int window = gdbrsp_isnoack() ? FLASH_WINDOW : 1;
+  gdbrsp_latency(NULL, 1);
+
+  /* the loader stub needs RAM; without a RAM record, it is skipped for this
+     download, but it stays set for the next */
+  int useloader = (LoaderImage != NULL && !Differential);
+  if (useloader && RamSize == 0) {
+    notice(BMPSTAT_NOTICE, "No RAM record, loader stub not used");
+    useloader = 0;
+  }
+
   unsigned long progress_range = 0;
   for (int rgn = 0; rgn < FlashRgnCount; rgn++) {
-    int segment, type, rcvd;
-    unsigned long topaddr, flashsectors, paddr, vaddr, fileoffs, filesize;
-    /* walk through all segments in the ELF file that fall into this region */
+    int segment, type, rcvd, pending;
+    unsigned long topaddr, flashsectors, paddr, vaddr, fileoffs, filesize, start, end;
+    unsigned long tstamp, written;
+    char rate[32];
+    /* walk through all segments in the ELF file that fall into this region;
+       the segments need not be sorted on address, so the top address is the
+       highest end address of all segments (clipped to the region) */
     topaddr = 0;
-    for (segment = 0; elf_segment_by_index(fp, segment, &type, &fileoffs, &filesize, NULL, &paddr, NULL) == ELFERR_NONE; segment++) {
-      if (type == 1 && paddr >= FlashRgn[rgn].address && paddr < FlashRgn[rgn].address + FlashRgn[rgn].size) {
-        topaddr = paddr + filesize;
-        progress_range += filesize;
+    for (segment = 0; elf_image_segment(elf, segment, &type, &fileoffs, &filesize, NULL, &paddr, NULL) == ELFERR_NONE; segment++) {
+      if (type == 1 && region_overlap(rgn, paddr, filesize, &start, &end)) {
+        if (end > topaddr)
+          topaddr = end;
+        progress_range += end - start;
       }
     }
     if (topaddr == 0)
       continue; /* no segment fitting in this Flash sector */
     bmp_progress_reset(progress_range+1);
-    /* erase the Flash memory */
     assert(topaddr <= FlashRgn[rgn].address + FlashRgn[rgn].size);
     flashsectors = ((topaddr - FlashRgn[rgn].address + (FlashRgn[rgn].blocksize - 1)) / FlashRgn[rgn].blocksize);
-    assert(flashsectors * FlashRgn[rgn].blocksize <= FlashRgn[rgn].address + FlashRgn[rgn].size);
+    assert(flashsectors * FlashRgn[rgn].blocksize <= FlashRgn[rgn].size);
+    if (Differential) {
+      notice(BMPSTAT_NOTICE, "Compare Flash at 0x%x length 0x%x",
+             (unsigned)FlashRgn[rgn].address, (unsigned)(flashsectors * FlashRgn[rgn].blocksize));
+      if (!flash_differential(elf, rgn, topaddr, flashsectors, cmd, pktsize, window, &written)) {
+        free(cmd);
+        return 0;
+      }
+      goto flash_done;
+    }
+    /* erase the Flash memory */
     notice(BMPSTAT_NOTICE, "Erase Flash at 0x%x length 0x%x",
            (unsigned)FlashRgn[rgn].address, (unsigned)(flashsectors * FlashRgn[rgn].blocksize));
     yield((void*)(intptr_t)1);
+    tstamp = clock_ms();
     sprintf(cmd, "vFlashErase:%x,%x", (unsigned)FlashRgn[rgn].address, (unsigned)(flashsectors * FlashRgn[rgn].blocksize));
     gdbrsp_xmit(cmd, -1);
     rcvd = gdbrsp_recv(cmd, pktsize, 500);
@@ -627,59 +1251,59 @@ int bmp_download(FILE *fp)
       free(cmd);
       return 0;
     }
+    tstamp = clock_ms() - tstamp;
+    notice(BMPSTAT_NOTICE, "Erase: %lu KiB in %lu ms%s",
+           (flashsectors * FlashRgn[rgn].blocksize) / 1024, tstamp,
+           throughput(rate, flashsectors * FlashRgn[rgn].blocksize, tstamp));
     bmp_progress_step(1);
+    if (useloader) {
+      /* complete the erase before running the loader stub on the target */
+      gdbrsp_xmit("vFlashDone", -1);
+      rcvd = gdbrsp_recv(cmd, pktsize, 500);
+      if (rcvd != 2 || memcmp(cmd, "OK", rcvd)!= 0) {
+        notice(BMPERR_FLASHDONE, "Flash completion failed");
+        free(cmd);
+        return 0;
+      }
+      if (!flash_compressed(elf, rgn, topaddr, flashsectors, cmd, pktsize, window, &written)) {
+        free(cmd);
+        return 0;
+      }
+      continue;
+    }
     /* walk through all segments again, to download the payload */
-    for (segment = 0; elf_segment_by_index(fp, segment, &type, &fileoffs, &filesize, &vaddr, &paddr, NULL) == ELFERR_NONE; segment++) {
-      unsigned char *data;
-      unsigned pos, numbytes, esccount, idx;
-      if (type != 1 || filesize == 0 || paddr < FlashRgn[rgn].address || paddr >= FlashRgn[rgn].address + FlashRgn[rgn].size)
+    tstamp = clock_ms();
+    written = 0;
+    pending = 0;
+    for (segment = 0; elf_image_segment(elf, segment, &type, &fileoffs, &filesize, &vaddr, &paddr, NULL) == ELFERR_NONE; segment++) {
+      if (type != 1 || !region_overlap(rgn, paddr, filesize, &start, &end))
         continue;
-      notice(BMPSTAT_NOTICE, "%d: %s segment at 0x%x length 0x%x", segment, (vaddr == paddr) ? "Code" : "Data", (unsigned)paddr, (unsigned)filesize);
-      data = malloc(filesize);
-      if (data == NULL) {
-        notice(BMPERR_MEMALLOC, "Memory allocation failure");
+      notice(BMPSTAT_NOTICE, "%d: %s segment at 0x%x length 0x%x", segment, (vaddr == paddr) ? "Code" : "Data", (unsigned)start, (unsigned)(end - start));
+      if (fileoffs + filesize > elf->size) {
+        notice(BMPERR_GENERAL, "Segment %d lies outside the ELF file", segment);
+        flash_collect(cmd, pktsize, &pending, 0);
         free(cmd);
         return 0;
       }
       yield((void*)(intptr_t)1);
-      fseek(fp, fileoffs, SEEK_SET);
-      fread(data, 1, filesize, fp);
-      for (pos = numbytes = 0; pos < filesize; pos += numbytes) {
-        unsigned prefixlen;
-        sprintf(cmd, "vFlashWrite:%x:", (unsigned)(paddr + pos));
-        prefixlen = strlen(cmd) + 4;  /* +1 for '$', +3 for '#nn' checksum */
-        /* make blocks that are a multiple of 16 bytes (for guaranteed alignment)
-           that are less than (or equal to) PacketSize; start by subtracting the
-           prefix length */
-        numbytes = (pktsize - prefixlen) & ~0x0f;
-        if (pos + numbytes > filesize)
-          numbytes = filesize - pos;
-        /* check how many bytes in the packet must be escaped, then check
-           whether the packet would still fit (decrement the block length
-           otherwise) */
-        for ( ;; ) {
-          esccount = 0;
-          for (idx = 0; idx < numbytes; idx++)
-            if (data[pos + idx] == '$' || data[pos + idx] == '#' || data[pos + idx] == '}')
-              esccount += 1;
-          if (numbytes + esccount + prefixlen <= (unsigned)pktsize)
-            break;
-          numbytes -= 16;
-        }
-        memmove(cmd + (prefixlen - 4), data + pos, numbytes);
-        gdbrsp_xmit(cmd, (prefixlen - 4) + numbytes);
-        rcvd = gdbrsp_recv(cmd, pktsize, 500);
-        if (rcvd != 2 || memcmp(cmd, "OK", rcvd)!= 0) {
-          notice(BMPERR_FLASHWRITE, "Flash write failed");
-          free(data);
-          free(cmd);
-          return 0;
-        }
-        bmp_progress_step(numbytes);
-        yield((void*)(intptr_t)1);
+      if (!data_write(WRITE_FLASH, elf->data + fileoffs + (start - paddr), start, end - start, cmd, pktsize, window, &pending)) {
+        notice(BMPERR_FLASHWRITE, "Flash write failed");
+        free(cmd);
+        return 0;
       }
-      free(data);
+      written += end - start;
     }
+    if (!flash_collect(cmd, pktsize, &pending, 0)) {
+      notice(BMPERR_FLASHWRITE, "Flash write failed");
+      free(cmd);
+      return 0;
+    }
+    tstamp = clock_ms() - tstamp;
+    notice(BMPSTAT_NOTICE, "Write: %lu KiB in %lu ms%s%s",
+           written / 1024, tstamp, throughput(rate, written, tstamp),
+           (window > 1) ? " (pipelined)" : "");
+  flash_done:
+    tstamp = clock_ms();
     gdbrsp_xmit("vFlashDone", -1);
     rcvd = gdbrsp_recv(cmd, pktsize, 500);
     if (rcvd != 2 || memcmp(cmd, "OK", rcvd)!= 0) {
@@ -687,34 +1311,152 @@ int bmp_download(FILE *fp)
       free(cmd);
       return 0;
     }
+    tstamp = clock_ms() - tstamp;
+    notice(BMPSTAT_NOTICE, "Done: %lu ms%s", tstamp, throughput(rate, written, tstamp));
   }
 
+  report_latency();
   free(cmd);
   return 1;
 }
 
+/** bmp_download() downloads the loadable segments of an ELF file into Flash
+ *  memory. If the gdbserver supports no-ack mode, it is switched to it, and
+ *  up to FLASH_WINDOW vFlashWrite packets are kept in flight (otherwise, each
+ *  packet waits for the reply on the preceding packet). The throughput of the
+ *  erase, write and completion phases is reported via the callback.
+ *
+ *  \return 1 on success, 0 on failure.
+ *
+ *  \note See bmp_setdifferential() for writing only changed blocks, and
+ *        bmp_setloader() for compressed downloads through a loader stub.
+ */
+int bmp_download(FILE *fp)
+{
+  ELF_IMAGE elf;
+  int result;
+
+  bmp_progress_reset(0);
+  if (!bmp_isopen()) {
+    notice(BMPERR_NOCONNECT, "Not connected to Black Magic Probe");
+    return 0;
+  }
+  if (FlashRgnCount == 0) {
+    notice(BMPERR_NOFLASH, "No Flash memory record");
+    return 0;
+  }
+  assert(fp != NULL);
+  if (elf_image_open(fp, &elf) != ELFERR_NONE) {
+    notice(BMPERR_GENERAL, "Invalid ELF file");
+    return 0;
+  }
+  result = download_image(&elf);
+  elf_image_close(&elf);
+  return result;
+}
+
+typedef struct tagVERIFY_BLOCK {
+  int segment;            /* segment index in the ELF file */
+  unsigned long offset;   /* position of the block in the ELF file */
+  unsigned long address;  /* start address of the block in Flash memory */
+  unsigned long size;     /* size of the block */
+  unsigned long base;     /* start address of the Flash region */
+  unsigned long sector;   /* size of the Flash sector (resolution for mismatches) */
+  unsigned crc;           /* CRC of the block in the ELF file */
+} VERIFY_BLOCK;
+
+typedef struct tagVERIFY_LIST {
+  VERIFY_BLOCK *blocks;
+  size_t count, size;
+} VERIFY_LIST;
+
+/* verify_add() appends a range to a list of blocks; the range is split into
+   blocks of the given size (aligned to "base"); it returns 0 on a memory
+   allocation failure */
+static int verify_add(VERIFY_LIST *list, int segment, unsigned long offset,
+                      unsigned long address, unsigned long size,
+                      unsigned long base, unsigned long blocksize, unsigned long sector)
+{
+  assert(list != NULL);
+  assert(blocksize > 0 && address >= base);
+  while (size > 0) {
+    unsigned long partsize = blocksize - (address - base) % blocksize;
+    if (partsize > size)
+      partsize = size;
+    if (list->count >= list->size) {
+      size_t newsize = (list->size == 0) ? 16 : 2 * list->size;
+      VERIFY_BLOCK *newlist = realloc(list->blocks, newsize * sizeof(VERIFY_BLOCK));
+      if (newlist == NULL)
+        return 0;
+      list->blocks = newlist;
+      list->size = newsize;
+    }
+    list->blocks[list->count].segment = segment;
+    list->blocks[list->count].offset = offset;
+    list->blocks[list->count].address = address;
+    list->blocks[list->count].size = partsize;
+    list->blocks[list->count].base = base;
+    list->blocks[list->count].sector = sector;
+    list->blocks[list->count].crc = 0;
+    list->count += 1;
+    offset += partsize;
+    address += partsize;
+    size -= partsize;
+  }
+  return 1;
+}
+
+static int verify_compare(const void *a, const void *b)
+{
+  unsigned long addr1 = ((const VERIFY_BLOCK*)a)->address;
+  unsigned long addr2 = ((const VERIFY_BLOCK*)b)->address;
+  return (addr1 < addr2) ? -1 : (addr1 > addr2) ? 1 : 0;
+}
+
+/** bmp_verify() compares the loadable segments of the ELF file (that are in
+ *  Flash memory) to the contents of Flash memory, by comparing CRCs.
+ *
+ *  \param fp    The ELF file.
+ *
+ *  \return 1 if all segments match, 0 on a mismatch or on an error.
+ *
+ *  \note The segments are checked in chunks of (at least) VERIFY_CHUNK bytes.
+ *        A chunk that does not match, is checked again per Flash sector, so
+ *        that the mismatch is reported for the range of the sectors that
+ *        differ. The qCRC request for a chunk is sent before the CRC of that
+ *        chunk is calculated on the host, so that the host and the target work
+ *        in parallel; in no-ack mode, up to VERIFY_WINDOW requests are kept in
+ *        flight. After a time-out on a reply, the requests that were in flight
+ *        are sent again, one at a time; if the single request then times out
+ *        as well, verification stops with an error.
+ */
 int bmp_verify(FILE *fp)
 {
-  char cmd[100];
-  int segment, sector, type, allmatch;
+  VERIFY_LIST list, mismatch;
+  ELF_IMAGE elf;
+  size_t next, done, idx;
+  int segment, sector, type, window, result;
   unsigned long offset, filesize, paddr;
 
   if (!bmp_isopen()) {
     notice(BMPERR_NOCONNECT, "Not connected to Black Magic Probe");
     return 0;
   }
-
-  /* run over all segments in the ELF file */
-  allmatch = 1;
   assert(fp != NULL);
+  if (elf_image_open(fp, &elf) != ELFERR_NONE) {
+    notice(BMPERR_GENERAL, "Invalid ELF file");
+    return 0;
+  }
+
+  /* make a list of the chunks to check, for all segments in the ELF file */
+  memset(&list, 0, sizeof list);
+  memset(&mismatch, 0, sizeof mismatch);
+  result = 1;
   for (segment = 0;
-       elf_segment_by_index(fp, segment, &type, &offset, &filesize, NULL, &paddr, NULL) == ELFERR_NONE;
+       result && elf_image_segment(&elf, segment, &type, &offset, &filesize, NULL, &paddr, NULL) == ELFERR_NONE;
        segment++)
   {
-    unsigned char *data;
-    unsigned crc_src, crc_tgt;
-    size_t rcvd;
-
+    unsigned long base, blocksize, chunksize;
     if (type != 1 || filesize == 0)
       continue;   /* no loadable data */
     /* also check that paddr falls within a Flash memory sector */
@@ -723,31 +1465,244 @@ int bmp_verify(FILE *fp)
         break;
     if (sector >= FlashRgnCount)
       continue; /* segment is outside of any Flash sector */
-    /* read entire segment, calc CRC */
-    data = malloc((size_t)filesize * sizeof (unsigned char));
-    if (data == NULL) {
-      notice(BMPERR_MEMALLOC, "Memory allocation failure");
+    base = FlashRgn[sector].address;
+    blocksize = (FlashRgn[sector].blocksize > 0) ? FlashRgn[sector].blocksize : VERIFY_CHUNK;
+    chunksize = (blocksize < VERIFY_CHUNK) ? (VERIFY_CHUNK / blocksize) * blocksize : blocksize;
+    if (offset + filesize > elf.size) {
+      notice(BMPERR_GENERAL, "Segment %d lies outside the ELF file", segment);
+      if (list.blocks != NULL)
+        free(list.blocks);
+      elf_image_close(&elf);
       return 0;
     }
-    fseek(fp, offset, SEEK_SET);
-    fread(data, 1, filesize, fp);
-    crc_src = (unsigned)gdb_crc32((uint32_t)~0, data, filesize);
-    free(data);
-    /* request CRC from Black Magic Probe */
-    sprintf(cmd, "qCRC:%lx,%lx",paddr,filesize);
-    gdbrsp_xmit(cmd, -1);
-    rcvd = gdbrsp_recv(cmd, sizearray(cmd), 3000);
-    cmd[rcvd] = '\0';
-    crc_tgt = (rcvd >= 2 && cmd[0] == 'C') ? strtoul(cmd + 1, NULL, 16) : 0;
-    if (crc_tgt != crc_src) {
-      notice(BMPERR_FLASHCRC, "Segment %d data mismatch", segment);
-      allmatch = 0;
+    result = verify_add(&list, segment, offset, paddr, filesize, base, chunksize, blocksize);
+  }
+  if (!result) {
+    notice(BMPERR_MEMALLOC, "Memory allocation failure");
+    if (list.blocks != NULL)
+      free(list.blocks);
+    elf_image_close(&elf);
+    return 0;
+  }
+
+  /* send the requests and collect the replies; chunks that fail are added to
+     the end of the list, split into sectors */
+  window = gdbrsp_isnoack() ? VERIFY_WINDOW : 1;
+  for (next = done = 0; result && done < list.count; done++) {
+    VERIFY_BLOCK *block;
+    char cmd[40];
+    size_t rcvd;
+    unsigned crc_tgt;
+    for ( ;; ) {
+      while (next < list.count && next - done < (size_t)window) {
+        block = &list.blocks[next++];
+        sprintf(cmd, "qCRC:%lx,%lx", block->address, block->size);
+        gdbrsp_xmit(cmd, -1);
+        /* calculate the CRC on the file data while the probe is busy */
+        block->crc = (unsigned)gdb_crc32((uint32_t)~0, elf.data + block->offset, block->size);
+      }
+      do {
+        rcvd = gdbrsp_recv(cmd, sizearray(cmd) - 1, 3000);
+      } while (rcvd > 0 && cmd[0] == 'o');  /* ignore console output */
+      if (rcvd > 0)
+        break;
+      /* on a time-out, a late reply would be taken for the reply on the next
+         request; wait until the replies stop coming in, and drop these */
+      while (gdbrsp_recv(cmd, sizearray(cmd) - 1, 3000) > 0)
+        /* nothing */;
+      gdbrsp_clear();
+      if (next - done <= 1)
+        break;
+      /* re-issue the requests that were in flight, one at a time */
+      next = done;
+      window = 1;
     }
+    block = &list.blocks[done];
+    if (rcvd == 0) {
+      /* a time-out is not a mismatch, so it is reported on its own */
+      notice(BMPERR_NORESPONSE, "No response on qCRC at 0x%lx", block->address);
+      free(list.blocks);
+      if (mismatch.blocks != NULL)
+        free(mismatch.blocks);
+      elf_image_close(&elf);
+      return 0;
+    }
+    cmd[(rcvd < sizearray(cmd)) ? rcvd : sizearray(cmd) - 1] = '\0';
+    if (rcvd >= 2 && cmd[0] == 'C') {
+      crc_tgt = strtoul(cmd + 1, NULL, 16);
+      if (crc_tgt == block->crc)
+        continue;
+      if (block->size > block->sector) {
+        VERIFY_BLOCK chunk = *block;  /* copy, because the list may move */
+        result = verify_add(&list, chunk.segment, chunk.offset, chunk.address, chunk.size,
+                            chunk.base, chunk.sector, chunk.sector);
+        continue;
+      }
+    }
+    /* mismatch on a sector (or an error reply on a chunk) */
+    result = verify_add(&mismatch, block->segment, block->offset, block->address, block->size,
+                        block->address, block->size, block->sector);
+  }
+  free(list.blocks);
+  elf_image_close(&elf);
+  if (!result) {
+    notice(BMPERR_MEMALLOC, "Memory allocation failure");
+    gdbrsp_clear();
+    if (mismatch.blocks != NULL)
+      free(mismatch.blocks);
+    return 0;
+  }
+
+  /* report runs of adjacent sectors that differ */
+  if (mismatch.count > 0) {
+    qsort(mismatch.blocks, mismatch.count, sizeof(VERIFY_BLOCK), verify_compare);
+    for (idx = 0; idx < mismatch.count; ) {
+      const VERIFY_BLOCK *first = &mismatch.blocks[idx];
+      unsigned long end = first->address + first->size;
+      for (idx++; idx < mismatch.count && mismatch.blocks[idx].segment == first->segment
+                  && mismatch.blocks[idx].address == end; idx++)
+        end += mismatch.blocks[idx].size;
+      notice(BMPERR_FLASHCRC, "Segment %d data mismatch at 0x%lx-0x%lx",
+             first->segment, first->address, end - 1);
+    }
+    free(mismatch.blocks);
+    return 0;
   }
-  if (allmatch)
-    notice(BMPSTAT_SUCCESS, "Verification successful");
 
-  return allmatch;
+  notice(BMPSTAT_SUCCESS, "Verification successful");
+  return 1;
+}
+
+/** bmp_readmem() reads a block of memory from the target.
+ *
+ *  \param address  The start address in target memory.
+ *  \param buffer   The buffer that will hold the data.
+ *  \param length   The number of bytes to read.
+ *
+ *  \return 1 on success, 0 on failure.
+ *
+ *  \note The block is read in chunks that fit the packet size of the
+ *        gdbserver. In no-ack mode, several requests are kept in flight. The
+ *        binary "x" packet is used if the gdbserver supports it, and the
+ *        hex-encoded "m" packet otherwise. A gdbserver may return fewer bytes
+ *        than requested on "x" (when the escaped data does not fit in its
+ *        buffer); the remainder is requested again.
+ */
+int bmp_readmem(unsigned long address, unsigned char *buffer, size_t length)
+{
+  struct {
+    unsigned long offset, size;
+    int binary;
+  } pending[READ_WINDOW], retry[2 * READ_WINDOW + 1];
+  int head, count, numretry, window, binary, pktsize, result;
+  unsigned long next, done, tstamp;
+  char cmd[40], rate[32], *reply;
+
+  assert(buffer != NULL || length == 0);
+  if (!bmp_isopen()) {
+    notice(BMPERR_NOCONNECT, "Not connected to Black Magic Probe");
+    return 0;
+  }
+  pktsize = (PacketSize > 0) ? PacketSize : 64;
+  reply = malloc((2 * pktsize + 16) * sizeof(char));
+  if (reply == NULL) {
+    notice(BMPERR_MEMALLOC, "Memory allocation error");
+    return 0;
+  }
+  binary = BinaryUpload;
+  if (binary)
+    gdbrsp_packetsize(2 * pktsize + 16);  /* escaped binary data may be up to twice as big */
+  window = gdbrsp_isnoack() ? READ_WINDOW : 1;
+
+  tstamp = clock_ms();
+  head = count = numretry = 0;
+  next = done = 0;
+  result = 1;
+  while (done < length) {
+    unsigned long offset, size, got;
+    size_t rcvd;
+    int type;
+    /* fill the pipeline, with the remainders of short replies first */
+    while (count < window && (numretry > 0 || next < length)) {
+      unsigned long maxsize = binary ? pktsize - 16 : (pktsize - 16) / 2;
+      if (numretry > 0) {
+        numretry--;
+        offset = retry[numretry].offset;
+        size = retry[numretry].size;
+      } else {
+        offset = next;
+        size = length - next;
+        if (size > maxsize)
+          size = maxsize;
+        next += size;
+      }
+      if (size > maxsize) {
+        /* after switching from "x" to "m", a remainder may be too big */
+        assert(numretry < (int)sizearray(retry));
+        retry[numretry].offset = offset + maxsize;
+        retry[numretry].size = size - maxsize;
+        numretry++;
+        size = maxsize;
+      }
+      sprintf(cmd, "%c%lx,%lx", binary ? 'x' : 'm', address + offset, size);
+      gdbrsp_xmit(cmd, -1);
+      pending[(head + count) % READ_WINDOW].offset = offset;
+      pending[(head + count) % READ_WINDOW].size = size;
+      pending[(head + count) % READ_WINDOW].binary = binary;
+      count++;
+    }
+    /* handle the reply on the oldest request */
+    assert(count > 0);
+    offset = pending[head].offset;
+    size = pending[head].size;
+    type = pending[head].binary;
+    head = (head + 1) % READ_WINDOW;
+    count--;
+    rcvd = gdbrsp_recv(reply, 2 * pktsize + 15, 1000);
+    if (rcvd == 0 && type) {
+      /* empty reply: "x" is not supported, fall back to "m" */
+      binary = BinaryUpload = 0;
+      assert(numretry < (int)sizearray(retry));
+      retry[numretry].offset = offset;
+      retry[numretry].size = size;
+      numretry++;
+      continue;
+    }
+    got = 0;
+    if (type && rcvd > 1 && rcvd <= size + 1 && reply[0] == 'b') {
+      got = rcvd - 1;
+      memcpy(buffer + offset, reply + 1, got);
+    } else if (!type && rcvd >= 2 && rcvd <= 2 * size && (rcvd & 1) == 0) {
+      reply[rcvd] = '\0';
+      if (hex2byte_array(reply, buffer + offset))
+        got = rcvd / 2;
+    }
+    if (got == 0) {
+      notice(BMPERR_MEMREAD, "Memory read failed at 0x%lx", address + offset);
+      result = 0;
+      break;
+    }
+    if (got < size) {
+      assert(numretry < (int)sizearray(retry));
+      retry[numretry].offset = offset + got;
+      retry[numretry].size = size - got;
+      numretry++;
+    }
+    done += got;
+  }
+  if (!result) {
+    /* drain the replies of the requests that are still in flight */
+    while (count-- > 0)
+      gdbrsp_recv(reply, 2 * pktsize + 15, 1000);
+    gdbrsp_clear();
+  } else if (length >= 4096) {
+    tstamp = clock_ms() - tstamp;
+    notice(BMPSTAT_NOTICE, "Read: %lu KiB in %lu ms%s%s",
+           (unsigned long)length / 1024, tstamp, throughput(rate, length, tstamp),
+           binary ? " (binary)" : "");
+  }
+  free(reply);
+  return result;
 }
 
 /** bmp_enabletrace() code enables trace in the Black Magic Probe.
@@ -864,53 +1819,60 @@ static int hex2byte_array(const char *hex, unsigned char *byte)
  *
  *  \note When the line of a script has a magic value for the "value" field, it
  *        is replaced by a parameter.
+ *
+ *  \note The script is compiled on the first run (and kept in memory), so that
+ *        a chain of read-modify-write lines on the same register takes a single
+ *        read and a single write, and assignments to adjacent registers are
+ *        written in a single packet.
  */
 int bmp_runscript(const char *name, const char *mcu, const char *arch, const unsigned long *params)
 {
-  uint32_t address, value;
-  uint8_t size;
-  char oper;
-  int result;
+  const BMSCRIPT_OP *ops;
+  size_t count, idx;
+  int pending, window, result;
+  char cmd[100];
 
-  bmscript_clearcache();
-  bmscript_load(mcu, arch);  /* very quick if the scriptsfor the MCU are already in memory */
+  assert(name != NULL && mcu != NULL);
+  bmscript_load(mcu, arch);  /* very quick if the scripts for the MCU are already in memory */
+  if (!bmscript_compile(name, &ops, &count))
+    return 1;   /* no script for this MCU, nothing to do */
+
+  /* in no-ack mode, up to SCRIPT_WINDOW writes are kept in flight; a read
+     waits until all earlier writes are acknowledged */
+  window = gdbrsp_isnoack() ? SCRIPT_WINDOW : 1;
+  pending = 0;
   result = 1;
-  while (result && bmscript_line(name, &oper, &address, &value, &size)) {
-    char cmd[100];
-    size_t len = 0;
+  for (idx = 0; result && idx < count; idx++) {
+    const BMSCRIPT_OP *op = &ops[idx];
+    uint32_t address = op->address;
+    unsigned char buffer[SCRIPT_MAXBLOCK];
+    size_t len;
     if ((address & ~0xf) == SCRIPT_MAGIC) {
       assert(params != NULL);
       address = (uint32_t)params[address & 0xf];  /* replace address parameter */
       if (address == ~0)
         continue; /* ignore row on invalid address */
     }
-    if ((value & ~0xf) == SCRIPT_MAGIC) {
-      assert(params != NULL);
-      value = (uint32_t)params[value & 0xf];      /* replace value parameter */
+    assert(op->size <= sizearray(buffer));
+    memset(buffer, 0, op->size);
+    if (op->read) {
+      if (!flash_collect(cmd, sizearray(cmd), &pending, 0)
+          || !bmp_readmem(address, buffer, op->size))
+      {
+        result = 0;
+        break;
+      }
     }
-    if (oper == '|' || oper == '&' || oper == '~') {
-      uint32_t cur = 0;
-      uint8_t bytes[4] = { 0, 0, 0, 0 };
-      sprintf(cmd, "m%08X,%X:", address, size);
-      gdbrsp_xmit(cmd, -1);
-      len = gdbrsp_recv(cmd, sizearray(cmd), 1000);
-      cmd[len] = '\0';
-      hex2byte_array(cmd, bytes);
-      memmove(&cur, bytes, size);
-      if (oper == '|')
-        value |= cur;
-      else if (oper == '&')
-        value &= cur;
-      else
-        value &= ~cur;
-    }
-    sprintf(cmd, "X%08X,%X:", address, size);
+    bmscript_apply(op, buffer, params);
+    sprintf(cmd, "X%08X,%X:", address, op->size);
     len = strlen(cmd);
-    memmove(cmd + len, &value, size);
-    gdbrsp_xmit(cmd, len + size);
-    len = gdbrsp_recv(cmd, sizearray(cmd), 1000);
-    result = (len == 2 && memcmp(cmd, "OK", len) == 0);
+    memmove(cmd + len, buffer, op->size);
+    gdbrsp_xmit(cmd, len + op->size);
+    pending += 1;
+    result = flash_collect(cmd, sizearray(cmd), &pending, window - 1);
   }
+  if (!flash_collect(cmd, sizearray(cmd), &pending, 0))
+    result = 0;
 
   return result;
 }
@@ -42,6 +42,7 @@ enum {
   BMPERR_FLASHWRITE = -10,/* Flash write failed */
   BMPERR_FLASHDONE  = -11,/* Flash programming completion failed */
   BMPERR_FLASHCRC   = -12,/* Flash CRC verification failed */
+  BMPERR_MEMREAD    = -13,/* memory read failed */
   BMPERR_GENERAL    = -14,
 };
 
@@ -63,8 +64,11 @@ int bmp_detach(int powerdown);
 
 int bmp_monitor(const char *command);
 int bmp_fullerase(void);
+void bmp_setdifferential(int enable);
+int bmp_setloader(const char *filename);
 int bmp_download(FILE *fp);
 int bmp_verify(FILE *fp);
+int bmp_readmem(unsigned long address, unsigned char *buffer, size_t length);
 
 void bmp_progress_reset(unsigned long numsteps);
 void bmp_progress_step(unsigned long step);
@@ -0,0 +1,991 @@
+/*
+ * A simulated Black Magic Probe, for testing and benchmarking the GDB-RSP
+ * code of the utilities without hardware. It runs a gdbserver on a TCP/IP
+ * port (like a ctxLink) or on a pseudo-terminal (like the virtual serial port
+ * of a Black Magic Probe), and it emulates a Cortex-M target with Flash memory
+ * and RAM. The latency and the bandwidth of the link, as well as the erase and
+ * programming speed of the Flash memory, can be set.
+ *
+ * Loader stubs for compressed downloads (see examples/flashloader.c) are
+ * recognized when the target is resumed, and they run natively on the host,
+ * on the simulated RAM and Flash memory.
+ *
+ * This utility is for Linux (and other POSIX systems).
+ *
+ * Copyright 2022 CompuPhase
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#define _GNU_SOURCE
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include "bmp-scan.h"
+#include "crc32.h"
+
+/* the loader stub runs on the simulated RAM */
+static uint8_t *ram_ptr(uint32_t address);
+#define LOADER_PTR(addr)  ram_ptr(addr)
+#include "../examples/flashloader.c"
+
+#define PACKET_SIZE   0x400   /* maximum packet size, as reported to the host */
+#define NUM_REGS      17      /* r0..r15 + xPSR */
+#define REG_PC        15
+#define MAX_PERIPH    256     /* number of peripheral registers that are kept */
+#define NEVER         UINT64_MAX
+
+typedef struct tagPACKET {
+  struct tagPACKET *next;
+  uint64_t time;      /* time at which it has arrived (in) or is delivered (out) */
+  size_t size;
+  char data[];
+} PACKET;
+
+/* target model */
+static uint32_t FlashBase = 0x08000000;
+static uint32_t FlashSize = 64 * 1024;
+static uint32_t FlashBlock = 1024;
+static uint32_t RamBase = 0x20000000;
+static uint32_t RamSize = 20 * 1024;
+static uint8_t *Flash = NULL;
+static uint8_t *Ram = NULL;
+static struct {
+  uint32_t address;
+  uint32_t value;
+} Periph[MAX_PERIPH];
+static int PeriphCount = 0;
+static uint32_t Regs[NUM_REGS];
+static char Driver[64] = "STM32F1 medium density M3/M4";
+static int Attached = 0;
+static int Running = 0;
+static int BinaryUpload = 1;  /* support for the "x" packet */
+
+/* link & timing model (all times in microseconds) */
+static double Latency = 0;        /* one-way latency */
+static double Bandwidth = 0;      /* in bytes per second, 0 = unlimited */
+static double EraseTime = 0;      /* per Flash block */
+static double ProgramRate = 0;    /* in bytes per second, 0 = unlimited */
+static uint64_t InFree = 0;       /* time that the link is free (host -> probe) */
+static uint64_t OutFree = 0;      /* time that the link is free (probe -> host) */
+static uint64_t BusyUntil = 0;    /* time that the probe is done with the current command */
+
+/* protocol state */
+static int NoAckMode = 0;
+static PACKET *InQueue = NULL;
+static PACKET *OutQueue = NULL;
+static char InBuffer[2 * PACKET_SIZE + 16];
+static size_t InLength = 0;
+static int Verbose = 0;
+
+
+static uint64_t now_us(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* transfer_time() returns the time that it takes to push "size" bytes
+   through the link, for the configured bandwidth */
+static uint64_t transfer_time(size_t size)
+{
+  return (Bandwidth > 0) ? (uint64_t)(size * 1000000.0 / Bandwidth) : 0;
+}
+
+static void queue_append(PACKET **root, PACKET *pkt)
+{
+  pkt->next = NULL;
+  while (*root != NULL)
+    root = &(*root)->next;
+  *root = pkt;
+}
+
+static void queue_clear(PACKET **root)
+{
+  while (*root != NULL) {
+    PACKET *next = (*root)->next;
+    free(*root);
+    *root = next;
+  }
+}
+
+static void log_packet(const char *prefix, const char *data, size_t size)
+{
+  size_t idx;
+  if (!Verbose)
+    return;
+  fprintf(stderr, "%s ", prefix);
+  for (idx = 0; idx < size && idx < 64; idx++) {
+    unsigned char c = (unsigned char)data[idx];
+    if (c >= ' ' && c < 0x7f)
+      fputc(c, stderr);
+    else
+      fprintf(stderr, "\\x%02x", c);
+  }
+  if (size > 64)
+    fprintf(stderr, "... (%u bytes)", (unsigned)size);
+  fputc('\n', stderr);
+}
+
+/* send_raw() queues bytes for the host, which will be delivered after the
+   given time plus the transfer time and the latency */
+static void send_raw(const char *data, size_t size, uint64_t time)
+{
+  PACKET *pkt = malloc(sizeof(PACKET) + size);
+  if (pkt == NULL)
+    return;
+  if (OutFree < time)
+    OutFree = time;
+  OutFree += transfer_time(size);
+  pkt->time = OutFree + (uint64_t)Latency;
+  pkt->size = size;
+  memcpy(pkt->data, data, size);
+  queue_append(&OutQueue, pkt);
+}
+
+/* reply() frames a reply packet (escaping binary data) and queues it; the
+   reply is sent at the time that the probe is done with the command */
+static void reply(const char *data, size_t size)
+{
+  char *buffer = malloc(2 * size + 4);
+  size_t idx, len;
+  unsigned char sum = 0;
+
+  if (buffer == NULL)
+    return;
+  log_packet("<-", data, size);
+  len = 0;
+  buffer[len++] = '$';
+  for (idx = 0; idx < size; idx++) {
+    char c = data[idx];
+    if (c == '$' || c == '#' || c == '}' || c == '*') {
+      buffer[len++] = '}';
+      sum += (unsigned char)'}';
+      c ^= 0x20;
+    }
+    buffer[len++] = c;
+    sum += (unsigned char)c;
+  }
+  len += sprintf(buffer + len, "#%02x", sum);
+  send_raw(buffer, len, BusyUntil);
+  free(buffer);
+}
+
+static void reply_str(const char *str)
+{
+  reply(str, strlen(str));
+}
+
+/* reply_output() sends text as console output (an "O" packet) */
+static void reply_output(const char *text)
+{
+  char buffer[256];
+  size_t idx;
+  buffer[0] = 'O';
+  for (idx = 0; text[idx] != '\0' && 2 * idx + 3 < sizeof buffer; idx++)
+    sprintf(buffer + 1 + 2 * idx, "%02x", (unsigned char)text[idx]);
+  reply(buffer, 1 + 2 * idx);
+}
+
+static int hexdigit(int c)
+{
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
+
+/* hex2bin() decodes a hex string, returns the number of bytes decoded */
+static size_t hex2bin(const char *hex, size_t hexlen, uint8_t *data, size_t size)
+{
+  size_t count;
+  for (count = 0; count < size && 2 * count + 1 < hexlen; count++) {
+    int h = hexdigit(hex[2 * count]);
+    int l = hexdigit(hex[2 * count + 1]);
+    if (h < 0 || l < 0)
+      break;
+    data[count] = (uint8_t)((h << 4) | l);
+  }
+  return count;
+}
+
+static void bin2hex(const uint8_t *data, size_t size, char *hex)
+{
+  size_t idx;
+  for (idx = 0; idx < size; idx++)
+    sprintf(hex + 2 * idx, "%02x", data[idx]);
+}
+
+/* unescape() decodes the binary payload of an X packet (in place), returns
+   the decoded size */
+static size_t unescape(char *data, size_t size)
+{
+  size_t src, dest;
+  for (src = dest = 0; src < size; src++) {
+    if (data[src] == '}' && src + 1 < size)
+      data[dest++] = data[++src] ^ 0x20;
+    else
+      data[dest++] = data[src];
+  }
+  return dest;
+}
+
+
+static uint8_t *ram_ptr(uint32_t address)
+{
+  assert(address >= RamBase && address < RamBase + RamSize);
+  return Ram + (address - RamBase);
+}
+
+static int in_range(uint32_t address, uint32_t size, uint32_t base, uint32_t top)
+{
+  return address >= base && address <= top && size <= top - address;
+}
+
+/* periph_byte() returns a pointer to a byte in the peripheral register model;
+   registers that were not written before read as zero */
+static uint8_t *periph_byte(uint32_t address, int create)
+{
+  static uint32_t zero;
+  int idx;
+  for (idx = 0; idx < PeriphCount && Periph[idx].address != (address & ~3); idx++)
+    {}
+  if (idx == PeriphCount) {
+    if (!create || PeriphCount >= MAX_PERIPH) {
+      zero = 0;
+      return (uint8_t*)&zero;
+    }
+    Periph[idx].address = address & ~3;
+    Periph[idx].value = 0;
+    PeriphCount++;
+  }
+  return (uint8_t*)&Periph[idx].value + (address & 3);
+}
+
+static int mem_read(uint32_t address, uint8_t *data, uint32_t size)
+{
+  if (in_range(address, size, FlashBase, FlashBase + FlashSize)) {
+    memcpy(data, Flash + (address - FlashBase), size);
+  } else if (in_range(address, size, RamBase, RamBase + RamSize)) {
+    memcpy(data, Ram + (address - RamBase), size);
+  } else if (address >= 0x40000000) {
+    uint32_t idx;
+    for (idx = 0; idx < size; idx++)
+      data[idx] = *periph_byte(address + idx, 0);
+  } else {
+    return 0;
+  }
+  return 1;
+}
+
+static int mem_write(uint32_t address, const uint8_t *data, uint32_t size)
+{
+  if (in_range(address, size, RamBase, RamBase + RamSize)) {
+    memcpy(Ram + (address - RamBase), data, size);
+  } else if (address >= 0x40000000) {
+    uint32_t idx;
+    for (idx = 0; idx < size; idx++)
+      *periph_byte(address + idx, 1) = data[idx];
+  } else {
+    return 0; /* Flash memory (or unmapped memory) cannot be written directly */
+  }
+  return 1;
+}
+
+/* flash_program() is called by the loader stub */
+int flash_program(uint32_t address, const uint8_t *data, uint32_t size)
+{
+  uint32_t idx;
+  if (!in_range(address, size, FlashBase, FlashBase + FlashSize))
+    return 0;
+  for (idx = 0; idx < size; idx++)
+    Flash[address - FlashBase + idx] &= data[idx];  /* programming only clears bits */
+  if (ProgramRate > 0)
+    BusyUntil += (uint64_t)(size * 1000000.0 / ProgramRate);
+  return 1;
+}
+
+/* run_loader() checks whether the PC points to the entry point of a loader
+   stub in RAM, and if so, it runs the stub; it returns 0 if there is no stub */
+static int run_loader(void)
+{
+  uint32_t pc = Regs[REG_PC] & ~1;
+  uint32_t base;
+
+  if (!in_range(pc, 4, RamBase, RamBase + RamSize))
+    return 0;
+  for (base = pc & ~3; base >= RamBase && base + sizeof(FLASHLOADER_HDR) <= RamBase + RamSize; base -= 4) {
+    const FLASHLOADER_HDR *hdr = (const FLASHLOADER_HDR*)ram_ptr(base);
+    if (hdr->magic == FLASHLOADER_MAGIC && base + (hdr->entry & ~1) == pc) {
+      uint32_t job = Regs[0];
+      if (!in_range(job, sizeof(FLASHLOADER_JOB), RamBase, RamBase + RamSize) || (job & 3) != 0)
+        return 0;
+      flashloader((FLASHLOADER_JOB*)ram_ptr(job));
+      Regs[REG_PC] = Regs[14] & ~1; /* return to the breakpoint set by the host */
+      return 1;
+    }
+    if (base == RamBase)
+      break;
+  }
+  return 0;
+}
+
+static void memory_map(char *xml, size_t size)
+{
+  /* same format as the Black Magic Probe firmware (no XML declaration) */
+  snprintf(xml, size,
+           "<memory-map>"
+           "<memory type=\"flash\" start=\"0x%08x\" length=\"0x%x\"><property name=\"blocksize\">0x%x</property></memory>"
+           "<memory type=\"ram\" start=\"0x%08x\" length=\"0x%x\"/>"
+           "</memory-map>",
+           FlashBase, FlashSize, FlashBlock, RamBase, RamSize);
+}
+
+static void monitor(const char *cmd)
+{
+  if (strcmp(cmd, "version") == 0) {
+    reply_output("Black Magic Probe (Firmware v1.8.2-sim) (Hardware Version 3)\n");
+    reply_str("OK");
+  } else if (strcmp(cmd, "swdp_scan") == 0 || strcmp(cmd, "jtag_scan") == 0) {
+    char line[100];
+    reply_output("Target voltage: 3.3V\n");
+    reply_output("Available Targets:\n");
+    reply_output("No. Att Driver\n");
+    snprintf(line, sizeof line, " 1      %s\n", Driver);
+    reply_output(line);
+    reply_str("OK");
+  } else if (strncmp(cmd, "traceswo", 8) == 0) {
+    reply_output("SIM00001:05:85\n");
+    reply_str("OK");
+  } else if (strcmp(cmd, "erase_mass") == 0) {
+    memset(Flash, 0xff, FlashSize);
+    BusyUntil += (uint64_t)(EraseTime * (FlashSize / FlashBlock));
+    reply_str("OK");
+  } else {
+    /* tpwr, connect_srst, reset and others: accept silently */
+    reply_str("OK");
+  }
+}
+
+static void handle_packet(char *pkt, size_t size)
+{
+  char buffer[2 * PACKET_SIZE + 16];
+  unsigned long address, length;
+  char *ptr;
+
+  log_packet("->", pkt, size);
+  pkt[size] = '\0';
+  if (size == 1 && pkt[0] == '\x03') {
+    if (Running) {
+      Running = 0;
+      reply_str("T02");
+    }
+    return;
+  }
+  if (Running)
+    return;   /* only an interrupt is handled while the target runs */
+
+  switch (pkt[0]) {
+  case '!':
+  case 'H':
+    reply_str("OK");
+    break;
+  case '?':
+    reply_str(Attached ? "T05" : "W00");
+    break;
+  case 'c':
+    if (run_loader()) {
+      reply_str("T05");
+    } else {
+      Running = 1;
+    }
+    break;
+  case 's':
+    reply_str("T05");
+    break;
+  case 'D':
+    Attached = 0;
+    reply_str("OK");
+    break;
+  case 'k':
+    Attached = 0;
+    break;
+  case 'g':
+    { int idx;
+      for (idx = 0; idx < NUM_REGS; idx++) {
+        uint8_t le[4] = { (uint8_t)Regs[idx], (uint8_t)(Regs[idx] >> 8), (uint8_t)(Regs[idx] >> 16), (uint8_t)(Regs[idx] >> 24) };
+        bin2hex(le, 4, buffer + 8 * idx);
+      }
+      reply(buffer, 8 * NUM_REGS);
+    }
+    break;
+  case 'G':
+    { int idx;
+      for (idx = 0; idx < NUM_REGS && 8 * idx + 8 < (int)size; idx++) {
+        uint8_t le[4];
+        hex2bin(pkt + 1 + 8 * idx, 8, le, 4);
+        Regs[idx] = le[0] | (le[1] << 8) | (le[2] << 16) | ((uint32_t)le[3] << 24);
+      }
+      reply_str("OK");
+    }
+    break;
+  case 'p':
+  case 'P':
+    { unsigned long regnum = strtoul(pkt + 1, &ptr, 16);
+      uint8_t le[4];
+      if (regnum >= NUM_REGS) {
+        reply_str("E01");
+      } else if (pkt[0] == 'p') {
+        le[0] = (uint8_t)Regs[regnum];
+        le[1] = (uint8_t)(Regs[regnum] >> 8);
+        le[2] = (uint8_t)(Regs[regnum] >> 16);
+        le[3] = (uint8_t)(Regs[regnum] >> 24);
+        bin2hex(le, 4, buffer);
+        reply(buffer, 8);
+      } else if (*ptr == '=' && hex2bin(ptr + 1, strlen(ptr + 1), le, 4) == 4) {
+        Regs[regnum] = le[0] | (le[1] << 8) | (le[2] << 16) | ((uint32_t)le[3] << 24);
+        reply_str("OK");
+      } else {
+        reply_str("E01");
+      }
+    }
+    break;
+  case 'm':
+    address = strtoul(pkt + 1, &ptr, 16);
+    length = (*ptr == ',') ? strtoul(ptr + 1, NULL, 16) : 0;
+    if (length > PACKET_SIZE / 2 - 2) {
+      reply_str("E02");
+    } else {
+      uint8_t data[PACKET_SIZE / 2];
+      if (mem_read((uint32_t)address, data, (uint32_t)length)) {
+        bin2hex(data, length, buffer);
+        reply(buffer, 2 * length);
+      } else {
+        reply_str("E01");
+      }
+    }
+    break;
+  case 'x':
+    if (!BinaryUpload) {
+      reply_str("");
+      break;
+    }
+    address = strtoul(pkt + 1, &ptr, 16);
+    length = (*ptr == ',') ? strtoul(ptr + 1, NULL, 16) : 0;
+    if (length > PACKET_SIZE) {
+      reply_str("E02");
+    } else {
+      uint8_t data[PACKET_SIZE];
+      if (mem_read((uint32_t)address, data, (uint32_t)length)) {
+        /* return only as many bytes as fit in a packet after escaping */
+        unsigned long count, room = PACKET_SIZE - 5;
+        for (count = 0; count < length; count++) {
+          uint8_t c = data[count];
+          int need = (c == '$' || c == '#' || c == '}' || c == '*') ? 2 : 1;
+          if (need > (int)room)
+            break;
+          room -= need;
+        }
+        buffer[0] = 'b';
+        memcpy(buffer + 1, data, count);
+        reply(buffer, count + 1);
+      } else {
+        reply_str("E01");
+      }
+    }
+    break;
+  case 'M':
+  case 'X':
+    address = strtoul(pkt + 1, &ptr, 16);
+    length = (*ptr == ',') ? strtoul(ptr + 1, &ptr, 16) : 0;
+    if (*ptr != ':' || length > PACKET_SIZE) {
+      reply_str("E02");
+    } else {
+      uint8_t *data;
+      size_t count;
+      ptr++;
+      if (pkt[0] == 'X') {
+        count = unescape(ptr, size - (ptr - pkt));
+        data = (uint8_t*)ptr;
+      } else {
+        data = (uint8_t*)buffer;
+        count = hex2bin(ptr, size - (ptr - pkt), data, length);
+      }
+      if (count != length)
+        reply_str("E02");
+      else if (mem_write((uint32_t)address, data, (uint32_t)length))
+        reply_str("OK");
+      else
+        reply_str("E01");
+    }
+    break;
+  case 'q':
+    if (strncmp(pkt, "qSupported", 10) == 0) {
+      NoAckMode = 0;
+      sprintf(buffer, "PacketSize=%X;qXfer:memory-map:read+;QStartNoAckMode+%s",
+              PACKET_SIZE, BinaryUpload ? ";binary-upload+" : "");
+      reply_str(buffer);
+    } else if (strncmp(pkt, "qRcmd,", 6) == 0) {
+      length = hex2bin(pkt + 6, size - 6, (uint8_t*)buffer, sizeof buffer - 1);
+      buffer[length] = '\0';
+      monitor(buffer);
+    } else if (strncmp(pkt, "qXfer:memory-map:read::", 23) == 0) {
+      char xml[1024];
+      size_t xmllen;
+      address = strtoul(pkt + 23, &ptr, 16);
+      length = (*ptr == ',') ? strtoul(ptr + 1, NULL, 16) : 0;
+      memory_map(xml, sizeof xml);
+      xmllen = strlen(xml);
+      /* like the Black Magic Probe, reply 'm' for as long as there is data,
+         and send 'l' only when the end has been reached */
+      if (address >= xmllen) {
+        reply_str("l");
+      } else {
+        if (length > xmllen - address)
+          length = xmllen - address;
+        if (length > PACKET_SIZE - 5)
+          length = PACKET_SIZE - 5;
+        buffer[0] = 'm';
+        memcpy(buffer + 1, xml + address, length);
+        reply(buffer, length + 1);
+      }
+    } else if (strncmp(pkt, "qCRC:", 5) == 0) {
+      address = strtoul(pkt + 5, &ptr, 16);
+      length = (*ptr == ',') ? strtoul(ptr + 1, NULL, 16) : 0;
+      uint8_t *data = malloc(length > 0 ? length : 1);
+      if (data != NULL && mem_read((uint32_t)address, data, (uint32_t)length)) {
+        sprintf(buffer, "C%08x", gdb_crc32(0xffffffff, data, (unsigned)length));
+        reply_str(buffer);
+      } else {
+        reply_str("E01");
+      }
+      free(data);
+    } else {
+      reply_str("");
+    }
+    break;
+  case 'Q':
+    if (strcmp(pkt, "QStartNoAckMode") == 0) {
+      reply_str("OK");
+      NoAckMode = 1;
+    } else {
+      reply_str("");
+    }
+    break;
+  case 'v':
+    if (strncmp(pkt, "vAttach;", 8) == 0) {
+      Attached = 1;
+      reply_str("T05");
+    } else if (strncmp(pkt, "vRun", 4) == 0) {
+      memset(Regs, 0, sizeof Regs);
+      reply_str("T05");
+    } else if (strncmp(pkt, "vFlashErase:", 12) == 0) {
+      address = strtoul(pkt + 12, &ptr, 16);
+      length = (*ptr == ',') ? strtoul(ptr + 1, NULL, 16) : 0;
+      if (!in_range((uint32_t)address, (uint32_t)length, FlashBase, FlashBase + FlashSize)) {
+        reply_str("E01");
+      } else {
+        /* erase all blocks that overlap the range */
+        unsigned long start = (address - FlashBase) / FlashBlock * FlashBlock;
+        unsigned long top = address - FlashBase + length;
+        if (top > FlashSize - FlashSize % FlashBlock)
+          top = FlashSize;  /* avoid overflow of the rounding below */
+        else
+          top = (top + FlashBlock - 1) / FlashBlock * FlashBlock;
+        memset(Flash + start, 0xff, top - start);
+        BusyUntil += (uint64_t)(EraseTime * ((top - start) / FlashBlock));
+        reply_str("OK");
+      }
+    } else if (strncmp(pkt, "vFlashWrite:", 12) == 0) {
+      address = strtoul(pkt + 12, &ptr, 16);
+      if (*ptr != ':') {
+        reply_str("E02");
+      } else {
+        ptr++;
+        length = unescape(ptr, size - (ptr - pkt));
+        if (!in_range((uint32_t)address, (uint32_t)length, FlashBase, FlashBase + FlashSize)) {
+          reply_str("E01");
+        } else {
+          unsigned long idx;
+          for (idx = 0; idx < length; idx++)
+            Flash[address - FlashBase + idx] &= (uint8_t)ptr[idx];
+          if (ProgramRate > 0)
+            BusyUntil += (uint64_t)(length * 1000000.0 / ProgramRate);
+          reply_str("OK");
+        }
+      }
+    } else if (strcmp(pkt, "vFlashDone") == 0) {
+      reply_str("OK");
+    } else {
+      reply_str("");
+    }
+    break;
+  default:
+    reply_str("");
+  }
+}
+
+/* receive() splits incoming data in packets, and queues these with their
+   arrival times in the link model */
+static void receive(const char *data, size_t size, uint64_t time)
+{
+  if (InLength + size > sizeof InBuffer) {
+    InLength = 0; /* overrun, drop all pending data */
+    if (size > sizeof InBuffer)
+      return;
+  }
+  memcpy(InBuffer + InLength, data, size);
+  InLength += size;
+
+  for ( ;; ) {
+    size_t start, idx;
+    /* skip acknowledges and noise, but handle a break */
+    for (start = 0; start < InLength && InBuffer[start] != '$' && InBuffer[start] != '\x03'; start++)
+      {}
+    if (start < InLength && InBuffer[start] == '\x03') {
+      PACKET *pkt = malloc(sizeof(PACKET) + 2);
+      if (pkt != NULL) {
+        pkt->size = 1;
+        pkt->data[0] = '\x03';
+        if (InFree < time)
+          InFree = time;
+        InFree += transfer_time(1);
+        pkt->time = InFree + (uint64_t)Latency;
+        queue_append(&InQueue, pkt);
+      }
+      start++;
+    } else {
+      for (idx = start; idx < InLength && InBuffer[idx] != '#'; idx++)
+        {}
+      if (idx + 2 >= InLength) {
+        /* incomplete packet, keep it */
+        memmove(InBuffer, InBuffer + start, InLength - start);
+        InLength -= start;
+        break;
+      }
+      unsigned char sum = 0;
+      size_t i;
+      for (i = start + 1; i < idx; i++)
+        sum += (unsigned char)InBuffer[i];
+      if (hexdigit(InBuffer[idx + 1]) * 16 + hexdigit(InBuffer[idx + 2]) != sum) {
+        if (!NoAckMode)
+          send_raw("-", 1, time);
+      } else {
+        size_t len = idx - start - 1;
+        PACKET *pkt = malloc(sizeof(PACKET) + len + 1);
+        if (pkt != NULL) {
+          pkt->size = len;
+          memcpy(pkt->data, InBuffer + start + 1, len);
+          if (InFree < time)
+            InFree = time;
+          InFree += transfer_time(len + 4);
+          pkt->time = InFree + (uint64_t)Latency;
+          queue_append(&InQueue, pkt);
+        }
+      }
+      start = idx + 3;
+    }
+    memmove(InBuffer, InBuffer + start, InLength - start);
+    InLength -= start;
+  }
+}
+
+static void reset_session(void)
+{
+  queue_clear(&InQueue);
+  queue_clear(&OutQueue);
+  InLength = 0;
+  NoAckMode = 0;
+  Attached = 0;
+  Running = 0;
+  InFree = OutFree = BusyUntil = 0;
+}
+
+/* serve() handles a session with the host, returns when the connection is
+   closed */
+static void serve(int fd)
+{
+  reset_session();
+  for ( ;; ) {
+    uint64_t now = now_us();
+    uint64_t next;
+    struct pollfd pfd;
+    int timeout, result;
+
+    /* handle packets that have arrived, when the probe is no longer busy */
+    while (InQueue != NULL && InQueue->time <= now && BusyUntil <= now) {
+      PACKET *pkt = InQueue;
+      InQueue = pkt->next;
+      BusyUntil = (pkt->time > BusyUntil) ? pkt->time : BusyUntil;
+      if (!NoAckMode && !(pkt->size == 1 && pkt->data[0] == '\x03'))
+        send_raw("+", 1, BusyUntil);
+      handle_packet(pkt->data, pkt->size);
+      free(pkt);
+    }
+    /* send replies that are due */
+    while (OutQueue != NULL && OutQueue->time <= now) {
+      PACKET *pkt = OutQueue;
+      OutQueue = pkt->next;
+      if (write(fd, pkt->data, pkt->size) < 0 && errno != EAGAIN) {
+        free(pkt);
+        return;
+      }
+      free(pkt);
+    }
+
+    next = NEVER;
+    if (InQueue != NULL)
+      next = (InQueue->time > BusyUntil) ? InQueue->time : BusyUntil;
+    if (OutQueue != NULL && OutQueue->time < next)
+      next = OutQueue->time;
+    if (next == NEVER)
+      timeout = -1;
+    else if (next <= now)
+      timeout = 0;
+    else
+      timeout = (int)((next - now + 999) / 1000);
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    result = poll(&pfd, 1, timeout);
+    if (result < 0 && errno != EINTR)
+      return;
+    if (result > 0) {
+      char buffer[512];
+      ssize_t count = read(fd, buffer, sizeof buffer);
+      if (count > 0)
+        receive(buffer, (size_t)count, now_us());
+      else if (count == 0 || (errno != EAGAIN && errno != EINTR))
+        return;   /* connection closed */
+    }
+  }
+}
+
+static void save_flash(const char *filename)
+{
+  FILE *fp;
+  if (filename == NULL || *filename == '\0')
+    return;
+  if ((fp = fopen(filename, "wb")) == NULL) {
+    fprintf(stderr, "Failed to write \"%s\", error %d\n", filename, errno);
+    return;
+  }
+  fwrite(Flash, 1, FlashSize, fp);
+  fclose(fp);
+}
+
+static void load_flash(const char *filename)
+{
+  FILE *fp;
+  if ((fp = fopen(filename, "rb")) == NULL) {
+    fprintf(stderr, "Failed to read \"%s\", error %d\n", filename, errno);
+    exit(EXIT_FAILURE);
+  }
+  if (fread(Flash, 1, FlashSize, fp) == 0)
+    fprintf(stderr, "Warning: \"%s\" is empty\n", filename);
+  fclose(fp);
+}
+
+static void usage(void)
+{
+  printf("bmsim - a simulated Black Magic Probe with a Cortex-M target.\n\n"
+         "Usage: bmsim [options]\n\n"
+         "Options:\n"
+         "-tcp[=port]     Listen on a TCP/IP port (on the local host), default %d.\n"
+         "-pty            Create a pseudo-terminal (its name is printed).\n"
+         "-flash=base,size,blocksize\n"
+         "                Flash memory, default 0x08000000,0x10000,0x400.\n"
+         "-ram=base,size  RAM, default 0x20000000,0x5000.\n"
+         "-load=file      Load the Flash memory from a binary file.\n"
+         "-dump=file      Save the Flash memory to a file on every disconnect.\n"
+         "-driver=name    The driver name, as reported by swdp_scan.\n"
+         "-nobinary       No support for the \"x\" packet (binary memory read).\n"
+         "-latency=ms     One-way latency of the link (may be fractional).\n"
+         "-bandwidth=KB/s Bandwidth of the link (in both directions).\n"
+         "-erase=ms       Erase time of a Flash block.\n"
+         "-program=KB/s   Programming speed of the Flash memory.\n"
+         "-v              Log all packets to stderr.\n",
+         BMP_PORT_GDB);
+}
+
+/* parse_list() parses up to "count" comma-separated numbers, returns the
+   number of values found */
+static int parse_list(const char *str, unsigned long *values, int count)
+{
+  int idx;
+  for (idx = 0; idx < count && *str != '\0'; idx++) {
+    char *ptr;
+    values[idx] = strtoul(str, &ptr, 0);
+    if (ptr == str)
+      break;
+    str = (*ptr == ',') ? ptr + 1 : ptr;
+  }
+  return idx;
+}
+
+static int open_tcp(int port)
+{
+  struct sockaddr_in addr;
+  int sock, on = 1;
+
+  if ((sock = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+    return -1;
+  setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof on);
+  memset(&addr, 0, sizeof addr);
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons((unsigned short)port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (bind(sock, (struct sockaddr*)&addr, sizeof addr) < 0 || listen(sock, 1) < 0) {
+    close(sock);
+    return -1;
+  }
+  return sock;
+}
+
+/* open_pty() creates a pseudo-terminal; it also opens the slave side, so
+   that the master does not see a hang-up when a client closes the port */
+static int open_pty(int *slave)
+{
+  struct termios tio;
+  int fd = posix_openpt(O_RDWR | O_NOCTTY);
+  if (fd < 0 || grantpt(fd) < 0 || unlockpt(fd) < 0
+      || (*slave = open(ptsname(fd), O_RDWR | O_NOCTTY)) < 0)
+  {
+    if (fd >= 0)
+      close(fd);
+    return -1;
+  }
+  if (tcgetattr(*slave, &tio) == 0) {
+    cfmakeraw(&tio);
+    tcsetattr(*slave, TCSANOW, &tio);
+  }
+  return fd;
+}
+
+int main(int argc, char *argv[])
+{
+  const char *dumpfile = NULL;
+  const char *loadfile = NULL;
+  int port = 0, use_pty = 0;
+  int idx;
+
+  for (idx = 1; idx < argc; idx++) {
+    const char *arg = argv[idx];
+    unsigned long values[3];
+    if (strncmp(arg, "-tcp", 4) == 0) {
+      port = (arg[4] == '=') ? atoi(arg + 5) : BMP_PORT_GDB;
+    } else if (strcmp(arg, "-pty") == 0) {
+      use_pty = 1;
+    } else if (strncmp(arg, "-flash=", 7) == 0 && parse_list(arg + 7, values, 3) == 3
+               && values[1] > 0 && values[2] > 0 && values[1] % values[2] == 0) {
+      FlashBase = (uint32_t)values[0];
+      FlashSize = (uint32_t)values[1];
+      FlashBlock = (uint32_t)values[2];
+    } else if (strncmp(arg, "-ram=", 5) == 0 && parse_list(arg + 5, values, 2) == 2 && values[1] > 0) {
+      RamBase = (uint32_t)values[0];
+      RamSize = (uint32_t)values[1];
+    } else if (strncmp(arg, "-load=", 6) == 0) {
+      loadfile = arg + 6;
+    } else if (strncmp(arg, "-dump=", 6) == 0) {
+      dumpfile = arg + 6;
+    } else if (strncmp(arg, "-driver=", 8) == 0) {
+      snprintf(Driver, sizeof Driver, "%s", arg + 8);
+    } else if (strncmp(arg, "-latency=", 9) == 0) {
+      Latency = strtod(arg + 9, NULL) * 1000.0;
+    } else if (strncmp(arg, "-bandwidth=", 11) == 0) {
+      Bandwidth = strtod(arg + 11, NULL) * 1024.0;
+    } else if (strncmp(arg, "-erase=", 7) == 0) {
+      EraseTime = strtod(arg + 7, NULL) * 1000.0;
+    } else if (strncmp(arg, "-program=", 9) == 0) {
+      ProgramRate = strtod(arg + 9, NULL) * 1024.0;
+    } else if (strcmp(arg, "-nobinary") == 0) {
+      BinaryUpload = 0;
+    } else if (strcmp(arg, "-v") == 0) {
+      Verbose = 1;
+    } else {
+      usage();
+      return EXIT_FAILURE;
+    }
+  }
+  if ((port == 0) == (use_pty == 0)) {
+    usage();
+    return EXIT_FAILURE;
+  }
+
+  Flash = malloc(FlashSize);
+  Ram = calloc(RamSize, 1);
+  if (Flash == NULL || Ram == NULL) {
+    fprintf(stderr, "Memory allocation failure\n");
+    return EXIT_FAILURE;
+  }
+  memset(Flash, 0xff, FlashSize);
+  if (loadfile != NULL)
+    load_flash(loadfile);
+  signal(SIGPIPE, SIG_IGN);
+
+  if (use_pty) {
+    int slave;
+    int fd = open_pty(&slave);
+    if (fd < 0) {
+      fprintf(stderr, "Failed to create a pseudo-terminal, error %d\n", errno);
+      return EXIT_FAILURE;
+    }
+    printf("Listening on %s\n", ptsname(fd));
+    fflush(stdout);
+    serve(fd);  /* a pty has a single session */
+    save_flash(dumpfile);
+    close(slave);
+    close(fd);
+  } else {
+    int sock = open_tcp(port);
+    if (sock < 0) {
+      fprintf(stderr, "Failed to open port %d, error %d\n", port, errno);
+      return EXIT_FAILURE;
+    }
+    printf("Listening on port %d\n", port);
+    fflush(stdout);
+    for ( ;; ) {
+      int on = 1;
+      int fd = accept(sock, NULL, NULL);
+      if (fd < 0)
+        continue;
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof on);
+      serve(fd);
+      close(fd);
+      save_flash(dumpfile);
+      if (Verbose)
+        fprintf(stderr, "Connection closed\n");
+    }
+  }
+
+  free(Flash);
+  free(Ram);
+  return EXIT_SUCCESS;
+}
@@ -97,8 +97,8 @@
   #define IS_OPTION(s)  ((s)[0] == '-')
 #endif
 
-static DWARF_LINELOOKUP dwarf_linetable = { NULL };
-static DWARF_SYMBOLLIST dwarf_symboltable = { NULL};
+static DWARF_LINETABLE dwarf_linetable = { NULL };
+static DWARF_SYMBOLTABLE dwarf_symboltable = { NULL};
 static DWARF_PATHLIST dwarf_filetable = { NULL};
 
 int ctf_error_notify(int code, int linenr, const char *message)
@@ -155,6 +155,8 @@ static void usage(const char *invalid_option)
          "Options:\n"
          "-f=value  Font size to use (value must be 8 or larger).\n"
          "-h        This help.\n"
+         "-p        Load the decoder plug-in that tracegen generated for the TSDL\n"
+         "          file (a shared library next to the TSDL file).\n"
          "-t=path   Path to the TSDL metadata file to use.\n");
 }
 
@@ -182,6 +184,7 @@ typedef struct tagAPPSTATE {
   int datasize;                 /**< packet size */
   int reload_format;            /**< whether to reload the TSDL file */
   char TSDLfile[_MAX_PATH];     /**< CTF decoding, message file */
+  int TSDLplugin;               /**< whether to load the decoder plug-in for the TSDL file */
   char ELFfile[_MAX_PATH];      /**< ELF file for symbol/address look-up */
   TRACEFILTER *filterlist;      /**< filter expressions */
   int filtercount;              /**< count of valid entries in filterlist */
@@ -397,6 +400,9 @@ static void panel_options(struct nk_context *ctx, APPSTATE *state,
       }
     }
     nk_layout_row_end(ctx);
+    nk_layout_row_dynamic(ctx, ROW_HEIGHT, 1);
+    if (checkbox_tooltip(ctx, "Load decoder plug-in", &state->TSDLplugin, NK_TEXT_LEFT, "Load the decoder that tracegen generated for the TSDL file (native code)"))
+      state->reload_format = nk_true;
     nk_layout_row_begin(ctx, NK_STATIC, ROW_HEIGHT, 3);
     nk_layout_row_push(ctx, LABEL_WIDTH);
     nk_label(ctx, "ELF file", NK_TEXT_ALIGN_LEFT | NK_TEXT_ALIGN_MIDDLE);
@@ -753,12 +759,18 @@ static void handle_stateaction(APPSTATE *state)
       if (ctf_parse_init(state->TSDLfile) && ctf_parse_run()) {
         const CTF_STREAM *stream;
         int seqnr;
+        char libpath[_MAX_PATH], msg[_MAX_PATH + 50];
         /* stream names overrule configured channel names */
         for (seqnr = 0; (stream = stream_by_seqnr(seqnr)) != NULL; seqnr++)
           if (stream->name != NULL && strlen(stream->name) > 0)
             channel_setname(seqnr, stream->name);
         state->error_flags &= ~ERROR_NO_TSDL;
-        tracelog_statusmsg(TRACESTATMSG_CTF, "CTF mode active", BMPSTAT_SUCCESS);
+        strlcpy(msg, "CTF mode active", sizearray(msg));
+        if (state->TSDLplugin && ctf_decode_plugin(state->TSDLfile, libpath, sizearray(libpath))) {
+          strlcat(msg, ", decoder plug-in ", sizearray(msg));
+          strlcat(msg, libpath, sizearray(msg));
+        }
+        tracelog_statusmsg(TRACESTATMSG_CTF, msg, BMPSTAT_SUCCESS);
       } else {
         ctf_parse_cleanup();
       }
@@ -769,7 +781,9 @@ static void handle_stateaction(APPSTATE *state)
       FILE *fp = fopen(state->ELFfile, "rb");
       if (fp != NULL) {
         int address_size;
-        dwarf_read(fp, &dwarf_linetable, &dwarf_symboltable, &dwarf_filetable, &address_size);
+        /* only a few symbols are looked up (for the CTF decoder and the
+           TRACESWO settings), so units are decoded on demand */
+        dwarf_read_lazy(fp, &dwarf_linetable, &dwarf_symboltable, &dwarf_filetable, &address_size);
         fclose(fp);
         state->error_flags &= ~ERROR_NO_ELF;
       }
@@ -803,6 +817,7 @@ int main(int argc, char *argv[])
   appstate.connect_srst = nk_false;
   appstate.cur_chan_edit = -1;
   appstate.cur_match_line = -1;
+  ctf_parse_setcache(1);  /* keep parsed TSDL metadata in a cache file */
   /* locate the configuration file for settings */
   get_configfile(txtConfigFile, sizearray(txtConfigFile), "bmtrace.ini");
 
@@ -858,6 +873,7 @@ int main(int argc, char *argv[])
   appstate.connect_srst = (int)ini_getl("Settings", "connect-srst", 0, txtConfigFile);
   appstate.datasize = (int)ini_getl("Settings", "datasize", 1, txtConfigFile);
   ini_gets("Settings", "tsdl", "", appstate.TSDLfile, sizearray(appstate.TSDLfile), txtConfigFile);
+  appstate.TSDLplugin = (int)ini_getl("Settings", "tsdl-plugin", 0, txtConfigFile);
   ini_gets("Settings", "elf", "", appstate.ELFfile, sizearray(appstate.ELFfile), txtConfigFile);
   ini_gets("Settings", "mcu-freq", "48000000", appstate.cpuclock_str, sizearray(appstate.cpuclock_str), txtConfigFile);
   ini_gets("Settings", "bitrate", "100000", appstate.bitrate_str, sizearray(appstate.bitrate_str), txtConfigFile);
@@ -928,6 +944,9 @@ int main(int argc, char *argv[])
             strlcpy(opt_fontmono, mono, sizearray(opt_fontmono));
         }
         break;
+      case 'p':
+        appstate.TSDLplugin = 1;
+        break;
       case 't':
         ptr = &argv[idx][2];
         if (*ptr == '=' || *ptr == ':')
@@ -1091,6 +1110,7 @@ int main(int argc, char *argv[])
   ini_putl("Settings", "connect-srst", appstate.connect_srst, txtConfigFile);
   ini_putl("Settings", "datasize", appstate.datasize, txtConfigFile);
   ini_puts("Settings", "tsdl", appstate.TSDLfile, txtConfigFile);
+  ini_putl("Settings", "tsdl-plugin", appstate.TSDLplugin, txtConfigFile);
   ini_puts("Settings", "elf", appstate.ELFfile, txtConfigFile);
   ini_putl("Settings", "mcu-freq", appstate.cpuclock, txtConfigFile);
   ini_putl("Settings", "bitrate", appstate.bitrate, txtConfigFile);
@@ -1116,6 +1136,7 @@ int main(int argc, char *argv[])
   ctf_parse_cleanup();
   ctf_decode_cleanup();
   dwarf_cleanup(&dwarf_linetable, &dwarf_symboltable, &dwarf_filetable);
+  demangle_cache_clear();
   bmp_disconnect();
   tcpip_cleanup();
   return EXIT_SUCCESS;
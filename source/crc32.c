@@ -1,8 +1,17 @@
 /* Implementation of CRC32 as used by GDB
  * GDB uses the ITU I.363.5 algorithm, see: https://github.com/Michaelangel007/crc32
+ *
+ * Build this file with the macro STANDALONE defined on the command line to
+ * create a self-contained executable that checks the optimized CRC routines
+ * against the byte-wise loop, and reports their throughput.
  */
+#include <stddef.h>
 #include "crc32.h"
 
+#if !defined sizearray
+  #define sizearray(e)    (sizeof(e) / sizeof((e)[0]))
+#endif
+
 /* CRC32 table is copied from the GDB source
    for details, see: https://github.com/Michaelangel007/crc32 */
 static const unsigned long crc_table[256] =
@@ -73,6 +82,154 @@ static const unsigned long crc_table[256] =
   0xbcb4666d, 0xb8757bda, 0xb5365d03, 0xb1f740b4
 };
 
+/* tables for "slicing-by-8": crc_slice[k][b] is the CRC of byte b followed by
+   k zero bytes; crc_slice[0] is the same as crc_table */
+static uint32_t crc_slice[8][256];
+static int crc_initialized = 0;
+
+static uint32_t crc32_bytewise(uint32_t crc, const unsigned char *data, size_t size)
+{
+  while (size--)
+    crc = (crc << 8) ^ (uint32_t)crc_table[((crc >> 24) ^ *data++) & 0xff];
+  return crc;
+}
+
+static uint32_t crc32_slice8(uint32_t crc, const unsigned char *data, size_t size)
+{
+  while (size >= 8) {
+    uint32_t hi = crc ^ (((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16)
+                         | ((uint32_t)data[2] << 8) | (uint32_t)data[3]);
+    uint32_t lo = ((uint32_t)data[4] << 24) | ((uint32_t)data[5] << 16)
+                  | ((uint32_t)data[6] << 8) | (uint32_t)data[7];
+    crc = crc_slice[7][hi >> 24] ^ crc_slice[6][(hi >> 16) & 0xff]
+          ^ crc_slice[5][(hi >> 8) & 0xff] ^ crc_slice[4][hi & 0xff]
+          ^ crc_slice[3][lo >> 24] ^ crc_slice[2][(lo >> 16) & 0xff]
+          ^ crc_slice[1][(lo >> 8) & 0xff] ^ crc_slice[0][lo & 0xff];
+    data += 8;
+    size -= 8;
+  }
+  while (size--)
+    crc = (crc << 8) ^ crc_slice[0][((crc >> 24) ^ *data++) & 0xff];
+  return crc;
+}
+
+#if (defined __GNUC__ && (defined __x86_64__ || defined __i386__)) \
+    || (defined _MSC_VER && (defined _M_X64 || defined _M_IX86))
+#define CRC_CLMUL
+
+#include <emmintrin.h>
+#include <tmmintrin.h>
+#include <wmmintrin.h>
+#if defined _MSC_VER
+  #include <intrin.h>
+  #define CLMUL_TARGET
+#else
+  #define CLMUL_TARGET  __attribute__((target("pclmul,ssse3")))
+#endif
+
+/* folding constants: x^n mod P for n = 128+64, 128, 512+64 and 512 */
+static uint64_t fold_1[2], fold_4[2];
+
+/* xpow_mod() returns x^n modulo the CRC polynomial */
+static uint32_t xpow_mod(unsigned n)
+{
+  uint32_t r = 1;
+  while (n-- > 0)
+    r = (r << 1) ^ ((r & 0x80000000) ? 0x04c11db7 : 0);
+  return r;
+}
+
+static int cpu_has_clmul(void)
+{
+  #if defined _MSC_VER
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] & (1 << 1)) != 0 && (info[2] & (1 << 9)) != 0;  /* PCLMULQDQ and SSSE3 */
+  #else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("ssse3");
+  #endif
+}
+
+/* crc32_clmul() folds the data in 128-bit blocks with carry-less
+   multiplication (four blocks in parallel, for the main loop); the data is
+   loaded in big-endian order, because this CRC is MSB-first */
+CLMUL_TARGET
+static uint32_t crc32_clmul(uint32_t crc, const unsigned char *data, size_t size)
+{
+  const __m128i bswap = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+  __m128i k, x0, x1, x2, x3;
+  unsigned char block[16];
+
+  if (size < 64)
+    return crc32_slice8(crc, data, size);
+
+  /* the initial CRC is XORed into the first 32 bits of the message */
+  x0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)data), bswap);
+  x0 = _mm_xor_si128(x0, _mm_set_epi32((int)crc, 0, 0, 0));
+  x1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 16)), bswap);
+  x2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 32)), bswap);
+  x3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 48)), bswap);
+  data += 64;
+  size -= 64;
+
+  #define FOLD(x, k, next) \
+    _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128((x), (k), 0x11), \
+                                _mm_clmulepi64_si128((x), (k), 0x00)), (next))
+
+  k = _mm_set_epi64x((long long)fold_4[0], (long long)fold_4[1]);
+  while (size >= 64) {
+    x0 = FOLD(x0, k, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)data), bswap));
+    x1 = FOLD(x1, k, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 16)), bswap));
+    x2 = FOLD(x2, k, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 32)), bswap));
+    x3 = FOLD(x3, k, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 48)), bswap));
+    data += 64;
+    size -= 64;
+  }
+
+  /* fold the four lanes into one, then fold in any remaining full blocks */
+  k = _mm_set_epi64x((long long)fold_1[0], (long long)fold_1[1]);
+  x1 = FOLD(x0, k, x1);
+  x2 = FOLD(x1, k, x2);
+  x3 = FOLD(x2, k, x3);
+  while (size >= 16) {
+    x3 = FOLD(x3, k, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)data), bswap));
+    data += 16;
+    size -= 16;
+  }
+  #undef FOLD
+
+  /* the CRC of the 128-bit remainder (with a zero initial value) reduces it
+     to 32 bits; then the tail is handled with the table */
+  _mm_storeu_si128((__m128i*)block, _mm_shuffle_epi8(x3, bswap));
+  crc = crc32_slice8(0, block, sizeof block);
+  return crc32_slice8(crc, data, size);
+}
+#endif /* x86 or x86_64 */
+
+static uint32_t (*crc32_kernel)(uint32_t crc, const unsigned char *data, size_t size) = crc32_bytewise;
+
+static void crc32_init(void)
+{
+  unsigned b, k;
+
+  for (b = 0; b < 256; b++) {
+    crc_slice[0][b] = (uint32_t)crc_table[b];
+    for (k = 1; k < 8; k++)
+      crc_slice[k][b] = (crc_slice[k - 1][b] << 8) ^ (uint32_t)crc_table[crc_slice[k - 1][b] >> 24];
+  }
+  crc32_kernel = crc32_slice8;
+  #if defined CRC_CLMUL
+    fold_1[0] = xpow_mod(128 + 64);
+    fold_1[1] = xpow_mod(128);
+    fold_4[0] = xpow_mod(512 + 64);
+    fold_4[1] = xpow_mod(512);
+    if (cpu_has_clmul())
+      crc32_kernel = crc32_clmul;
+  #endif
+  crc_initialized = 1;
+}
+
 /** gdb_crc32()
  *  \param crc    The initial CRC, set to ~0 on the first call.
  *  \param data   The data block to calculate the CRC on.
@@ -84,11 +241,103 @@ static const unsigned long crc_table[256] =
  *        you can call it iteratively in small blocks over a big buffer. On the
  *        first call, the value of the crc param is set to ~0, on every next
  *        call, it is set the the output of the previous call.
+ *
+ *  \note On the first call, the fastest implementation for the CPU is
+ *        selected: carry-less multiplication (on x86/x86_64 with PCLMULQDQ),
+ *        or "slicing-by-8" tables.
  */
 uint32_t gdb_crc32(uint32_t crc, const unsigned char *data, unsigned size)
 {
-  while (size--)
-    crc = (crc << 8) ^ crc_table[((crc >> 24) ^ *data++) & 0xff];
-  return crc;
+  if (!crc_initialized)
+    crc32_init();
+  return crc32_kernel(crc, data, size);
+}
+
+
+#if defined STANDALONE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static double bench(uint32_t (*kernel)(uint32_t, const unsigned char*, size_t),
+                    const unsigned char *data, size_t size, int rounds, uint32_t *crc)
+{
+  clock_t start = clock();
+  double sec;
+  int r;
+  for (r = 0; r < rounds; r++)
+    *crc = kernel(~(uint32_t)0, data, size);
+  sec = (double)(clock() - start) / CLOCKS_PER_SEC;
+  return (sec > 0) ? (double)size * rounds / sec / 1e6 : 0.0;
+}
+
+int main(void)
+{
+  #define BENCH_SIZE  (1024 * 1024)
+  static unsigned char data[BENCH_SIZE + 64];
+  static const struct {
+    const char *name;
+    uint32_t (*kernel)(uint32_t, const unsigned char*, size_t);
+  } kernels[] = {
+    { "byte-wise", crc32_bytewise },
+    { "slicing-by-8", crc32_slice8 },
+    #if defined CRC_CLMUL
+      { "carry-less multiply", crc32_clmul },
+    #endif
+  };
+  uint32_t ref, crc;
+  unsigned idx, k, errors = 0;
+
+  srand(1);
+  for (idx = 0; idx < sizeof data; idx++)
+    data[idx] = (unsigned char)rand();
+  crc32_init();
+  #if defined CRC_CLMUL
+    if (!cpu_has_clmul())
+      printf("No PCLMULQDQ support on this CPU, skipping carry-less multiply\n");
+  #endif
+
+  /* verify all kernels against the byte-wise loop, for a range of sizes and
+     (mis)alignments; also check the known CRC of "123456789" */
+  if (crc32_bytewise(~(uint32_t)0, (const unsigned char*)"123456789", 9) != 0x0376e6e7) {
+    printf("FAILED: byte-wise CRC of check string\n");
+    errors++;
+  }
+  for (k = 1; k < sizearray(kernels); k++) {
+    #if defined CRC_CLMUL
+      if (kernels[k].kernel == crc32_clmul && !cpu_has_clmul())
+        continue;
+    #endif
+    for (idx = 0; idx < 2000; idx++) {
+      size_t offset = idx % 17;
+      size_t size = (idx < 1000) ? idx : (size_t)rand() % (BENCH_SIZE / 16);
+      uint32_t init = (idx & 1) ? ~(uint32_t)0 : (uint32_t)rand();
+      ref = crc32_bytewise(init, data + offset, size);
+      crc = kernels[k].kernel(init, data + offset, size);
+      if (crc != ref) {
+        printf("FAILED: %s, size %u, offset %u: %08x instead of %08x\n",
+               kernels[k].name, (unsigned)size, (unsigned)offset, crc, ref);
+        errors++;
+        break;
+      }
+    }
+  }
+  if (errors > 0)
+    return EXIT_FAILURE;
+
+  for (k = 0; k < sizearray(kernels); k++) {
+    double rate;
+    #if defined CRC_CLMUL
+      if (kernels[k].kernel == crc32_clmul && !cpu_has_clmul())
+        continue;
+    #endif
+    rate = bench(kernels[k].kernel, data, BENCH_SIZE, (k == 0) ? 20 : 200, &crc);
+    printf("%-20s %08x %9.1f MB/s\n", kernels[k].name, crc, rate);
+  }
+  printf("selected: %s\n", (crc32_kernel == crc32_slice8) ? "slicing-by-8" : "carry-less multiply");
+  return EXIT_SUCCESS;
 }
 
+#endif /* STANDALONE */
@@ -17,7 +17,6 @@
  * limitations under the License.
  */
 
-#include <alloca.h>
 #include <assert.h>
 #include <stdio.h>
 #include <stdint.h>
@@ -31,7 +30,12 @@
 #endif
 #if defined _MSC_VER
   #define strdup(s)   _strdup(s)
-  #define alloca(a)   _alloca(a)
+#endif
+
+#if defined _WIN32
+  #include <windows.h>
+#else
+  #include <dlfcn.h>
 #endif
 
 #include "demangle.h"
@@ -50,6 +54,11 @@ typedef struct tagTRACEMSG {
 } TRACEMSG;
 
 static const unsigned char magic[] = { 0xc1, 0x1f, 0xfc, 0xc1 };
+static const unsigned char magic_compact[] = { 0xc2, 0x2f, 0xfc, 0xc2 }; /* packets with compact encoding */
+
+#define MAX_STREAMS       32  /* stream ids are limited by the stream mask (32-bit) */
+#define MAX_STRINGS       64  /* size of the table with interned strings */
+#define MAX_VARINT_SIZE   10  /* LEB128 encoding of a 64-bit value */
 
 enum {
   STATE_SCAN_MAGIC,
@@ -66,6 +75,11 @@ static const CTF_EVENT *event = NULL;               /* event currently being par
 static const CTF_EVENT_FIELD *field = NULL;         /* field currently being parsed */
 static const CTF_CLOCK *clock;                      /* clock set for the stream */
 static double timestamp = 0.0;                      /* timestamp in the event header */
+static int compact = 0;                             /* whether the current packet uses compact encoding */
+static int cur_stream = 0;                          /* stream id of the current packet */
+static long strtag = -1;                            /* tag of the string being parsed (compact encoding) */
+static uint64_t tstamp_prev[MAX_STREAMS];           /* previous timestamp per stream (compact encoding) */
+static char *strtab[MAX_STRINGS];                   /* interned strings (compact encoding) */
 
 static unsigned char *cache = NULL;
 static size_t cache_size = 0;
@@ -80,7 +94,20 @@ static size_t msgstack_size = 0;
 static size_t msgstack_head = 0;
 static size_t msgstack_tail = 0;
 
-static const DWARF_SYMBOLLIST *symboltable = NULL;
+static const DWARF_SYMBOLTABLE *symboltable = NULL;
+
+/* decoder plug-in, generated by tracegen for a specific TSDL file */
+typedef uint32_t (*PLUGIN_HASH)(void);
+typedef int (*PLUGIN_PAYLOADSIZE)(int event_id);
+typedef int (*PLUGIN_FORMAT)(int event_id, const unsigned char *payload, char *text, size_t size,
+                             int (*lookup)(uint32_t address, char *symbol, size_t size));
+#if defined _WIN32
+  static HMODULE plugin_handle = NULL;
+#else
+  static void *plugin_handle = NULL;
+#endif
+static PLUGIN_PAYLOADSIZE plugin_payload_size = NULL;
+static PLUGIN_FORMAT plugin_format = NULL;
 
 
 static void cache_grow(size_t extra)
@@ -270,7 +297,7 @@ int msgstack_peek(uint16_t *streamid, double *timestamp, const char **message)
   return 1;
 }
 
-void ctf_set_symtable(const DWARF_SYMBOLLIST *symtable)
+void ctf_set_symtable(const DWARF_SYMBOLTABLE *symtable)
 {
   symboltable = symtable;
 }
@@ -283,11 +310,7 @@ static int lookup_symbol(uint32_t address, char *symname, size_t maxlength)
   if (sym == NULL)
     return 0;
   assert(sym->name != NULL);
-  char *buffer = alloca(maxlength * sizeof(char));
-  if (demangle(buffer, maxlength, sym->name))
-    strlcpy(symname, buffer, maxlength);
-  else
-    strlcpy(symname, sym->name, maxlength);
+  strlcpy(symname, demangle_cached(sym->name), maxlength);
   return 1;
 }
 
@@ -371,6 +394,131 @@ static char *fmt_int64(int64_t num, char *str, int base)
   return str;
 }
 
+/** varint_collect() collects the bytes of a LEB128 value in the cache. It
+ *  returns 1 when the value is complete, 0 when more bytes are needed, and -1
+ *  if the value is invalid (too long).
+ */
+static int varint_collect(const unsigned char *stream, size_t size, size_t *idx)
+{
+  assert(stream != NULL && idx != NULL);
+  while (*idx < size) {
+    unsigned char b = stream[(*idx)++];
+    cache_grow(1);
+    cache[cache_filled++] = b;
+    if ((b & 0x80) == 0)
+      return 1;
+    if (cache_filled >= MAX_VARINT_SIZE)
+      return -1;
+  }
+  return 0;
+}
+
+/** varint_decode() decodes the LEB128 value in the cache; it handles signed
+ *  (SLEB128) and unsigned (ULEB128) values.
+ */
+static uint64_t varint_decode(int is_signed)
+{
+  uint64_t value = 0;
+  unsigned shift = 0;
+  size_t idx;
+
+  for (idx = 0; idx < cache_filled; idx++) {
+    value |= (uint64_t)(cache[idx] & 0x7f) << shift;
+    shift += 7;
+  }
+  if (is_signed && shift < 64 && cache_filled > 0 && (cache[cache_filled - 1] & 0x40) != 0)
+    value |= ~(uint64_t)0 << shift; /* sign-extend */
+  return value;
+}
+
+static void strtab_clear(void)
+{
+  int idx;
+  for (idx = 0; idx < MAX_STRINGS; idx++) {
+    if (strtab[idx] != NULL) {
+      free((void*)strtab[idx]);
+      strtab[idx] = NULL;
+    }
+  }
+}
+
+static void plugin_unload(void)
+{
+  if (plugin_handle != NULL) {
+    #if defined _WIN32
+      FreeLibrary(plugin_handle);
+    #else
+      dlclose(plugin_handle);
+    #endif
+    plugin_handle = NULL;
+  }
+  plugin_payload_size = NULL;
+  plugin_format = NULL;
+}
+
+/** ctf_decode_plugin() loads the decoder that tracegen generated for the TSDL
+ *  file (option -decoder). The decoder must be built as a shared library with
+ *  the same base name as the TSDL file, and in the same directory. It is only
+ *  used if it was generated from the same metadata as what is currently
+ *  loaded; events that have a fixed layout are then formatted by the plug-in,
+ *  the others (and packets in the compact encoding) by the generic decoder.
+ *
+ *  \param tsdlfile  The TSDL file that was parsed.
+ *  \param libpath   [out] The path of the library that was loaded, may be NULL.
+ *  \param libpath_size  The size of the libpath buffer.
+ *
+ *  \return 1 if the plug-in was loaded, 0 if it was not found or does not
+ *          match the metadata.
+ *
+ *  \note The plug-in is native code, so the caller should only call this
+ *        function when the user has explicitly enabled decoder plug-ins.
+ */
+int ctf_decode_plugin(const char *tsdlfile, char *libpath, size_t libpath_size)
+{
+  char path[260], *ptr;
+  PLUGIN_HASH plugin_hash;
+
+  plugin_unload();
+  if (tsdlfile == NULL || strlen(tsdlfile) == 0)
+    return 0;
+  /* a path without directory is looked up in the library search path, so
+     force it to be relative to the current directory */
+  if (strpbrk(tsdlfile, "/\\") == NULL)
+    strlcpy(path, "./", sizearray(path));
+  else
+    path[0] = '\0';
+  strlcat(path, tsdlfile, sizearray(path));
+  ptr = strrchr(path, '.');
+  if (ptr != NULL && strpbrk(ptr, "/\\") == NULL)
+    *ptr = '\0';
+  #if defined _WIN32
+    strlcat(path, ".dll", sizearray(path));
+    plugin_handle = LoadLibraryA(path);
+    if (plugin_handle == NULL)
+      return 0;
+    plugin_hash = (PLUGIN_HASH)GetProcAddress(plugin_handle, "tracegen_metadata_hash");
+    plugin_payload_size = (PLUGIN_PAYLOADSIZE)GetProcAddress(plugin_handle, "tracegen_payload_size");
+    plugin_format = (PLUGIN_FORMAT)GetProcAddress(plugin_handle, "tracegen_format");
+  #else
+    strlcat(path, ".so", sizearray(path));
+    plugin_handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (plugin_handle == NULL)
+      return 0;
+    *(void**)&plugin_hash = dlsym(plugin_handle, "tracegen_metadata_hash");
+    *(void**)&plugin_payload_size = dlsym(plugin_handle, "tracegen_payload_size");
+    *(void**)&plugin_format = dlsym(plugin_handle, "tracegen_format");
+  #endif
+  if (plugin_hash == NULL || plugin_payload_size == NULL || plugin_format == NULL
+      || plugin_hash() != ctf_metadata_hash())
+  {
+    plugin_unload();
+    return 0;
+  }
+  if (libpath != NULL && libpath_size > 0)
+    strlcpy(libpath, path, libpath_size);
+  return 1;
+}
+
 static void format_field(const char *fieldname, const CTF_TYPE *type, const unsigned char *data)
 {
   msgbuffer_append(fieldname, -1);
@@ -392,7 +540,7 @@ static void format_field(const char *fieldname, const CTF_TYPE *type, const unsi
     } else {
       uint32_t v = 0;
       memcpy(&v, data, type->size / 8);
-      if (base == CTF_BASE_ADDR) {
+      if (type->base == CTF_BASE_ADDR) {
         if (!lookup_symbol(v, txt, sizearray(txt)))
           fmt_uint32(v, txt, 16);
       } else if (type->flags & TYPEFLAG_SIGNED) {
@@ -472,7 +620,6 @@ int ctf_decode(const unsigned char *stream, size_t size, long channel)
   if (event_count(-1) == 0)     /* no events defined, nothing to do */
     return 0;
 
-  cache_reset();
   result = 0;
   idx = 0;
 
@@ -486,58 +633,39 @@ restart:
       pkt_header = packet_header();
     assert(pkt_header != NULL);
     if (pkt_header->header.magic_size == 0) {
+      /* without magic, the encoding cannot be detected, so it must be
+         declared in the TSDL file */
+      compact = (trace_global()->encoding == ENCODING_COMPACT);
       /* advance state and restart */
       state++;
       goto restart;
     }
-    if (cache_filled > 0) {
-      /* the first bytes in cache already matched, check the remaining bytes */
-      len = (pkt_header->header.magic_size / 8) - cache_filled;
-      assert(len > 0);
-      assert(idx == 0);
-      if (len > size)
-        len = size;
-      if (memcmp(stream, magic + cache_filled, len) == 0) {
-        /* match, check whether this is still a patial match */
-        if (cache_filled + len == (pkt_header->header.magic_size / 8u)) {
-          state++;
-          idx += len;
-          cache_reset();
-          goto restart;
-        } else {
-          cache_filled += len;
-          return result; /* nothing to do further, wait for more bytes */
-        }
+    /* match the bytes against both the standard magic and the magic for the
+       compact encoding; the cache only holds the count of matched bytes */
+    len = pkt_header->header.magic_size / 8;
+    while (idx < size) {
+      unsigned char b = stream[idx++];
+      if (cache_filled == 0) {
+        if (b == magic[0])
+          compact = 0;
+        else if (b == magic_compact[0])
+          compact = 1;
+        else
+          continue;
+        cache_filled = 1;
+      } else if (b == (compact ? magic_compact : magic)[cache_filled]) {
+        cache_filled += 1;
       } else {
-        /* mismatch, re-scan */
+        /* mismatch, re-scan (the mismatching byte may be the start of the
+           magic) */
         cache_reset();
+        idx -= 1;
+        continue;
       }
-    }
-    if (state == STATE_SCAN_MAGIC) {
-      while (idx < size) {
-        while (idx < size && stream[idx] != magic[0])
-          idx++;  /* find first byte of the magic */
-        if (idx < size) {
-          /* potential start of magic found */
-          len = pkt_header->header.magic_size / 8;
-          if (idx + len > size)
-            len = size - idx;
-          if (memcmp(stream, magic + cache_filled, len) == 0) {
-            /* match, check whether this is still a patial match */
-            if (len == pkt_header->header.magic_size / 8u) {
-              state++;  /* full match -> advance state & restart */
-              idx += len;
-              cache_reset();
-              goto restart;
-            } else {
-              assert(cache_filled == 0);
-              cache_filled = len;
-              return result; /* nothing to do further, wait for more bytes */
-            }
-          } else {
-            idx += 1;
-          }
-        }
+      if (cache_filled == len) {
+        state++;  /* full match -> advance state & restart */
+        cache_reset();
+        goto restart;
       }
     }
     break;
@@ -590,6 +718,7 @@ restart:
     /* get the event header from the stream.id or the passed-in channel */
     { /* local block */
       const CTF_STREAM *s = stream_by_id(channel);
+      cur_stream = (int)channel;
       if (s != NULL) {
         evt_header = &s->event;
         clock = (s->clock != NULL) ? clock_by_name(s->clock->selector) : NULL;
@@ -678,6 +807,35 @@ restart:
       assert(cache_filled == 0);
       goto restart;
     }
+    if (compact) {
+      /* delta or absolute timestamp, in ULEB128 (bit 0 is set for an absolute
+         timestamp) */
+      uint64_t tstamp;
+      int result_varint = varint_collect(stream, size, &idx);
+      if (result_varint == 0)
+        break;  /* wait for more bytes */
+      if (result_varint < 0) {
+        state = STATE_SCAN_MAGIC;
+        cache_reset();
+        msgbuffer_reset();
+        goto restart;
+      }
+      tstamp = varint_decode(0);
+      if (cur_stream >= 0 && cur_stream < MAX_STREAMS) {
+        if ((tstamp & 1) == 0)
+          tstamp = tstamp_prev[cur_stream] + (tstamp >> 1);
+        else
+          tstamp >>= 1;
+        if (evt_header->header.timestamp_size < 64)
+          tstamp &= ((uint64_t)1 << evt_header->header.timestamp_size) - 1;
+        tstamp_prev[cur_stream] = tstamp;
+      }
+      if (clock != NULL)
+        timestamp = (double)(tstamp + clock->offset) / (double)clock->frequeny + clock->offset_s;
+      state++;
+      cache_reset();
+      goto restart;
+    }
     len = (evt_header->header.timestamp_size / 8) - cache_filled;
     if (idx + len <= size) {
       /* get the timestamp; this code assumes Little Endian */
@@ -703,10 +861,70 @@ restart:
 
   case STATE_GET_FIELDS:
     assert(field != NULL);
+    if (plugin_format != NULL && !compact && field == event->field_root.next
+        && (int)(len = plugin_payload_size(event->id)) > 0)
+    {
+      /* fixed layout, collect the complete payload and format it in one go */
+      char text[256];
+      int textlen;
+      if (cache_filled < len) {
+        size_t count = len - cache_filled;
+        if (idx + count > size)
+          count = size - idx;
+        cache_grow(count);
+        memcpy(cache + cache_filled, stream + idx, count);
+        idx += count;
+        cache_filled += count;
+        if (cache_filled < len)
+          return result;  /* payload not yet complete, wait for more incoming bytes */
+      }
+      msgbuffer_append(": ", 2);
+      textlen = plugin_format(event->id, cache, text, sizeof text, lookup_symbol);
+      if (textlen >= 0 && (size_t)textlen < sizeof text) {
+        msgbuffer_append(text, textlen);
+      } else {
+        /* text did not fit, use the generic decoder on the collected payload */
+        const unsigned char *data = cache;
+        for ( ; field != NULL; field = field->next) {
+          if (field != event->field_root.next)
+            msgbuffer_append(", ", 2);
+          format_field(field->name, &field->type, data);
+          data += field->type.size / 8;
+        }
+      }
+      cache_reset();
+      msgbuffer_append("", 1);  /* force zero-terminate msgbuffer */
+      msgstack_push((uint16_t)event->stream_id, timestamp, msgbuffer);
+      msgbuffer_reset();
+      result += 1;  /* flag: one more trace message completed */
+      state = STATE_SCAN_MAGIC;
+      goto restart;
+    }
     switch (field->type.typeclass) {
     case CLASS_INTEGER:
-    case CLASS_FLOAT:
     case CLASS_ENUM:
+      if (compact) {
+        uint64_t value;
+        int result_varint = varint_collect(stream, size, &idx);
+        if (result_varint == 0)
+          return result;  /* full field not yet in the buffer */
+        if (result_varint < 0) {
+          state = STATE_SCAN_MAGIC;
+          cache_reset();
+          msgbuffer_reset();
+          goto restart;
+        }
+        /* store the value in the declared size, for format_field() (this code
+           assumes Little Endian) */
+        value = varint_decode(field->type.flags & TYPEFLAG_SIGNED);
+        cache_reset();
+        cache_grow(sizeof value);
+        memcpy(cache, &value, sizeof value);
+        cache_filled = field->type.size / 8;
+        break;
+      }
+      /* fall through */
+    case CLASS_FLOAT:
     case CLASS_STRUCT:
       assert(field->type.size / 8 > 0);
       len = (field->type.size / 8) - cache_filled;
@@ -720,6 +938,35 @@ restart:
         return result;  /* full field not yet in the buffer, wait for more incoming bytes */
       break;
     case CLASS_STRING:
+      if (compact && strtag < 0) {
+        /* get the tag: 0 = literal string, odd = reference to an interned
+           string, even = definition of an interned string */
+        uint64_t tag;
+        int result_varint = varint_collect(stream, size, &idx);
+        if (result_varint == 0)
+          return result;  /* wait for more bytes */
+        tag = (result_varint > 0) ? varint_decode(0) : 0;
+        if (result_varint < 0 || tag > 2 * MAX_STRINGS) {
+          /* invalid varint, or tag for a slot beyond the table */
+          state = STATE_SCAN_MAGIC;
+          cache_reset();
+          msgbuffer_reset();
+          goto restart;
+        }
+        strtag = (long)tag;
+        cache_reset();
+        if (strtag & 1) {
+          /* reference, copy the string from the table */
+          long slot = (strtag - 1) / 2;
+          const char *str = (slot < MAX_STRINGS && strtab[slot] != NULL) ? strtab[slot] : "?";
+          len = strlen(str) + 1;
+          cache_grow(len);
+          memcpy(cache, str, len);
+          cache_filled = len;
+          strtag = -1;
+          break;
+        }
+      }
       /* store the string (temporarily) in the cache */
       while (idx < size && stream[idx] != 0) {
         cache_grow(1);
@@ -730,6 +977,16 @@ restart:
         cache_grow(1);
         cache[cache_filled++] = 0;
         idx++;
+        if (strtag > 0) {
+          /* definition of an interned string, store it in the table */
+          long slot = (strtag - 2) / 2;
+          if (slot < MAX_STRINGS) {
+            if (strtab[slot] != NULL)
+              free((void*)strtab[slot]);
+            strtab[slot] = strdup((const char*)cache);
+          }
+        }
+        strtag = -1;
       } else {
         /* zero terminating byte not found, wait for more incoming bytes */
         return result;
@@ -762,9 +1019,12 @@ restart:
 
 void ctf_decode_cleanup(void)
 {
+  plugin_unload();
   cache_clear();
   msgbuffer_clear();
   msgstack_clear();
+  strtab_clear();
+  memset(tstamp_prev, 0, sizeof tstamp_prev);
 }
 
 void ctf_decode_reset(void)
@@ -772,4 +1032,5 @@ void ctf_decode_reset(void)
   cache_reset();
   msgbuffer_reset();
   state = STATE_SCAN_MAGIC;
+  strtag = -1;
 }
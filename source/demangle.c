@@ -1692,3 +1692,139 @@ int demangle(char *plain, size_t size, const char *mangled)
   return mangle.valid;
 }
 
+/* The cache maps mangled names to demangled names, so that each name is
+   demangled only once (and only when it is first needed). Both names are
+   copied into a string pool that grows in blocks, so that the returned
+   pointers stay valid until demangle_cache_clear(). The cache is indexed by
+   an open-addressing hash table on the mangled name. */
+typedef struct tagNAMEBLOCK {
+  struct tagNAMEBLOCK *next;
+  size_t used;
+  size_t size;
+} NAMEBLOCK;  /* followed by the string data */
+
+typedef struct tagNAMEENTRY {
+  const char *mangled;
+  const char *plain;    /* NULL if the name could not be demangled */
+  unsigned hash;
+} NAMEENTRY;
+
+#define NAMEBLOCK_SIZE  8192
+
+static NAMEBLOCK *name_pool = NULL;
+static NAMEENTRY *name_table = NULL;
+static unsigned name_tablesize = 0;  /* always a power of 2 */
+static unsigned name_count = 0;
+
+static unsigned name_hash(const char *name)
+{
+  unsigned hash = 2166136261u;  /* FNV-1a */
+  while (*name != '\0')
+    hash = (hash ^ (unsigned char)*name++) * 16777619u;
+  return hash;
+}
+
+static const char *name_store(const char *name)
+{
+  size_t len = strlen(name) + 1;
+  if (name_pool == NULL || name_pool->used + len > name_pool->size) {
+    size_t size = (len > NAMEBLOCK_SIZE) ? len : NAMEBLOCK_SIZE;
+    NAMEBLOCK *block = malloc(sizeof(NAMEBLOCK) + size);
+    if (block == NULL)
+      return NULL;
+    block->next = name_pool;
+    block->used = 0;
+    block->size = size;
+    name_pool = block;
+  }
+  char *str = (char*)(name_pool + 1) + name_pool->used;
+  memcpy(str, name, len);
+  name_pool->used += len;
+  return str;
+}
+
+static bool name_grow(void)
+{
+  unsigned newsize = (name_tablesize == 0) ? 1024 : 2 * name_tablesize;
+  NAMEENTRY *table = calloc(newsize, sizeof(NAMEENTRY));
+  if (table == NULL)
+    return false;
+  for (unsigned i = 0; i < name_tablesize; i++) {
+    if (name_table[i].mangled != NULL) {
+      unsigned slot = name_table[i].hash & (newsize - 1);
+      while (table[slot].mangled != NULL)
+        slot = (slot + 1) & (newsize - 1);
+      table[slot] = name_table[i];
+    }
+  }
+  if (name_table != NULL)
+    free(name_table);
+  name_table = table;
+  name_tablesize = newsize;
+  return true;
+}
+
+/** demangle_cached() returns the demangled name for a mangled name. It
+ *  demangles a name on its first look-up, and returns the cached result on
+ *  later look-ups. If the name is not a mangled name (or if it cannot be
+ *  demangled), the function returns the input pointer.
+ *
+ *  \param mangled  The (mangled) name.
+ *
+ *  \return The demangled name; this pointer is valid until a call to
+ *          demangle_cache_clear().
+ *
+ *  \note The cache is not thread-safe.
+ */
+const char *demangle_cached(const char *mangled)
+{
+  assert(mangled != NULL);
+  if (mangled[0] != '_' || mangled[1] != 'Z')
+    return mangled;
+
+  unsigned hash = name_hash(mangled);
+  if (name_tablesize > 0) {
+    unsigned slot = hash & (name_tablesize - 1);
+    while (name_table[slot].mangled != NULL) {
+      if (name_table[slot].hash == hash && strcmp(name_table[slot].mangled, mangled) == 0)
+        return (name_table[slot].plain != NULL) ? name_table[slot].plain : mangled;
+      slot = (slot + 1) & (name_tablesize - 1);
+    }
+  }
+
+  /* not in the cache, demangle and add it (keep the table at most 3/4 full) */
+  char plain[256];
+  bool valid = demangle(plain, sizeof(plain), mangled);
+  if (4 * (name_count + 1) > 3 * name_tablesize && !name_grow())
+    return mangled;   /* insufficient memory */
+  NAMEENTRY entry;
+  entry.mangled = name_store(mangled);
+  entry.plain = valid ? name_store(plain) : NULL;
+  entry.hash = hash;
+  if (entry.mangled == NULL || (valid && entry.plain == NULL))
+    return mangled;   /* insufficient memory */
+  unsigned slot = hash & (name_tablesize - 1);
+  while (name_table[slot].mangled != NULL)
+    slot = (slot + 1) & (name_tablesize - 1);
+  name_table[slot] = entry;
+  name_count++;
+  return valid ? entry.plain : mangled;
+}
+
+/** demangle_cache_clear() frees all names in the cache. All pointers that
+ *  demangle_cached() returned become invalid.
+ */
+void demangle_cache_clear(void)
+{
+  while (name_pool != NULL) {
+    NAMEBLOCK *next = name_pool->next;
+    free(name_pool);
+    name_pool = next;
+  }
+  if (name_table != NULL)
+    free(name_table);
+  name_table = NULL;
+  name_tablesize = 0;
+  name_count = 0;
+}
+
@@ -19,4 +19,7 @@
 
 int demangle(char *plain, size_t size, const char *mangled);
 
+const char *demangle_cached(const char *mangled);
+void demangle_cache_clear(void);
+
 #endif /* _DEMANGLE_H */
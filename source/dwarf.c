@@ -22,6 +22,16 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+#if defined WIN32 || defined _WIN32
+  #define WIN32_LEAN_AND_MEAN
+  #include <windows.h>
+#else
+  #include <pthread.h>
+  #include <unistd.h>
+#endif
+#include "cksum.h"
 #include "demangle.h"
 #include "elf.h"
 #include "dwarf.h"
@@ -45,6 +55,9 @@
 #endif
 #if defined _MSC_VER
   #define strdup(s)   _strdup(s)
+  #define fileno(f)   _fileno(f)
+  #define fstat(h,s)  _fstat(h,s)
+  #define stat        _stat
 #endif
 
 #if !defined _MAX_PATH
@@ -63,6 +76,7 @@ enum {
   TABLE_LINE,
   TABLE_PUBNAME,
   TABLE_LINE_STR,
+  TABLE_NAMES,
   /* ----- */
   TABLE_COUNT
 };
@@ -132,6 +146,19 @@ typedef struct tagPUBNAME_HDR32 {
   uint32_t info_size;   /* size of this symbol in the comprehensive debug table */
 } PACKED PUBNAME_HDR32;
 
+typedef struct tagNAMES_HDR32 {
+  uint32_t unit_length;     /* total length of this block, excluding this field */
+  uint16_t version;         /* DWARF 5+ */
+  uint16_t padding;
+  uint32_t comp_unit_count;
+  uint32_t local_type_unit_count;
+  uint32_t foreign_type_unit_count;
+  uint32_t bucket_count;    /* 0 if the name index has no hash table */
+  uint32_t name_count;
+  uint32_t abbrev_table_size;
+  uint32_t augmentation_string_size;
+} PACKED NAMES_HDR32;
+
 /* unit headers (DWARF 5+) */
 #define DW_UT_compile                 0x01
 #define DW_UT_type                    0x02
@@ -142,6 +169,13 @@ typedef struct tagPUBNAME_HDR32 {
 #define DW_UT_lo_user                 0x80
 #define DW_UT_hi_user                 0xff
 
+/* name index attributes (DWARF 5+) */
+#define DW_IDX_compile_unit           0x01
+#define DW_IDX_type_unit              0x02
+#define DW_IDX_die_offset             0x03
+#define DW_IDX_parent                 0x04
+#define DW_IDX_type_hash              0x05
+
 /* tags */
 #define DW_TAG_array_type             0x01
 #define DW_TAG_class_type             0x02
@@ -504,8 +538,6 @@ typedef struct tagATTRIBUTE {
 } ATTRIBUTE;
 
 typedef struct tagABBREVLIST {
-  struct tagABBREVLIST *next;
-  int unit;     /* the compilation unit */
   int id;
   int tag;
   int has_children;
@@ -513,32 +545,41 @@ typedef struct tagABBREVLIST {
   ATTRIBUTE *attributes;
 } ABBREVLIST;
 
+typedef struct tagABBREVTABLE {
+  ABBREVLIST *entries;  /* abbreviations of a single unit (normally sorted on id) */
+  int count,size;
+} ABBREVTABLE;
+
 typedef struct tagPATHXREF {
-  struct tagPATHXREF *next;
-  int unit, file; /* input pair */
-  int index;      /* index in DWARF_PATHLIST */
+  int **xlat;     /* per unit: index in DWARF_PATHLIST for each local file index */
+  int *count;     /* per unit: number of local files */
+  int numunits;
 } PATHXREF;
 
-static ABBREVLIST *abbrev_insert(ABBREVLIST *root,int unit,int id,int tag,int has_children,
+static ABBREVLIST *abbrev_insert(ABBREVTABLE *table,int id,int tag,int has_children,
                                  int num_attributes,const ATTRIBUTE attributes[])
 {
   ABBREVLIST *cur;
 
-  assert(root!=NULL);
+  assert(table!=NULL);
   assert(attributes!=NULL || num_attributes==0);
-  if ((cur=(ABBREVLIST*)malloc(sizeof(ABBREVLIST)))==NULL)
-    return NULL;      /* insufficient memory */
-  cur->unit=unit;
+  if (table->count>=table->size) {
+    int newsize=(table->size==0) ? 64 : 2*table->size;
+    ABBREVLIST *list=(ABBREVLIST*)realloc(table->entries,newsize*sizeof(ABBREVLIST));
+    if (list==NULL)
+      return NULL;      /* insufficient memory */
+    table->entries=list;
+    table->size=newsize;
+  }
+  cur=&table->entries[table->count];
   cur->id=id;
   cur->tag=tag;
   cur->has_children=has_children;
   cur->count=num_attributes;
   if (num_attributes>0) {
     int idx;
-    if ((cur->attributes=malloc(num_attributes*sizeof(ATTRIBUTE)))==NULL) {
-      free(cur);
+    if ((cur->attributes=malloc(num_attributes*sizeof(ATTRIBUTE)))==NULL)
       return NULL;      /* insufficient memory */
-    }
     for (idx=0; idx<num_attributes; idx++) {
       cur->attributes[idx].tag=attributes[idx].tag;
       cur->attributes[idx].format=attributes[idx].format;
@@ -547,88 +588,71 @@ static ABBREVLIST *abbrev_insert(ABBREVLIST *root,int unit,int id,int tag,int ha
   } else {
     cur->attributes=NULL;
   }
-  /* insert as "last" (append mode) */
-  assert(root!=NULL);
-  while (root->next!=NULL)
-    root=root->next;
-  cur->next=root->next;
-  root->next=cur;
+  table->count+=1;
   return cur;
 }
-
-static void abbrev_deletetable(ABBREVLIST *root)
+static void abbrev_deletetable(ABBREVTABLE *table)
 {
-  ABBREVLIST *cur,*next;
+  int idx;
 
-  assert(root!=NULL);
-  cur=root->next;
-  while (cur!=NULL) {
-    next=cur->next;
-    assert(cur->attributes!=NULL || cur->count==0);
-    if (cur->attributes!=NULL)
-      free(cur->attributes);
-    free(cur);
-    cur=next;
-  } /* while */
-  memset(root,0,sizeof(ABBREVLIST));
+  assert(table!=NULL);
+  for (idx=0; idx<table->count; idx++) {
+    assert(table->entries[idx].attributes!=NULL || table->entries[idx].count==0);
+    if (table->entries[idx].attributes!=NULL)
+      free(table->entries[idx].attributes);
+  }
+  if (table->entries!=NULL)
+    free(table->entries);
+  memset(table,0,sizeof(ABBREVTABLE));
 }
-
-static ABBREVLIST *abbrev_find(const ABBREVLIST *root,int unit,int id)
+static const ABBREVLIST *abbrev_find(const ABBREVTABLE *table,int id)
 {
-  ABBREVLIST *cur;
-  int index;
+  int idx;
 
-  assert(root!=NULL);
-  index=0;
-  for (cur=root->next; cur!=NULL && (cur->unit!=unit || cur->id!=id); cur=cur->next)
-    index++;
-  return cur;
+  assert(table!=NULL);
+  /* abbreviation codes are normally numbered sequentially, starting at 1 */
+  if (id>=1 && id<=table->count && table->entries[id-1].id==id)
+    return &table->entries[id-1];
+  for (idx=0; idx<table->count; idx++)
+    if (table->entries[idx].id==id)
+      return &table->entries[idx];
+  return NULL;
 }
 
-
-static PATHXREF *pathxref_insert(PATHXREF *root,int unit,int file,int index)
+static int pathxref_init(PATHXREF *table,int numunits)
 {
-  PATHXREF *cur;
-
-  if ((cur=(PATHXREF*)malloc(sizeof(PATHXREF)))==NULL)
-    return NULL;      /* insufficient memory */
-  cur->unit=unit;
-  cur->file=file;
-  cur->index=index;
-  /* insert as "last" (append mode) */
-  assert(root!=NULL);
-  while (root->next!=NULL)
-    root=root->next;
-  cur->next=root->next;
-  root->next=cur;
-  return cur;
+  assert(table!=NULL && table->xlat==NULL);
+  if (numunits==0)
+    return 1;
+  table->xlat=(int**)calloc(numunits,sizeof(int*));
+  table->count=(int*)calloc(numunits,sizeof(int));
+  if (table->xlat==NULL || table->count==NULL)
+    return 0;
+  table->numunits=numunits;
+  return 1;
 }
-
-static void pathxref_deletetable(PATHXREF *root)
+static void pathxref_deletetable(PATHXREF *table)
 {
-  PATHXREF *cur,*next;
+  int unit;
 
-  assert(root!=NULL);
-  cur=root->next;
-  while (cur!=NULL) {
-    next=cur->next;
-    free(cur);
-    cur=next;
-  } /* while */
-  memset(root,0,sizeof(PATHXREF));
+  assert(table!=NULL);
+  for (unit=0; unit<table->numunits; unit++)
+    if (table->xlat[unit]!=NULL)
+      free(table->xlat[unit]);
+  if (table->xlat!=NULL)
+    free(table->xlat);
+  if (table->count!=NULL)
+    free(table->count);
+  memset(table,0,sizeof(PATHXREF));
 }
-
-static int pathxref_find(const PATHXREF *root,int unit,int file)
+static int pathxref_find(const PATHXREF *table,int unit,int file)
 {
-  PATHXREF *cur;
-
-  assert(root!=NULL);
-  for (cur=root->next; cur!=NULL && (cur->unit!=unit || cur->file!=file); cur=cur->next)
-    /* nothing */;
-  return (cur!=NULL) ? cur->index : -1;
+  assert(table!=NULL);
+  if (unit<0 || unit>=table->numunits || file<0 || file>=table->count[unit])
+    return -1;
+  return table->xlat[unit][file];
 }
 
-
 static DWARF_PATHLIST *path_insert(DWARF_PATHLIST *root,const char *string)
 {
   DWARF_PATHLIST *cur;
@@ -693,97 +717,194 @@ static int path_find(const DWARF_PATHLIST *root,const char *name)
 }
 
 
-static DWARF_LINELOOKUP *line_findline(const DWARF_LINELOOKUP *root,int line,int fileindex)
+typedef struct tagLINEARRAY {
+  DWARF_LINELOOKUP *entries;
+  unsigned count,size;
+} LINEARRAY;
+
+static int line_append(LINEARRAY *array,int line,unsigned address,int fileindex)
 {
   DWARF_LINELOOKUP *cur;
 
-  assert(root!=NULL);
-  for (cur=root->next; cur!=NULL && (cur->line!=line || cur->fileindex!=fileindex); cur=cur->next)
-    /* nothing */;
-  return cur;
+  assert(array!=NULL);
+  if (array->count>=array->size) {
+    unsigned newsize=(array->size==0) ? 1024 : 2*array->size;
+    DWARF_LINELOOKUP *list=(DWARF_LINELOOKUP*)realloc(array->entries,newsize*sizeof(DWARF_LINELOOKUP));
+    if (list==NULL)
+      return 0;      /* insufficient memory */
+    array->entries=list;
+    array->size=newsize;
+  }
+  cur=&array->entries[array->count++];
+  cur->next=NULL;
+  cur->line=line;
+  cur->address=address;
+  cur->fileindex=fileindex;
+  return 1;
 }
 
-static DWARF_LINELOOKUP *line_findaddress(const DWARF_LINELOOKUP *root,unsigned address,int fileindex)
+static int line_cmp_fileaddr(const void *p1,const void *p2)
 {
-  DWARF_LINELOOKUP *cur;
+  const DWARF_LINELOOKUP *l1=(const DWARF_LINELOOKUP*)p1;
+  const DWARF_LINELOOKUP *l2=(const DWARF_LINELOOKUP*)p2;
+  if (l1->fileindex!=l2->fileindex)
+    return (l1->fileindex<l2->fileindex) ? -1 : 1;
+  if (l1->address!=l2->address)
+    return (l1->address<l2->address) ? -1 : 1;
+  if (l1->line!=l2->line)
+    return (l1->line>l2->line) ? -1 : 1;  /* highest line first */
+  return 0;
+}
 
-  assert(root!=NULL);
-  for (cur=root->next; cur!=NULL && (cur->address!=address || cur->fileindex!=fileindex); cur=cur->next)
-    /* nothing */;
-  return cur;
+static int line_cmp_fileline(const void *p1,const void *p2)
+{
+  const DWARF_LINELOOKUP *l1=(const DWARF_LINELOOKUP*)p1;
+  const DWARF_LINELOOKUP *l2=(const DWARF_LINELOOKUP*)p2;
+  if (l1->fileindex!=l2->fileindex)
+    return (l1->fileindex<l2->fileindex) ? -1 : 1;
+  if (l1->line!=l2->line)
+    return (l1->line<l2->line) ? -1 : 1;
+  if (l1->address!=l2->address)
+    return (l1->address<l2->address) ? -1 : 1;  /* lowest address first */
+  return 0;
 }
 
-static DWARF_LINELOOKUP *line_insert(DWARF_LINELOOKUP *root,int line,unsigned address,int fileindex)
+static int line_cmp_address(const void *p1,const void *p2)
 {
-  DWARF_LINELOOKUP *cur;
+  const DWARF_LINELOOKUP *l1=(const DWARF_LINELOOKUP*)p1;
+  const DWARF_LINELOOKUP *l2=(const DWARF_LINELOOKUP*)p2;
+  if (l1->address!=l2->address)
+    return (l1->address<l2->address) ? -1 : 1;
+  if (l1->fileindex!=l2->fileindex)
+    return (l1->fileindex<l2->fileindex) ? -1 : 1;
+  if (l1->line!=l2->line)
+    return (l1->line<l2->line) ? -1 : 1;
+  return 0;
+}
 
-  assert(root!=NULL);
-  /* first try to find an item with that line number, if it exists, keep the
-     lowest address in the item;
-     then try to find an item with the same address, if it exists, keep the
-     highest line number */
-  if ((cur=line_findline(root,line,fileindex))!=NULL) {
-    if (address<cur->address)
-      cur->address=address;
-  } else if ((cur=line_findaddress(root,address,fileindex))!=NULL) {
-    if (line>cur->line)
-      cur->line=line;
-    assert(fileindex==cur->fileindex);
-  } else {
-    DWARF_LINELOOKUP *pred;
-    if ((cur=(DWARF_LINELOOKUP*)malloc(sizeof(DWARF_LINELOOKUP)))==NULL)
-      return NULL;      /* insufficient memory */
-    cur->line=line;
-    cur->address=address;
-    cur->fileindex=fileindex;
-    /* find insertion position (keep the list sorted on address) */
-    for (pred=root; pred->next!=NULL && pred->next->address<address; pred=pred->next)
-      /* nothing */;
-    /* insert */
-    assert(pred!=NULL);
-    cur->next=pred->next;
-    pred->next=cur;
+static int line_cmp_index(const void *p1,const void *p2)
+{
+  return line_cmp_fileline(*(const DWARF_LINELOOKUP**)p1,*(const DWARF_LINELOOKUP**)p2);
+}
+
+/* line_compact() removes redundant rows: for rows with the same address (in
+   the same file), the highest line number is kept, and for rows with the same
+   line number, the lowest address is kept. The remaining rows are sorted on
+   address; the function returns the number of these rows. */
+static unsigned line_compact(DWARF_LINELOOKUP *list,unsigned count)
+{
+  unsigned idx,kept;
+
+  if (count==0)
+    return 0;
+  qsort(list,count,sizeof(DWARF_LINELOOKUP),line_cmp_fileline);
+  for (kept=1,idx=1; idx<count; idx++)
+    if (list[idx].fileindex!=list[kept-1].fileindex || list[idx].line!=list[kept-1].line)
+      list[kept++]=list[idx];
+  count=kept;
+  qsort(list,count,sizeof(DWARF_LINELOOKUP),line_cmp_fileaddr);
+  for (kept=1,idx=1; idx<count; idx++)
+    if (list[idx].fileindex!=list[kept-1].fileindex || list[idx].address!=list[kept-1].address)
+      list[kept++]=list[idx];
+  count=kept;
+  qsort(list,count,sizeof(DWARF_LINELOOKUP),line_cmp_address);
+  return count;
+}
+
+/* line_buildtable() turns the collected rows into the line table: the rows are
+   compacted and sorted on address, and an index on file & line is added. The
+   array is moved into the table (so it is empty on return). */
+static int line_buildtable(DWARF_LINETABLE *linetable,LINEARRAY *array)
+{
+  DWARF_LINELOOKUP *list,*shrunk;
+  unsigned idx,count;
+
+  assert(linetable!=NULL && linetable->next==NULL);
+  assert(array!=NULL);
+  list=array->entries;
+  count=array->count;
+  memset(array,0,sizeof(LINEARRAY));
+  if (count==0) {
+    if (list!=NULL)
+      free(list);
+    return 1;
   }
-  return cur;
+
+  count=line_compact(list,count);
+  if ((shrunk=(DWARF_LINELOOKUP*)realloc(list,count*sizeof(DWARF_LINELOOKUP)))!=NULL)
+    list=shrunk;
+
+  /* chain the entries, for iteration */
+  for (idx=0; idx+1<count; idx++)
+    list[idx].next=&list[idx+1];
+  list[count-1].next=NULL;
+
+  /* build the index for look-up by line */
+  linetable->byline=(DWARF_LINELOOKUP**)malloc(count*sizeof(DWARF_LINELOOKUP*));
+  if (linetable->byline==NULL) {
+    free(list);
+    return 0;       /* insufficient memory */
+  }
+  for (idx=0; idx<count; idx++)
+    linetable->byline[idx]=&list[idx];
+  qsort(linetable->byline,count,sizeof(DWARF_LINELOOKUP*),line_cmp_index);
+
+  linetable->next=list;
+  linetable->count=count;
+  return 1;
 }
 
-static void line_deletetable(DWARF_LINELOOKUP *root)
+static void line_deletetable(DWARF_LINETABLE *linetable)
 {
-  DWARF_LINELOOKUP *cur,*next;
+  assert(linetable!=NULL);
+  if (linetable->byaddress!=NULL)
+    free(linetable->byaddress);   /* in lazy mode, the units own the entries */
+  else if (linetable->next!=NULL)
+    free(linetable->next);
+  if (linetable->byline!=NULL)
+    free(linetable->byline);
+  memset(linetable,0,sizeof(DWARF_LINETABLE));
+}
 
-  assert(root!=NULL);
-  cur=root->next;
-  while (cur!=NULL) {
-    next=cur->next;
-    free(cur);
-    cur=next;
-  } /* while */
-  memset(root,0,sizeof(DWARF_LINELOOKUP));
+/* line_entry() returns the entry at an index in address order */
+static DWARF_LINELOOKUP *line_entry(const DWARF_LINETABLE *linetable,unsigned idx)
+{
+  assert(idx<linetable->count);
+  return (linetable->byaddress!=NULL) ? linetable->byaddress[idx] : &linetable->next[idx];
 }
 
-static DWARF_SYMBOLLIST *symname_insert(DWARF_SYMBOLLIST *root,const char *name,
+typedef struct tagSYMARRAY {
+  DWARF_SYMBOLLIST *entries;
+  unsigned count,size;
+} SYMARRAY;
+
+static DWARF_SYMBOLLIST *symname_insert(SYMARRAY *array,const char *name,
                                         unsigned code_addr,unsigned code_range,
                                         unsigned data_addr,int fileindex,int line,
                                         int external)
 {
-  DWARF_SYMBOLLIST *cur,*pred;
-  char demangled[256];
+  DWARF_SYMBOLLIST *cur;
 
-  assert(root!=NULL);
+  assert(array!=NULL);
   assert(name!=NULL);
 
-  if ((cur=(DWARF_SYMBOLLIST*)malloc(sizeof(DWARF_SYMBOLLIST)))==NULL)
-    return NULL;      /* insufficient memory */
+  if (array->count>=array->size) {
+    unsigned newsize=(array->size==0) ? 256 : 2*array->size;
+    DWARF_SYMBOLLIST *list=(DWARF_SYMBOLLIST*)realloc(array->entries,newsize*sizeof(DWARF_SYMBOLLIST));
+    if (list==NULL)
+      return NULL;    /* insufficient memory */
+    array->entries=list;
+    array->size=newsize;
+  }
+  cur=&array->entries[array->count];
 
-  if (demangle(demangled, sizeof(demangled), name))
-    cur->name=strdup(demangled);
-  else
-    cur->name=strdup(name);
-  if (cur==NULL) {
-    free(cur);
+  /* the name is stored as is; C++ names are demangled on display, through
+     demangle_cached() */
+  cur->name=strdup(name);
+  if (cur->name==NULL)
     return NULL;      /* insufficient memory */
-  }
 
+  cur->next=NULL;
   cur->code_addr=code_addr;
   cur->code_range=code_range;
   cur->data_addr=data_addr;
@@ -796,30 +917,216 @@ static DWARF_SYMBOLLIST *symname_insert(DWARF_SYMBOLLIST *root,const char *name,
     cur->scope=SCOPE_UNIT;
   else
     cur->scope=SCOPE_UNKNOWN;
-  /* insert sorted on name */
-  for (pred=root; pred->next!=NULL && strcmp(name,pred->next->name)>0; pred=pred->next)
-    /* nothing */;
-  /* insert */
-  assert(pred!=NULL);
-  cur->next=pred->next;
-  pred->next=cur;
+  array->count+=1;
   return cur;
 }
 
-static void symname_deletetable(DWARF_SYMBOLLIST *root)
+static int sym_cmp_order(const void *p1,const void *p2)
 {
-  DWARF_SYMBOLLIST *cur,*next;
+  const DWARF_SYMBOLLIST *s1=*(const DWARF_SYMBOLLIST**)p1;
+  const DWARF_SYMBOLLIST *s2=*(const DWARF_SYMBOLLIST**)p2;
+  int result=strcmp(s1->name,s2->name);
+  if (result==0)  /* same name: the most recently added symbol goes first */
+    result=(s1>s2) ? -1 : (s1<s2) ? 1 : 0;
+  return result;
+}
 
-  assert(root!=NULL);
-  cur=root->next;
-  while (cur!=NULL) {
-    next=cur->next;
-    assert(cur->name!=NULL);
-    free(cur->name);
-    free(cur);
-    cur=next;
-  } /* while */
-  memset(root,0,sizeof(DWARF_SYMBOLLIST));
+static int sym_cmp_file(const void *p1,const void *p2)
+{
+  const DWARF_SYMBOLLIST *s1=*(const DWARF_SYMBOLLIST**)p1;
+  const DWARF_SYMBOLLIST *s2=*(const DWARF_SYMBOLLIST**)p2;
+  if (s1->fileindex!=s2->fileindex)
+    return (s1->fileindex<s2->fileindex) ? -1 : 1;
+  if (s1->scope!=s2->scope)
+    return (s1->scope<s2->scope) ? -1 : 1;
+  return (s1<s2) ? -1 : (s1>s2) ? 1 : 0;  /* symbols are already sorted on name */
+}
+
+static int sym_cmp_code(const void *p1,const void *p2)
+{
+  const DWARF_SYMBOLLIST *s1=*(const DWARF_SYMBOLLIST**)p1;
+  const DWARF_SYMBOLLIST *s2=*(const DWARF_SYMBOLLIST**)p2;
+  if (s1->code_addr!=s2->code_addr)
+    return (s1->code_addr<s2->code_addr) ? -1 : 1;
+  return (s1<s2) ? -1 : (s1>s2) ? 1 : 0;
+}
+
+static int sym_cmp_data(const void *p1,const void *p2)
+{
+  const DWARF_SYMBOLLIST *s1=*(const DWARF_SYMBOLLIST**)p1;
+  const DWARF_SYMBOLLIST *s2=*(const DWARF_SYMBOLLIST**)p2;
+  if (s1->data_addr!=s2->data_addr)
+    return (s1->data_addr<s2->data_addr) ? -1 : 1;
+  return (s1<s2) ? -1 : (s1>s2) ? 1 : 0;
+}
+
+static unsigned sym_hash(const char *name)
+{
+  unsigned hash=2166136261u;  /* FNV-1a */
+  while (*name!='\0')
+    hash=(hash^(unsigned char)*name++)*16777619u;
+  return hash;
+}
+
+/* sym_buildtable() sorts the collected symbols on name and moves these into
+   the symbol table (so that the array is empty on return). The symbols are
+   chained, so that the table can be walked as a list. */
+static int sym_buildtable(DWARF_SYMBOLTABLE *symboltable,SYMARRAY *array)
+{
+  DWARF_SYMBOLLIST **order,*list;
+  unsigned idx,count;
+
+  assert(symboltable!=NULL && symboltable->next==NULL);
+  assert(array!=NULL);
+  count=array->count;
+  if (count==0) {
+    if (array->entries!=NULL)
+      free(array->entries);
+    memset(array,0,sizeof(SYMARRAY));
+    return 1;
+  }
+
+  order=(DWARF_SYMBOLLIST**)malloc(count*sizeof(DWARF_SYMBOLLIST*));
+  list=(DWARF_SYMBOLLIST*)malloc(count*sizeof(DWARF_SYMBOLLIST));
+  if (order==NULL || list==NULL) {
+    if (order!=NULL)
+      free(order);
+    if (list!=NULL)
+      free(list);
+    return 0;
+  }
+  for (idx=0; idx<count; idx++)
+    order[idx]=&array->entries[idx];
+  qsort(order,count,sizeof(DWARF_SYMBOLLIST*),sym_cmp_order);
+  for (idx=0; idx<count; idx++) {
+    list[idx]=*order[idx];
+    list[idx].next=(idx+1<count) ? &list[idx+1] : NULL;
+  }
+  free(order);
+  free(array->entries);
+  memset(array,0,sizeof(SYMARRAY));
+
+  symboltable->next=list;
+  symboltable->count=count;
+  return 1;
+}
+
+/* sym_entry() returns the symbol at an index in name order */
+static DWARF_SYMBOLLIST *sym_entry(const DWARF_SYMBOLTABLE *symboltable,unsigned idx)
+{
+  assert(idx<symboltable->count);
+  return (symboltable->byname!=NULL) ? symboltable->byname[idx] : &symboltable->next[idx];
+}
+
+/* sym_buildhash() (re-)creates the hash table on name, it refers to the first
+   symbol with that name */
+static int sym_buildhash(DWARF_SYMBOLTABLE *symboltable)
+{
+  unsigned idx,count=symboltable->count;
+
+  if (symboltable->namehash!=NULL)
+    free(symboltable->namehash);
+  symboltable->hashsize=16;
+  while (symboltable->hashsize<2*count)
+    symboltable->hashsize*=2;
+  symboltable->namehash=(unsigned*)calloc(symboltable->hashsize,sizeof(unsigned));
+  if (symboltable->namehash==NULL)
+    return 0;
+  for (idx=0; idx<count; idx++) {
+    const char *name=sym_entry(symboltable,idx)->name;
+    if (idx==0 || strcmp(name,sym_entry(symboltable,idx-1)->name)!=0) {
+      unsigned slot=sym_hash(name)&(symboltable->hashsize-1);
+      while (symboltable->namehash[slot]!=0)
+        slot=(slot+1)&(symboltable->hashsize-1);
+      symboltable->namehash[slot]=idx+1;  /* +1 because 0 marks an empty slot */
+    }
+  }
+  return 1;
+}
+
+/* sym_buildindex() creates the look-up indices for the symbol table; it must
+   be called after the scopes of all symbols are final. */
+static int sym_buildindex(DWARF_SYMBOLTABLE *symboltable)
+{
+  DWARF_SYMBOLLIST *list=symboltable->next;
+  unsigned idx,count=symboltable->count;
+  unsigned numfunctions,numvariables;
+
+  if (count==0)
+    return 1;
+
+  if (!sym_buildhash(symboltable))
+    return 0;
+  /* index on file & scope */
+  symboltable->byfile=(DWARF_SYMBOLLIST**)malloc(count*sizeof(DWARF_SYMBOLLIST*));
+  /* functions and global/static variables, sorted on address */
+  for (numfunctions=numvariables=idx=0; idx<count; idx++) {
+    if (DWARF_IS_FUNCTION(&list[idx]))
+      numfunctions++;
+    else if (list[idx].data_addr!=0)
+      numvariables++;
+  }
+  symboltable->functions=(DWARF_SYMBOLLIST**)malloc((numfunctions+1)*sizeof(DWARF_SYMBOLLIST*));
+  symboltable->variables=(DWARF_SYMBOLLIST**)malloc((numvariables+1)*sizeof(DWARF_SYMBOLLIST*));
+  if (symboltable->byfile==NULL || symboltable->functions==NULL || symboltable->variables==NULL)
+    return 0;
+
+  for (idx=0; idx<count; idx++)
+    symboltable->byfile[idx]=&list[idx];
+  qsort(symboltable->byfile,count,sizeof(DWARF_SYMBOLLIST*),sym_cmp_file);
+
+  for (numfunctions=numvariables=idx=0; idx<count; idx++) {
+    if (DWARF_IS_FUNCTION(&list[idx]))
+      symboltable->functions[numfunctions++]=&list[idx];
+    else if (list[idx].data_addr!=0)
+      symboltable->variables[numvariables++]=&list[idx];
+  }
+  qsort(symboltable->functions,numfunctions,sizeof(DWARF_SYMBOLLIST*),sym_cmp_code);
+  qsort(symboltable->variables,numvariables,sizeof(DWARF_SYMBOLLIST*),sym_cmp_data);
+  symboltable->numfunctions=numfunctions;
+  symboltable->numvariables=numvariables;
+  return 1;
+}
+
+static void symname_deletetable(DWARF_SYMBOLTABLE *symboltable)
+{
+  unsigned idx;
+
+  assert(symboltable!=NULL);
+  if (symboltable->byname!=NULL) {
+    free(symboltable->byname);    /* in lazy mode, the units own the symbols */
+  } else if (symboltable->next!=NULL) {
+    if (symboltable->namepool==NULL) {
+      for (idx=0; idx<symboltable->count; idx++) {
+        assert(symboltable->next[idx].name!=NULL);
+        free(symboltable->next[idx].name);
+      }
+    }
+    free(symboltable->next);
+  }
+  if (symboltable->namepool!=NULL)
+    free(symboltable->namepool);
+  if (symboltable->namehash!=NULL)
+    free(symboltable->namehash);
+  if (symboltable->byfile!=NULL)
+    free(symboltable->byfile);
+  if (symboltable->functions!=NULL)
+    free(symboltable->functions);
+  if (symboltable->variables!=NULL)
+    free(symboltable->variables);
+  memset(symboltable,0,sizeof(DWARF_SYMBOLTABLE));
+}
+
+static void symarray_delete(SYMARRAY *array)
+{
+  unsigned idx;
+
+  assert(array!=NULL);
+  for (idx=0; idx<array->count; idx++)
+    free(array->entries[idx].name);
+  if (array->entries!=NULL)
+    free(array->entries);
+  memset(array,0,sizeof(SYMARRAY));
 }
 
 
@@ -832,22 +1139,49 @@ static char *strins(char *string,const char *sub)
   return string;
 }
 
-static long read_leb128(FILE *fp,int sign,int *size)
+/* The ELF file is mapped into memory, and the DWARF tables are decoded through
+   a cursor into that memory block (the positions are file offsets). */
+typedef struct tagMEMFILE {
+  const unsigned char *base;  /* start of the ELF image */
+  const unsigned char *ptr;   /* current read position */
+  const unsigned char *end;   /* end of the ELF image */
+} MEMFILE;
+
+#define mem_getc(mf)  (((mf)->ptr<(mf)->end) ? *(mf)->ptr++ : EOF)
+#define mem_tell(mf)  ((long)((mf)->ptr-(mf)->base))
+
+static void mem_seek(MEMFILE *mf,unsigned long offset)
+{
+  mf->ptr=(offset<(unsigned long)(mf->end-mf->base)) ? mf->base+offset : mf->end;
+}
+
+static size_t mem_read(void *buffer,size_t size,size_t count,MEMFILE *mf)
+{
+  size_t avail=mf->end-mf->ptr;
+  size_t bytes=size*count;
+  if (bytes>avail)
+    bytes=avail;
+  memcpy(buffer,mf->ptr,bytes);
+  mf->ptr+=bytes;
+  return (size>0) ? bytes/size : 0;
+}
+
+static long read_leb128(MEMFILE *fp,int sign,int *size)
 {
+  const unsigned char *start=fp->ptr;
   long value=0;
   int shift=0;
-  int byte;
+  int byte=0;
 
-  if (size!=NULL)
-    *size=0;
-  while ((byte=fgetc(fp))!=EOF) {
-    if (size!=NULL)
-      *size+=1;
+  while (fp->ptr<fp->end) {
+    byte=*fp->ptr++;
     value |= (long)(byte & 0x7f) << shift;
     shift+=7;
     if ((byte & 0x80)==0)
       break;  /* no continuation, so done */
   }
+  if (size!=NULL)
+    *size=(int)(fp->ptr-start);
   /* sign-extend; since bit 7 in the last byte read is the continuation bit,
      bit 6 is the sign bit */
   if (sign && (byte & 0x40)!=0 && shift < (sizeof(long)*8))
@@ -859,7 +1193,7 @@ static long read_leb128(FILE *fp,int sign,int *size)
 /* read_value() reads numeric data in various formats. It does not read address
    data or other fields where the data size depends on the bit size of the ELF
    file rather than on the format of the field. */
-static int64_t read_value(FILE *fp,int format,int *size)
+static int64_t read_value(MEMFILE *fp,int format,int *size)
 {
   int64_t value=0;
   int sz=0;
@@ -872,36 +1206,36 @@ static int64_t read_value(FILE *fp,int format,int *size)
   case DW_FORM_data1:             /* constant, 1 byte */
   case DW_FORM_ref1:              /* reference, 1 bytes */
   case DW_FORM_flag:              /* flag, 1 byte (0=false, any non-zero=true) */
-    fread(&value,1,1,fp);
+    mem_read(&value,1,1,fp);
     sz=1;
     break;
   case DW_FORM_data2:             /* constant, 2 bytes */
   case DW_FORM_ref2:              /* reference, 2 bytes */
-    fread(&value,2,1,fp);
+    mem_read(&value,2,1,fp);
     sz=2;
     break;
   case DW_FORM_data4:             /* constant, 4 bytes */
   case DW_FORM_ref4:              /* reference, 4 bytes */
-    fread(&value,4,1,fp);
+    mem_read(&value,4,1,fp);
     sz=4;
     break;
   case DW_FORM_data8:             /* constant, 8 bytes */
   case DW_FORM_ref8:              /* reference, 8 bytes */
   case DW_FORM_ref_sig8:          /* type signature, 8 bytes */
-    fread(&value,8,1,fp);
+    mem_read(&value,8,1,fp);
     sz=8;
     break;
   case DW_FORM_data16:            /* constant, 16 bytes */
-    fread(&value,8,1,fp);
-    fread(&value,8,1,fp);
+    mem_read(&value,8,1,fp);
+    mem_read(&value,8,1,fp);
     sz=16;
     break;
   case DW_FORM_ref_sup4:          /* reference relative to .debug_info of a supplementaty object file, 4 bytes */
-    fread(&value,4,1,fp);
+    mem_read(&value,4,1,fp);
     sz=4;
     break;
   case DW_FORM_ref_sup8:          /* reference relative to .debug_info of a supplementaty object file, 8 bytes */
-    fread(&value,8,1,fp);
+    mem_read(&value,8,1,fp);
     sz=8;
     break;
   case DW_FORM_sdata:             /* constant, signed LEB128 */
@@ -916,15 +1250,15 @@ static int64_t read_value(FILE *fp,int format,int *size)
     int opc=0;
     sz+=datasz;
     if (datasz>=1) {
-      fread(&opc,1,1,fp);
+      mem_read(&opc,1,1,fp);
       datasz-=1;
     }
     if (opc==DW_OP_addr && datasz>0 && datasz<=sizeof value) {
-      fread(&value,datasz,1,fp);
+      mem_read(&value,datasz,1,fp);
     } else {
       /* register/stack-relative location expressions are currently not supported */
       while (datasz-->0)
-        fgetc(fp);
+        mem_getc(fp);
     }
     break;
   } /* DW_FORM_exprloc */
@@ -936,12 +1270,11 @@ static int64_t read_value(FILE *fp,int format,int *size)
   return value;
 }
 
-static void read_string(FILE *fp,int format,int stringtable,char *string,int max,int *size)
+static void read_string(MEMFILE *fp,int format,int stringtable,char *string,int max,int *size)
 {
   int sz=0;
   int idx,count,byte;
   int32_t offs;
-  long pos;
 
   assert(fp!=NULL);
   assert(string!=NULL);
@@ -950,7 +1283,7 @@ static void read_string(FILE *fp,int format,int stringtable,char *string,int max
   idx=0;
   switch (format) {
   case DW_FORM_string:            /* string, zero-terminated */
-    while ((byte=fgetc(fp))!=EOF) {
+    while ((byte=mem_getc(fp))!=EOF) {
       if (idx<max)
         string[idx]=(char)byte;
       idx++;
@@ -962,20 +1295,16 @@ static void read_string(FILE *fp,int format,int stringtable,char *string,int max
   case DW_FORM_strp:              /* string, 4-byte offset into the .debug_str section */
   case DW_FORM_strp_sup:          /* string, 4-byte offset into the .debug_str section of a supplementary object file */
   case DW_FORM_line_strp:         /* string, 4-byte offset into the .debug_line_str section */
-    fread(&offs,4,1,fp);
+    mem_read(&offs,4,1,fp);
     sz=4;
-    /* look up the string */
+    /* look up the string (directly in the mapped image) */
     assert(stringtable!=0);
-    pos=ftell(fp);
-    fseek(fp,stringtable+offs,SEEK_SET);
-    while ((byte=fgetc(fp))!=EOF) {
-      if (idx<max)
-        string[idx]=(char)byte;
-      idx++;
-      if (byte==0)
-        break;
+    if ((unsigned long)(stringtable+offs)<(unsigned long)(fp->end-fp->base)) {
+      const unsigned char *ptr=fp->base+stringtable+offs;
+      while (ptr<fp->end && *ptr!='\0' && idx<max-1)
+        string[idx++]=(char)*ptr++;
+      string[idx]='\0';
     }
-    fseek(fp,pos,SEEK_SET);
     break;
   case DW_FORM_block:             /* block, unsigned LEB128-encoded length + data bytes */
   case DW_FORM_block1:            /* block, 1-byte length + up to 255 data bytes */
@@ -987,20 +1316,20 @@ static void read_string(FILE *fp,int format,int stringtable,char *string,int max
       count=read_leb128(fp,0,&sz);
       break;
     case DW_FORM_block1:
-      fread(&count,1,1,fp);
+      mem_read(&count,1,1,fp);
       sz=1;
       break;
     case DW_FORM_block2:
-      fread(&count,2,1,fp);
+      mem_read(&count,2,1,fp);
       sz=2;
       break;
     case DW_FORM_block4:
-      fread(&count,4,1,fp);
+      mem_read(&count,4,1,fp);
       sz=4;
       break;
     }
     sz+=count;
-    while (idx<count && (byte=fgetc(fp))!=EOF) {
+    while (idx<count && (byte=mem_getc(fp))!=EOF) {
       if (idx<max)
         string[idx]=(char)byte;
       idx++;
@@ -1014,37 +1343,34 @@ static void read_string(FILE *fp,int format,int stringtable,char *string,int max
     *size=sz;
 }
 
-static void dwarf_abbrev(FILE *fp,const DWARFTABLE tables[],ABBREVLIST *abbrevlist)
+/* dwarf_abbrev() reads the abbreviations for a single unit; the offset is
+   relative to the start of the .debug_abbrev table */
+static int dwarf_abbrev(MEMFILE *fp,const DWARFTABLE tables[],unsigned long offset,ABBREVTABLE *table)
 {
   #define MAX_ATTRIBUTES  50  /* max. number of attributes for a single tag */
-  int unit,tag,attrib,format;
+  int tag,attrib,format;
   int size,count;
   unsigned char flag;
-  unsigned long tablesize;
+  long tablesize;
   ATTRIBUTE attributes[MAX_ATTRIBUTES];
 
   assert(fp!=NULL);
   assert(tables!=NULL);
-  assert(abbrevlist!=NULL);
-  assert(abbrevlist->next==NULL); /* abbrevlist should be empty */
+  assert(table!=NULL);
+  assert(table->count==0); /* table should be empty */
 
-  fseek(fp,tables[TABLE_ABBREV].offset,SEEK_SET);
-  tablesize=tables[TABLE_ABBREV].size;
-  assert(tablesize>0); /* debug information should have been found */
-
-  unit=0;
+  tablesize=(long)tables[TABLE_ABBREV].size-(long)offset;
+  mem_seek(fp,tables[TABLE_ABBREV].offset+offset);
   while (tablesize > 0) {
     /* get and check the abbreviation id (a sequence number relative to its unit) */
     int idx=(int)read_leb128(fp,0,&size);
     tablesize-=size;
-    if (idx==0) {
-      unit+=1;  /* an id that is zero, indicates the end of a unit */
-      continue;
-    }
+    if (idx==0)
+      break;    /* an id that is zero, indicates the end of a unit */
     /* get the tag and the "has-children" flag */
     tag=(int)read_leb128(fp,0,&size);
     tablesize-=size;
-    fread(&flag,1,1,fp);
+    mem_read(&flag,1,1,fp);
     tablesize-=1;
     /* get the list of attributes */
     count=0;
@@ -1067,19 +1393,20 @@ static void dwarf_abbrev(FILE *fp,const DWARFTABLE tables[],ABBREVLIST *abbrevli
       count++;
     }
     /* store the abbreviation */
-    abbrev_insert(abbrevlist,unit,idx,tag,flag,count,attributes);
+    if (abbrev_insert(table,idx,tag,flag,count,attributes)==NULL)
+      return 0;
   }
+  return 1;
 }
-
-static int read_unitheader(FILE *fp,UNIT_HDR32 *header,int *size)
+static int read_unitheader(MEMFILE *fp,UNIT_HDR32 *header,int *size)
 {
   long mark;
 
   assert(fp!=NULL);
   assert(header!=NULL);
   assert(size!=NULL);
-  mark=ftell(fp); /* may need to "un-read" */
-  if (fread(header,sizeof(UNIT_HDR32),1,fp)==0)
+  mark=mem_tell(fp); /* may need to "un-read" */
+  if (mem_read(header,sizeof(UNIT_HDR32),1,fp)==0)
     return 0;     /* read failed */
   assert(header->unit_length!=0xffffffff);  /* otherwise, should read 64-bit header */
   //??? on big_endian, swap version field before testing it
@@ -1094,8 +1421,8 @@ static int read_unitheader(FILE *fp,UNIT_HDR32 *header,int *size)
      */
     #define HDRSIZE 11
     unsigned char hdr[HDRSIZE];
-    fseek(fp,mark,SEEK_SET);
-    fread(&hdr,1,HDRSIZE,fp);
+    mem_seek(fp,mark);
+    mem_read(&hdr,1,HDRSIZE,fp);
     memcpy(&header->unit_length,hdr+0,4); /* redundant, identical to v5 */
     memcpy(&header->version,hdr+4,2);     /* redundant, identical to v5 */
     memcpy(&header->abbrev_offs,hdr+6,4);
@@ -1108,15 +1435,15 @@ static int read_unitheader(FILE *fp,UNIT_HDR32 *header,int *size)
   return 1;
 }
 
-static int read_prologue(FILE *fp,DWARF_PROLOGUE32 *prologue,int *size)
+static int read_prologue(MEMFILE *fp,DWARF_PROLOGUE32 *prologue,int *size)
 {
   long mark;
 
   assert(fp!=NULL);
   assert(prologue!=NULL);
   assert(size!=NULL);
-  mark=ftell(fp); /* may need to "un-read" */
-  if (fread(prologue,sizeof(DWARF_PROLOGUE32),1,fp)==0)
+  mark=mem_tell(fp); /* may need to "un-read" */
+  if (mem_read(prologue,sizeof(DWARF_PROLOGUE32),1,fp)==0)
     return 0;     /* read failed */
   assert(prologue->total_length!=0xffffffff);  /* otherwise, should read 64-bit prologue */
   //??? on big_endian, swap version field before testing it
@@ -1139,8 +1466,8 @@ static int read_prologue(FILE *fp,DWARF_PROLOGUE32 *prologue,int *size)
      */
     #define HDRSIZE 15
     unsigned char hdr[HDRSIZE];
-    fseek(fp,mark,SEEK_SET);
-    fread(&hdr,1,HDRSIZE,fp);
+    mem_seek(fp,mark);
+    mem_read(&hdr,1,HDRSIZE,fp);
     memcpy(&prologue->total_length,hdr+0,4);  /* redundant, identical to v5 */
     memcpy(&prologue->version,hdr+4,2);       /* redundant, identical to v5 */
     memcpy(&prologue->prologue_length,hdr+6,4);
@@ -1172,8 +1499,8 @@ static int read_prologue(FILE *fp,DWARF_PROLOGUE32 *prologue,int *size)
      */
     #define HDRSIZE 16
     unsigned char hdr[HDRSIZE];
-    fseek(fp,mark,SEEK_SET);
-    fread(&hdr,sizeof(hdr),1,fp);
+    mem_seek(fp,mark);
+    mem_read(&hdr,sizeof(hdr),1,fp);
     memcpy(&prologue->total_length,hdr+0,4);  /* redundant, identical to v5 */
     memcpy(&prologue->version,hdr+4,2);       /* redundant, identical to v5 */
     memcpy(&prologue->prologue_length,hdr+6,4);
@@ -1212,526 +1539,2360 @@ static void clear_state(STATE *state,int default_is_stmt)
   state->discriminator=0;
 }
 
-/* dwarf_linetable() parses the .debug_line table and retrieves the
-   line-number/code-address tupples. DWARF implements the table as a state
-   machine with pseudo-instructions to set/clear state fields. There may be
-   several of such state programs in the section.
-   The output of this function is a list with line information structures and
-   a list of filenames. The each element of the line number structure includes
-   an index into the file list. The line number list is sorted on the code
-   address */
-static int dwarf_linetable(FILE *fp,const DWARFTABLE tables[],
-                           DWARF_LINELOOKUP *linetable,DWARF_PATHLIST *filetable,
-                           PATHXREF *xreftable)
+/* The DWARF units are decoded in parallel: the offsets of all units are
+   collected first, then a pool of threads decodes the units into per-thread
+   arenas, and finally, the results are merged in unit order (so that the
+   result does not depend on the scheduling of the threads). */
+#if !defined DWARF_MAX_THREADS
+  #define DWARF_MAX_THREADS 16
+#endif
+
+typedef struct tagUNITINFO {
+  unsigned long offset;       /* file offset of the unit */
+  int unit;                   /* unit number (index in the path cross-reference) */
+  int arena;                  /* arena that holds the rows or symbols of the unit */
+  unsigned start,count;       /* range of the rows or symbols in the arena */
+  DWARF_PATHLIST file_list;   /* local file table (for line programs) */
+  int address_size;           /* address size (for information units) */
+  int result;
+} UNITINFO;
+
+typedef struct tagUNITPOOL {
+  MEMFILE image;              /* each worker makes its own copy of the cursor */
+  const DWARFTABLE *tables;
+  const PATHXREF *xreftable;
+  UNITINFO *units;
+  int numunits;
+  int nextunit;               /* next unit to be picked up by a worker */
+  int (*decode)(struct tagUNITPOOL *pool,MEMFILE *fp,int arena,int unit);
+  LINEARRAY lines[DWARF_MAX_THREADS];
+  SYMARRAY symbols[DWARF_MAX_THREADS];
+  struct tagLAZYUNIT *lazyunits;  /* destination of the decoded units (lazy mode) */
+# if defined WIN32 || defined _WIN32
+    LONG volatile counter;
+# else
+    pthread_mutex_t lock;
+# endif
+} UNITPOOL;
+
+typedef struct tagUNITWORKER {
+  UNITPOOL *pool;
+  int arena;
+} UNITWORKER;
+
+static int unitpool_next(UNITPOOL *pool)
+{
+  int unit;
+# if defined WIN32 || defined _WIN32
+    unit=(int)InterlockedIncrement(&pool->counter)-1;
+# else
+    pthread_mutex_lock(&pool->lock);
+    unit=pool->nextunit++;
+    pthread_mutex_unlock(&pool->lock);
+# endif
+  return unit;
+}
+
+#if defined WIN32 || defined _WIN32
+static DWORD __stdcall unitpool_worker(LPVOID arg)
+#else
+static void *unitpool_worker(void *arg)
+#endif
+{
+  UNITWORKER *worker=(UNITWORKER*)arg;
+  UNITPOOL *pool=worker->pool;
+  MEMFILE memfile=pool->image;
+  int unit;
+
+  while ((unit=unitpool_next(pool))<pool->numunits) {
+    pool->units[unit].arena=worker->arena;
+    pool->units[unit].result=pool->decode(pool,&memfile,worker->arena,unit);
+  }
+  return 0;
+}
+
+static int unitpool_threads(int numunits)
+{
+  int count;
+# if defined WIN32 || defined _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    count=(int)info.dwNumberOfProcessors;
+# elif defined _SC_NPROCESSORS_ONLN
+    count=(int)sysconf(_SC_NPROCESSORS_ONLN);
+# else
+    count=1;
+# endif
+  if (count>DWARF_MAX_THREADS)
+    count=DWARF_MAX_THREADS;
+  if (count>numunits)
+    count=numunits;
+  return (count>=1) ? count : 1;
+}
+
+/* unitpool_run() decodes all units, and returns 1 on success (all units) */
+static int unitpool_run(UNITPOOL *pool)
+{
+  UNITWORKER workers[DWARF_MAX_THREADS];
+  int idx,count,result;
+# if defined WIN32 || defined _WIN32
+    HANDLE hThread[DWARF_MAX_THREADS];
+# else
+    pthread_t hThread[DWARF_MAX_THREADS];
+    int started[DWARF_MAX_THREADS];
+# endif
+
+  count=unitpool_threads(pool->numunits);
+  pool->nextunit=0;
+  for (idx=0; idx<count; idx++) {
+    workers[idx].pool=pool;
+    workers[idx].arena=idx;
+  }
+  /* the calling thread is worker 0, start the others as threads (if a thread
+     cannot be created, the remaining workers pick up its share) */
+# if defined WIN32 || defined _WIN32
+    pool->counter=0;
+    for (idx=1; idx<count; idx++)
+      hThread[idx]=CreateThread(NULL,0,unitpool_worker,&workers[idx],0,NULL);
+    unitpool_worker(&workers[0]);
+    for (idx=1; idx<count; idx++) {
+      if (hThread[idx]!=NULL) {
+        WaitForSingleObject(hThread[idx],INFINITE);
+        CloseHandle(hThread[idx]);
+      }
+    }
+# else
+    pthread_mutex_init(&pool->lock,NULL);
+    for (idx=1; idx<count; idx++)
+      started[idx]=(pthread_create(&hThread[idx],NULL,unitpool_worker,&workers[idx])==0);
+    unitpool_worker(&workers[0]);
+    for (idx=1; idx<count; idx++)
+      if (started[idx])
+        pthread_join(hThread[idx],NULL);
+    pthread_mutex_destroy(&pool->lock);
+# endif
+
+  result=1;
+  for (idx=0; idx<pool->numunits; idx++)
+    if (!pool->units[idx].result)
+      result=0;
+  return result;
+}
+
+static void unitpool_cleanup(UNITPOOL *pool)
+{
+  int idx;
+
+  for (idx=0; idx<pool->numunits; idx++)
+    path_deletetable(&pool->units[idx].file_list);
+  if (pool->units!=NULL)
+    free(pool->units);
+  for (idx=0; idx<DWARF_MAX_THREADS; idx++) {
+    if (pool->lines[idx].entries!=NULL)
+      free(pool->lines[idx].entries);
+    symarray_delete(&pool->symbols[idx]);
+  }
+  memset(pool,0,sizeof(UNITPOOL));
+}
+
+static int unitpool_add(UNITPOOL *pool,unsigned long offset,int *size)
+{
+  if (pool->numunits>=*size) {
+    int newsize=(*size==0) ? 64 : 2*(*size);
+    UNITINFO *list=(UNITINFO*)realloc(pool->units,newsize*sizeof(UNITINFO));
+    if (list==NULL)
+      return 0;
+    pool->units=list;
+    *size=newsize;
+  }
+  memset(&pool->units[pool->numunits],0,sizeof(UNITINFO));
+  pool->units[pool->numunits].offset=offset;
+  pool->units[pool->numunits].unit=pool->numunits;
+  pool->numunits+=1;
+  return 1;
+}
+
+/* line_decodeunit() runs the "line program" of a single unit; it appends the
+   rows to the arena (with file indices that are local to the unit). If
+   "header_only" is set, only the file table of the unit is read. */
+static int line_decodeunit(MEMFILE *fp,unsigned long offset,LINEARRAY *rows,DWARF_PATHLIST *file_list,
+                           int header_only)
 {
   DWARF_PROLOGUE32 prologue;
   STATE state;
   int dirpos,opcode,lebsize,prologue_size;
-  int unit,idx;
-  long value;
-  unsigned tableoffset,tablesize;
+  int idx,byte;
+  long value,count;
+  uint8_t *std_argcnt;  /* array with argument counts for standard opcodes */
   char path[_MAX_PATH];
   DWARF_PATHLIST include_list = { NULL };
-  DWARF_PATHLIST file_list = { NULL };
-  DWARF_LINELOOKUP line_list = { NULL };
-  DWARF_PATHLIST *fileitem;
-  DWARF_LINELOOKUP *lineitem;
 
-  assert(fp!=NULL);
-  assert(tables!=NULL);
-  assert(linetable!=NULL);
+  mem_seek(fp,offset);
+  /* check the prologue */
+  read_prologue(fp,&prologue,&prologue_size);
+  /* read the argument counts for the standard opcodes */
+  std_argcnt=(uint8_t*)malloc(prologue.opcode_base-1*sizeof(uint8_t));
+  if (std_argcnt==NULL)
+    return 0;
+  mem_read(std_argcnt,1,prologue.opcode_base-1,fp);
+  assert(prologue.version<5); //??? for DWARF 5+, the format for the include-paths and filenames tables is different
+  /* read the include-paths table */
+  while ((byte=mem_getc(fp))!=EOF && byte!='\0') {
+    for (idx=0; byte!=EOF && byte!='\0'; idx++) {
+      path[idx]=(char)byte;
+      byte=mem_getc(fp);
+    }
+    path[idx]='\0';
+    path_insert(&include_list,path);
+  }
+  /* read the filenames table */
+  while ((byte=mem_getc(fp))!=EOF && byte!='\0') {
+    for (idx=0; byte!=EOF && byte!='\0'; idx++) {
+      path[idx]=(char)byte;
+      byte=mem_getc(fp);
+    }
+    path[idx]='\0';
+    dirpos=read_leb128(fp,0,NULL);  /* read directory index */
+    read_leb128(fp,0,NULL);         /* skip modification time (GCC sets this to 0) */
+    read_leb128(fp,0,NULL);         /* skip source file size (GCC sets this to 0) */
+    if (dirpos>0 && strpbrk(path,"\\/")==NULL) {
+      char *dir=path_get(&include_list,dirpos-1);
+      strins(path,"/");
+      strins(path,dir);
+    }
+    path_insert(file_list,path);
+  }
+  path_deletetable(&include_list);
+  if (header_only) {
+    free(std_argcnt);
+    return 1;
+  }
+
+  /* jump to the start of the program, then start running */
+  clear_state(&state,prologue.default_is_stmt);
+  mem_seek(fp,offset+prologue.prologue_length+10);  /* +10 because the offset is relative to the field position */
+  count=prologue.total_length-prologue.prologue_length-6;
+  while (count>0) {
+    opcode=mem_getc(fp);
+    count--;
+    if (opcode==EOF)
+      break;
+    if (opcode<prologue.opcode_base) {
+      /* standard (or extended) opcode */
+      switch (opcode) {
+      case DW_LNS_extended_op:
+        value=read_leb128(fp,0,&lebsize);
+        count-=lebsize+value;
+        opcode=mem_getc(fp);
+        switch (opcode) {
+        case DW_LNE_end_sequence:
+          state.end_seq=1;
+          line_append(rows,state.line,state.address,state.file-1);
+          clear_state(&state,prologue.default_is_stmt);  /* reset to default values */
+          break;
+        case DW_LNE_set_address:
+          value=mem_getc(fp);
+          value|=(long)mem_getc(fp) << 8;
+          value|=(long)mem_getc(fp) << 16;
+          value|=(long)mem_getc(fp) << 24;
+          state.address=value;
+          break;
+        case DW_LNE_define_file:
+          for (idx=0; (byte=mem_getc(fp))!=EOF && byte!='\0'; idx++) {
+            path[idx]=(char)byte;
+            byte=mem_getc(fp);
+          }
+          path[idx]='\0';
+          dirpos=read_leb128(fp,0,NULL);  /* read directory index */
+          read_leb128(fp,0,NULL);         /* skip modification time (GCC sets this to 0) */
+          read_leb128(fp,0,NULL);         /* skip source file size (GCC sets this to 0) */
+          if (dirpos>0 && strpbrk(path,"\\/")==NULL) {
+            char *dir=path_get(&include_list,dirpos-1);
+            strins(path,"/");
+            strins(path,dir);
+          }
+          path_insert(file_list,path);
+          break;
+        case DW_LNE_set_discriminator:
+          state.discriminator=read_leb128(fp,0,NULL);
+          break;
+        default:
+          while (value-->0) /* skip any unrecognized extended opcode */
+            mem_getc(fp);
+        }
+        break;
+      case DW_LNS_copy:
+        line_append(rows,state.line,state.address,state.file-1);
+        state.basic_block=0;
+        break;
+      case DW_LNS_advance_pc:
+        value=read_leb128(fp,0,&lebsize);
+        count-=lebsize;
+        state.address+=value*prologue.min_instruction_size;
+        break;
+      case DW_LNS_advance_line:
+        value=read_leb128(fp,1,&lebsize);
+        count-=lebsize;
+        state.line+=value;
+        break;
+      case DW_LNS_set_file:
+        value=read_leb128(fp,0,&lebsize);
+        count-=lebsize;
+        state.file=value;
+        break;
+      case DW_LNS_set_column:
+        value=read_leb128(fp,0,&lebsize);
+        count-=lebsize;
+        state.column=value;
+        break;
+      case DW_LNS_negate_stmt:
+        state.is_stmt=!state.is_stmt;
+        break;
+      case DW_LNS_set_basic_block:
+        state.basic_block=1;
+        break;
+      case DW_LNS_const_add_pc:
+        state.address+=((255-prologue.opcode_base)/prologue.line_range)*prologue.min_instruction_size;
+        break;
+      case DW_LNS_fixed_advance_pc:
+        value=mem_getc(fp);
+        value|=mem_getc(fp) << 8;
+        state.address+=value;
+        count-=2;
+        break;
+      case DW_LNS_set_prologue_end:
+        state.prologue_end=1;
+        break;
+      case DW_LNS_set_epilogue_begin:
+        state.epiloge_begin=1;
+        break;
+      case DW_LNS_set_isa:
+        value=read_leb128(fp,0,&lebsize);
+        count-=lebsize;
+        state.isa=value;
+        break;
+      default:
+        /* skip opcode and any parameters */
+        for (idx=0; idx<std_argcnt[opcode-1]; idx++) {
+          read_leb128(fp,0,&lebsize);
+          count-=lebsize;
+        }
+      }
+    } else {
+      /* special opcode */
+      opcode-=prologue.opcode_base;
+      assert(prologue.max_oper_per_instruction==1); /* for VLIW architecture, the calculation below must be adjusted */
+      state.address+=(opcode/prologue.line_range)*prologue.min_instruction_size;
+      state.line+=prologue.line_base+opcode%prologue.line_range;
+      line_append(rows,state.line,state.address,state.file-1);
+      state.basic_block=0;
+      state.prologue_end=0;
+      state.epiloge_begin=0;
+      state.discriminator=0;
+    }
+  }
+
+  free(std_argcnt);
+  return 1;
+}
+
+static int line_decodetask(UNITPOOL *pool,MEMFILE *fp,int arena,int unit)
+{
+  UNITINFO *info=&pool->units[unit];
+  int result;
+  info->start=pool->lines[arena].count;
+  result=line_decodeunit(fp,info->offset,&pool->lines[arena],&info->file_list,0);
+  info->count=pool->lines[arena].count-info->start;
+  return result;
+}
+
+/* dwarf_linetable() parses the .debug_line table and retrieves the
+   line-number/code-address tupples. DWARF implements the table as a state
+   machine with pseudo-instructions to set/clear state fields. There may be
+   several of such state programs in the section.
+   The output of this function is a table with line information structures and
+   a list of filenames. The each element of the line number structure includes
+   an index into the file list. The line number table is sorted on the code
+   address */
+static int dwarf_linetable(MEMFILE *fp,const DWARFTABLE tables[],
+                           DWARF_LINETABLE *linetable,DWARF_PATHLIST *filetable,
+                           PATHXREF *xreftable)
+{
+  DWARF_PROLOGUE32 prologue;
+  UNITPOOL pool;
+  LINEARRAY line_list = { NULL };
+  DWARF_PATHLIST *fileitem;
+  unsigned long tableoffset,tablesize;
+  int prologue_size,unit,idx,size,result;
+
+  assert(fp!=NULL);
+  assert(tables!=NULL);
+  assert(linetable!=NULL);
   assert(linetable->next==NULL);  /* linetable should be empty */
   assert(filetable!=NULL);
   assert(filetable->next==NULL);  /* filetable should be empty */
   assert(xreftable!=NULL);
-  assert(xreftable->next==NULL);  /* path cross-reference should be empty */
+  assert(xreftable->xlat==NULL);  /* path cross-reference should be empty */
 
   tableoffset=tables[TABLE_LINE].offset;
   tablesize=tables[TABLE_LINE].size;
   assert(tableoffset>0 && tablesize>0); /* debug information should have been found */
-  fseek(fp,tableoffset,SEEK_SET);
 
-  unit=0;
-  prologue_size=sizeof(prologue); /* initial assumption */
-  while (tablesize>prologue_size) {
-    uint8_t *std_argcnt;  /* array with argument counts for standard opcodes */
-    long count;
-    int byte;
-    /* check the prologue */
-    read_prologue(fp,&prologue,&prologue_size);
-    /* read the argument counts for the standard opcodes */
-    std_argcnt=(uint8_t*)malloc(prologue.opcode_base-1*sizeof(uint8_t));
-    if (std_argcnt==NULL)
-      return 0;
-    fread(std_argcnt,1,prologue.opcode_base-1,fp);
-    assert(prologue.version<5); //??? for DWARF 5+, the format for the include-paths and filenames tables is different
-    /* read the include-paths table */
-    while ((byte=fgetc(fp))!=EOF && byte!='\0') {
-      for (idx=0; byte!=EOF && byte!='\0'; idx++) {
-        path[idx]=(char)byte;
-        byte=fgetc(fp);
-      }
-      path[idx]='\0';
-      path_insert(&include_list,path);
+  /* collect the offsets of all line programs */
+  memset(&pool,0,sizeof(pool));
+  pool.image=*fp;
+  pool.tables=tables;
+  pool.decode=line_decodetask;
+  size=0;
+  prologue_size=sizeof(prologue); /* initial assumption */
+  while (tablesize>(unsigned long)prologue_size) {
+    unsigned long length;
+    mem_seek(fp,tableoffset);
+    if (!read_prologue(fp,&prologue,&prologue_size))
+      break;
+    length=prologue.total_length+4;
+    if (length>tablesize || !unitpool_add(&pool,tableoffset,&size))
+      break;
+    tablesize-=length;
+    tableoffset+=length;
+  }
+
+  /* decode the line programs */
+  result=unitpool_run(&pool) && pathxref_init(xreftable,pool.numunits);
+
+  /* merge the rows and the file tables, in unit order */
+  for (unit=0; unit<pool.numunits && result; unit++) {
+    UNITINFO *info=&pool.units[unit];
+    const DWARF_LINELOOKUP *rows=pool.lines[info->arena].entries+info->start;
+    int *filexlat;        /* translation of the local file index to the global one */
+    int filecount;
+
+    /* check which files in the local file table are referenced at all */
+    filecount=0;
+    for (fileitem=info->file_list.next; fileitem!=NULL; fileitem=fileitem->next)
+      filecount++;
+    filexlat=(int*)calloc(filecount+1,sizeof(int));
+    if (filexlat==NULL) {
+      result=0;
+      break;
+    }
+    for (idx=0; (unsigned)idx<info->count; idx++)
+      if (rows[idx].fileindex>=0 && rows[idx].fileindex<filecount)
+        filexlat[rows[idx].fileindex]=1;
+
+    /* merge the local file table with the global one; the cross-reference
+       is only set for files that are new in the global table */
+    idx=0;
+    for (fileitem=info->file_list.next; fileitem!=NULL; fileitem=fileitem->next) {
+      int tgt=-1;
+      if (filexlat[idx]) {
+        /* so this file is referenced, now see whether it is already in the global
+           file table */
+        const char *name=fileitem->name;
+        assert(name!=NULL);
+        if (path_find(filetable,name)<0) {
+          path_insert(filetable,name);
+          tgt=path_find(filetable,name);  /* find it back, to add a cross-reference */
+          assert(tgt>=0);
+        }
+      }
+      filexlat[idx]=tgt;
+      idx++;
+    }
+    xreftable->xlat[unit]=filexlat;
+    xreftable->count[unit]=filecount;
+
+    /* translate the index in the local file table to the index in the global
+       file table, for the rows of this unit */
+    for (idx=0; (unsigned)idx<info->count; idx++) {
+      int local=rows[idx].fileindex;
+      if (!line_append(&line_list,rows[idx].line,rows[idx].address,
+                       (local>=0 && local<filecount) ? filexlat[local] : -1))
+      {
+        result=0;
+        break;
+      }
+    }
+  }
+  unitpool_cleanup(&pool);
+
+  /* sort and de-duplicate the rows of all units in one pass */
+  if (!result) {
+    if (line_list.entries!=NULL)
+      free(line_list.entries);
+    return 0;
+  }
+  return line_buildtable(linetable,&line_list);
+}
+
+/* dwarf_infotable() parses the .debug_info table and collects the functions.
+ */
+/* info_decodeunit() decodes the tags of a single unit in the .debug_info
+   table, and appends the symbols to the arena. If "cu_range" is not NULL,
+   only the compilation unit tag is decoded, and its address range is stored
+   in cu_range[0] and cu_range[1]. */
+static int info_decodeunit(MEMFILE *fp,const DWARFTABLE tables[],unsigned long offset,int unit,
+                           SYMARRAY *symbols,const PATHXREF *xreftable,int *address_size,
+                           uint32_t *cu_range)
+{
+  UNIT_HDR32 header;
+  ABBREVTABLE abbrev_table = { NULL };
+  const ABBREVLIST *abbrev;
+  const unsigned char *unit_end;
+  int idx,size,hdrsize,result;
+  unsigned long unitsize;
+  char name[256],str[256];
+  int64_t value;
+  int file=-1,line=0;
+  uint32_t code_addr=0, code_addr_end=0;
+  uint32_t data_addr=0;
+  int external=0;
+  int declaration=0;
+  int level=0;
+
+  mem_seek(fp,offset);
+  if (!read_unitheader(fp,&header,&hdrsize))
+    return 0;
+  unitsize=header.unit_length-(hdrsize-4);
+  assert(unitsize<0xfffffff0);  /* if larger, should read the 64-bit version of the structure */
+  unit_end=fp->ptr+unitsize;
+  *address_size=header.address_size;
+  /* load the abbreviations for this unit */
+  assert(tables[TABLE_ABBREV].offset>0);/* required table */
+  if (!dwarf_abbrev(fp,tables,header.abbrev_offs,&abbrev_table)) {
+    abbrev_deletetable(&abbrev_table);
+    return 0;
+  }
+  mem_seek(fp,offset+hdrsize);
+
+  result=1;
+  name[0]='\0';
+  /* browse through the tags */
+  while (unitsize>0 && fp->ptr<unit_end) {
+    /* read the abbreviation code */
+    idx=(int)read_leb128(fp,0,&size);
+    unitsize-=size;
+    if (idx==0) {
+      level-=1;
+      continue;
+    }
+    abbrev=abbrev_find(&abbrev_table,idx);
+    if (abbrev==NULL) {
+      result=0;   /* invalid abbreviation code (corrupt data) */
+      break;
+    }
+    /* run through the attributes */
+    for (idx=0; idx<abbrev->count; idx++) {
+      int format=abbrev->attributes[idx].format;
+      if (format==DW_FORM_indirect) {
+        /* format is specified in the .debug_info data (not in the abbreviation) */
+        format=read_leb128(fp,1,&size);
+        unitsize-=size;
+      }
+      switch (format) {
+      case DW_FORM_data1:             /* constant, 1 byte */
+      case DW_FORM_data2:             /* constant, 2 bytes */
+      case DW_FORM_data4:             /* constant, 4 bytes */
+      case DW_FORM_data8:             /* constant, 8 bytes */
+      case DW_FORM_sdata:             /* constant, signed LEB128 */
+      case DW_FORM_udata:             /* constant, unsigned LEB128 */
+      case DW_FORM_ref1:              /* reference, 1 bytes */
+      case DW_FORM_ref2:              /* reference, 2 bytes */
+      case DW_FORM_ref4:              /* reference, 4 bytes */
+      case DW_FORM_ref8:              /* reference, 8 bytes */
+      case DW_FORM_ref_udata:         /* reference, unsigned LEB128 */
+      case DW_FORM_flag:              /* flag, 1 byte (0=false, any non-zero=true) */
+      case DW_FORM_flag_present:      /* flag, no data */
+      case DW_FORM_ref_sig8:          /* type signature, 8 bytes */
+      case DW_FORM_exprloc:           /* block, unsigned LEB128-encoded length + data bytes */
+      case DW_FORM_ref_sup4:
+      case DW_FORM_ref_sup8:
+        value=read_value(fp,abbrev->attributes[idx].format,&size);
+        break;
+      case DW_FORM_addr:              /* address, 4 bytes for 32-bit, 8 bytes for 64-bit */
+      case DW_FORM_ref_addr:          /* reference, address size (4 bytes on 32-bit, 8 bytes on 64-bit) */
+      case DW_FORM_sec_offset:        /* offset to line number data (4 bytes on 32-bit, 8 bytes on 64-bit) */
+        value=0;
+        mem_read(&value,1,header.address_size,fp);
+        size=header.address_size;
+        break;
+      case DW_FORM_string:            /* string, zero-terminated */
+      case DW_FORM_strp:              /* string, 4-byte offset into the .debug_str section */
+      case DW_FORM_strp_sup:
+      case DW_FORM_block:             /* block, unsigned LEB128-encoded length + data bytes */
+      case DW_FORM_block1:            /* block, 1-byte length + up to 255 data bytes */
+      case DW_FORM_block2:            /* block, 2-byte length + up to 64K data bytes */
+      case DW_FORM_block4:            /* block, 4-byte length + up to 4G data bytes */
+        read_string(fp,abbrev->attributes[idx].format,tables[TABLE_STR].offset,str,sizeof(str),&size);
+        break;
+      case DW_FORM_line_strp:
+        read_string(fp,abbrev->attributes[idx].format,tables[TABLE_LINE_STR].offset,str,sizeof(str),&size);
+        break;
+      case DW_FORM_implicit_const:
+        value=abbrev->attributes[idx].value;
+        size=0;
+        break;
+      default:
+        assert(0);
+      }
+      unitsize-=size;
+      if (abbrev->tag==DW_TAG_subprogram || abbrev->tag==DW_TAG_variable || abbrev->tag==DW_TAG_formal_parameter) {
+        //??? also handle DW_TAG_lexical_block for the scope of local variables
+        /* store selected fields */
+        switch (abbrev->attributes[idx].tag) {
+        case DW_AT_name:
+          strcpy(name,str);
+          break;
+        case DW_AT_low_pc:
+          if (abbrev->tag==DW_TAG_subprogram)
+            code_addr=(uint32_t)value;
+          break;
+        case DW_AT_high_pc:
+          if (abbrev->tag==DW_TAG_subprogram) {
+            code_addr_end=(uint32_t)value;
+            /* depending on the format, the "high pc" value is an offset
+               instead of an address */
+            if (abbrev->attributes[idx].format!=DW_FORM_addr)
+              code_addr_end+=code_addr;
+          }
+          break;
+        case DW_AT_decl_file:
+          file=pathxref_find(xreftable,unit,(int)value-1);
+          break;
+        case DW_AT_decl_line:
+          line=(int)value;
+          break;
+        case DW_AT_location:
+          if (abbrev->tag==DW_TAG_variable)
+            data_addr=(uint32_t)value;  /* global / static variable */
+          break;
+        case DW_AT_external:
+          if (abbrev->tag==DW_TAG_variable)
+            external=(int)value;
+          break;
+        case DW_AT_declaration:
+          declaration=(int)value;
+          break;
+        }
+      } else if (abbrev->tag==DW_TAG_compile_unit && cu_range!=NULL) {
+        if (abbrev->attributes[idx].tag==DW_AT_low_pc) {
+          cu_range[0]=(uint32_t)value;
+        } else if (abbrev->attributes[idx].tag==DW_AT_high_pc) {
+          cu_range[1]=(uint32_t)value;
+          if (abbrev->attributes[idx].format!=DW_FORM_addr)
+            cu_range[1]+=cu_range[0];
+        }
+      }
+    } /* for (idx<abbrev->count) */
+    if (cu_range!=NULL)
+      break;  /* only the compilation unit tag was requested */
+    if ((abbrev->tag==DW_TAG_subprogram && code_addr_end>code_addr)
+        || (abbrev->tag==DW_TAG_variable && data_addr!=0))
+      declaration=0;
+    if ((abbrev->tag==DW_TAG_subprogram || abbrev->tag==DW_TAG_variable || abbrev->tag==DW_TAG_formal_parameter)
+        && !declaration) {
+      /* inlined functions are added as if they have address 0; when inline
+         functions get instantiated, these are added as "references" to
+         functions; these are not handled */
+      assert(code_addr_end>=code_addr);
+      if (name[0]!='\0' && file>=0
+          && symname_insert(symbols,name,code_addr,code_addr_end-code_addr,
+                            data_addr,file,line,external)==NULL)
+        result=0;
+      name[0]='\0';
+      code_addr=code_addr_end=0;
+      data_addr=0;
+      external=0;
+      declaration=0;
+      file=-1;
+    }
+    if (abbrev->has_children)
+      level+=1;
+  }
+  abbrev_deletetable(&abbrev_table);
+  return result;
+}
+
+static int info_decodetask(UNITPOOL *pool,MEMFILE *fp,int arena,int unit)
+{
+  UNITINFO *info=&pool->units[unit];
+  int result;
+  info->start=pool->symbols[arena].count;
+  result=info_decodeunit(fp,pool->tables,info->offset,info->unit,&pool->symbols[arena],
+                         pool->xreftable,&info->address_size,NULL);
+  info->count=pool->symbols[arena].count-info->start;
+  return result;
+}
+
+static int dwarf_infotable(MEMFILE *fp,const DWARFTABLE tables[],
+                           SYMARRAY *symboltable,int *address_size,
+                           const PATHXREF *xreftable)
+{
+  UNIT_HDR32 header;
+  UNITPOOL pool;
+  unsigned long tableoffset,tablesize;
+  int unit,size,hdrsize,result;
+
+  assert(fp!=NULL);
+  assert(tables!=NULL);
+  assert(symboltable!=NULL);
+  assert(symboltable->count==0);  /* symboltable should be empty */
+  assert(address_size!=NULL);
+  assert(xreftable!=NULL);
+
+  assert(tables[TABLE_INFO].offset>0);  /* debug information should have been found */
+  tableoffset=tables[TABLE_INFO].offset;
+  tablesize=tables[TABLE_INFO].size;
+
+  /* collect the offsets of all units */
+  memset(&pool,0,sizeof(pool));
+  pool.image=*fp;
+  pool.tables=tables;
+  pool.xreftable=xreftable;
+  pool.decode=info_decodetask;
+  size=0;
+  while (tablesize>sizeof(header)) {
+    unsigned long length;
+    mem_seek(fp,tableoffset);
+    if (!read_unitheader(fp,&header,&hdrsize))
+      break;
+    length=header.unit_length+4;
+    if (length>tablesize || !unitpool_add(&pool,tableoffset,&size))
+      break;
+    tablesize-=length;
+    tableoffset+=length;
+  }
+
+  /* decode the units */
+  result=unitpool_run(&pool);
+
+  /* concatenate the symbols, in unit order */
+  for (unit=0; unit<pool.numunits && result; unit++) {
+    UNITINFO *info=&pool.units[unit];
+    SYMARRAY *arena=&pool.symbols[info->arena];
+    unsigned idx;
+    *address_size=info->address_size;
+    if (symboltable->count+info->count>symboltable->size) {
+      unsigned newsize=(symboltable->size==0) ? 256 : symboltable->size;
+      DWARF_SYMBOLLIST *list;
+      while (newsize<symboltable->count+info->count)
+        newsize*=2;
+      list=(DWARF_SYMBOLLIST*)realloc(symboltable->entries,newsize*sizeof(DWARF_SYMBOLLIST));
+      if (list==NULL) {
+        result=0;
+        break;
+      }
+      symboltable->entries=list;
+      symboltable->size=newsize;
+    }
+    for (idx=0; idx<info->count; idx++) {
+      symboltable->entries[symboltable->count++]=arena->entries[info->start+idx];
+      arena->entries[info->start+idx].name=NULL;  /* ownership moved */
+    }
+  }
+  unitpool_cleanup(&pool);
+  return result;
+}
+static int sym_cmp_fileline(const void *p1,const void *p2)
+{
+  const DWARF_SYMBOLLIST *s1=*(const DWARF_SYMBOLLIST**)p1;
+  const DWARF_SYMBOLLIST *s2=*(const DWARF_SYMBOLLIST**)p2;
+  if (s1->fileindex!=s2->fileindex)
+    return (s1->fileindex<s2->fileindex) ? -1 : 1;
+  if (s1->line!=s2->line)
+    return (s1->line<s2->line) ? -1 : 1;
+  return (s1<s2) ? -1 : (s1>s2) ? 1 : 0;
+}
+
+/* dwarf_postprocess() sets the line range of each function, and then assigns
+   function scope to all local variables that are declared in that range. The
+   functions and the local variables are both sorted on file & line, and these
+   two lists are merged. The symbols are in an array (the symbol table, or the
+   symbols of a unit). */
+static int dwarf_postprocess(DWARF_SYMBOLLIST *symbols,unsigned count,const DWARF_LINETABLE *linetable)
+{
+  DWARF_SYMBOLLIST **functions,**locals,**active;
+  unsigned idx,numfunctions,numlocals,numactive,fidx;
+
+  assert(linetable!=NULL);
+  if (count==0)
+    return 1;
+  assert(symbols!=NULL);
+  functions=(DWARF_SYMBOLLIST**)malloc(count*sizeof(DWARF_SYMBOLLIST*));
+  locals=(DWARF_SYMBOLLIST**)malloc(count*sizeof(DWARF_SYMBOLLIST*));
+  active=(DWARF_SYMBOLLIST**)malloc(count*sizeof(DWARF_SYMBOLLIST*));
+  if (functions==NULL || locals==NULL || active==NULL) {
+    if (functions!=NULL)
+      free(functions);
+    if (locals!=NULL)
+      free(locals);
+    if (active!=NULL)
+      free(active);
+    return 0;
+  }
+
+  numfunctions=numlocals=0;
+  for (idx=0; idx<count; idx++) {
+    DWARF_SYMBOLLIST *sym=&symbols[idx];
+    if (DWARF_IS_FUNCTION(sym)) {
+      /* the line range of the function ends at the line of the last entry in
+         the line table that precedes the end address of the function */
+      uint32_t addr=sym->code_addr+sym->code_range;
+      unsigned low=0,high=linetable->count;
+      while (low<high) {
+        unsigned mid=low+(high-low)/2;
+        if (line_entry(linetable,mid)->address<addr)
+          low=mid+1;
+        else
+          high=mid;
+      }
+      if (low>0)
+        sym->line_limit=line_entry(linetable,low-1)->line+1; /* +1 for consistency with DWARF address range */
+      if (sym->line_limit>sym->line)
+        functions[numfunctions++]=sym;
+    } else if (sym->scope==SCOPE_UNKNOWN) {
+      locals[numlocals++]=sym;
+    }
+  }
+  qsort(functions,numfunctions,sizeof(DWARF_SYMBOLLIST*),sym_cmp_fileline);
+  qsort(locals,numlocals,sizeof(DWARF_SYMBOLLIST*),sym_cmp_fileline);
+
+  /* walk through the local variables, and keep a list of the functions whose
+     range covers the line of the variable; when ranges overlap, the function
+     that comes first in the array wins */
+  numactive=fidx=0;
+  for (idx=0; idx<numlocals; idx++) {
+    DWARF_SYMBOLLIST *lcl=locals[idx],*owner;
+    unsigned a;
+    if (idx>0 && lcl->fileindex!=locals[idx-1]->fileindex)
+      numactive=0;
+    while (fidx<numfunctions
+           && (functions[fidx]->fileindex<lcl->fileindex
+               || (functions[fidx]->fileindex==lcl->fileindex && functions[fidx]->line<=lcl->line)))
+    {
+      if (functions[fidx]->fileindex==lcl->fileindex)
+        active[numactive++]=functions[fidx];
+      fidx++;
+    }
+    owner=NULL;
+    for (a=0; a<numactive; ) {
+      if (active[a]->line_limit<=lcl->line) {
+        active[a]=active[--numactive];  /* range ended, remove from the list */
+      } else {
+        if (owner==NULL || active[a]<owner)
+          owner=active[a];
+        a++;
+      }
+    }
+    if (owner!=NULL) {
+      assert(lcl->code_addr==0);  /* nested functions don't occur */
+      lcl->scope=SCOPE_FUNCTION;
+      lcl->line_limit=owner->line_limit;
+      assert(lcl->line_limit>lcl->line);
+    }
+  }
+
+  free(functions);
+  free(locals);
+  free(active);
+  return 1;
+}
+
+/* dwarf_read() returns three lists: a list with source code line numbers,
+ * a list with functions and a list with the file paths (referred to by the
+ * other two lists)
+ */
+static unsigned long phase_time[DWARF_PHASE_COUNT];
+
+/* phase_clock() returns a wall-clock time stamp in milliseconds (CPU time is
+   not a useful measure, because units are decoded by multiple threads) */
+static unsigned long phase_clock(void)
+{
+# if defined WIN32 || defined _WIN32
+    return GetTickCount();
+# else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (unsigned long)ts.tv_sec*1000+ts.tv_nsec/1000000;
+# endif
+}
+
+#define PHASE_MARK(phase,mark) \
+  do { unsigned long now=phase_clock(); phase_time[phase]=now-(mark); (mark)=now; } while (0)
+
+/* dwarf_gettables() gets the offsets to the various debug tables */
+static void dwarf_gettables(const ELF_IMAGE *image,DWARFTABLE tables[])
+{
+  elf_image_section(image,".debug_info",&tables[TABLE_INFO].offset,NULL,&tables[TABLE_INFO].size);
+  elf_image_section(image,".debug_abbrev",&tables[TABLE_ABBREV].offset,NULL,&tables[TABLE_ABBREV].size);
+  elf_image_section(image,".debug_str",&tables[TABLE_STR].offset,NULL,&tables[TABLE_STR].size);
+  elf_image_section(image,".debug_line",&tables[TABLE_LINE].offset,NULL,&tables[TABLE_LINE].size);
+  elf_image_section(image,".debug_pubnames",&tables[TABLE_PUBNAME].offset,NULL,&tables[TABLE_PUBNAME].size);
+  elf_image_section(image,".debug_line_str",&tables[TABLE_LINE_STR].offset,NULL,&tables[TABLE_LINE_STR].size);
+  elf_image_section(image,".debug_names",&tables[TABLE_NAMES].offset,NULL,&tables[TABLE_NAMES].size);
+}
+
+/** dwarf_read() reads the DWARF information from an ELF file. The file is
+ *  mapped into memory for the duration of the call; see dwarf_read_image() to
+ *  read the information from an image that is already mapped.
+ */
+int dwarf_read(FILE *fp,DWARF_LINETABLE *linetable,DWARF_SYMBOLTABLE *symboltable,
+               DWARF_PATHLIST *filetable,int *address_size)
+{
+  ELF_IMAGE image;
+  int result;
+
+  assert(fp!=NULL);
+  if (elf_image_open(fp,&image)!=ELFERR_NONE)
+    return 0;
+  result=dwarf_read_image(&image,linetable,symboltable,filetable,address_size);
+  elf_image_close(&image);
+  return result;
+}
+
+int dwarf_read_image(const ELF_IMAGE *image,DWARF_LINETABLE *linetable,DWARF_SYMBOLTABLE *symboltable,
+                     DWARF_PATHLIST *filetable,int *address_size)
+{
+  DWARFTABLE tables[TABLE_COUNT];
+  PATHXREF xreftable = { NULL };
+  SYMARRAY sym_list = { NULL };
+  MEMFILE memfile;
+  MEMFILE *fp=&memfile;
+  int result;
+  unsigned long mark;
+
+  assert(image!=NULL && image->data!=NULL);
+  assert(linetable!=NULL);        /* tables must be valid, but empty */
+  assert(linetable->next==NULL);
+  assert(symboltable!=NULL);
+  assert(symboltable->next==NULL);
+  assert(filetable!=NULL);
+  assert(filetable->next==NULL);
+  assert(address_size!=NULL);
+
+  if (image->wordsize!=32)
+    return 0; /* only 32-bit architectures at this time */
+  memfile.base=memfile.ptr=image->data;
+  memfile.end=image->data+image->size;
+
+  dwarf_gettables(image,tables);
+
+  memset(phase_time,0,sizeof phase_time);
+  mark=phase_clock();
+  result=1;
+  /* the line table also holds information for the file path table and the path
+     cross-reference; the table is therefore mandatory in the DWARF format and
+     it is the first one to parse */
+  if (tables[TABLE_LINE].offset!=0)
+    result=dwarf_linetable(fp,tables,linetable,filetable,&xreftable);
+  PHASE_MARK(DWARF_PHASE_LINES,mark);
+  /* the information table implicitly parses the abbreviations table, but it
+     discards that table before returning */
+  if (result && tables[TABLE_INFO].offset!=0)
+    result=dwarf_infotable(fp,tables,&sym_list,address_size,&xreftable);
+  PHASE_MARK(DWARF_PHASE_INFO,mark);
+
+  pathxref_deletetable(&xreftable);
+  if (result)
+    result=sym_buildtable(symboltable,&sym_list);
+  symarray_delete(&sym_list);
+  PHASE_MARK(DWARF_PHASE_SORT,mark);
+
+  /* now that we have seen all functions, we can update the scope of local
+     variables */
+  if (result)
+    result=dwarf_postprocess(symboltable->next,symboltable->count,linetable);
+  PHASE_MARK(DWARF_PHASE_SCOPE,mark);
+  if (result)
+    result=sym_buildindex(symboltable);
+  PHASE_MARK(DWARF_PHASE_INDEX,mark);
+
+  return result;
+}
+
+/* In lazy mode, only a directory of the compilation units is built when the
+   file is loaded: the offsets of the line program and the information unit of
+   each unit, the address ranges of the units (from .debug_aranges, or from the
+   tag of the compilation unit), the file tables (from the headers of the line
+   programs) and the name indices (from .debug_names, or else the public names
+   from .debug_pubnames, if present). The lines
+   and symbols of a unit are decoded when a look-up touches that unit, into
+   arrays that the unit keeps until dwarf_cleanup(); as these arrays do not
+   move, pointers returned by earlier look-ups stay valid. The tables only hold
+   indices (arrays of pointers) into the arrays of the units that are loaded,
+   and the entries of newly loaded units are merged into these indices. Unlike
+   full decoding, the rows are compacted per unit (not over all units), and
+   symbols with the same name may be in a different order. The debug sections
+   that are needed for this are
+   copied into a private buffer, so that the ELF file is not kept open (or
+   mapped) between look-ups; the offsets in the tables are relative to this
+   buffer. */
+typedef struct tagLAZYUNIT {
+  unsigned long line_offset;  /* offset of the line program, 0 if none */
+  unsigned long info_offset;  /* offset of the information unit, 0 if none */
+  int state;                  /* LAZY_xxx */
+  int ranged;                 /* whether the address range of the unit is known */
+  LINEARRAY rows;             /* rows (with global file indices) */
+  SYMARRAY symbols;
+} LAZYUNIT;
+
+enum {
+  LAZY_UNLOADED,
+  LAZY_PENDING,
+  LAZY_LOADED,
+};
+
+typedef struct tagLAZYRANGE {
+  uint32_t low,high;
+  int unit;
+} LAZYRANGE;
+
+typedef struct tagLAZYNAME {
+  const char *name;           /* points into the section data */
+  int unit;
+} LAZYNAME;
+
+typedef struct tagLAZYINDEX { /* a name index in .debug_names */
+  unsigned long cu_list;      /* offsets of the sub-tables in the section data */
+  unsigned long buckets;
+  unsigned long hashes;
+  unsigned long strings;
+  unsigned long entries;
+  unsigned long abbrevs;
+  unsigned long pool;
+  unsigned long end;
+  uint32_t cu_count;
+  uint32_t bucket_count;      /* 0 if the index has no hash table */
+  uint32_t name_count;
+} LAZYINDEX;
+
+struct tagDWARF_LAZY {
+  unsigned char *data;        /* copy of the debug sections */
+  unsigned long size;
+  DWARFTABLE tables[TABLE_COUNT]; /* offsets are relative to "data" */
+  PATHXREF xreftable;
+  LAZYUNIT *units;
+  int numunits;
+  int numloaded;
+  LAZYRANGE *ranges;          /* sorted on address */
+  unsigned numranges;
+  LAZYNAME *names;            /* sorted on name */
+  unsigned numnames;
+  LAZYINDEX *indices;
+  unsigned numindices;
+  DWARF_LINETABLE *linetable;
+  DWARF_SYMBOLTABLE *symboltable;
+};
+
+static int lazy_cmp_range(const void *p1,const void *p2)
+{
+  const LAZYRANGE *r1=(const LAZYRANGE*)p1;
+  const LAZYRANGE *r2=(const LAZYRANGE*)p2;
+  if (r1->low!=r2->low)
+    return (r1->low<r2->low) ? -1 : 1;
+  return r1->unit-r2->unit;
+}
+
+static int lazy_cmp_name(const void *p1,const void *p2)
+{
+  const LAZYNAME *n1=(const LAZYNAME*)p1;
+  const LAZYNAME *n2=(const LAZYNAME*)p2;
+  int result=strcmp(n1->name,n2->name);
+  return (result!=0) ? result : n1->unit-n2->unit;
+}
+
+/* lazy_unit() returns the unit index for an information unit, or -1 */
+static int lazy_unit(const DWARF_LAZY *lazy,unsigned long info_offset)
+{
+  int low=0,high=lazy->numunits;
+  while (low<high) {
+    int mid=low+(high-low)/2;
+    unsigned long offs=lazy->units[mid].info_offset;
+    if (offs==info_offset)
+      return mid;
+    if (offs!=0 && offs<info_offset)
+      low=mid+1;
+    else
+      high=mid;
+  }
+  return -1;
+}
+
+static int lazy_addunit(DWARF_LAZY *lazy,int index,unsigned long offset,int info,int *size)
+{
+  if (index>=*size) {
+    int newsize=(*size==0) ? 64 : 2*(*size);
+    LAZYUNIT *list=(LAZYUNIT*)realloc(lazy->units,newsize*sizeof(LAZYUNIT));
+    if (list==NULL)
+      return 0;
+    memset(list+*size,0,(newsize-*size)*sizeof(LAZYUNIT));
+    lazy->units=list;
+    *size=newsize;
+  }
+  if (info)
+    lazy->units[index].info_offset=offset;
+  else
+    lazy->units[index].line_offset=offset;
+  if (index>=lazy->numunits)
+    lazy->numunits=index+1;
+  return 1;
+}
+
+static int lazy_addrange(DWARF_LAZY *lazy,uint32_t low,uint32_t high,int unit,unsigned *size)
+{
+  if (lazy->numranges>=*size) {
+    unsigned newsize=(*size==0) ? 64 : 2*(*size);
+    LAZYRANGE *list=(LAZYRANGE*)realloc(lazy->ranges,newsize*sizeof(LAZYRANGE));
+    if (list==NULL)
+      return 0;
+    lazy->ranges=list;
+    *size=newsize;
+  }
+  lazy->ranges[lazy->numranges].low=low;
+  lazy->ranges[lazy->numranges].high=high;
+  lazy->ranges[lazy->numranges].unit=unit;
+  lazy->numranges+=1;
+  lazy->units[unit].ranged=1;
+  return 1;
+}
+
+/* lazy_directory() collects the units, the file tables, the address ranges of
+   the units and the public names */
+static int lazy_directory(DWARF_LAZY *lazy,const ELF_IMAGE *image,MEMFILE *fp,
+                          DWARF_PATHLIST *filetable,int *address_size)
+{
+  DWARF_PROLOGUE32 prologue;
+  UNIT_HDR32 header;
+  const unsigned char *data,*ptr,*end;
+  unsigned long tableoffset,tablesize,length;
+  unsigned rangesize;
+  int unit,size,prologue_size,hdrsize,numfiles;
+
+  /* the line programs and the information units */
+  size=0;
+  tableoffset=lazy->tables[TABLE_LINE].offset;
+  tablesize=(tableoffset!=0) ? lazy->tables[TABLE_LINE].size : 0;
+  prologue_size=sizeof(prologue); /* initial assumption */
+  for (unit=0; tablesize>(unsigned long)prologue_size; unit++) {
+    mem_seek(fp,tableoffset);
+    if (!read_prologue(fp,&prologue,&prologue_size))
+      break;
+    length=prologue.total_length+4;
+    if (length>tablesize)
+      break;
+    if (!lazy_addunit(lazy,unit,tableoffset,0,&size))
+      return 0;
+    tablesize-=length;
+    tableoffset+=length;
+  }
+  tableoffset=lazy->tables[TABLE_INFO].offset;
+  tablesize=(tableoffset!=0) ? lazy->tables[TABLE_INFO].size : 0;
+  for (unit=0; tablesize>sizeof(header); unit++) {
+    mem_seek(fp,tableoffset);
+    if (!read_unitheader(fp,&header,&hdrsize))
+      break;
+    length=header.unit_length+4;
+    if (length>tablesize)
+      break;
+    if (!lazy_addunit(lazy,unit,tableoffset,1,&size))
+      return 0;
+    if (unit==0)
+      *address_size=header.address_size;
+    tablesize-=length;
+    tableoffset+=length;
+  }
+  if (lazy->numunits==0)
+    return 0;
+
+  /* the file tables: unlike the full decoding, all files in the header of a
+     line program are added to the global file table, because it is unknown
+     at this point which files the line program refers to */
+  if (!pathxref_init(&lazy->xreftable,lazy->numunits))
+    return 0;
+  numfiles=0;
+  for (unit=0; unit<lazy->numunits; unit++) {
+    DWARF_PATHLIST file_list = { NULL };
+    const DWARF_PATHLIST *item;
+    int *filexlat,count,idx;
+    if (lazy->units[unit].line_offset==0)
+      continue;
+    line_decodeunit(fp,lazy->units[unit].line_offset,NULL,&file_list,1);
+    count=0;
+    for (item=file_list.next; item!=NULL; item=item->next)
+      count++;
+    if ((filexlat=(int*)malloc((count+1)*sizeof(int)))==NULL) {
+      path_deletetable(&file_list);
+      return 0;
+    }
+    for (idx=0,item=file_list.next; item!=NULL; idx++,item=item->next) {
+      int tgt=path_find(filetable,item->name);
+      if (tgt<0 && path_insert(filetable,item->name)!=NULL)
+        tgt=numfiles++;
+      filexlat[idx]=tgt;
+    }
+    lazy->xreftable.xlat[unit]=filexlat;
+    lazy->xreftable.count[unit]=count;
+    path_deletetable(&file_list);
+  }
+
+  /* the address ranges, from .debug_aranges */
+  rangesize=0;
+  data=elf_image_section(image,".debug_aranges",NULL,NULL,&length);
+  end=(data!=NULL) ? data+length : NULL;
+  for (ptr=data; ptr!=NULL && ptr+12<=end; ) {
+    const unsigned char *set_end,*tuple;
+    uint32_t set_length,info_offs,addr,len;
+    unsigned align;
+    memcpy(&set_length,ptr,4);
+    memcpy(&info_offs,ptr+6,4);
+    set_end=ptr+4+set_length;
+    if (set_length==0xffffffff || set_end>end)
+      break;  /* 64-bit DWARF, or corrupt data */
+    unit=lazy_unit(lazy,lazy->tables[TABLE_INFO].offset+info_offs);
+    align=2*ptr[10];  /* the tuples are aligned to twice the address size */
+    if (ptr[10]==4 && ptr[11]==0 && unit>=0) {
+      for (tuple=ptr+(12+align-1)/align*align; tuple+8<=set_end; tuple+=8) {
+        memcpy(&addr,tuple,4);
+        memcpy(&len,tuple+4,4);
+        if (addr==0 && len==0)
+          break;
+        if (len>0 && !lazy_addrange(lazy,addr,addr+len,unit,&rangesize))
+          return 0;
+      }
+    }
+    ptr=set_end;
+  }
+  /* for units that are not in .debug_aranges, use the range of the compilation
+     unit tag (units without range are decoded when an address look-up fails
+     to find a unit) */
+  for (unit=0; unit<lazy->numunits; unit++) {
+    uint32_t cu_range[2]={0,0};
+    int unit_address_size;
+    if (lazy->units[unit].ranged || lazy->units[unit].info_offset==0)
+      continue;
+    info_decodeunit(fp,lazy->tables,lazy->units[unit].info_offset,unit,NULL,
+                    &lazy->xreftable,&unit_address_size,cu_range);
+    if (cu_range[1]>cu_range[0] && !lazy_addrange(lazy,cu_range[0],cu_range[1],unit,&rangesize))
+      return 0;
+  }
+  if (lazy->numranges>0)
+    qsort(lazy->ranges,lazy->numranges,sizeof(LAZYRANGE),lazy_cmp_range);
+
+  /* the name indices, from .debug_names; there may be an index per object
+     file, or one index for all units */
+  if (lazy->tables[TABLE_NAMES].offset!=0) {
+    unsigned indexsize=0;
+    tableoffset=lazy->tables[TABLE_NAMES].offset;
+    tablesize=lazy->tables[TABLE_NAMES].size;
+    while (tablesize>sizeof(NAMES_HDR32)) {
+      NAMES_HDR32 nameshdr;
+      LAZYINDEX *index;
+      mem_seek(fp,tableoffset);
+      mem_read(&nameshdr,sizeof nameshdr,1,fp);
+      length=nameshdr.unit_length+4;
+      if (nameshdr.unit_length==0xffffffff || length>tablesize)
+        break;  /* 64-bit DWARF, or corrupt data */
+      /* each of the counts must be below the length (so the sub-tables
+         cannot overflow) */
+      if (nameshdr.version==5 && nameshdr.comp_unit_count>0
+          && (nameshdr.comp_unit_count | nameshdr.local_type_unit_count | nameshdr.foreign_type_unit_count
+              | nameshdr.bucket_count | nameshdr.name_count | nameshdr.abbrev_table_size
+              | nameshdr.augmentation_string_size)<length)
+      {
+        if (lazy->numindices>=indexsize) {
+          unsigned newsize=(indexsize==0) ? 16 : 2*indexsize;
+          LAZYINDEX *list=(LAZYINDEX*)realloc(lazy->indices,newsize*sizeof(LAZYINDEX));
+          if (list==NULL)
+            return 0;
+          lazy->indices=list;
+          indexsize=newsize;
+        }
+        index=&lazy->indices[lazy->numindices];
+        index->cu_count=nameshdr.comp_unit_count;
+        index->bucket_count=nameshdr.bucket_count;
+        index->name_count=nameshdr.name_count;
+        index->cu_list=tableoffset+sizeof(NAMES_HDR32)+nameshdr.augmentation_string_size;
+        index->buckets=index->cu_list+4*(nameshdr.comp_unit_count+nameshdr.local_type_unit_count)
+                       +8*nameshdr.foreign_type_unit_count;
+        index->hashes=index->buckets+4*nameshdr.bucket_count;
+        index->strings=index->hashes+((nameshdr.bucket_count>0) ? 4*nameshdr.name_count : 0);
+        index->entries=index->strings+4*nameshdr.name_count;
+        index->abbrevs=index->entries+4*nameshdr.name_count;
+        index->pool=index->abbrevs+nameshdr.abbrev_table_size;
+        index->end=tableoffset+length;
+        if (index->pool<=index->end)
+          lazy->numindices+=1;
+      }
+      tablesize-=length;
+      tableoffset+=length;
+    }
+  }
+
+  /* the public names, from .debug_pubnames (only if there is no name index) */
+  if (lazy->numindices==0 && lazy->tables[TABLE_PUBNAME].offset!=0) {
+    unsigned namesize=0;
+    ptr=lazy->data+lazy->tables[TABLE_PUBNAME].offset;
+    end=ptr+lazy->tables[TABLE_PUBNAME].size;
+    while (ptr+sizeof(PUBNAME_HDR32)<=end) {
+      PUBNAME_HDR32 pubhdr;
+      const unsigned char *set_end;
+      memcpy(&pubhdr,ptr,sizeof pubhdr);
+      set_end=ptr+4+pubhdr.totallength;
+      if (pubhdr.totallength==0xffffffff || set_end>end)
+        break;
+      unit=lazy_unit(lazy,lazy->tables[TABLE_INFO].offset+pubhdr.info_offs);
+      for (ptr+=sizeof(PUBNAME_HDR32); unit>=0 && ptr+4<set_end; ) {
+        uint32_t die_offs;
+        const char *name;
+        memcpy(&die_offs,ptr,4);
+        if (die_offs==0)
+          break;
+        name=(const char*)ptr+4;
+        if (memchr(name,'\0',set_end-(ptr+4))==NULL)
+          break;  /* corrupt data */
+        ptr+=4+strlen(name)+1;
+        if (lazy->numnames>=namesize) {
+          unsigned newsize=(namesize==0) ? 256 : 2*namesize;
+          LAZYNAME *list=(LAZYNAME*)realloc(lazy->names,newsize*sizeof(LAZYNAME));
+          if (list==NULL)
+            return 0;
+          lazy->names=list;
+          namesize=newsize;
+        }
+        lazy->names[lazy->numnames].name=name;
+        lazy->names[lazy->numnames].unit=unit;
+        lazy->numnames+=1;
+      }
+      ptr=set_end;
+    }
+    if (lazy->numnames>0)
+      qsort(lazy->names,lazy->numnames,sizeof(LAZYNAME),lazy_cmp_name);
+  }
+  return 1;
+}
+
+/* lazy_decodetask() decodes the line program and the information unit of a
+   single unit into the unit's own arrays (so the tasks need no arenas) */
+static int lazy_decodetask(UNITPOOL *pool,MEMFILE *fp,int arena,int unit)
+{
+  UNITINFO *info=&pool->units[unit];
+  LAZYUNIT *lazyunit=&pool->lazyunits[info->unit];
+  LINEARRAY rows = { NULL };
+  DWARF_PATHLIST file_list = { NULL };
+  unsigned idx;
+  int result=1;
+
+  (void)arena;
+  if (lazyunit->line_offset!=0) {
+    result=line_decodeunit(fp,lazyunit->line_offset,&rows,&file_list,0);
+    for (idx=0; idx<rows.count && result; idx++)
+      result=line_append(&lazyunit->rows,rows.entries[idx].line,rows.entries[idx].address,
+                         pathxref_find(pool->xreftable,info->unit,rows.entries[idx].fileindex));
+    if (rows.entries!=NULL)
+      free(rows.entries);
+    path_deletetable(&file_list);
+    lazyunit->rows.count=line_compact(lazyunit->rows.entries,lazyunit->rows.count);
+  }
+  if (lazyunit->info_offset!=0 && result)
+    result=info_decodeunit(fp,pool->tables,lazyunit->info_offset,info->unit,&lazyunit->symbols,
+                           pool->xreftable,&info->address_size,NULL);
+  return result;
+}
+
+/* lazy_merge() sorts the "numadd" pointers in "add", and merges these into the
+   sorted index "list" (with "count" pointers); it returns the merged index in
+   a new array (the caller frees the old one), or NULL on failure */
+static void *lazy_merge(const void *list,unsigned count,void *add,unsigned numadd,
+                        int (*compare)(const void*,const void*))
+{
+  const unsigned char *old=(const unsigned char*)list;
+  const unsigned char *cur=(const unsigned char*)add;
+  unsigned char *merged;
+  unsigned i1,i2,idx;
+
+  qsort(add,numadd,sizeof(void*),compare);
+  merged=(unsigned char*)malloc((count+numadd+1)*sizeof(void*));
+  if (merged==NULL)
+    return NULL;
+  for (i1=i2=idx=0; i1<count || i2<numadd; idx++) {
+    if (i2>=numadd || (i1<count && compare(old+i1*sizeof(void*),cur+i2*sizeof(void*))<=0))
+      memcpy(merged+idx*sizeof(void*),old+(i1++)*sizeof(void*),sizeof(void*));
+    else
+      memcpy(merged+idx*sizeof(void*),cur+(i2++)*sizeof(void*),sizeof(void*));
+  }
+  return merged;
+}
+
+static int line_cmp_addrindex(const void *p1,const void *p2)
+{
+  return line_cmp_address(*(const DWARF_LINELOOKUP**)p1,*(const DWARF_LINELOOKUP**)p2);
+}
+
+/* lazy_addlines() merges the rows of the units that were just decoded into the
+   indices of the line table, and re-chains the entries */
+static int lazy_addlines(DWARF_LAZY *lazy,const UNITPOOL *pool)
+{
+  DWARF_LINETABLE *linetable=lazy->linetable;
+  DWARF_LINELOOKUP **rows,**byaddress,**byline;
+  unsigned idx,count;
+  int unit;
+
+  for (count=0,unit=0; unit<pool->numunits; unit++)
+    count+=lazy->units[pool->units[unit].unit].rows.count;
+  if (count==0)
+    return 1;
+  if ((rows=(DWARF_LINELOOKUP**)malloc(count*sizeof(DWARF_LINELOOKUP*)))==NULL)
+    return 0;
+  for (count=0,unit=0; unit<pool->numunits; unit++) {
+    const LINEARRAY *cur=&lazy->units[pool->units[unit].unit].rows;
+    for (idx=0; idx<cur->count; idx++)
+      rows[count++]=&cur->entries[idx];
+  }
+  byline=(DWARF_LINELOOKUP**)lazy_merge(linetable->byline,linetable->count,rows,count,line_cmp_index);
+  byaddress=(DWARF_LINELOOKUP**)lazy_merge(linetable->byaddress,linetable->count,rows,count,line_cmp_addrindex);
+  free(rows);
+  if (byline==NULL || byaddress==NULL) {
+    if (byline!=NULL)
+      free(byline);
+    if (byaddress!=NULL)
+      free(byaddress);
+    return 0;
+  }
+  if (linetable->byline!=NULL)
+    free(linetable->byline);
+  if (linetable->byaddress!=NULL)
+    free(linetable->byaddress);
+  linetable->byline=byline;
+  linetable->byaddress=byaddress;
+  linetable->count+=count;
+
+  /* chain the entries, for iteration */
+  for (idx=0; idx+1<linetable->count; idx++)
+    byaddress[idx]->next=byaddress[idx+1];
+  byaddress[linetable->count-1]->next=NULL;
+  linetable->next=byaddress[0];
+  return 1;
+}
+
+/* lazy_addsymbols() completes the symbols of the units that were just decoded
+   (the line table must already hold the rows of these units), and merges these
+   into the indices of the symbol table */
+static int lazy_addsymbols(DWARF_LAZY *lazy,const UNITPOOL *pool)
+{
+  DWARF_SYMBOLTABLE *symboltable=lazy->symboltable;
+  DWARF_SYMBOLLIST **symbols,**functions,**variables;
+  DWARF_SYMBOLLIST **byname,**byfile,**byfunction,**byvariable;
+  unsigned idx,count,numfunctions,numvariables;
+  int unit,result;
+
+  for (count=0,unit=0; unit<pool->numunits; unit++) {
+    SYMARRAY *cur=&lazy->units[pool->units[unit].unit].symbols;
+    if (!dwarf_postprocess(cur->entries,cur->count,lazy->linetable))
+      return 0;
+    count+=cur->count;
+  }
+  if (count==0)
+    return 1;
+  symbols=(DWARF_SYMBOLLIST**)malloc(count*sizeof(DWARF_SYMBOLLIST*));
+  functions=(DWARF_SYMBOLLIST**)malloc(count*sizeof(DWARF_SYMBOLLIST*));
+  variables=(DWARF_SYMBOLLIST**)malloc(count*sizeof(DWARF_SYMBOLLIST*));
+  byname=byfile=byfunction=byvariable=NULL;
+  result=0;
+  if (symbols!=NULL && functions!=NULL && variables!=NULL) {
+    for (count=numfunctions=numvariables=0,unit=0; unit<pool->numunits; unit++) {
+      const SYMARRAY *cur=&lazy->units[pool->units[unit].unit].symbols;
+      for (idx=0; idx<cur->count; idx++) {
+        DWARF_SYMBOLLIST *sym=&cur->entries[idx];
+        symbols[count++]=sym;
+        if (DWARF_IS_FUNCTION(sym))
+          functions[numfunctions++]=sym;
+        else if (sym->data_addr!=0)
+          variables[numvariables++]=sym;
+      }
+    }
+    byname=(DWARF_SYMBOLLIST**)lazy_merge(symboltable->byname,symboltable->count,symbols,count,sym_cmp_order);
+    byfile=(DWARF_SYMBOLLIST**)lazy_merge(symboltable->byfile,symboltable->count,symbols,count,sym_cmp_file);
+    byfunction=(DWARF_SYMBOLLIST**)lazy_merge(symboltable->functions,symboltable->numfunctions,
+                                              functions,numfunctions,sym_cmp_code);
+    byvariable=(DWARF_SYMBOLLIST**)lazy_merge(symboltable->variables,symboltable->numvariables,
+                                              variables,numvariables,sym_cmp_data);
+    result=(byname!=NULL && byfile!=NULL && byfunction!=NULL && byvariable!=NULL);
+  }
+  if (symbols!=NULL)
+    free(symbols);
+  if (functions!=NULL)
+    free(functions);
+  if (variables!=NULL)
+    free(variables);
+  if (!result) {
+    if (byname!=NULL)
+      free(byname);
+    if (byfile!=NULL)
+      free(byfile);
+    if (byfunction!=NULL)
+      free(byfunction);
+    if (byvariable!=NULL)
+      free(byvariable);
+    return 0;
+  }
+
+  if (symboltable->byname!=NULL)
+    free(symboltable->byname);
+  if (symboltable->byfile!=NULL)
+    free(symboltable->byfile);
+  if (symboltable->functions!=NULL)
+    free(symboltable->functions);
+  if (symboltable->variables!=NULL)
+    free(symboltable->variables);
+  symboltable->byname=byname;
+  symboltable->byfile=byfile;
+  symboltable->functions=byfunction;
+  symboltable->variables=byvariable;
+  symboltable->count+=count;
+  symboltable->numfunctions+=numfunctions;
+  symboltable->numvariables+=numvariables;
+
+  /* chain the symbols, for iteration */
+  for (idx=0; idx+1<symboltable->count; idx++)
+    byname[idx]->next=byname[idx+1];
+  byname[symboltable->count-1]->next=NULL;
+  symboltable->next=byname[0];
+  return sym_buildhash(symboltable);
+}
+
+static void lazy_mark(DWARF_LAZY *lazy,int unit)
+{
+  if (unit>=0 && unit<lazy->numunits && lazy->units[unit].state==LAZY_UNLOADED)
+    lazy->units[unit].state=LAZY_PENDING;
+}
+
+/* lazy_commit() decodes all units that are marked as pending, and rebuilds
+   the tables; it returns the number of units that were decoded */
+static int lazy_commit(DWARF_LAZY *lazy)
+{
+  UNITPOOL pool;
+  int unit,size;
+
+  memset(&pool,0,sizeof(pool));
+  pool.image.base=pool.image.ptr=lazy->data;
+  pool.image.end=lazy->data+lazy->size;
+  pool.tables=lazy->tables;
+  pool.xreftable=&lazy->xreftable;
+  pool.lazyunits=lazy->units;
+  pool.decode=lazy_decodetask;
+  size=0;
+  for (unit=0; unit<lazy->numunits; unit++) {
+    if (lazy->units[unit].state!=LAZY_PENDING)
+      continue;
+    if (!unitpool_add(&pool,0,&size))
+      break;
+    pool.units[pool.numunits-1].unit=unit;
+    lazy->units[unit].state=LAZY_LOADED;  /* also on failure, so it is not retried */
+  }
+  for ( ; unit<lazy->numunits; unit++)
+    if (lazy->units[unit].state==LAZY_PENDING)
+      lazy->units[unit].state=LAZY_UNLOADED;  /* out of memory, retry on the next look-up */
+  size=pool.numunits;
+  if (size>0) {
+    unitpool_run(&pool);
+    lazy->numloaded+=size;
+    if (lazy_addlines(lazy,&pool))
+      lazy_addsymbols(lazy,&pool);
+  }
+  unitpool_cleanup(&pool);
+  return size;
+}
+
+static int lazy_touch_address(DWARF_LAZY *lazy,uint32_t address)
+{
+  unsigned low,high;
+  int unit;
+
+  if (lazy==NULL || lazy->numloaded==lazy->numunits)
+    return 0;
+  /* find the last range that starts at or below the address */
+  low=0;
+  high=lazy->numranges;
+  while (low<high) {
+    unsigned mid=low+(high-low)/2;
+    if (lazy->ranges[mid].low<=address)
+      low=mid+1;
+    else
+      high=mid;
+  }
+  if (low>0 && address<lazy->ranges[low-1].high) {
+    lazy_mark(lazy,lazy->ranges[low-1].unit);
+  } else {
+    /* not in a known range, try the units whose range is unknown */
+    for (unit=0; unit<lazy->numunits; unit++)
+      if (!lazy->units[unit].ranged)
+        lazy_mark(lazy,unit);
+  }
+  return lazy_commit(lazy);
+}
+
+static int lazy_touch_file(DWARF_LAZY *lazy,int fileindex)
+{
+  int unit,idx;
+
+  if (lazy==NULL || lazy->numloaded==lazy->numunits || fileindex<0)
+    return 0;
+  for (unit=0; unit<lazy->numunits; unit++) {
+    for (idx=0; idx<lazy->xreftable.count[unit]; idx++) {
+      if (lazy->xreftable.xlat[unit][idx]==fileindex) {
+        lazy_mark(lazy,unit);
+        break;
+      }
+    }
+  }
+  return lazy_commit(lazy);
+}
+
+/* names_hash() calculates the hash of a name for .debug_names: Bernstein's
+   hash on the name folded to lower case. It returns 0 for names with non-ASCII
+   characters, because these need Unicode case folding. */
+static int names_hash(const char *name,uint32_t *hash)
+{
+  uint32_t h=5381;
+
+  for ( ; *name!='\0'; name++) {
+    unsigned char c=(unsigned char)*name;
+    if (c>=0x80)
+      return 0;
+    if (c>='A' && c<='Z')
+      c=(unsigned char)(c-'A'+'a');
+    h=h*33+c;
+  }
+  *hash=h;
+  return 1;
+}
+
+static uint32_t lazy_read32(const DWARF_LAZY *lazy,unsigned long offset)
+{
+  uint32_t value;
+  memcpy(&value,lazy->data+offset,4);
+  return value;
+}
+
+/* lazy_index_match() compares the name at an index in the name index with the
+   name that is looked up */
+static int lazy_index_match(const DWARF_LAZY *lazy,const LAZYINDEX *index,uint32_t idx,const char *name)
+{
+  unsigned long offs=lazy_read32(lazy,index->strings+4*idx);
+  size_t length=strlen(name);
+
+  if (offs>=lazy->tables[TABLE_STR].size || length>=lazy->tables[TABLE_STR].size-offs)
+    return 0;
+  return memcmp(lazy->data+lazy->tables[TABLE_STR].offset+offs,name,length+1)==0;
+}
+
+/* lazy_index_abbrev() looks up an abbreviation in the name index, and copies
+   the (attribute, form) pairs; it returns the tag, or 0 if the abbreviation is
+   not found or if it uses a form that is not supported */
+#define MAX_NAMEATTRIBS 8
+static int lazy_index_abbrev(const DWARF_LAZY *lazy,const LAZYINDEX *index,long code,
+                             int attribs[][2],int *count)
+{
+  MEMFILE fp;
+
+  fp.base=lazy->data;
+  fp.end=lazy->data+index->pool;
+  mem_seek(&fp,index->abbrevs);
+  while (fp.ptr<fp.end) {
+    long cur=read_leb128(&fp,0,NULL);
+    int tag,num=0,valid=1;
+    if (cur==0)
+      break;  /* end of the abbreviation table */
+    tag=(int)read_leb128(&fp,0,NULL);
+    for ( ;; ) {
+      int attrib=(int)read_leb128(&fp,0,NULL);
+      int form=(int)read_leb128(&fp,0,NULL);
+      if (attrib==0 && form==0)
+        break;
+      switch (form) {
+      case DW_FORM_flag_present:
+      case DW_FORM_flag:
+      case DW_FORM_data1:
+      case DW_FORM_data2:
+      case DW_FORM_data4:
+      case DW_FORM_data8:
+      case DW_FORM_ref1:
+      case DW_FORM_ref2:
+      case DW_FORM_ref4:
+      case DW_FORM_ref8:
+      case DW_FORM_ref_sig8:
+      case DW_FORM_sdata:
+      case DW_FORM_udata:
+      case DW_FORM_ref_udata:
+        break;
+      default:
+        valid=0;
+      }
+      if (num<MAX_NAMEATTRIBS) {
+        attribs[num][0]=attrib;
+        attribs[num][1]=form;
+      }
+      num++;
+    }
+    if (cur==code) {
+      if (!valid || num>MAX_NAMEATTRIBS)
+        return 0;
+      *count=num;
+      return tag;
+    }
+  }
+  return 0;
+}
+
+/* lazy_index_entries() walks through the entries for the name at an index in
+   the name index, and marks the units that these entries refer to */
+static void lazy_index_entries(DWARF_LAZY *lazy,const LAZYINDEX *index,uint32_t idx)
+{
+  MEMFILE fp;
+
+  fp.base=lazy->data;
+  fp.end=lazy->data+index->end;
+  mem_seek(&fp,index->pool+lazy_read32(lazy,index->entries+4*idx));
+  while (fp.ptr<fp.end) {
+    int attribs[MAX_NAMEATTRIBS][2];
+    int count,i,typeunit;
+    long cu;
+    long code=read_leb128(&fp,0,NULL);
+    if (code==0 || lazy_index_abbrev(lazy,index,code,attribs,&count)==0)
+      break;  /* end of the list (or unsupported data) */
+    cu=(index->cu_count==1) ? 0 : -1;  /* the unit is implicit if there is only one */
+    typeunit=0;
+    for (i=0; i<count; i++) {
+      long value=(long)read_value(&fp,attribs[i][1],NULL);
+      if (attribs[i][0]==DW_IDX_compile_unit)
+        cu=value;
+      else if (attribs[i][0]==DW_IDX_type_unit)
+        typeunit=1;
     }
-    /* read the filenames table */
-    while ((byte=fgetc(fp))!=EOF && byte!='\0') {
-      for (idx=0; byte!=EOF && byte!='\0'; idx++) {
-        path[idx]=(char)byte;
-        byte=fgetc(fp);
-      }
-      path[idx]='\0';
-      dirpos=read_leb128(fp,0,NULL);  /* read directory index */
-      read_leb128(fp,0,NULL);         /* skip modification time (GCC sets this to 0) */
-      read_leb128(fp,0,NULL);         /* skip source file size (GCC sets this to 0) */
-      if (dirpos>0 && strpbrk(path,"\\/")==NULL) {
-        char *dir=path_get(&include_list,dirpos-1);
-        strins(path,"/");
-        strins(path,dir);
+    if (!typeunit && cu>=0 && (uint32_t)cu<index->cu_count)
+      lazy_mark(lazy,lazy_unit(lazy,lazy->tables[TABLE_INFO].offset+lazy_read32(lazy,index->cu_list+4*cu)));
+  }
+}
+
+/* lazy_index_lookup() looks up a name in a name index (with a probe in the
+   hash table), and marks the units that have a symbol with that name */
+static void lazy_index_lookup(DWARF_LAZY *lazy,const LAZYINDEX *index,const char *name)
+{
+  uint32_t hash,idx;
+
+  if (index->bucket_count>0 && names_hash(name,&hash)) {
+    uint32_t bucket=hash%index->bucket_count;
+    /* the bucket holds the 1-based index of the first name, or 0 if empty */
+    for (idx=lazy_read32(lazy,index->buckets+4*bucket); idx>0 && idx<=index->name_count; idx++) {
+      uint32_t h=lazy_read32(lazy,index->hashes+4*(idx-1));
+      if (h%index->bucket_count!=bucket)
+        break;  /* past the end of the bucket */
+      if (h==hash && lazy_index_match(lazy,index,idx-1,name)) {
+        lazy_index_entries(lazy,index,idx-1);
+        break;  /* names are unique in an index */
       }
-      path_insert(&file_list,path);
     }
-    path_deletetable(&include_list);
-
-    /* jump to the start of the program, then start running */
-    clear_state(&state,prologue.default_is_stmt);
-    fseek(fp,tableoffset+prologue.prologue_length+10,SEEK_SET);  /* +10 because the offset is relative to the field position */
-    count=prologue.total_length-prologue.prologue_length-6;
-    while (count>0) {
-      opcode=fgetc(fp);
-      count--;
-      if (opcode==EOF)
+  } else {
+    /* no hash table (or a name that cannot be hashed), scan all names */
+    for (idx=0; idx<index->name_count; idx++) {
+      if (lazy_index_match(lazy,index,idx,name)) {
+        lazy_index_entries(lazy,index,idx);
         break;
-      if (opcode<prologue.opcode_base) {
-        /* standard (or extended) opcode */
-        switch (opcode) {
-        case DW_LNS_extended_op:
-          value=read_leb128(fp,0,&lebsize);
-          count-=lebsize+value;
-          opcode=fgetc(fp);
-          switch (opcode) {
-          case DW_LNE_end_sequence:
-            state.end_seq=1;
-            line_insert(&line_list,state.line,state.address,state.file-1);
-            clear_state(&state,prologue.default_is_stmt);  /* reset to default values */
-            break;
-          case DW_LNE_set_address:
-            value=fgetc(fp);
-            value|=(long)fgetc(fp) << 8;
-            value|=(long)fgetc(fp) << 16;
-            value|=(long)fgetc(fp) << 24;
-            state.address=value;
-            break;
-          case DW_LNE_define_file:
-            for (idx=0; (byte=fgetc(fp))!=EOF && byte!='\0'; idx++) {
-              path[idx]=(char)byte;
-              byte=fgetc(fp);
-            }
-            path[idx]='\0';
-            dirpos=read_leb128(fp,0,NULL);  /* read directory index */
-            read_leb128(fp,0,NULL);         /* skip modification time (GCC sets this to 0) */
-            read_leb128(fp,0,NULL);         /* skip source file size (GCC sets this to 0) */
-            if (dirpos>0 && strpbrk(path,"\\/")==NULL) {
-              char *dir=path_get(&include_list,dirpos-1);
-              strins(path,"/");
-              strins(path,dir);
-            }
-            path_insert(&file_list,path);
-            break;
-          case DW_LNE_set_discriminator:
-            state.discriminator=read_leb128(fp,0,NULL);
-            break;
-          default:
-            while (value-->0) /* skip any unrecognized extended opcode */
-              fgetc(fp);
-          }
-          break;
-        case DW_LNS_copy:
-          line_insert(&line_list,state.line,state.address,state.file-1);
-          state.basic_block=0;
-          break;
-        case DW_LNS_advance_pc:
-          value=read_leb128(fp,0,&lebsize);
-          count-=lebsize;
-          state.address+=value*prologue.min_instruction_size;
-          break;
-        case DW_LNS_advance_line:
-          value=read_leb128(fp,1,&lebsize);
-          count-=lebsize;
-          state.line+=value;
-          break;
-        case DW_LNS_set_file:
-          value=read_leb128(fp,0,&lebsize);
-          count-=lebsize;
-          state.file=value;
-          break;
-        case DW_LNS_set_column:
-          value=read_leb128(fp,0,&lebsize);
-          count-=lebsize;
-          state.column=value;
-          break;
-        case DW_LNS_negate_stmt:
-          state.is_stmt=!state.is_stmt;
-          break;
-        case DW_LNS_set_basic_block:
-          state.basic_block=1;
-          break;
-        case DW_LNS_const_add_pc:
-          state.address+=((255-prologue.opcode_base)/prologue.line_range)*prologue.min_instruction_size;
-          break;
-        case DW_LNS_fixed_advance_pc:
-          value=fgetc(fp);
-          value|=fgetc(fp) << 8;
-          state.address+=value;
-          count-=2;
-          break;
-        case DW_LNS_set_prologue_end:
-          state.prologue_end=1;
-          break;
-        case DW_LNS_set_epilogue_begin:
-          state.epiloge_begin=1;
-          break;
-        case DW_LNS_set_isa:
-          value=read_leb128(fp,0,&lebsize);
-          count-=lebsize;
-          state.isa=value;
-          break;
-        default:
-          /* skip opcode and any parameters */
-          for (idx=0; idx<std_argcnt[opcode-1]; idx++) {
-            read_leb128(fp,0,&lebsize);
-            count-=lebsize;
-          }
-        }
-      } else {
-        /* special opcode */
-        opcode-=prologue.opcode_base;
-        assert(prologue.max_oper_per_instruction==1); /* for VLIW architecture, the calculation below must be adjusted */
-        state.address+=(opcode/prologue.line_range)*prologue.min_instruction_size;
-        state.line+=prologue.line_base+opcode%prologue.line_range;
-        line_insert(&line_list,state.line,state.address,state.file-1);
-        state.basic_block=0;
-        state.prologue_end=0;
-        state.epiloge_begin=0;
-        state.discriminator=0;
       }
     }
+  }
+}
 
-    free(std_argcnt);
+static int lazy_touch_name(DWARF_LAZY *lazy,const char *name)
+{
+  unsigned low,high,idx;
 
-    /* merge the local file table with the global one */
-    idx=0;
-    for (fileitem=file_list.next; fileitem!=NULL; fileitem=fileitem->next) {
-      /* check whether this file is referenced at all */
-      for (lineitem=line_list.next; lineitem!=NULL && lineitem->fileindex!=idx; lineitem=lineitem->next)
-        /* nothing */;
-      if (lineitem!=NULL) {
-        /* so this file is referenced, now see whether it is already in the global
-           file table */
-        const char *name=path_get(&file_list,idx);
-        assert(name!=NULL);
-        if (path_find(filetable,name)<0) {
-          int tgt;
-          path_insert(filetable,name);
-          tgt=path_find(filetable,name);  /* find it back, to add a cross-reference */
-          assert(tgt>=0);
-          pathxref_insert(xreftable,unit,idx,tgt);
-        }
-      }
-      idx++;
-    }
+  if (lazy==NULL || lazy->numloaded==lazy->numunits)
+    return 0;
+  low=0;
+  high=lazy->numnames;
+  while (low<high) {
+    unsigned mid=low+(high-low)/2;
+    if (strcmp(lazy->names[mid].name,name)<0)
+      low=mid+1;
+    else
+      high=mid;
+  }
+  for ( ; low<lazy->numnames && strcmp(lazy->names[low].name,name)==0; low++)
+    lazy_mark(lazy,lazy->names[low].unit);
+  for (idx=0; idx<lazy->numindices; idx++)
+    lazy_index_lookup(lazy,&lazy->indices[idx],name);
+  return lazy_commit(lazy);
+}
 
-    /* append the local line table to the global table (and translate the index
-       in the local file table to the index in the global file table) */
-    for (lineitem=line_list.next; lineitem!=NULL; lineitem=lineitem->next) {
-      int fileidx=pathxref_find(xreftable,unit,lineitem->fileindex);
-      line_insert(linetable,lineitem->line,lineitem->address,fileidx);
-    }
-    path_deletetable(&file_list);
-    line_deletetable(&line_list);
+static int lazy_touch_all(DWARF_LAZY *lazy)
+{
+  int unit;
 
-    /* prepare for a next "line program" (if any) */
-    value=ftell(fp);
-    tablesize-=value-tableoffset;
-    tableoffset=value;
-    unit+=1;
-  } /* while (tablesize) */
+  if (lazy==NULL || lazy->numloaded==lazy->numunits)
+    return 0;
+  for (unit=0; unit<lazy->numunits; unit++)
+    lazy_mark(lazy,unit);
+  return lazy_commit(lazy);
+}
 
-  return 1;
+static void lazy_delete(DWARF_LAZY *lazy)
+{
+  int unit;
+
+  assert(lazy!=NULL);
+  for (unit=0; unit<lazy->numunits; unit++) {
+    if (lazy->units[unit].rows.entries!=NULL)
+      free(lazy->units[unit].rows.entries);
+    symarray_delete(&lazy->units[unit].symbols);
+  }
+  if (lazy->units!=NULL)
+    free(lazy->units);
+  if (lazy->ranges!=NULL)
+    free(lazy->ranges);
+  if (lazy->names!=NULL)
+    free(lazy->names);
+  if (lazy->indices!=NULL)
+    free(lazy->indices);
+  pathxref_deletetable(&lazy->xreftable);
+  if (lazy->data!=NULL)
+    free(lazy->data);
+  free(lazy);
 }
 
-/* dwarf_infotable() parses the .debug_info table and collects the functions.
+/** dwarf_read_lazy() reads the directory of the compilation units from an ELF
+ *  file, but it defers decoding the lines and symbols of a unit until a look-up
+ *  needs it. The file table is complete on return, the line and symbol tables
+ *  grow as look-ups touch more units. The debug sections are copied into
+ *  memory, so the ELF file may be closed (or changed) after this call; the
+ *  look-ups then still use the information as it was at the time of this call.
+ *  The tables must be released with dwarf_cleanup().
+ *
+ *  Look-ups by address or by file only decode the units that cover that
+ *  address or file. Look-ups by name use the hash tables in .debug_names, or
+ *  else .debug_pubnames. Without .debug_names, a name that is not found in the
+ *  loaded units causes all remaining units to be decoded (.debug_pubnames only
+ *  lists external symbols). Iterating over the symbols with
+ *  dwarf_sym_from_index() decodes all units.
  */
-static int dwarf_infotable(FILE *fp,const DWARFTABLE tables[],
-                           DWARF_SYMBOLLIST *symboltable,int *address_size,
-                           const PATHXREF *xreftable)
+int dwarf_read_lazy(FILE *fp,DWARF_LINETABLE *linetable,DWARF_SYMBOLTABLE *symboltable,
+                    DWARF_PATHLIST *filetable,int *address_size)
 {
-  UNIT_HDR32 header;
-  ABBREVLIST abbrev_root = { NULL };
-  const ABBREVLIST *abbrev;
-  int unit,idx,size;
-  unsigned long tablesize;
-  char name[256],str[256];
-  int64_t value;
-  int file,line;
+  DWARF_LAZY *lazy;
+  ELF_IMAGE image;
+  MEMFILE memfile;
+  unsigned long mark,size;
+  int idx,result;
 
   assert(fp!=NULL);
-  assert(tables!=NULL);
-  assert(symboltable!=NULL);
-  assert(symboltable->next==NULL);/* symboltable should be empty */
+  assert(linetable!=NULL && linetable->next==NULL);
+  assert(symboltable!=NULL && symboltable->next==NULL);
+  assert(filetable!=NULL && filetable->next==NULL);
   assert(address_size!=NULL);
-  assert(xreftable!=NULL);
-
-  assert(tables[TABLE_ABBREV].offset>0);/* required table */
-  dwarf_abbrev(fp,tables,&abbrev_root);
 
-  assert(tables[TABLE_INFO].offset>0);  /* debug information should have been found */
-  fseek(fp,tables[TABLE_INFO].offset,SEEK_SET);
+  if (elf_image_open(fp,&image)!=ELFERR_NONE)
+    return 0;
+  if (image.wordsize!=32 || (lazy=(DWARF_LAZY*)calloc(1,sizeof(DWARF_LAZY)))==NULL) {
+    elf_image_close(&image);
+    return 0; /* only 32-bit architectures at this time */
+  }
 
-  unit=0;
-  tablesize=tables[TABLE_INFO].size;
-  while (tablesize>sizeof(header)) {
-    unsigned long unitsize;
-    uint32_t code_addr=0, code_addr_end=0;
-    uint32_t data_addr=0;
-    int external=0;
-    int declaration=0;
-    int level=0;
-    int hdrsize;
-    read_unitheader(fp,&header,&hdrsize);
-    unitsize=header.unit_length-(hdrsize-4);
-    assert(unitsize<0xfffffff0);  /* if larger, should read the 64-bit version of the structure */
-    *address_size=header.address_size;
-    tablesize-=unitsize+hdrsize;
-    name[0]='\0';
-    level=0;
-    /* browse through the tags */
-    while (unitsize>0) {
-      /* read the abbreviation code */
-      idx=(int)read_leb128(fp,0,&size);
-      unitsize-=size;
-      if (idx==0) {
-        level-=1;
-        continue;
-      }
-      abbrev=abbrev_find(&abbrev_root,unit,idx);
-      assert(abbrev!=NULL);
-      /* run through the attributes */
-      for (idx=0; idx<abbrev->count; idx++) {
-        int format=abbrev->attributes[idx].format;
-        if (format==DW_FORM_indirect) {
-          /* format is specified in the .debug_info data (not in the abbreviation) */
-          format=read_leb128(fp,1,&size);
-          unitsize-=size;
-        }
-        switch (format) {
-        case DW_FORM_data1:             /* constant, 1 byte */
-        case DW_FORM_data2:             /* constant, 2 bytes */
-        case DW_FORM_data4:             /* constant, 4 bytes */
-        case DW_FORM_data8:             /* constant, 8 bytes */
-        case DW_FORM_sdata:             /* constant, signed LEB128 */
-        case DW_FORM_udata:             /* constant, unsigned LEB128 */
-        case DW_FORM_ref1:              /* reference, 1 bytes */
-        case DW_FORM_ref2:              /* reference, 2 bytes */
-        case DW_FORM_ref4:              /* reference, 4 bytes */
-        case DW_FORM_ref8:              /* reference, 8 bytes */
-        case DW_FORM_ref_udata:         /* reference, unsigned LEB128 */
-        case DW_FORM_flag:              /* flag, 1 byte (0=false, any non-zero=true) */
-        case DW_FORM_flag_present:      /* flag, no data */
-        case DW_FORM_ref_sig8:          /* type signature, 8 bytes */
-        case DW_FORM_exprloc:           /* block, unsigned LEB128-encoded length + data bytes */
-        case DW_FORM_ref_sup4:
-        case DW_FORM_ref_sup8:
-          value=read_value(fp,abbrev->attributes[idx].format,&size);
-          break;
-        case DW_FORM_addr:              /* address, 4 bytes for 32-bit, 8 bytes for 64-bit */
-        case DW_FORM_ref_addr:          /* reference, address size (4 bytes on 32-bit, 8 bytes on 64-bit) */
-        case DW_FORM_sec_offset:        /* offset to line number data (4 bytes on 32-bit, 8 bytes on 64-bit) */
-          value=0;
-          fread(&value,1,header.address_size,fp);
-          size=header.address_size;
-          break;
-        case DW_FORM_string:            /* string, zero-terminated */
-        case DW_FORM_strp:              /* string, 4-byte offset into the .debug_str section */
-        case DW_FORM_strp_sup:
-        case DW_FORM_block:             /* block, unsigned LEB128-encoded length + data bytes */
-        case DW_FORM_block1:            /* block, 1-byte length + up to 255 data bytes */
-        case DW_FORM_block2:            /* block, 2-byte length + up to 64K data bytes */
-        case DW_FORM_block4:            /* block, 4-byte length + up to 4G data bytes */
-          read_string(fp,abbrev->attributes[idx].format,tables[TABLE_STR].offset,str,sizeof(str),&size);
-          break;
-        case DW_FORM_line_strp:
-          read_string(fp,abbrev->attributes[idx].format,tables[TABLE_LINE_STR].offset,str,sizeof(str),&size);
-          break;
-        case DW_FORM_implicit_const:
-          value=abbrev->attributes[idx].value;
-          size=0;
-          break;
-        default:
-          assert(0);
-        }
-        unitsize-=size;
-        if (abbrev->tag==DW_TAG_subprogram || abbrev->tag==DW_TAG_variable || abbrev->tag==DW_TAG_formal_parameter) {
-          //??? also handle DW_TAG_lexical_block for the scope of local variables
-          /* store selected fields */
-          switch (abbrev->attributes[idx].tag) {
-          case DW_AT_name:
-            strcpy(name,str);
-            break;
-          case DW_AT_low_pc:
-            if (abbrev->tag==DW_TAG_subprogram)
-              code_addr=(uint32_t)value;
-            break;
-          case DW_AT_high_pc:
-            if (abbrev->tag==DW_TAG_subprogram) {
-              code_addr_end=(uint32_t)value;
-              /* depending on the format, the "high pc" value is an offset
-                 instead of an address */
-              if (abbrev->attributes[idx].format!=DW_FORM_addr)
-                code_addr_end+=code_addr;
-            }
-            break;
-          case DW_AT_decl_file:
-            file=pathxref_find(xreftable,unit,(int)value-1);
-            break;
-          case DW_AT_decl_line:
-            line=(int)value;
-            break;
-          case DW_AT_location:
-            if (abbrev->tag==DW_TAG_variable)
-              data_addr=(uint32_t)value;  /* global / static variable */
-            break;
-          case DW_AT_external:
-            if (abbrev->tag==DW_TAG_variable)
-              external=(int)value;
-            break;
-          case DW_AT_declaration:
-            declaration=(int)value;
-            break;
-          }
-        }
-      } /* for (idx<abbrev->count) */
-      if ((abbrev->tag==DW_TAG_subprogram && code_addr_end>code_addr)
-          || (abbrev->tag==DW_TAG_variable && data_addr!=0))
-        declaration=0;
-      if ((abbrev->tag==DW_TAG_subprogram || abbrev->tag==DW_TAG_variable || abbrev->tag==DW_TAG_formal_parameter)
-          && !declaration) {
-        /* inlined functions are added as if they have address 0; when inline
-           functions get instantiated, these are added as "references" to
-           functions; these are not handled */
-        assert(code_addr_end>=code_addr);
-        if (name[0]!='\0' && file>=0)
-          symname_insert(symboltable,name,code_addr,code_addr_end-code_addr,
-                         data_addr,file,line,external);
-        name[0]='\0';
-        code_addr=code_addr_end=0;
-        data_addr=0;
-        external=0;
-        declaration=0;
-        file=-1;
-      }
-      if (abbrev->has_children)
-        level+=1;
+  /* copy the sections into a single buffer; the first section starts at a
+     non-zero offset, because an offset of zero means that a table is absent */
+  dwarf_gettables(&image,lazy->tables);
+  size=4;
+  for (idx=0; idx<TABLE_COUNT; idx++)
+    if (lazy->tables[idx].offset!=0)
+      size+=(lazy->tables[idx].size+3) & ~3;
+  if ((lazy->data=(unsigned char*)malloc(size))==NULL) {
+    elf_image_close(&image);
+    free(lazy);
+    return 0;
+  }
+  lazy->size=4;
+  for (idx=0; idx<TABLE_COUNT; idx++) {
+    if (lazy->tables[idx].offset!=0) {
+      memcpy(lazy->data+lazy->size,image.data+lazy->tables[idx].offset,lazy->tables[idx].size);
+      lazy->tables[idx].offset=lazy->size;
+      lazy->size+=(lazy->tables[idx].size+3) & ~3;
     }
-    unit+=1;
   }
-  abbrev_deletetable(&abbrev_root);
+  memfile.base=memfile.ptr=lazy->data;
+  memfile.end=lazy->data+lazy->size;
+
+  memset(phase_time,0,sizeof phase_time);
+  mark=phase_clock();
+  *address_size=0;
+  result=lazy_directory(lazy,&image,&memfile,filetable,address_size);
+  elf_image_close(&image);
+  if (!result) {
+    lazy_delete(lazy);
+    path_deletetable(filetable);
+    return 0;
+  }
+  PHASE_MARK(DWARF_PHASE_INFO,mark);
+  lazy->linetable=linetable;
+  lazy->symboltable=symboltable;
+  linetable->lazy=symboltable->lazy=lazy;
   return 1;
 }
 
-static void dwarf_postprocess(DWARF_SYMBOLLIST *symboltable,const DWARF_LINELOOKUP *linetable)
+void dwarf_cleanup(DWARF_LINETABLE *linetable,DWARF_SYMBOLTABLE *symboltable,DWARF_PATHLIST *filetable)
 {
-  DWARF_SYMBOLLIST *sym;
+  DWARF_LAZY *lazy=linetable->lazy;
+  line_deletetable(linetable);
+  symname_deletetable(symboltable);
+  path_deletetable(filetable);
+  if (lazy!=NULL)
+    lazy_delete(lazy);
+}
 
-  assert(symboltable!=NULL);
-  for (sym=symboltable->next; sym!=NULL; sym=sym->next) {
-    if (DWARF_IS_FUNCTION(sym)) {
-      /* go through the line table to find the line range for the function */
-      uint32_t addr=sym->code_addr+sym->code_range;
-      const DWARF_LINELOOKUP *line;
-      DWARF_SYMBOLLIST *lcl;
-      assert(linetable!=NULL);
-      for (line=linetable->next; line!=NULL && sym->line_limit==0; line=line->next) {
-        if (line->address<addr && (line->next==NULL || line->next->address>=addr)
-            && line->line>=sym->line_limit)
-          sym->line_limit=line->line+1; /* +1 for consistency with DWARF address range */
-      }
-      /* collect all local variables that are declared within this line range */
-      for (lcl=symboltable->next; lcl!=NULL; lcl=lcl->next) {
-        if (lcl->fileindex==sym->fileindex
-            && lcl->line>=sym->line && lcl->line<sym->line_limit
-            && lcl->scope==SCOPE_UNKNOWN)
-        {
-          assert(lcl->code_addr==0);  /* nested functions don't occur */
-          lcl->scope=SCOPE_FUNCTION;
-          lcl->line_limit=sym->line_limit;
-          assert(lcl->line_limit>lcl->line);
-        }
-      }
-    }
+/** dwarf_phase_time() returns the time (in milliseconds) that the most recent
+ *  call to dwarf_read() spent in a phase; see the DWARF_PHASE_xxx constants.
+ */
+unsigned long dwarf_phase_time(int phase)
+{
+  if (phase<0 || phase>=DWARF_PHASE_COUNT)
+    return 0;
+  return phase_time[phase];
+}
+
+/* The cache holds the line table, the symbol table (with the names as they
+   appear in the DWARF information) and the file table, plus the look-up
+   indices on these tables, so that none of these need to be rebuilt.
+   References between the tables are stored as indices, and names as offsets
+   in a string pool at the end of the file. The cache is keyed on the build-id
+   of the ELF file (or on its cksum if it has no build-id), plus the size and
+   modification time of the ELF file. */
+#define DWCACHE_MAGIC   0x43574442  /* "BDWC" */
+#define DWCACHE_VERSION 2
+
+typedef struct tagDWCACHE_HDR {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t address_size;
+  uint32_t ident;         /* hash of the build-id, or cksum of the ELF file */
+  uint32_t filesize;      /* size of the ELF file */
+  uint64_t mtime;         /* modification time of the ELF file */
+  uint32_t numpaths;
+  uint32_t numlines;
+  uint32_t numsymbols;
+  uint32_t hashsize;
+  uint32_t numfunctions;
+  uint32_t numvariables;
+  uint32_t poolsize;      /* size of the string pool */
+} DWCACHE_HDR;
+
+typedef struct tagDWCACHE_LINE {
+  uint32_t address;
+  int32_t line;
+  int32_t fileindex;
+} DWCACHE_LINE;
+
+typedef struct tagDWCACHE_SYM {
+  uint32_t name;          /* offset in the string pool */
+  uint32_t code_addr;
+  uint32_t code_range;
+  uint32_t data_addr;
+  int32_t line;
+  int32_t line_limit;
+  int16_t fileindex;
+  int16_t scope;
+} DWCACHE_SYM;
+
+/* dwcache_size() returns the size of the cache file for the counts in the
+   header */
+static size_t dwcache_size(const DWCACHE_HDR *hdr)
+{
+  return sizeof(DWCACHE_HDR)
+         + (size_t)hdr->numlines*(sizeof(DWCACHE_LINE)+sizeof(uint32_t))
+         + (size_t)hdr->numsymbols*(sizeof(DWCACHE_SYM)+sizeof(uint32_t))
+         + ((size_t)hdr->hashsize+hdr->numfunctions+hdr->numvariables+hdr->numpaths)*sizeof(uint32_t)
+         + hdr->poolsize;
+}
+
+static int dwcache_key(FILE *fp,const ELF_IMAGE *image,DWCACHE_HDR *hdr)
+{
+  struct stat st;
+  const unsigned char *note;
+  unsigned long length;
+
+  assert(fp!=NULL && image!=NULL && hdr!=NULL);
+  memset(hdr,0,sizeof(DWCACHE_HDR));
+  if (fstat(fileno(fp),&st)!=0)
+    return 0;
+  hdr->magic=DWCACHE_MAGIC;
+  hdr->version=DWCACHE_VERSION;
+  hdr->filesize=(uint32_t)st.st_size;
+  hdr->mtime=(uint64_t)st.st_mtime;
+  note=elf_image_section(image,".note.gnu.build-id",NULL,NULL,&length);
+  if (note!=NULL && length>0) {
+    uint32_t hash=2166136261u;  /* FNV-1a */
+    while (length-->0)
+      hash=(hash^*note++)*16777619u;
+    hdr->ident=hash;
+  } else {
+    hdr->ident=cksum(fp);
   }
+  return 1;
 }
 
-/* dwarf_read() returns three lists: a list with source code line numbers,
- * a list with functions and a list with the file paths (referred to by the
- * other two lists)
+/** dwcache_save() writes the tables to the cache file. Failure to write the
+ *  cache is not an error; it only means that the next load is slower.
  */
-int dwarf_read(FILE *fp,DWARF_LINELOOKUP *linetable,DWARF_SYMBOLLIST *symboltable,
-               DWARF_PATHLIST *filetable,int *address_size)
+static int dwcache_save(const char *cachefile,const DWCACHE_HDR *key,
+                        const DWARF_LINETABLE *linetable,const DWARF_SYMBOLTABLE *symboltable,
+                        const DWARF_PATHLIST *filetable,int address_size)
 {
-  DWARFTABLE tables[TABLE_COUNT];
-  PATHXREF xreftable = { NULL };
-  int result,wordsize;
+  DWCACHE_HDR hdr;
+  const DWARF_PATHLIST *path;
+  unsigned char *blob,*ptr;
+  char *pool;
+  size_t size;
+  uint32_t idx,top;
+  FILE *fp;
+  int result;
 
-  assert(fp!=NULL);
-  assert(linetable!=NULL);        /* tables must be valid, but empty */
-  assert(linetable->next==NULL);
-  assert(symboltable!=NULL);
-  assert(symboltable->next==NULL);
-  assert(filetable!=NULL);
-  assert(filetable->next==NULL);
-  assert(address_size!=NULL);
+  assert(cachefile!=NULL && key!=NULL);
+  assert(linetable->byaddress==NULL && symboltable->byname==NULL);  /* not in lazy mode */
+  hdr=*key;
+  hdr.address_size=(uint16_t)address_size;
+  hdr.numlines=linetable->count;
+  hdr.numsymbols=symboltable->count;
+  hdr.hashsize=symboltable->hashsize;
+  hdr.numfunctions=symboltable->numfunctions;
+  hdr.numvariables=symboltable->numvariables;
+  for (path=filetable->next; path!=NULL; path=path->next) {
+    hdr.numpaths++;
+    hdr.poolsize+=strlen(path->name)+1;
+  }
+  for (idx=0; idx<symboltable->count; idx++)
+    hdr.poolsize+=strlen(symboltable->next[idx].name)+1;
+  size=dwcache_size(&hdr);
+  if ((blob=(unsigned char*)malloc(size))==NULL)
+    return 0;
+
+  memcpy(blob,&hdr,sizeof hdr);
+  ptr=blob+sizeof hdr;
+  pool=(char*)blob+size-hdr.poolsize;
+  top=0;
+  for (idx=0; idx<hdr.numlines; idx++) {
+    DWCACHE_LINE *rec=(DWCACHE_LINE*)ptr;
+    rec->address=linetable->next[idx].address;
+    rec->line=linetable->next[idx].line;
+    rec->fileindex=linetable->next[idx].fileindex;
+    ptr+=sizeof(DWCACHE_LINE);
+  }
+  for (idx=0; idx<hdr.numlines; idx++,ptr+=sizeof(uint32_t))
+    *(uint32_t*)ptr=(uint32_t)(linetable->byline[idx]-linetable->next);
+  for (idx=0; idx<hdr.numsymbols; idx++) {
+    const DWARF_SYMBOLLIST *sym=&symboltable->next[idx];
+    DWCACHE_SYM *rec=(DWCACHE_SYM*)ptr;
+    size_t len=strlen(sym->name)+1;
+    memcpy(pool+top,sym->name,len);
+    rec->name=top;
+    top+=len;
+    rec->code_addr=sym->code_addr;
+    rec->code_range=sym->code_range;
+    rec->data_addr=sym->data_addr;
+    rec->line=sym->line;
+    rec->line_limit=sym->line_limit;
+    rec->fileindex=sym->fileindex;
+    rec->scope=sym->scope;
+    ptr+=sizeof(DWCACHE_SYM);
+  }
+  for (idx=0; idx<hdr.hashsize; idx++,ptr+=sizeof(uint32_t))
+    *(uint32_t*)ptr=symboltable->namehash[idx];
+  for (idx=0; idx<hdr.numsymbols; idx++,ptr+=sizeof(uint32_t))
+    *(uint32_t*)ptr=(uint32_t)(symboltable->byfile[idx]-symboltable->next);
+  for (idx=0; idx<hdr.numfunctions; idx++,ptr+=sizeof(uint32_t))
+    *(uint32_t*)ptr=(uint32_t)(symboltable->functions[idx]-symboltable->next);
+  for (idx=0; idx<hdr.numvariables; idx++,ptr+=sizeof(uint32_t))
+    *(uint32_t*)ptr=(uint32_t)(symboltable->variables[idx]-symboltable->next);
+  for (path=filetable->next; path!=NULL; path=path->next,ptr+=sizeof(uint32_t)) {
+    size_t len=strlen(path->name)+1;
+    memcpy(pool+top,path->name,len);
+    *(uint32_t*)ptr=top;
+    top+=len;
+  }
+  assert((char*)ptr==pool && top==hdr.poolsize);
+
+  result=0;
+  if ((fp=fopen(cachefile,"wb"))!=NULL) {
+    result=(fwrite(blob,1,size,fp)==size);
+    fclose(fp);
+    if (!result)
+      remove(cachefile);
+  }
+  free(blob);
+  return result;
+}
+
+/** dwcache_load() reads the cache file with a single read, and verifies that
+ *  it matches the key of the ELF file. On success, the tables are rebuilt
+ *  from the cache; the names of the symbols are kept in a single block (the
+ *  string pool).
+ */
+static int dwcache_load(const char *cachefile,const DWCACHE_HDR *key,
+                        DWARF_LINETABLE *linetable,DWARF_SYMBOLTABLE *symboltable,
+                        DWARF_PATHLIST *filetable,int *address_size)
+{
+  DWCACHE_HDR hdr;
+  const unsigned char *ptr;
+  const uint32_t *byline,*namehash,*byfile,*functions,*variables,*paths;
+  const DWCACHE_LINE *lines;
+  const DWCACHE_SYM *syms;
+  const char *pool;
+  unsigned char *blob;
+  DWARF_PATHLIST *tail;
+  long size;
+  uint32_t idx;
+  FILE *fp;
 
-  result=elf_info(fp,&wordsize,NULL,NULL,NULL);
-  if (result!=ELFERR_NONE || wordsize!=32) {
-    /* only 32-bit architectures at this time */
+  assert(cachefile!=NULL && key!=NULL);
+  if ((fp=fopen(cachefile,"rb"))==NULL)
+    return 0;
+  fseek(fp,0,SEEK_END);
+  size=ftell(fp);
+  fseek(fp,0,SEEK_SET);
+  if (size<(long)sizeof(DWCACHE_HDR) || (blob=(unsigned char*)malloc(size))==NULL) {
+    fclose(fp);
+    return 0;
+  }
+  if (fread(blob,1,size,fp)!=(size_t)size) {
     fclose(fp);
+    free(blob);
     return 0;
   }
+  fclose(fp);
 
-  /* get offsets to various debug tables */
-  elf_section_by_name(fp,".debug_info",&tables[TABLE_INFO].offset,NULL,&tables[TABLE_INFO].size);
-  elf_section_by_name(fp,".debug_abbrev",&tables[TABLE_ABBREV].offset,NULL,&tables[TABLE_ABBREV].size);
-  elf_section_by_name(fp,".debug_str",&tables[TABLE_STR].offset,NULL,&tables[TABLE_STR].size);
-  elf_section_by_name(fp,".debug_line",&tables[TABLE_LINE].offset,NULL,&tables[TABLE_LINE].size);
-  elf_section_by_name(fp,".debug_pubnames",&tables[TABLE_PUBNAME].offset,NULL,&tables[TABLE_PUBNAME].size);
-  elf_section_by_name(fp,".debug_line_str",&tables[TABLE_LINE_STR].offset,NULL,&tables[TABLE_LINE_STR].size);
+  /* verify the key and the size of the cache */
+  memcpy(&hdr,blob,sizeof hdr);
+  if (hdr.magic!=key->magic || hdr.version!=key->version || hdr.ident!=key->ident
+      || hdr.filesize!=key->filesize || hdr.mtime!=key->mtime
+      || hdr.hashsize<(hdr.numsymbols>0 ? 2*hdr.numsymbols : 0)
+      || (hdr.hashsize&(hdr.hashsize-1))!=0
+      || hdr.numfunctions+hdr.numvariables>hdr.numsymbols
+      || dwcache_size(&hdr)!=(size_t)size
+      || (hdr.poolsize>0 && blob[size-1]!='\0'))
+  {
+    free(blob);
+    return 0;
+  }
+  ptr=blob+sizeof hdr;
+  lines=(const DWCACHE_LINE*)ptr;
+  ptr+=hdr.numlines*sizeof(DWCACHE_LINE);
+  byline=(const uint32_t*)ptr;
+  ptr+=hdr.numlines*sizeof(uint32_t);
+  syms=(const DWCACHE_SYM*)ptr;
+  ptr+=hdr.numsymbols*sizeof(DWCACHE_SYM);
+  namehash=(const uint32_t*)ptr;
+  ptr+=hdr.hashsize*sizeof(uint32_t);
+  byfile=(const uint32_t*)ptr;
+  ptr+=hdr.numsymbols*sizeof(uint32_t);
+  functions=(const uint32_t*)ptr;
+  ptr+=hdr.numfunctions*sizeof(uint32_t);
+  variables=(const uint32_t*)ptr;
+  ptr+=hdr.numvariables*sizeof(uint32_t);
+  paths=(const uint32_t*)ptr;
+  pool=(const char*)blob+size-hdr.poolsize;
 
-  result=1;
-  /* the line table also holds information for the file path table and the path
-     cross-reference; the table is therefore mandatory in the DWARF format and
-     it is the first one to parse */
-  if (tables[TABLE_LINE].offset!=0)
-    result=dwarf_linetable(fp,tables,linetable,filetable,&xreftable);
-  /* the information table implicitly parses the abbreviations table, but it
-     discards that table before returning */
-  if (result && tables[TABLE_INFO].offset!=0)
-    result=dwarf_infotable(fp,tables,symboltable,address_size,&xreftable);
+  /* verify all references, so that the tables need no checks after loading */
+  for (idx=0; idx<hdr.numlines; idx++)
+    if (byline[idx]>=hdr.numlines)
+      break;
+  if (idx<hdr.numlines) {
+    free(blob);
+    return 0;
+  }
+  for (idx=0; idx<hdr.numsymbols; idx++)
+    if (syms[idx].name>=hdr.poolsize || byfile[idx]>=hdr.numsymbols)
+      break;
+  if (idx<hdr.numsymbols) {
+    free(blob);
+    return 0;
+  }
+  for (idx=0; idx<hdr.hashsize; idx++)
+    if (namehash[idx]>hdr.numsymbols)
+      break;
+  if (idx<hdr.hashsize) {
+    free(blob);
+    return 0;
+  }
+  for (idx=0; idx<hdr.numfunctions+hdr.numvariables; idx++)
+    if (functions[idx]>=hdr.numsymbols) /* functions & variables are contiguous */
+      break;
+  if (idx<hdr.numfunctions+hdr.numvariables) {
+    free(blob);
+    return 0;
+  }
+  for (idx=0; idx<hdr.numpaths; idx++)
+    if (paths[idx]>=hdr.poolsize)
+      break;
+  if (idx<hdr.numpaths) {
+    free(blob);
+    return 0;
+  }
 
-  pathxref_deletetable(&xreftable);
+  /* allocate the tables (with the same sizes as when building these) */
+  if (hdr.numlines>0) {
+    linetable->next=(DWARF_LINELOOKUP*)malloc(hdr.numlines*sizeof(DWARF_LINELOOKUP));
+    linetable->byline=(DWARF_LINELOOKUP**)malloc(hdr.numlines*sizeof(DWARF_LINELOOKUP*));
+  }
+  if (hdr.numsymbols>0) {
+    symboltable->next=(DWARF_SYMBOLLIST*)malloc(hdr.numsymbols*sizeof(DWARF_SYMBOLLIST));
+    symboltable->namehash=(unsigned*)malloc(hdr.hashsize*sizeof(unsigned));
+    symboltable->byfile=(DWARF_SYMBOLLIST**)malloc(hdr.numsymbols*sizeof(DWARF_SYMBOLLIST*));
+    symboltable->functions=(DWARF_SYMBOLLIST**)malloc((hdr.numfunctions+1)*sizeof(DWARF_SYMBOLLIST*));
+    symboltable->variables=(DWARF_SYMBOLLIST**)malloc((hdr.numvariables+1)*sizeof(DWARF_SYMBOLLIST*));
+    symboltable->namepool=(char*)malloc(hdr.poolsize);
+  }
+  if ((hdr.numlines>0 && (linetable->next==NULL || linetable->byline==NULL))
+      || (hdr.numsymbols>0 && (symboltable->next==NULL || symboltable->namehash==NULL
+                               || symboltable->byfile==NULL || symboltable->functions==NULL
+                               || symboltable->variables==NULL || symboltable->namepool==NULL)))
+  {
+    free(blob);
+    line_deletetable(linetable);
+    symname_deletetable(symboltable);
+    return 0;
+  }
 
-  /* now that we have seen all functions, we can update the scope of local
-     variables */
-  dwarf_postprocess(symboltable,linetable);
+  for (idx=0; idx<hdr.numlines; idx++) {
+    DWARF_LINELOOKUP *cur=&linetable->next[idx];
+    cur->next=(idx+1<hdr.numlines) ? cur+1 : NULL;
+    cur->address=lines[idx].address;
+    cur->line=lines[idx].line;
+    cur->fileindex=lines[idx].fileindex;
+    linetable->byline[idx]=&linetable->next[byline[idx]];
+  }
+  linetable->count=hdr.numlines;
+
+  if (hdr.numsymbols>0) {
+    DWARF_SYMBOLLIST *list=symboltable->next;
+    memcpy(symboltable->namepool,pool,hdr.poolsize);
+    for (idx=0; idx<hdr.numsymbols; idx++) {
+      list[idx].next=(idx+1<hdr.numsymbols) ? &list[idx+1] : NULL;
+      list[idx].name=symboltable->namepool+syms[idx].name;
+      list[idx].code_addr=syms[idx].code_addr;
+      list[idx].code_range=syms[idx].code_range;
+      list[idx].data_addr=syms[idx].data_addr;
+      list[idx].line=syms[idx].line;
+      list[idx].line_limit=syms[idx].line_limit;
+      list[idx].fileindex=syms[idx].fileindex;
+      list[idx].scope=syms[idx].scope;
+      symboltable->byfile[idx]=&list[byfile[idx]];
+    }
+    for (idx=0; idx<hdr.hashsize; idx++)
+      symboltable->namehash[idx]=namehash[idx];
+    for (idx=0; idx<hdr.numfunctions; idx++)
+      symboltable->functions[idx]=&list[functions[idx]];
+    for (idx=0; idx<hdr.numvariables; idx++)
+      symboltable->variables[idx]=&list[variables[idx]];
+    symboltable->count=hdr.numsymbols;
+    symboltable->hashsize=hdr.hashsize;
+    symboltable->numfunctions=hdr.numfunctions;
+    symboltable->numvariables=hdr.numvariables;
+  }
+
+  /* the file table is a list, it is rebuilt in order */
+  tail=filetable;
+  for (idx=0; idx<hdr.numpaths; idx++) {
+    DWARF_PATHLIST *cur=(DWARF_PATHLIST*)malloc(sizeof(DWARF_PATHLIST));
+    if (cur==NULL || (cur->name=strdup(pool+paths[idx]))==NULL) {
+      if (cur!=NULL)
+        free(cur);
+      free(blob);
+      dwarf_cleanup(linetable,symboltable,filetable);
+      return 0;
+    }
+    cur->next=NULL;
+    tail->next=cur;
+    tail=cur;
+  }
+
+  *address_size=hdr.address_size;
+  free(blob);
+  return 1;
+}
+
+/** dwarf_read_cached() reads the DWARF information from an ELF file, like
+ *  dwarf_read(), but it first tries to load the tables from the cache file.
+ *  If the cache is absent or out of date, the DWARF information is parsed
+ *  and the cache file is (re-)created. The cachefile parameter may be NULL,
+ *  in which case this function is the same as dwarf_read().
+ */
+int dwarf_read_cached(FILE *fp,const char *cachefile,DWARF_LINETABLE *linetable,
+                      DWARF_SYMBOLTABLE *symboltable,DWARF_PATHLIST *filetable,
+                      int *address_size)
+{
+  ELF_IMAGE image;
+  DWCACHE_HDR key;
+  int result,haskey;
+  unsigned long mark;
 
+  assert(fp!=NULL);
+  assert(linetable!=NULL && symboltable!=NULL && filetable!=NULL);
+  assert(address_size!=NULL);
+  if (elf_image_open(fp,&image)!=ELFERR_NONE)
+    return 0;
+  mark=phase_clock();
+  haskey=(cachefile!=NULL && dwcache_key(fp,&image,&key));
+  if (haskey && dwcache_load(cachefile,&key,linetable,symboltable,filetable,address_size)) {
+    elf_image_close(&image);
+    memset(phase_time,0,sizeof phase_time);
+    PHASE_MARK(DWARF_PHASE_CACHE,mark);
+    return 1;
+  }
+
+  *address_size=0;  /* in case there is no information table */
+  result=dwarf_read_image(&image,linetable,symboltable,filetable,address_size);
+  elf_image_close(&image);
+  if (result && haskey) {
+    mark=phase_clock();
+    dwcache_save(cachefile,&key,linetable,symboltable,filetable,*address_size);
+    PHASE_MARK(DWARF_PHASE_CACHE,mark);
+  }
   return result;
 }
 
-void dwarf_cleanup(DWARF_LINELOOKUP *linetable,DWARF_SYMBOLLIST *symboltable,DWARF_PATHLIST *filetable)
+static const DWARF_SYMBOLLIST *sym_lookup_name(const DWARF_SYMBOLTABLE *symboltable,
+                                              const char *name,int fileindex,int lineindex)
 {
-  line_deletetable(linetable);
-  symname_deletetable(symboltable);
-  path_deletetable(filetable);
+  const DWARF_SYMBOLLIST *sym,*unit_match,*extern_match;
+  unsigned slot,idx;
+
+  assert(symboltable!=NULL);
+  assert(name!=NULL);
+  if (symboltable->namehash==NULL)
+    return NULL;
+  /* find the first symbol with the name */
+  slot=sym_hash(name)&(symboltable->hashsize-1);
+  for ( ;; ) {
+    idx=symboltable->namehash[slot];
+    if (idx==0)
+      return NULL;
+    if (strcmp(sym_entry(symboltable,idx-1)->name,name)==0)
+      break;
+    slot=(slot+1)&(symboltable->hashsize-1);
+  }
+  /* walk through all symbols with that name: local variables are matched
+     first, then static globals, then external symbols */
+  unit_match=extern_match=NULL;
+  for (sym=sym_entry(symboltable,idx-1); sym!=NULL && strcmp(sym->name,name)==0; sym=sym->next) {
+    if (sym->scope==SCOPE_FUNCTION) {
+      if (fileindex>=0 && lineindex>=0 && sym->fileindex==fileindex
+          && sym->line<=lineindex && lineindex<sym->line_limit)
+        return sym;
+    } else if (sym->scope==SCOPE_UNIT) {
+      if (fileindex>=0 && sym->fileindex==fileindex && unit_match==NULL)
+        unit_match=sym;
+    } else if (sym->scope==SCOPE_EXTERNAL) {
+      if (extern_match==NULL)
+        extern_match=sym;
+    }
+  }
+  return (unit_match!=NULL) ? unit_match : extern_match;
 }
 
 /** dwarf_sym_from_name() returns a function or variable that matches the name,
@@ -1742,76 +3903,109 @@ void dwarf_cleanup(DWARF_LINELOOKUP *linetable,DWARF_SYMBOLLIST *symboltable,DWA
  *  - Functions and variables with unit scope are found if the fileindex
  *    matches. This test is skipped if fileindex is -1.
  *  - External functions and variables are always matched, but are matched last.
+ *
+ *  The name may be a mangled or a demangled C++ name.
  */
-const DWARF_SYMBOLLIST *dwarf_sym_from_name(const DWARF_SYMBOLLIST *symboltable,
+const DWARF_SYMBOLLIST *dwarf_sym_from_name(const DWARF_SYMBOLTABLE *symboltable,
                                             const char *name,int fileindex,int lineindex)
 {
   const DWARF_SYMBOLLIST *sym;
 
   assert(symboltable!=NULL);
   assert(name!=NULL);
-  /* check local variables */
-  if (fileindex>=0 && lineindex>=0) {
-    for (sym=symboltable->next; sym!=NULL; sym=sym->next) {
-      assert(sym->name!=NULL);
-      if (sym->scope==SCOPE_FUNCTION
-          && sym->fileindex==fileindex
-          && sym->line<=lineindex && lineindex<sym->line_limit
-          && strcmp(sym->name,name)==0)
-        return sym;
-    }
+  if (symboltable->lazy!=NULL) {
+    lazy_touch_file(symboltable->lazy,fileindex);
+    lazy_touch_name(symboltable->lazy,name);
   }
-  /* check static globals */
-  if (fileindex>=0) {
-    for (sym=symboltable->next; sym!=NULL; sym=sym->next) {
-      assert(sym->name!=NULL);
-      if (sym->scope==SCOPE_UNIT
-          && sym->fileindex==fileindex
-          && strcmp(sym->name,name)==0)
-        return sym;
+  sym=sym_lookup_name(symboltable,name,fileindex,lineindex);
+  /* without .debug_names, the symbol may be in any of the remaining units
+     (.debug_pubnames only lists external symbols, not the static ones) */
+  if (sym==NULL && symboltable->lazy!=NULL && symboltable->lazy->numindices==0
+      && lazy_touch_all(symboltable->lazy)>0)
+    sym=sym_lookup_name(symboltable,name,fileindex,lineindex);
+  /* the names are stored as is, so a demangled name must be matched against
+     the mangled names; these sort together (on the "_Z" prefix); the name
+     indices hold mangled names only, so in lazy mode, a qualified C++ name
+     may be in any unit */
+  if (sym==NULL && !(name[0]=='_' && name[1]=='Z')) {
+    unsigned low=0,high;
+    if (strstr(name,"::")!=NULL)
+      lazy_touch_all(symboltable->lazy);
+    high=symboltable->count;
+    while (low<high) {
+      unsigned mid=low+(high-low)/2;
+      if (strcmp(sym_entry(symboltable,mid)->name,"_Z")<0)
+        low=mid+1;
+      else
+        high=mid;
+    }
+    for ( ; low<symboltable->count && strncmp(sym_entry(symboltable,low)->name,"_Z",2)==0; low++) {
+      const char *mangled=sym_entry(symboltable,low)->name;
+      if (strcmp(demangle_cached(mangled),name)==0) {
+        sym=sym_lookup_name(symboltable,mangled,fileindex,lineindex);
+        if (sym!=NULL)
+          break;
+      }
     }
   }
-  /* check external symbols */
-  for (sym=symboltable->next; sym!=NULL; sym=sym->next) {
-    assert(sym->name!=NULL);
-    if (sym->scope==SCOPE_EXTERNAL
-        && strcmp(sym->name,name)==0)
-      return sym;
-  }
-  return NULL;
+  return sym;
 }
 
-const DWARF_SYMBOLLIST *dwarf_sym_from_address(const DWARF_SYMBOLLIST *symboltable,unsigned address,int exact)
+/** dwarf_sym_from_address() returns the variable or function at the address.
+ *  If parameter "exact" is zero, and there is no symbol at the address, it
+ *  returns the closest function at a lower address.
+ */
+const DWARF_SYMBOLLIST *dwarf_sym_from_address(const DWARF_SYMBOLTABLE *symboltable,unsigned address,int exact)
 {
-  const DWARF_SYMBOLLIST *sym, *select = NULL;
+  DWARF_SYMBOLLIST **list;
+  unsigned low,high;
 
   assert(symboltable!=NULL);
-  for (sym=symboltable->next; sym!=NULL; sym=sym->next) {
-    if (sym->code_range==0) {
-      /* check variable */
-      if (sym->data_addr==address)
-        return sym;   /* always return the variable on an exact address match */
-    } else {
-      /* check function */
-      if (sym->code_addr==address)
-        return sym;   /* always return the function on an exact address match */
-      if (!exact && sym->code_addr<address)
-        select=sym;   /* optionally return the closest function at a lower address */
-    }
+  lazy_touch_address(symboltable->lazy,address);
+  if (symboltable->functions==NULL)
+    return NULL;
+  /* look up the variable */
+  list=symboltable->variables;
+  low=0;
+  high=symboltable->numvariables;
+  while (low<high) {
+    unsigned mid=low+(high-low)/2;
+    if (list[mid]->data_addr<address)
+      low=mid+1;
+    else
+      high=mid;
+  }
+  if (low<symboltable->numvariables && list[low]->data_addr==address)
+    return list[low];
+  /* look up the function, find the last one at or below the address */
+  list=symboltable->functions;
+  low=0;
+  high=symboltable->numfunctions;
+  while (low<high) {
+    unsigned mid=low+(high-low)/2;
+    if (list[mid]->code_addr<=address)
+      low=mid+1;
+    else
+      high=mid;
   }
-  return select;
+  if (low==0)
+    return NULL;  /* all functions are at higher addresses */
+  low-=1;
+  if (list[low]->code_addr==address) {
+    while (low>0 && list[low-1]->code_addr==address)
+      low--;      /* return the first in name order */
+    return list[low];
+  }
+  return exact ? NULL : list[low];
 }
 
-const DWARF_SYMBOLLIST *dwarf_sym_from_index(const DWARF_SYMBOLLIST *symboltable,unsigned index)
+const DWARF_SYMBOLLIST *dwarf_sym_from_index(const DWARF_SYMBOLTABLE *symboltable,unsigned index)
 {
-  const DWARF_SYMBOLLIST *sym;
-
   assert(symboltable!=NULL);
-  for (sym=symboltable->next; sym!=NULL; sym=sym->next) {
-    if (index--==0)
-      return sym;
-  }
-  return NULL;
+  lazy_touch_all(symboltable->lazy);
+  if (index>=symboltable->count)
+    return NULL;
+  return sym_entry(symboltable,index);
 }
 
 /** dwarf_collect_functions_in_file() stores the pointers to all "code" symbols
@@ -1824,19 +4018,36 @@ const DWARF_SYMBOLLIST *dwarf_sym_from_index(const DWARF_SYMBOLLIST *symboltable
  *  Note that the returned list holds pointers to symbols, not the symbols
  *  themselves. The list can be sorted on function names or function addresses.
  */
-unsigned dwarf_collect_functions_in_file(const DWARF_SYMBOLLIST *symboltable,int fileindex,
+unsigned dwarf_collect_functions_in_file(const DWARF_SYMBOLTABLE *symboltable,int fileindex,
                                          int sort,const DWARF_SYMBOLLIST *list[],int numentries)
 {
-  const DWARF_SYMBOLLIST *sym;
+  DWARF_SYMBOLLIST **index;
+  unsigned low,high;
   int count;
 
   assert(symboltable!=NULL);
+  lazy_touch_file(symboltable->lazy,fileindex);
   if (list==NULL)
     numentries=0;
+  index=symboltable->byfile;
+  if (index==NULL)
+    return 0;
 
+  /* find the first symbol of the file, then walk through the symbols of that
+     file (these are sorted on scope, then on name) */
+  low=0;
+  high=symboltable->count;
+  while (low<high) {
+    unsigned mid=low+(high-low)/2;
+    if (index[mid]->fileindex<fileindex)
+      low=mid+1;
+    else
+      high=mid;
+  }
   count=0;
-  for (sym=symboltable->next; sym!=NULL; sym=sym->next) {
-    if (sym->fileindex==fileindex && DWARF_IS_FUNCTION(sym)) {
+  for ( ; low<symboltable->count && index[low]->fileindex==fileindex; low++) {
+    const DWARF_SYMBOLLIST *sym=index[low];
+    if (DWARF_IS_FUNCTION(sym)) {
       if (count<numentries) {
         int pos;
         if (sort==DWARF_SORT_ADDRESS) {
@@ -1909,14 +4120,57 @@ int dwarf_fileindex_from_path(const DWARF_PATHLIST *filetable,const char *path)
   return -1;
 }
 
-const DWARF_LINELOOKUP *dwarf_line_from_address(const DWARF_LINELOOKUP *linetable,unsigned address)
+/** dwarf_line_from_address() returns the line table entry for the address,
+ *  meaning the last entry at or below the address. It returns NULL if the
+ *  address is below the first entry in the table.
+ */
+const DWARF_LINELOOKUP *dwarf_line_from_address(const DWARF_LINETABLE *linetable,unsigned address)
+{
+  unsigned low,high;
+
+  assert(linetable!=NULL);
+  lazy_touch_address(linetable->lazy,address);
+  if (linetable->count==0 || address<line_entry(linetable,0)->address)
+    return NULL;
+  /* binary search for the last entry with an address <= the requested address */
+  low=0;
+  high=linetable->count;
+  while (high-low>1) {
+    unsigned mid=low+(high-low)/2;
+    if (line_entry(linetable,mid)->address<=address)
+      low=mid;
+    else
+      high=mid;
+  }
+  return line_entry(linetable,low);
+}
+
+/** dwarf_line_from_fileline() returns the line table entry for the line in the
+ *  file, or for the first line after it that has code (in the same file). It
+ *  returns NULL if no line at or after the requested line has code.
+ */
+const DWARF_LINELOOKUP *dwarf_line_from_fileline(const DWARF_LINETABLE *linetable,int fileindex,int line)
 {
-  const DWARF_LINELOOKUP *line;
+  DWARF_LINELOOKUP **index;
+  unsigned low,high;
 
   assert(linetable!=NULL);
-  for (line=linetable->next; line!=NULL; line=line->next)
-    if (line->address<=address && (line->next==NULL || line->next->address>address))
-      return line;
+  lazy_touch_file(linetable->lazy,fileindex);
+  index=linetable->byline;
+  if (index==NULL)
+    return NULL;
+  /* binary search for the first entry at or after the requested file & line */
+  low=0;
+  high=linetable->count;
+  while (low<high) {
+    unsigned mid=low+(high-low)/2;
+    if (index[mid]->fileindex<fileindex || (index[mid]->fileindex==fileindex && index[mid]->line<line))
+      low=mid+1;
+    else
+      high=mid;
+  }
+  if (low<linetable->count && index[low]->fileindex==fileindex)
+    return index[low];
   return NULL;
 }
 
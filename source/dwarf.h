@@ -19,10 +19,14 @@
 #ifndef _DWARF_H
 #define _DWARF_H
 
+#include "elf.h"
+
 #if defined __cplusplus
   extern "C" {
 #endif
 
+typedef struct tagDWARF_LAZY DWARF_LAZY;
+
 typedef struct tagDWARF_PATHLIST {
   struct tagDWARF_PATHLIST *next;
   char *name;
@@ -47,6 +51,21 @@ typedef struct tagDWARF_SYMBOLLIST {
   short scope;
 } DWARF_SYMBOLLIST;
 
+typedef struct tagDWARF_SYMBOLTABLE {
+  DWARF_SYMBOLLIST *next;       /* array sorted on name (first symbol in lazy mode), symbols are also chained (for iteration) */
+  unsigned count;               /* number of symbols in the array */
+  DWARF_SYMBOLLIST **byname;    /* index sorted on name (lazy mode only, NULL otherwise) */
+  unsigned *namehash;           /* hash table on name (index+1 of the first symbol with the name) */
+  unsigned hashsize;
+  DWARF_SYMBOLLIST **byfile;    /* index sorted on file & scope */
+  DWARF_SYMBOLLIST **functions; /* functions, sorted on address */
+  unsigned numfunctions;
+  DWARF_SYMBOLLIST **variables; /* global & static variables, sorted on address */
+  unsigned numvariables;
+  char *namepool;               /* block with all names (when loaded from the cache), or NULL */
+  DWARF_LAZY *lazy;             /* state for decoding units on demand, or NULL */
+} DWARF_SYMBOLTABLE;
+
 typedef struct tagDWARF_LINELOOKUP {
   struct tagDWARF_LINELOOKUP *next;
   unsigned address;
@@ -54,6 +73,14 @@ typedef struct tagDWARF_LINELOOKUP {
   int fileindex;
 } DWARF_LINELOOKUP;
 
+typedef struct tagDWARF_LINETABLE {
+  DWARF_LINELOOKUP *next;       /* array sorted on address (first entry in lazy mode), entries are also chained (for iteration) */
+  unsigned count;               /* number of entries in the array */
+  DWARF_LINELOOKUP **byaddress; /* index sorted on address (lazy mode only, NULL otherwise) */
+  DWARF_LINELOOKUP **byline;    /* index on the entries, sorted on file & line */
+  DWARF_LAZY *lazy;             /* state for decoding units on demand, or NULL */
+} DWARF_LINETABLE;
+
 #define DWARF_IS_FUNCTION(sym)  ((sym)->code_range>0)
 #define DWARF_IS_VARIABLE(sym)  ((sym)->code_range==0)
 
@@ -62,16 +89,31 @@ enum {
   DWARF_SORT_ADDRESS,
 };
 
-int dwarf_read(FILE *fp,DWARF_LINELOOKUP *linetable,DWARF_SYMBOLLIST *symboltable,DWARF_PATHLIST *filetable,int *address_size);
-void dwarf_cleanup(DWARF_LINELOOKUP *linetable,DWARF_SYMBOLLIST *symboltable,DWARF_PATHLIST *filetable);
+enum {
+  DWARF_PHASE_LINES,  /* parsing the line table */
+  DWARF_PHASE_INFO,   /* parsing the information & abbreviations tables */
+  DWARF_PHASE_SORT,   /* sorting the symbol table */
+  DWARF_PHASE_SCOPE,  /* function line ranges & scopes of local variables */
+  DWARF_PHASE_INDEX,  /* building the symbol look-up indices */
+  DWARF_PHASE_CACHE,  /* loading or saving the cache file */
+  DWARF_PHASE_COUNT
+};
+
+int dwarf_read(FILE *fp,DWARF_LINETABLE *linetable,DWARF_SYMBOLTABLE *symboltable,DWARF_PATHLIST *filetable,int *address_size);
+int dwarf_read_image(const ELF_IMAGE *image,DWARF_LINETABLE *linetable,DWARF_SYMBOLTABLE *symboltable,DWARF_PATHLIST *filetable,int *address_size);
+int dwarf_read_lazy(FILE *fp,DWARF_LINETABLE *linetable,DWARF_SYMBOLTABLE *symboltable,DWARF_PATHLIST *filetable,int *address_size);
+int dwarf_read_cached(FILE *fp,const char *cachefile,DWARF_LINETABLE *linetable,DWARF_SYMBOLTABLE *symboltable,DWARF_PATHLIST *filetable,int *address_size);
+void dwarf_cleanup(DWARF_LINETABLE *linetable,DWARF_SYMBOLTABLE *symboltable,DWARF_PATHLIST *filetable);
+unsigned long dwarf_phase_time(int phase);
 
-const DWARF_SYMBOLLIST* dwarf_sym_from_name(const DWARF_SYMBOLLIST *symboltable,const char *name,int fileindex,int lineindex);
-const DWARF_SYMBOLLIST* dwarf_sym_from_address(const DWARF_SYMBOLLIST *symboltable,unsigned address,int exact);
-const DWARF_SYMBOLLIST* dwarf_sym_from_index(const DWARF_SYMBOLLIST *symboltable,unsigned index);
-unsigned                dwarf_collect_functions_in_file(const DWARF_SYMBOLLIST *symboltable,int fileindex,int sort,const DWARF_SYMBOLLIST *list[],int numentries);
+const DWARF_SYMBOLLIST* dwarf_sym_from_name(const DWARF_SYMBOLTABLE *symboltable,const char *name,int fileindex,int lineindex);
+const DWARF_SYMBOLLIST* dwarf_sym_from_address(const DWARF_SYMBOLTABLE *symboltable,unsigned address,int exact);
+const DWARF_SYMBOLLIST* dwarf_sym_from_index(const DWARF_SYMBOLTABLE *symboltable,unsigned index);
+unsigned                dwarf_collect_functions_in_file(const DWARF_SYMBOLTABLE *symboltable,int fileindex,int sort,const DWARF_SYMBOLLIST *list[],int numentries);
 const char*             dwarf_path_from_fileindex(const DWARF_PATHLIST *filetable,int fileindex);
 int                     dwarf_fileindex_from_path(const DWARF_PATHLIST *filetable,const char *path);
-const DWARF_LINELOOKUP* dwarf_line_from_address(const DWARF_LINELOOKUP *linetable,unsigned address);
+const DWARF_LINELOOKUP* dwarf_line_from_address(const DWARF_LINETABLE *linetable,unsigned address);
+const DWARF_LINELOOKUP* dwarf_line_from_fileline(const DWARF_LINETABLE *linetable,int fileindex,int line);
 
 #if defined __cplusplus
   }
@@ -26,12 +26,19 @@
 #include <string.h>
 #include "elf.h"
 #if defined WIN32 || defined _WIN32
+  #define WIN32_LEAN_AND_MEAN
+  #include <windows.h>
+  #include <io.h>
   #if defined __MINGW32__ || defined __MINGW64__ || defined _MSC_VER
     #include "strlcpy.h"
   #endif
 #elif defined __linux__
   #include <bsd/string.h>
 #endif
+#if defined __linux__ || defined __FreeBSD__ || defined __APPLE__
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+#endif
 
 #if defined __GNUC__
   #define PACKED        __attribute__((packed))
@@ -616,94 +623,386 @@ int elf_section_by_address(FILE *fp,unsigned long baseaddr,
   return ELFERR_NONE;
 }
 
-/** elf_load_symbols() loads the symbol table from an ELF file (if one is
- *  present).
+/** elf_image_open() maps an ELF file into memory and parses its headers, so
+ *  that the sections and segments can subsequently be accessed as memory
+ *  blocks (without any further file I/O). If the file cannot be mapped, it is
+ *  read into memory instead.
  *
- *  To query the required size for holding the symbol table, call this function
- *  with parameter "symbols" set to NULL. The number of entries will be returned
- *  in parameter "number". After allocating sufficient memory, call this
- *  function again, with "number" set to the number of allocated entries.
+ *  \param fp         [in] File handle to the ELF file. The file handle may be
+ *                    closed after this function returns.
+ *  \param image      [out] Will hold the mapped image.
  *
- *  \param fp         [in] The file poiner to the ELF file.
- *  \param symbols    [out] A pointer to an array that will hold the symbol
- *                    table, or NULL to query the required size of the symbol
- *                    table.
- *  \param number     [in/out] If the "symbols" parameter is non-NULL, this
- *                    parameter holds the maximum number of entries that the
- *                    array can hold. If the "symbols" parameter is NULL, this
- *                    parameter will be set to the required number of entries.
+ *  \return An error code.
  *
- *  \return An error value.
+ *  \note The image must be released with elf_image_close().
  */
-int elf_load_symbols(FILE *fp,ELF_SYMBOL *symbols,int *number)
+int elf_image_open(FILE *fp,ELF_IMAGE *image)
 {
-  unsigned long offset,length;
-  char *stringtable;
-  ELF32SYMBOL sym;
-  int i,total,err,size;
-
-  assert(number!=NULL);
-  size=(symbols!=NULL) ? *number : 0;
-  if (symbols!=NULL && *number>0)
-    memset(symbols,0,*number*sizeof(ELF_SYMBOL));
-  *number=0;
+  ELF32HDR hdr;
+  int bigendian;
 
-  /* first read the symbol string table */
   assert(fp!=NULL);
-  err=elf_section_by_name(fp,".strtab",&offset,NULL,&length);
-  if (err!=ELFERR_NONE)
-    return err;
-  stringtable=malloc(length);
-  if (stringtable==NULL)
-    return ELFERR_MEMORY;
-  fseek(fp,offset,SEEK_SET);
-  fread(stringtable,1,length,fp);
+  assert(image!=NULL);
+  memset(image,0,sizeof(ELF_IMAGE));
+  fflush(fp);   /* the mapping must see any data still buffered for writing */
 
-  /* now get the symbol table */
-  err=elf_section_by_name(fp,".symtab",&offset,NULL,&length);
-  if (err!=ELFERR_NONE) {
-    free((void*)stringtable);
-    return err;
+# if defined WIN32 || defined _WIN32
+  {
+    HANDLE hfile=(HANDLE)_get_osfhandle(_fileno(fp));
+    if (hfile!=INVALID_HANDLE_VALUE) {
+      HANDLE hmap=CreateFileMapping(hfile,NULL,PAGE_READONLY,0,0,NULL);
+      if (hmap!=NULL) {
+        image->data=(const unsigned char*)MapViewOfFile(hmap,FILE_MAP_READ,0,0,0);
+        if (image->data!=NULL) {
+          image->size=GetFileSize(hfile,NULL);
+          image->handle=(void*)hmap;
+          image->mapped=1;
+        } else {
+          CloseHandle(hmap);
+        }
+      }
+    }
+  }
+# elif defined __linux__ || defined __FreeBSD__ || defined __APPLE__
+  {
+    struct stat st;
+    if (fstat(fileno(fp),&st)==0 && st.st_size>0) {
+      void *data=mmap(NULL,(size_t)st.st_size,PROT_READ,MAP_PRIVATE,fileno(fp),0);
+      if (data!=MAP_FAILED) {
+        image->data=(const unsigned char*)data;
+        image->size=(unsigned long)st.st_size;
+        image->mapped=1;
+      }
+    }
+  }
+# endif
+  if (image->data==NULL) {
+    /* no memory-mapped file support (or mapping failed), read the file */
+    unsigned char *data;
+    long size;
+    fseek(fp,0,SEEK_END);
+    size=ftell(fp);
+    if (size<=0)
+      return ELFERR_FILEFORMAT;
+    data=(unsigned char*)malloc(size);
+    if (data==NULL)
+      return ELFERR_MEMORY;
+    fseek(fp,0,SEEK_SET);
+    if (fread(data,1,size,fp)!=(size_t)size) {
+      free(data);
+      return ELFERR_FILEFORMAT;
+    }
+    image->data=data;
+    image->size=(unsigned long)size;
+  }
+
+  /* parse the header */
+  if (image->size<sizeof(hdr)) {
+    elf_image_close(image);
+    return ELFERR_FILEFORMAT;
+  }
+  memcpy(&hdr,image->data,sizeof(hdr));
+  if (memcmp(hdr.magic,"\177ELF",4)!=0 || hdr.shoff==0) {
+    elf_image_close(image);
+    return ELFERR_FILEFORMAT;
+  }
+  bigendian=(hdr.endian==2);
+  image->wordsize=(hdr.wordsize==1) ? 32 : 64;
+  image->bigendian=bigendian;
+  if (image->wordsize==32) {
+    ELF32SECTION section;
+    uint32_t shoff=bigendian ? SWAP32(hdr.shoff) : hdr.shoff;
+    uint32_t phoff=bigendian ? SWAP32(hdr.phoff) : hdr.phoff;
+    int shnum=bigendian ? SWAP16(hdr.shnum) : hdr.shnum;
+    int phnum=bigendian ? SWAP16(hdr.phnum) : hdr.phnum;
+    int shtrndx=bigendian ? SWAP16(hdr.shtrndx) : hdr.shtrndx;
+    if (shoff+(unsigned long)shnum*sizeof(ELF32SECTION)>image->size
+        || phoff+(unsigned long)phnum*sizeof(ELF32PROGRAM)>image->size
+        || shtrndx>=shnum)
+    {
+      elf_image_close(image);
+      return ELFERR_FILEFORMAT;
+    }
+    image->shoff=shoff;
+    image->shnum=shnum;
+    image->phoff=phoff;
+    image->phnum=(phoff!=0) ? phnum : 0;
+    /* locate the section names */
+    memcpy(&section,image->data+shoff+shtrndx*sizeof(ELF32SECTION),sizeof(section));
+    image->shstroff=bigendian ? SWAP32(section.offset) : section.offset;
+    image->shstrsize=bigendian ? SWAP32(section.size) : section.size;
+    if (image->shstroff+image->shstrsize>image->size)
+      image->shstrsize=0;
+  }
+
+  return ELFERR_NONE;
+}
+
+/** elf_image_close() releases a mapped image.
+ */
+void elf_image_close(ELF_IMAGE *image)
+{
+  assert(image!=NULL);
+  if (image->data!=NULL) {
+    if (image->mapped) {
+#     if defined WIN32 || defined _WIN32
+        UnmapViewOfFile((void*)image->data);
+        CloseHandle((HANDLE)image->handle);
+#     elif defined __linux__ || defined __FreeBSD__ || defined __APPLE__
+        munmap((void*)image->data,image->size);
+#     endif
+    } else {
+      free((void*)image->data);
+    }
+  }
+  memset(image,0,sizeof(ELF_IMAGE));
+}
+
+/** elf_image_section() looks up a section by name in a mapped image.
+ *
+ *  \param image        [in] The mapped image.
+ *  \param sectionname  [in] The name of the section to locate.
+ *  \param offset       [out] Set to the file offset to the section in the ELF
+ *                      file. This parameter may be NULL.
+ *  \param address      [out] The memory address for the section. This parameter
+ *                      may be NULL.
+ *  \param length       [out] Set to the length of the section. This parameter
+ *                      may be NULL.
+ *
+ *  \return A pointer to the section contents, or NULL if the section is not
+ *          found (or if the section has no contents in the file).
+ */
+const unsigned char *elf_image_section(const ELF_IMAGE *image,const char *sectionname,
+                                       unsigned long *offset,unsigned long *address,
+                                       unsigned long *length)
+{
+  const char *names;
+  int idx;
+
+  assert(image!=NULL);
+  assert(sectionname!=NULL && strlen(sectionname)>0);
+  if (offset!=NULL)
+    *offset=0;
+  if (address!=NULL)
+    *address=0;
+  if (length!=NULL)
+    *length=0;
+  if (image->wordsize!=32)
+    return NULL;
+
+  names=(const char*)image->data+image->shstroff;
+  for (idx=0; idx<image->shnum; idx++) {
+    ELF32SECTION section;
+    uint32_t nidx,offs,size;
+    memcpy(&section,image->data+image->shoff+idx*sizeof(ELF32SECTION),sizeof(section));
+    nidx=image->bigendian ? SWAP32(section.name) : section.name;
+    if (nidx>=image->shstrsize
+        || strncmp(names+nidx,sectionname,image->shstrsize-nidx)!=0)
+      continue;
+    offs=image->bigendian ? SWAP32(section.offset) : section.offset;
+    size=image->bigendian ? SWAP32(section.size) : section.size;
+    if ((unsigned long)offs+size>image->size)
+      return NULL;  /* section lies (partially) outside the file */
+    if (offset!=NULL)
+      *offset=offs;
+    if (address!=NULL)
+      *address=image->bigendian ? SWAP32(section.addr) : section.addr;
+    if (length!=NULL)
+      *length=size;
+    return image->data+offs;
   }
+  return NULL;
+}
+
+/** elf_image_segment() returns information on a segment in a mapped image.
+ *  The parameters are the same as for elf_segment_by_index(), see there.
+ *
+ *  \return An error code.
+ */
+int elf_image_segment(const ELF_IMAGE *image,int index,
+                      int *type,
+                      unsigned long *offset,unsigned long *filesize,
+                      unsigned long *vaddr,unsigned long *paddr,
+                      unsigned long *memsize)
+{
+  ELF32PROGRAM segment;
+  int bigendian;
+
+  assert(image!=NULL);
+  assert(index>=0);
+  if (type!=NULL)
+    *type=-1;
+  if (offset!=NULL)
+    *offset=0;
+  if (filesize!=NULL)
+    *filesize=0;
+  if (vaddr!=NULL)
+    *vaddr=0;
+  if (paddr!=NULL)
+    *paddr=0;
+  if (memsize!=NULL)
+    *memsize=0;
+
+  if (image->wordsize!=32 || image->phoff==0)
+    return ELFERR_FILEFORMAT;
+  if (index>=image->phnum)
+    return ELFERR_NOMATCH;   /* requested segment not present */
+  memcpy(&segment,image->data+image->phoff+index*sizeof(ELF32PROGRAM),sizeof(segment));
+  bigendian=image->bigendian;
+  if (type!=NULL)
+    *type=bigendian ? SWAP32(segment.type) : segment.type;
+  if (offset!=NULL)
+    *offset=bigendian ? SWAP32(segment.offset) : segment.offset;
+  if (filesize!=NULL)
+    *filesize=bigendian ? SWAP32(segment.filesz) : segment.filesz;
+  if (vaddr!=NULL)
+    *vaddr=bigendian ? SWAP32(segment.vaddr) : segment.vaddr;
+  if (paddr!=NULL)
+    *paddr=bigendian ? SWAP32(segment.paddr) : segment.paddr;
+  if (memsize!=NULL)
+    *memsize=bigendian ? SWAP32(segment.memsz) : segment.memsz;
+  return ELFERR_NONE;
+}
+
+static int symtab_cmp(const void *p1,const void *p2)
+{
+  const ELF_SYMBOL *s1=(const ELF_SYMBOL*)p1;
+  const ELF_SYMBOL *s2=(const ELF_SYMBOL*)p2;
+  if (s1->address!=s2->address)
+    return (s1->address<s2->address) ? -1 : 1;
+  /* same address: keep the order of the string table */
+  return (s1->name<s2->name) ? -1 : (s1->name>s2->name) ? 1 : 0;
+}
+
+/** elf_image_symtab() loads the functions and variables from the symbol table
+ *  of a mapped image, in a single pass. The symbols and the names are stored
+ *  in a single memory block: the array with the symbols is followed by a copy
+ *  of the string table, and the names point into that copy.
+ *
+ *  \param image      [in] The mapped image.
+ *  \param symbols    [out] Will point to the array with the symbols, sorted on
+ *                    address. The array must be released with free(); it is
+ *                    set to NULL if the symbol table is empty.
+ *  \param number     [out] The number of symbols in the array.
+ *
+ *  \return An error code.
+ */
+int elf_image_symtab(const ELF_IMAGE *image,ELF_SYMBOL **symbols,int *number)
+{
+  const unsigned char *symtab;
+  const char *stringtable;
+  unsigned long strsize,length;
+  ELF_SYMBOL *list;
+  char *strings;
+  int i,total,count;
+
+  assert(image!=NULL);
+  assert(symbols!=NULL);
+  assert(number!=NULL);
+  *symbols=NULL;
+  *number=0;
+
+  stringtable=(const char*)elf_image_section(image,".strtab",NULL,NULL,&strsize);
+  symtab=elf_image_section(image,".symtab",NULL,NULL,&length);
+  if (stringtable==NULL || symtab==NULL)
+    return (image->wordsize==32) ? ELFERR_NOMATCH : ELFERR_FILEFORMAT;
 
   assert(length % sizeof(ELF32SYMBOL)==0);
   total=length/sizeof(ELF32SYMBOL);
-  fseek(fp,offset,SEEK_SET);
+  if (total==0)
+    return ELFERR_NONE;
+  /* allocate for the case that all entries are functions or variables, plus
+     the string table (with a terminator, in case the table lacks one) */
+  list=(ELF_SYMBOL*)malloc(total*sizeof(ELF_SYMBOL)+strsize+1);
+  if (list==NULL)
+    return ELFERR_MEMORY;
+  strings=(char*)(list+total);
+  memcpy(strings,stringtable,strsize);
+  strings[strsize]='\0';
+
+  count=0;
   for (i=0; i<total; i++) {
+    ELF32SYMBOL sym;
     int type;
-    fread(&sym,sizeof(ELF32SYMBOL),1,fp);
-    if (sym.name==0)
+    memcpy(&sym,symtab+i*sizeof(ELF32SYMBOL),sizeof(sym));
+    if (sym.name==0 || sym.name>=strsize)
       continue; /* ignore anonymous symbols */
     type=sym.info & 0x0f;
     if (type!=STT_OBJECT && type!=STT_FUNC && type!=STT_COMMON)
       continue; /* collect only functions & variables */
-    if (*number<size) {
-      const char *ptr=stringtable+sym.name;
-      assert(symbols!=NULL);  /* otherwise "size" would be zero (and this "if" never entered) */
-      symbols[*number].name=strdup(ptr);
-      symbols[*number].address=sym.addr;
-      symbols[*number].size=sym.size;
-      symbols[*number].is_func=(type==STT_FUNC);
-      symbols[*number].is_ext=(((sym.info >> 4) & 1)!=0);
-      if (symbols[*number].name==NULL) {
-        elf_clear_symbols(symbols,*number);
-        return ELFERR_MEMORY;
-      }
-    }
-    *number+=1;
+    list[count].name=strings+sym.name;
+    list[count].address=sym.addr;
+    list[count].size=sym.size;
+    list[count].is_func=(type==STT_FUNC);
+    list[count].is_ext=(((sym.info >> 4) & 1)!=0);
+    count++;
+  }
+  if (count==0) {
+    free((void*)list);
+    return ELFERR_NONE;
   }
+  qsort(list,count,sizeof(ELF_SYMBOL),symtab_cmp);
 
-  free((void*)stringtable);
+  *symbols=list;
+  *number=count;
   return ELFERR_NONE;
 }
 
-void elf_clear_symbols(ELF_SYMBOL *symbols,int number)
+/** elf_load_symtab() loads the functions and variables from the symbol table
+ *  of an ELF file. The parameters are the same as for elf_image_symtab(), see
+ *  there.
+ *
+ *  \return An error code.
+ */
+int elf_load_symtab(FILE *fp,ELF_SYMBOL **symbols,int *number)
 {
-  int i;
+  ELF_IMAGE image;
+  int err;
+
+  assert(fp!=NULL);
   assert(symbols!=NULL);
-  for (i=0; i<number; i++)
-    if (symbols[i].name!=NULL)
-      free((void*)symbols[i].name);
+  assert(number!=NULL);
+  *symbols=NULL;
+  *number=0;
+  err=elf_image_open(fp,&image);
+  if (err!=ELFERR_NONE)
+    return err;
+  err=elf_image_symtab(&image,symbols,number);
+  elf_image_close(&image);
+  return err;
+}
+
+/** elf_symbol_at() looks up the symbol that holds an address, with a binary
+ *  search in an array that is sorted on address (see elf_load_symtab()).
+ *
+ *  \param symbols    [in] The array with the symbols.
+ *  \param number     [in] The number of symbols in the array.
+ *  \param address    [in] The address to look up.
+ *
+ *  \return The symbol whose range (address plus size) holds the address, or
+ *          that starts at the address (for a symbol with unknown size). The
+ *          function returns NULL if no symbol holds the address.
+ */
+const ELF_SYMBOL *elf_symbol_at(const ELF_SYMBOL *symbols,int number,unsigned long address)
+{
+  int low,high,idx;
+
+  assert(symbols!=NULL || number==0);
+  /* find the first symbol above the address */
+  low=0;
+  high=number;
+  while (low<high) {
+    int mid=low+(high-low)/2;
+    if (symbols[mid].address<=address)
+      low=mid+1;
+    else
+      high=mid;
+  }
+  /* check the symbols at the highest address below (or at) the address */
+  for (idx=low-1; idx>=0 && symbols[idx].address==symbols[low-1].address; idx--)
+    if (symbols[idx].address==address || address<symbols[idx].address+symbols[idx].size)
+      return &symbols[idx];
+  return NULL;
 }
 
 /** elf_patch_vecttable() updates the checksum in the vector table in the ELF
@@ -41,6 +41,22 @@ typedef struct tagELF_SYMBOL {
   unsigned char is_ext; /* 1 for external scope, 0 for file local scope */
 } ELF_SYMBOL;
 
+typedef struct tagELF_IMAGE {
+  const unsigned char *data;  /* contents of the ELF file */
+  unsigned long size;         /* size of the ELF file in bytes */
+  int wordsize;               /* 32 or 64 */
+  int bigendian;              /* 1 for Big Endian byte order */
+  /* fields below are for internal use */
+  unsigned long shoff;        /* file offset of the section header table */
+  int shnum;                  /* number of sections */
+  unsigned long phoff;        /* file offset of the program header table */
+  int phnum;                  /* number of segments */
+  unsigned long shstroff;     /* file offset of the section names */
+  unsigned long shstrsize;
+  void *handle;               /* handle of the file mapping (if needed) */
+  int mapped;                 /* 1 if memory-mapped, 0 if read into memory */
+} ELF_IMAGE;
+
 int elf_info(FILE *fp,int *wordsize,int *bigendian,int *machine,unsigned long *entry_addr);
 
 int elf_segment_by_index(FILE *fp,int index,
@@ -56,8 +72,20 @@ int elf_section_by_address(FILE *fp,unsigned long baseaddr,
                            char *sectionname,size_t namelength,unsigned long *offset,
                            unsigned long *address,unsigned long *length);
 
-int elf_load_symbols(FILE *fp,ELF_SYMBOL *symbols,int *number);
-void elf_clear_symbols(ELF_SYMBOL *symbols,int number);
+int elf_image_open(FILE *fp,ELF_IMAGE *image);
+void elf_image_close(ELF_IMAGE *image);
+const unsigned char *elf_image_section(const ELF_IMAGE *image,const char *sectionname,
+                                       unsigned long *offset,unsigned long *address,
+                                       unsigned long *length);
+int elf_image_segment(const ELF_IMAGE *image,int index,
+                      int *type,
+                      unsigned long *offset,unsigned long *filesize,
+                      unsigned long *vaddr,unsigned long *paddr,
+                      unsigned long *memsize);
+
+int elf_load_symtab(FILE *fp,ELF_SYMBOL **symbols,int *number);
+int elf_image_symtab(const ELF_IMAGE *image,ELF_SYMBOL **symbols,int *number);
+const ELF_SYMBOL *elf_symbol_at(const ELF_SYMBOL *symbols,int number,unsigned long address);
 
 int elf_patch_vecttable(FILE *fp,const char *driver,unsigned int *checksum);
 int elf_check_crp(FILE *fp,int *crp);
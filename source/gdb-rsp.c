@@ -24,8 +24,10 @@
 #endif
 #include <assert.h>
 #include <ctype.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "bmp-support.h"
 #include "gdb-rsp.h"
@@ -33,13 +35,22 @@
 #include "tcpip.h"
 
 #define TIMEOUT       500
-#define POLL_INTERVAL 50
 #define RETRIES       3
+#define MAX_PENDING   16  /* max. number of commands in flight, for the latency statistics */
 
 
-static unsigned char *cache = NULL; /* cache for received data */
+static unsigned char *xmit_buffer = NULL; /* buffer for framing transmitted packets */
+static size_t xmit_size = 0;
+static unsigned char *cache = NULL; /* ring buffer for received data */
 static size_t cache_size = 0;       /* maximum size of the cache */
-static size_t cache_idx = 0;        /* index to the free area of the cache */
+static size_t cache_head = 0;       /* index of the first byte in the cache */
+static size_t cache_count = 0;      /* number of bytes in the cache */
+static int noack_mode = 0;          /* set when the gdbserver does not send (or expect) acks */
+
+static unsigned long latency_hist[GDBRSP_LATENCY_BUCKETS];
+static uint64_t latency_stamp[MAX_PENDING]; /* transmit times of commands in flight */
+static int latency_head = 0;
+static int latency_count = 0;
 
 
 static int hex2int(char ch)
@@ -61,11 +72,134 @@ static char int2hex(int v)
   return digits[v];
 }
 
+/* clock_us() returns a monotonic time stamp in microseconds */
+static uint64_t clock_us(void)
+{
+  #if defined _WIN32
+    LARGE_INTEGER count, freq;
+    QueryPerformanceCounter(&count);
+    QueryPerformanceFrequency(&freq);
+    return (uint64_t)(count.QuadPart / freq.QuadPart) * 1000000
+           + (uint64_t)(count.QuadPart % freq.QuadPart) * 1000000 / freq.QuadPart;
+  #else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+  #endif
+}
+
+/* latency_start() registers the transmit time of a command, latency_done()
+   adds the round-trip time of the oldest command in flight to the histogram
+   (when its reply arrives), and latency_drop() forgets it (on a time-out) */
+static void latency_start(uint64_t stamp)
+{
+  if (latency_count == MAX_PENDING) {
+    latency_head = (latency_head + 1) % MAX_PENDING;  /* drop the oldest */
+    latency_count--;
+  }
+  latency_stamp[(latency_head + latency_count) % MAX_PENDING] = stamp;
+  latency_count++;
+}
+
+static void latency_done(void)
+{
+  if (latency_count > 0) {
+    uint64_t delta = clock_us() - latency_stamp[latency_head];
+    int bucket;
+    for (bucket = 0; bucket < GDBRSP_LATENCY_BUCKETS - 1 && delta >= ((uint64_t)125 << bucket); bucket++)
+      {}
+    latency_hist[bucket]++;
+    latency_head = (latency_head + 1) % MAX_PENDING;
+    latency_count--;
+  }
+}
+
+static void latency_drop(void)
+{
+  if (latency_count > 0) {
+    latency_head = (latency_head + 1) % MAX_PENDING;
+    latency_count--;
+  }
+}
+
+/* cache_at() returns the byte at an offset from the head of the cache */
+static unsigned char cache_at(size_t offset)
+{
+  size_t idx = cache_head + offset;
+  assert(offset < cache_count);
+  if (idx >= cache_size)
+    idx -= cache_size;
+  return cache[idx];
+}
+
+static void cache_remove(size_t count)
+{
+  assert(count <= cache_count);
+  cache_head += count;
+  if (cache_head >= cache_size)
+    cache_head -= cache_size;
+  cache_count -= count;
+  if (cache_count == 0)
+    cache_head = 0;   /* so that the next read gets the full buffer */
+}
+
+static void link_xmit(const unsigned char *buffer, size_t size)
+{
+  while (size > 0) {
+    size_t count;
+    if (bmp_comport() != NULL)
+      count = rs232_xmit(bmp_comport(), buffer, size);
+    else
+      count = tcpip_xmit(buffer, size);
+    if (count == 0 || count > size)
+      break;    /* error */
+    buffer += count;
+    size -= count;
+  }
+}
+
+/* link_fill() waits for data to arrive on the serial port or the socket, and
+   appends it to the cache; it returns 0 on time-out or error */
+static int link_fill(uint64_t deadline, int timeout)
+{
+  size_t tail, room, count;
+  int wait;
+
+  if (timeout < 0) {
+    wait = -1;
+  } else {
+    uint64_t now = clock_us();
+    wait = (now < deadline) ? (int)((deadline - now + 999) / 1000) : 0;
+  }
+  if (bmp_comport() != NULL) {
+    if (!rs232_wait(bmp_comport(), wait))
+      return 0;
+  } else {
+    if (!tcpip_wait(wait))
+      return 0;
+  }
+
+  /* read into the contiguous free area after the tail */
+  tail = cache_head + cache_count;
+  if (tail >= cache_size)
+    tail -= cache_size;
+  room = (tail >= cache_head && cache_count < cache_size) ? cache_size - tail : cache_head - tail;
+  if (room == 0)
+    return 0;
+  if (bmp_comport() != NULL)
+    count = rs232_recv(bmp_comport(), cache + tail, room);
+  else
+    count = tcpip_recv(cache + tail, room);
+  cache_count += count;
+  return (count > 0); /* no data after a successful wait means that the link is closed */
+}
+
 
 /** gdbrsp_packetsize() sets the maximum size of incoming packets. It uses
  *  this to allocate a buffer for incoming data. If the size is set to 0, the
- *  current buffer is freed. Otherwise, the cache for incoming packets is only
- *  adjusted to receive bigger packets (it does not shrink).
+ *  current buffer (and the buffer for transmitted packets) is freed.
+ *  Otherwise, the cache for incoming packets is only adjusted to receive
+ *  bigger packets (it does not shrink).
  */
 void gdbrsp_packetsize(size_t size)
 {
@@ -74,17 +208,25 @@ void gdbrsp_packetsize(size_t size)
       free(cache);
       cache = NULL;
     }
+    if (xmit_buffer != NULL) {
+      free(xmit_buffer);
+      xmit_buffer = NULL;
+    }
+    xmit_size = 0;
     cache_size = size;
-    cache_idx = 0;
+    cache_head = cache_count = 0;
   } else if (size > cache_size) {
     unsigned char *buf = malloc(size * sizeof(char));
     if (buf != NULL) {
       if (cache != NULL) {
-        memcpy(buf, cache, cache_idx * sizeof(char));
+        size_t idx;
+        for (idx = 0; idx < cache_count; idx++)
+          buf[idx] = cache_at(idx);
         free(cache);
       }
       cache = buf;
       cache_size = size;
+      cache_head = 0;
     }
   }
 }
@@ -94,11 +236,9 @@ void gdbrsp_packetsize(size_t size)
  *  \param buffer   Will hold the received data, but the payload only (so the
  *                  '$' at the start and the checksum at the end are stripped
  *                  off).
- *  \param size     The maximum number of bytes that the buffer can hold. Note
- *                  that the checksum bytes are stored in this buffer before
- *                  analysis, so the buffer must be 3 bytes larger than the
- *                  largest expected response).
- *  \param timeout  Time to wait for a response, in ms.
+ *  \param size     The maximum number of bytes that the buffer can hold.
+ *  \param timeout  Time to wait for a response, in ms. If -1, the function
+ *                  waits indefinitely.
  *
  *  \return The number of bytes received, or zero on time-out (or error). The
  *          return value can be bigger than parameter size, which indicates that
@@ -108,11 +248,15 @@ void gdbrsp_packetsize(size_t size)
  *  \note Console output messages by the target will have a lower case 'o' at
  *        the start of the output buffer (not an upper case letter). The message
  *        has already been translated from hex encoding to ASCII.
+ *
+ *  \note Packets are decoded directly from the receive cache, which is a ring
+ *        buffer. The function blocks on the serial port or socket until data
+ *        arrives, or until the time-out expires.
  */
 size_t gdbrsp_recv(char *buffer, size_t size, int timeout)
 {
-  size_t head, tail, idx;
-  int cycles, chk_cache;
+  uint64_t deadline;
+  size_t scan, idx;
 
   if (!bmp_isopen())
     return 0;
@@ -122,105 +266,77 @@ size_t gdbrsp_recv(char *buffer, size_t size, int timeout)
       return 0;
   }
 
-  cycles = (timeout < 0) ? -1 : timeout / POLL_INTERVAL;
-  chk_cache = (cache_idx > 0);  /* analyse data in the cache even if no new data is received */
-  head = tail = 0;
-  while (cache_idx < cache_size) {
-    size_t count;
-    if (bmp_comport() != NULL)
-      count = rs232_recv(bmp_comport(), cache + cache_idx, cache_size - cache_idx);
-    else
-      count = tcpip_recv(cache + cache_idx, cache_size - cache_idx);
-    cache_idx += count;
-    if (count > 0 || chk_cache) {
-      chk_cache = 0;
-      /* check start character (throw away everything before this) */
-      if (head == 0) {
-        for (idx = 0; idx < cache_idx && cache[idx] != '$'; idx++)
-          /* nothing */;
-        if (idx == cache_idx) {
-          cache_idx = 0;        /* throw away all received data */
-        } else {
-          assert(idx < cache_idx && cache[idx] == '$');
-          head = idx + 1;       /* also skip '$' */
-        }
-      }
+  deadline = clock_us() + ((timeout > 0) ? (uint64_t)timeout * 1000 : 0);
+  scan = 0;   /* position up to which the cache was searched for the end mark */
+  for ( ;; ) {
+    /* check start character (throw away everything before this) */
+    for (idx = 0; idx < cache_count && cache_at(idx) != '$'; idx++)
+      {}
+    if (idx > 0) {
+      cache_remove(idx);
+      scan = 0;
+    }
+    if (cache_count > 0) {
       /* check whether we have an end mark and a checksum */
-      for (tail = head; tail < cache_idx && cache[tail] != '#'; tail++)
-        /* nothing */;
-      if (tail + 2 < cache_idx) {
+      if (scan == 0)
+        scan = 1;       /* skip '$' */
+      while (scan < cache_count && cache_at(scan) != '#')
+        scan++;
+      if (scan + 2 < cache_count) {
         /* '#' found and 2 characters follow, verify the checksum */
-        int chksum = (hex2int(cache[tail + 1]) << 4) | hex2int(cache[tail + 2]);
+        int chksum = (hex2int(cache_at(scan + 1)) << 4) | hex2int(cache_at(scan + 2));
         int sum = 0;
-        for (idx = head; idx < tail; idx++)
-          sum += cache[idx];
+        for (idx = 1; idx < scan; idx++)
+          sum += cache_at(idx);
         sum &= 0xff;
         if (sum == chksum) {
-          /* confirm reception and copy to the buffer */
-          if (bmp_comport() != NULL)
-            rs232_xmit(bmp_comport(), (const unsigned char*)"+", 1);
-          else
-            tcpip_xmit((const unsigned char*)"+", 1);
-          count = tail - head;  /* number of payload bytes */
-          if (count >= 3 && cache[head] == 'O' && isxdigit(cache[head + 1]) && isxdigit(cache[head + 2])) {
-            unsigned c;
+          size_t count;
+          /* confirm reception (unless in no-ack mode) and copy to the buffer */
+          if (!noack_mode)
+            link_xmit((const unsigned char*)"+", 1);
+          if (scan >= 4 && cache_at(1) == 'O' && isxdigit(cache_at(2)) && isxdigit(cache_at(3))) {
             /* convert the first letter to a lower-case 'o', so that an output
                message of the single letter 'K' won't be mis-interpreted as 'OK' */
             buffer[0] = 'o';
-            count = (count + 1) / 2;
-            for (c = 1, idx = head + 1; c < count && c < size; c += 1, idx += 2)
-              buffer[c] = (char)((hex2int(cache[idx]) << 4) | hex2int(cache[idx + 1]));
+            count = scan / 2; /* 'O' + hex-encoded text */
+            for (idx = 1; idx < count && idx < size; idx++)
+              buffer[idx] = (char)((hex2int(cache_at(2 * idx)) << 4) | hex2int(cache_at(2 * idx + 1)));
           } else {
-            unsigned c;
-            for (c = 0, idx = head; c < count && c < size; c += 1, idx += 1) {
-              if (cache[idx] == '}') {
-                /* escaped binary encoding */
-                idx += 1;
-                buffer[c] = cache[idx] ^ 0x20;
-              } else {
-                buffer[c] = cache[idx];
-                /* the Black Magic Probe does currently not support run-length
-                   encoding, so we currently do not check for it */
-              }
+            /* the Black Magic Probe does currently not support run-length
+               encoding, so we currently do not check for it */
+            for (count = 0, idx = 1; idx < scan; idx++) {
+              unsigned char c = cache_at(idx);
+              if (c == '}' && idx + 1 < scan)
+                c = cache_at(++idx) ^ 0x20;  /* escaped binary encoding */
+              if (count < size)
+                buffer[count] = (char)c;
+              count++;
             }
+            latency_done(); /* console output does not complete a command */
           }
-          /* remove the packet from the cache */
-          tail += 3;
-          assert(tail <= cache_idx);
-          if (tail < cache_idx)
-            memmove(cache, cache + tail, cache_idx - tail);
-          cache_idx -= tail;
+          cache_remove(scan + 3);
           return count; /* return payload size (excluding checksum) */
-        } else {
-          /* send NAK */
-          if (bmp_comport() != NULL)
-            rs232_xmit(bmp_comport(), (const unsigned char*)"-", 1);
-          else
-            tcpip_xmit((const unsigned char*)"-", 1);
         }
-        /* remove the packet from the cache */
-        tail += 3;
-        assert(tail <= cache_idx);
-        if (tail < cache_idx)
-          memmove(cache, cache + tail, cache_idx - tail);
-        cache_idx -= tail;
-        head = 0;
+        /* send NAK (in no-ack mode, the packet is silently dropped) */
+        if (!noack_mode)
+          link_xmit((const unsigned char*)"-", 1);
+        cache_remove(scan + 3);
+        scan = 0;
+        continue;
+      }
+      if (cache_count == cache_size) {
+        /* the cache is full, but no end mark with checksum was yet received,
+           meaning that the cache was too small; this should never happen */
+        assert(0);
+        cache_remove(cache_count);
+        return 0;
       }
     }
-    if (cycles > 0 && --cycles == 0)
+    if (!link_fill(deadline, timeout)) {
+      latency_drop();
       return 0;       /* nothing received within timeout period */
-    #if defined _WIN32
-      Sleep(POLL_INTERVAL);
-    #else
-      usleep(POLL_INTERVAL * 1000);
-    #endif
+    }
   }
-
-  /* when arrived here, tail == size (so the buffer is filled to its maximum),
-     but no end mark with checksum was yet received, meaning that the buffer was
-     too small; this should never happen */
-  assert(0);
-  return 0;
 }
 
 /** gdbrsp_xmit() transmits a packet to the gdbserver.
@@ -232,108 +348,146 @@ size_t gdbrsp_recv(char *buffer, size_t size, int timeout)
  *                  the buffer is assumed to contain a zero-terminated string.
  *
  *  \return 1 on success, 0 on timeout or error.
+ *
+ *  \note In no-ack mode, this function returns as soon as the packet is sent,
+ *        so that a next packet can be sent before the reply on the first
+ *        packet is received.
  */
 int gdbrsp_xmit(const char *buffer, int size)
 {
-  size_t buflen, count, idx;
-  int retry, cycle, sum;
-  unsigned char buf[10], *fullbuffer;
+  size_t buflen, idx, pos;
+  int retry, hexencode;
+  unsigned char sum;
 
   assert(buffer != NULL);
   if (!bmp_isopen())
     return 0;
+  if (cache == NULL) {
+    gdbrsp_packetsize(256);
+    if (cache == NULL)
+      return 0;
+  }
 
+  /* the worst case is that every byte must be escaped or hex-encoded, plus
+     the '$' prefix and the '#nn' suffix */
   buflen = (size == -1) ? strlen(buffer) : size;
-  if (buflen > 6 && memcmp(buffer, "qRcmd,", 6) == 0) {
-    size = ((buflen - 6) * 2) + 6;  /* payload is hex-encoded */
-  } else {
-    size = 0;
-    for (idx = 0; idx < buflen; idx++) {
-      size += 1;
-      if (buffer[idx] == '$' || buffer[idx] == '#' || buffer[idx] == '}')
-        size += 1;      /* these characters must be escaped */
-    }
+  if (2 * buflen + 4 > xmit_size) {
+    unsigned char *buf = malloc(2 * buflen + 4);
+    if (buf == NULL)
+      return 0;
+    if (xmit_buffer != NULL)
+      free(xmit_buffer);
+    xmit_buffer = buf;
+    xmit_size = 2 * buflen + 4;
   }
-  size += 4;            /* add '$' prefix and '#nn' suffix */
 
-  fullbuffer = malloc(size);
-  if (fullbuffer == NULL)
-    return 0;
-
-  /* add prefix, handle payload */
-  *fullbuffer = '$';
-  if (buflen > 6 && memcmp(buffer, "qRcmd,", 6) == 0) {
-    const char *src = buffer + 6;
-    unsigned char *dest = fullbuffer + 6 + 1;
-    count = buflen - 6;
-    memcpy(fullbuffer + 1, buffer, 6);
-    while (count > 0) {
-      *dest++ = int2hex((*src >> 4) & 0x0f);
-      *dest++ = int2hex(*src & 0x0f);
-      src++;
-      count--;
-    }
-  } else {
-    const char *src = buffer;
-    unsigned char *dest = fullbuffer + 1;
-    for (idx = 0; idx < buflen; idx++) {
-      for (idx = 0; idx < buflen; idx++) {
-        if (*src == '$' || *src == '#' || *src == '}') {
-          *dest++ = '}';        /* these characters must be escaped */
-          *dest++ = *src++ ^ 0x20;
-        } else {
-          *dest++ = *src++;
-        }
-      }
+  /* frame the packet, escape (or hex-encode) the payload, and calculate the
+     checksum over the translated payload, all in a single pass */
+  hexencode = (buflen > 6 && memcmp(buffer, "qRcmd,", 6) == 0);
+  sum = 0;
+  pos = 0;
+  xmit_buffer[pos++] = '$';
+  for (idx = 0; idx < buflen; idx++) {
+    unsigned char c = (unsigned char)buffer[idx];
+    if (hexencode && idx >= 6) {
+      unsigned char h = (unsigned char)int2hex((c >> 4) & 0x0f);
+      unsigned char l = (unsigned char)int2hex(c & 0x0f);
+      xmit_buffer[pos++] = h;
+      xmit_buffer[pos++] = l;
+      sum += h + l;
+    } else if (c == '$' || c == '#' || c == '}') {
+      xmit_buffer[pos++] = '}';  /* these characters must be escaped */
+      xmit_buffer[pos++] = c ^ 0x20;
+      sum += '}' + (c ^ 0x20);
+    } else {
+      xmit_buffer[pos++] = c;
+      sum += c;
     }
   }
-  /* add checksum */
-  sum = 0;
-  for (idx = 1; idx < (unsigned)size - 3; idx++)
-    sum += fullbuffer[idx];     /* run over fullbuffer, so that the checksum is over the translated buffer */
-  *(fullbuffer + size - 3) = '#';
-  *(fullbuffer + size - 2) = int2hex((sum >> 4) & 0x0f);
-  *(fullbuffer + size - 1) = int2hex(sum & 0x0f);
+  xmit_buffer[pos++] = '#';
+  xmit_buffer[pos++] = int2hex((sum >> 4) & 0x0f);
+  xmit_buffer[pos++] = int2hex(sum & 0x0f);
+  assert(pos <= xmit_size);
 
   for (retry = 0; retry < RETRIES; retry++) {
-    if (bmp_comport() != NULL)
-      rs232_xmit(bmp_comport(), fullbuffer, size);
-    else
-      tcpip_xmit(fullbuffer, size);
-    for (cycle = 0; cycle < TIMEOUT / POLL_INTERVAL; cycle++) {
-      do {
-        if (bmp_comport() != NULL)
-          count = rs232_recv(bmp_comport(), buf, 1);
-        else
-          count = tcpip_recv(buf, 1);
-        if (count == 1) {
-          if (buf[0] == '+') {
-            free(fullbuffer);
-            return 1;
-          }
-          if (buf[0] == '-') {
-            cycle = TIMEOUT / POLL_INTERVAL;  /* retransmit without timeout */
-            break;
-          }
+    uint64_t stamp = clock_us();
+    uint64_t deadline = stamp + TIMEOUT * 1000;
+    link_xmit(xmit_buffer, pos);
+    if (noack_mode) {
+      latency_start(stamp);
+      return 1;   /* no '+' is coming */
+    }
+    /* wait for the acknowledge, in the receive cache */
+    for ( ;; ) {
+      while (cache_count > 0 && cache_at(0) != '+' && cache_at(0) != '-' && cache_at(0) != '$')
+        cache_remove(1);  /* skip noise */
+      if (cache_count > 0) {
+        unsigned char c = cache_at(0);
+        if (c == '+' || c == '$') {
+          /* a reply implies that the command was received (the '+' was lost) */
+          if (c == '+')
+            cache_remove(1);
+          latency_start(stamp);
+          return 1;
         }
-      } while (count == 1);
-      #if defined _WIN32
-        Sleep(POLL_INTERVAL);
-      #else
-        usleep(POLL_INTERVAL * 1000);
-      #endif
+        cache_remove(1);  /* '-' -> retransmit without timeout */
+        break;
+      }
+      if (!link_fill(deadline, TIMEOUT))
+        break;
     }
   }
 
-  free(fullbuffer);
   return 0;
 }
 
+/** gdbrsp_noackmode() switches no-ack mode on or off. In no-ack mode, the
+ *  received packets are not acknowledged with '+' (or '-'), and transmitted
+ *  packets do not wait for a '+'.
+ *
+ *  \param enable   Set to 1 to enable no-ack mode, or 0 to go back to the
+ *                  standard (acknowledged) mode.
+ *
+ *  \note The gdbserver must be switched to no-ack mode (with the
+ *        "QStartNoAckMode" packet) before calling this function.
+ */
+void gdbrsp_noackmode(int enable)
+{
+  noack_mode = (enable != 0);
+}
+
+/** gdbrsp_isnoack() returns whether no-ack mode is active. */
+int gdbrsp_isnoack(void)
+{
+  return noack_mode;
+}
+
 /** gdbrsp_clear() clears the cache, to remove any superfluous OK or error
  *  codes that GDB sent.
  */
 void gdbrsp_clear(void)
 {
-  cache_idx = 0;
+  cache_head = cache_count = 0;
+  latency_count = 0;
+}
+
+/** gdbrsp_latency() returns the histogram of the round-trip times of commands
+ *  (from transmitting the command until the reply is received).
+ *
+ *  \param histogram  An array of GDBRSP_LATENCY_BUCKETS elements that is
+ *                    filled with the counts. Bucket 0 counts the round trips
+ *                    below 0.125 ms, and the range of each next bucket ends
+ *                    at double the time of the previous one. The last bucket
+ *                    holds everything above its lower bound. This parameter
+ *                    may be NULL.
+ *  \param reset      If non-zero, the histogram is cleared (after it is
+ *                    copied).
+ */
+void gdbrsp_latency(unsigned long *histogram, int reset)
+{
+  if (histogram != NULL)
+    memcpy(histogram, latency_hist, sizeof latency_hist);
+  if (reset)
+    memset(latency_hist, 0, sizeof latency_hist);
 }
 
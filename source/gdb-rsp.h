@@ -27,6 +27,12 @@ size_t gdbrsp_recv(char *buffer, size_t size, int timeout);
 int    gdbrsp_xmit(const char *buffer, int size);
 void   gdbrsp_clear(void);
 
+void   gdbrsp_noackmode(int enable);
+int    gdbrsp_isnoack(void);
+
+#define GDBRSP_LATENCY_BUCKETS  16  /* 0.125 ms .. 4 s, in powers of 2 */
+void   gdbrsp_latency(unsigned long *histogram, int reset);
+
 #if defined __cplusplus
   }
 #endif
@@ -0,0 +1,258 @@
+/*
+ * Compression and decompression of data in the LZ4 "block" format (without
+ * the LZ4 frame header). The compressor is a simple greedy compressor; it is
+ * meant for compressing firmware images before transferring these to a
+ * loader stub on the target.
+ *
+ * Build this file with the macro STANDALONE defined on the command line to
+ * create a self-contained executable that reports the compression ratio of a
+ * file.
+ *
+ * Copyright 2022 CompuPhase
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+#include "lz4block.h"
+
+#define MINMATCH      4
+#define LASTLITERALS  5   /* the last 5 bytes are always literals */
+#define MFLIMIT       12  /* the last match must start 12 bytes before the end */
+#define MAXOFFSET     65535
+#define HASH_BITS     12
+
+
+static uint32_t read32(const unsigned char *p)
+{
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static unsigned hash32(uint32_t sequence)
+{
+  return (unsigned)((sequence * 2654435761u) >> (32 - HASH_BITS));
+}
+
+/* put_length() stores the part of a length that exceeds 15 as a series of
+   bytes, returns the updated output position, or 0 if the output overflows */
+static size_t put_length(unsigned char *dest, size_t pos, size_t destsize, size_t length)
+{
+  while (length >= 255) {
+    if (pos >= destsize)
+      return 0;
+    dest[pos++] = 255;
+    length -= 255;
+  }
+  if (pos >= destsize)
+    return 0;
+  dest[pos++] = (unsigned char)length;
+  return pos;
+}
+
+/* put_sequence() stores a run of literals, optionally followed by a match
+   (for the last sequence, matchlen is 0); it returns the updated output
+   position, or 0 if the output overflows */
+static size_t put_sequence(unsigned char *dest, size_t pos, size_t destsize,
+                           const unsigned char *literals, size_t litlen,
+                           unsigned offset, size_t matchlen)
+{
+  size_t token;
+
+  if (pos >= destsize)
+    return 0;
+  token = pos++;
+  dest[token] = (unsigned char)(((litlen < 15) ? litlen : 15) << 4);
+  if (litlen >= 15 && (pos = put_length(dest, pos, destsize, litlen - 15)) == 0)
+    return 0;
+  if (pos + litlen > destsize)
+    return 0;
+  memcpy(dest + pos, literals, litlen);
+  pos += litlen;
+  if (matchlen > 0) {
+    assert(matchlen >= MINMATCH);
+    matchlen -= MINMATCH;
+    if (pos + 2 > destsize)
+      return 0;
+    dest[pos++] = (unsigned char)(offset & 0xff);
+    dest[pos++] = (unsigned char)(offset >> 8);
+    dest[token] |= (unsigned char)((matchlen < 15) ? matchlen : 15);
+    if (matchlen >= 15 && (pos = put_length(dest, pos, destsize, matchlen - 15)) == 0)
+      return 0;
+  }
+  return pos;
+}
+
+/** lz4_compress() compresses a block of data.
+ *
+ *  \param src      The data to compress.
+ *  \param srclen   The size of the data in bytes.
+ *  \param dest     The buffer that will hold the compressed data.
+ *  \param destsize The size of the dest buffer. To be sure that the
+ *                  compressed data fits, it should be at least
+ *                  lz4_bound(srclen) bytes.
+ *
+ *  \return The size of the compressed data, or 0 if the dest buffer is too
+ *          small.
+ */
+size_t lz4_compress(const unsigned char *src, size_t srclen, unsigned char *dest, size_t destsize)
+{
+  size_t table[1 << HASH_BITS];
+  size_t pos, anchor, outpos;
+
+  assert(src != NULL);
+  assert(dest != NULL);
+  memset(table, 0xff, sizeof table);  /* all entries are invalid */
+  pos = anchor = outpos = 0;
+  if (srclen > MFLIMIT) {
+    size_t limit = srclen - MFLIMIT;
+    while (pos < limit) {
+      uint32_t sequence = read32(src + pos);
+      unsigned h = hash32(sequence);
+      size_t ref = table[h];
+      table[h] = pos;
+      if (ref != (size_t)~0 && pos - ref <= MAXOFFSET && read32(src + ref) == sequence) {
+        size_t length = MINMATCH;
+        size_t maxlength = srclen - LASTLITERALS - pos;
+        while (length < maxlength && src[ref + length] == src[pos + length])
+          length++;
+        outpos = put_sequence(dest, outpos, destsize, src + anchor, pos - anchor,
+                              (unsigned)(pos - ref), length);
+        if (outpos == 0)
+          return 0;
+        pos += length;
+        anchor = pos;
+      } else {
+        pos++;
+      }
+    }
+  }
+  /* the last sequence holds only literals */
+  outpos = put_sequence(dest, outpos, destsize, src + anchor, srclen - anchor, 0, 0);
+  return outpos;
+}
+
+/** lz4_decompress() decompresses a block of data.
+ *
+ *  \param src      The compressed data.
+ *  \param srclen   The size of the compressed data in bytes.
+ *  \param dest     The buffer that will hold the decompressed data.
+ *  \param destsize The size of the dest buffer.
+ *
+ *  \return The size of the decompressed data, or 0 on error (the compressed
+ *          data is invalid, or the dest buffer is too small).
+ */
+size_t lz4_decompress(const unsigned char *src, size_t srclen, unsigned char *dest, size_t destsize)
+{
+  size_t pos, outpos;
+
+  assert(src != NULL);
+  assert(dest != NULL);
+  pos = outpos = 0;
+  while (pos < srclen) {
+    unsigned token = src[pos++];
+    size_t length = token >> 4;
+    unsigned offset;
+    if (length == 15) {
+      unsigned char b;
+      do {
+        if (pos >= srclen)
+          return 0;
+        b = src[pos++];
+        length += b;
+      } while (b == 255);
+    }
+    if (pos + length > srclen || outpos + length > destsize)
+      return 0;
+    memcpy(dest + outpos, src + pos, length);
+    pos += length;
+    outpos += length;
+    if (pos >= srclen)
+      break;  /* last sequence has no match */
+    if (pos + 2 > srclen)
+      return 0;
+    offset = src[pos] | (src[pos + 1] << 8);
+    pos += 2;
+    if (offset == 0 || offset > outpos)
+      return 0;
+    length = token & 0x0f;
+    if (length == 15) {
+      unsigned char b;
+      do {
+        if (pos >= srclen)
+          return 0;
+        b = src[pos++];
+        length += b;
+      } while (b == 255);
+    }
+    length += MINMATCH;
+    if (outpos + length > destsize)
+      return 0;
+    while (length-- > 0) {
+      dest[outpos] = dest[outpos - offset]; /* byte copy, because the match may overlap */
+      outpos++;
+    }
+  }
+  return outpos;
+}
+
+
+#if defined STANDALONE
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+int main(int argc, char **argv)
+{
+  FILE *fp;
+  unsigned char *data, *packed, *check;
+  size_t size, packedsize, checksize;
+
+  if (argc != 2) {
+    printf("lz4block - report the LZ4 block compression ratio of a file.\n\n"
+           "Usage: lz4block filename\n\n");
+    return EXIT_FAILURE;
+  }
+  if ((fp = fopen(argv[1], "rb")) == NULL) {
+    fprintf(stderr, "Failed to open \"%s\", error %d\n", argv[1], errno);
+    return EXIT_FAILURE;
+  }
+  fseek(fp, 0, SEEK_END);
+  size = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+  data = malloc(size + 1);
+  packed = malloc(lz4_bound(size));
+  check = malloc(size + 1);
+  if (data == NULL || packed == NULL || check == NULL) {
+    fprintf(stderr, "Memory allocation failure\n");
+    return EXIT_FAILURE;
+  }
+  size = fread(data, 1, size, fp);
+  fclose(fp);
+
+  packedsize = lz4_compress(data, size, packed, lz4_bound(size));
+  checksize = lz4_decompress(packed, packedsize, check, size + 1);
+  printf("%lu -> %lu bytes (%.1f%%)\n", (unsigned long)size, (unsigned long)packedsize,
+         (size > 0) ? 100.0 * packedsize / size : 0.0);
+  if (checksize != size || memcmp(data, check, size) != 0) {
+    fprintf(stderr, "Decompressed data does not match the original\n");
+    return EXIT_FAILURE;
+  }
+  free(data);
+  free(packed);
+  free(check);
+  return EXIT_SUCCESS;
+}
+
+#endif /* STANDALONE */
@@ -0,0 +1,42 @@
+/*
+ * Compression and decompression of data in the LZ4 "block" format (without
+ * the LZ4 frame header). The compressor is a simple greedy compressor; it is
+ * meant for compressing firmware images before transferring these to a
+ * loader stub on the target.
+ *
+ * Copyright 2022 CompuPhase
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef _LZ4BLOCK_H
+#define _LZ4BLOCK_H
+
+#include <stddef.h>
+
+#if defined __cplusplus
+  extern "C" {
+#endif
+
+/** lz4_bound() returns the maximum size of the compressed data, for a block
+ *  of the given size (when the data does not compress at all).
+ */
+#define lz4_bound(size)   ((size) + (size) / 255 + 16)
+
+size_t lz4_compress(const unsigned char *src, size_t srclen, unsigned char *dest, size_t destsize);
+size_t lz4_decompress(const unsigned char *src, size_t srclen, unsigned char *dest, size_t destsize);
+
+#if defined __cplusplus
+  }
+#endif
+
+#endif /* _LZ4BLOCK_H */
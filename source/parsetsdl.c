@@ -21,6 +21,7 @@
 #include <assert.h>
 #include <ctype.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -118,6 +119,12 @@ static CTF_CLOCK ctf_clock_root = { NULL };
 static CTF_STREAM ctf_stream_root = { NULL };
 static CTF_EVENT ctf_event_root = { NULL };
 
+static int cache_enabled = 0;
+static char *cache_filename = NULL;
+static uint32_t cache_hash = 0;
+static uint32_t cache_filesize = 0;
+static unsigned char *cache_blob = NULL;  /* set when the metadata was loaded from the cache */
+
 
 static const char *token_description(int token);
 static void parse_declaration(CTF_TYPE *type, char *identifier, int size);
@@ -234,10 +241,14 @@ static int readline_init(const char *filename)
 
 static void readline_cleanup(void)
 {
-  if (inputfile != NULL)
+  if (inputfile != NULL) {
     fclose(inputfile);
-  if (linebuffer != NULL)
+    inputfile = NULL;
+  }
+  if (linebuffer != NULL) {
     free((void*)linebuffer);
+    linebuffer = NULL;
+  }
 }
 
 static int readline_next(void)
@@ -674,6 +685,11 @@ static int token_need(int token)
   return (tok == TOK_EOF) ? -1 : 0;
 }
 
+const CTF_TRACE_GLOBAL *trace_global(void)
+{
+  return &ctf_trace;
+}
+
 const CTF_PACKET_HEADER *packet_header(void)
 {
   return &ctf_packet;
@@ -800,6 +816,85 @@ const CTF_EVENT *event_by_id(int event_id)
   return NULL;
 }
 
+static uint32_t hash_bytes(uint32_t hash, const void *data, size_t size)
+{
+  const unsigned char *ptr = (const unsigned char*)data;
+  while (size-- > 0) {
+    hash ^= *ptr++;
+    hash *= 16777619u;  /* FNV-1a */
+  }
+  return hash;
+}
+
+static uint32_t hash_int(uint32_t hash, long value)
+{
+  unsigned char bytes[4];
+  bytes[0] = (unsigned char)value;
+  bytes[1] = (unsigned char)(value >> 8);
+  bytes[2] = (unsigned char)(value >> 16);
+  bytes[3] = (unsigned char)(value >> 24);
+  return hash_bytes(hash, bytes, sizeof bytes);
+}
+
+static uint32_t hash_type(uint32_t hash, const CTF_TYPE *type)
+{
+  assert(type != NULL);
+  hash = hash_int(hash, type->typeclass);
+  hash = hash_int(hash, type->size);
+  hash = hash_int(hash, type->flags & (TYPEFLAG_SIGNED | TYPEFLAG_UTF8));
+  hash = hash_int(hash, type->base);
+  hash = hash_int(hash, type->length);
+  if (type->keys != NULL) {
+    const CTF_KEYVALUE *kv;
+    for (kv = type->keys->next; kv != NULL; kv = kv->next) {
+      hash = hash_bytes(hash, kv->name, strlen(kv->name) + 1);
+      hash = hash_int(hash, kv->value);
+    }
+  }
+  if (type->fields != NULL) {
+    const CTF_TYPE *sub;
+    for (sub = type->fields->next; sub != NULL; sub = sub->next) {
+      if (sub->identifier != NULL)
+        hash = hash_bytes(hash, sub->identifier, strlen(sub->identifier) + 1);
+      hash = hash_type(hash, sub);
+    }
+  }
+  return hash;
+}
+
+/** ctf_metadata_hash() returns a hash over the parsed metadata, covering the
+ *  encoding, the headers and the layout of all events (but not the comments
+ *  and formatting of the TSDL file). It is used to check that a decoder that
+ *  was generated from a TSDL file matches the current metadata.
+ */
+uint32_t ctf_metadata_hash(void)
+{
+  uint32_t hash = 2166136261u;
+  const CTF_STREAM *stream;
+  const CTF_EVENT *event;
+
+  hash = hash_int(hash, ctf_trace.encoding);
+  hash = hash_int(hash, ctf_packet.header.magic_size);
+  hash = hash_int(hash, ctf_packet.header.uuid_size);
+  hash = hash_int(hash, ctf_packet.header.streamid_size);
+  for (stream = ctf_stream_root.next; stream != NULL; stream = stream->next) {
+    hash = hash_int(hash, stream->stream_id);
+    hash = hash_int(hash, stream->event.header.id_size);
+    hash = hash_int(hash, stream->event.header.timestamp_size);
+  }
+  for (event = ctf_event_root.next; event != NULL; event = event->next) {
+    const CTF_EVENT_FIELD *field;
+    hash = hash_int(hash, event->id);
+    hash = hash_int(hash, event->stream_id);
+    hash = hash_bytes(hash, event->name, strlen(event->name) + 1);
+    for (field = event->field_root.next; field != NULL; field = field->next) {
+      hash = hash_bytes(hash, field->name, strlen(field->name) + 1);
+      hash = hash_type(hash, &field->type);
+    }
+  }
+  return hash;
+}
+
 /** close_declaration() frees all memory for a single type declaration, but does
  *  not free the type structure itself. This function is used to clean-up a
  *  temporary declaration in an automatic variable (one obtained with
@@ -1551,6 +1646,9 @@ static void parse_trace(void)
       } else if (strcmp(identifier, "byte_order") == 0) {
         token_need(TOK_IDENTIFIER);
         ctf_trace.byte_order = (strcmp(token_gettext(), "be") == 0) ? BYTEORDER_BE : BYTEORDER_LE;
+      } else if (strcmp(identifier, "encoding") == 0) {
+        token_need(TOK_IDENTIFIER);
+        ctf_trace.encoding = (strcmp(token_gettext(), "compact") == 0) ? ENCODING_COMPACT : ENCODING_CTF;
       } else if (strcmp(identifier, "uuid") == 0) {
         int idx;
         const char *ptr;
@@ -1867,12 +1965,440 @@ static void parse_event(void)
   ctf_trace.stream_mask |= (1 << event->stream_id);
 }
 
+/* The cache is a single block that holds copies of all parsed structures,
+   with pointers stored as offsets from the start of the block. A relocation
+   table at the end of the block lists the positions of all pointers, so that
+   loading the cache is a single read followed by a pointer fix-up pass. The
+   structures are stored in native layout, so the header records the sizes of
+   the main structures to reject a cache that was created by another build. */
+#define CACHE_MAGIC     0x46544354  /* "TCTF" */
+#define CACHE_VERSION   2
+#define CACHE_ALIGN     8
+
+typedef struct tagCACHE_HEADER {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t ptrsize;
+  uint32_t layout;        /* combined sizes of the structures */
+  uint32_t hash;          /* hash of the TSDL file */
+  uint32_t filesize;      /* size of the TSDL file */
+  uint32_t blobsize;      /* total size of the cache data (including this header) */
+  uint32_t reloc_offset;  /* offset of the relocation table */
+  uint32_t reloc_count;   /* number of entries in the relocation table */
+  CTF_TRACE_GLOBAL trace;
+  CTF_PACKET_HEADER packet;
+  CTF_TYPE *types;        /* stored as offsets in the cache */
+  CTF_CLOCK *clocks;
+  CTF_STREAM *streams;
+  CTF_EVENT *events;
+} CACHE_HEADER;
+
+typedef struct tagCACHE_BUFFER {
+  unsigned char *data;
+  size_t size;
+  size_t top;
+  uint32_t *relocs;
+  size_t reloc_size;
+  size_t reloc_count;
+  int error;
+} CACHE_BUFFER;
+
+static uint32_t cache_layout(void)
+{
+  return (uint32_t)(sizeof(CTF_TYPE) ^ (sizeof(CTF_KEYVALUE) << 8) ^ (sizeof(CTF_CLOCK) << 16)
+                    ^ (sizeof(CTF_STREAM) << 20) ^ (sizeof(CTF_EVENT) << 24)
+                    ^ sizeof(CACHE_HEADER));
+}
+
+/** cache_filehash() calculates a hash (FNV-1a) over the contents of the file.
+ *  It returns 0 if the file cannot be read.
+ */
+static int cache_filehash(const char *filename, uint32_t *hash, uint32_t *filesize)
+{
+  FILE *fp;
+  unsigned char buffer[4096];
+  size_t count, idx;
+  uint32_t h = 2166136261u;
+  uint32_t size = 0;
+
+  assert(filename != NULL && hash != NULL && filesize != NULL);
+  fp = fopen(filename, "rb");
+  if (fp == NULL)
+    return 0;
+  while ((count = fread(buffer, 1, sizeof buffer, fp)) > 0) {
+    for (idx = 0; idx < count; idx++) {
+      h ^= buffer[idx];
+      h *= 16777619u;
+    }
+    size += (uint32_t)count;
+  }
+  fclose(fp);
+  *hash = h;
+  *filesize = size;
+  return 1;
+}
+
+/** cache_alloc() appends a copy of a block of data to the cache buffer and
+ *  returns its offset. The return value is 0 on failure (offset 0 is never a
+ *  valid offset for an object, because the header is stored there).
+ */
+static size_t cache_alloc(CACHE_BUFFER *cb, const void *src, size_t size)
+{
+  size_t offset;
+
+  assert(cb != NULL && src != NULL);
+  if (cb->error)
+    return 0;
+  offset = (cb->top + CACHE_ALIGN - 1) & ~(size_t)(CACHE_ALIGN - 1);
+  if (offset + size > cb->size) {
+    size_t newsize = (cb->size > 0) ? 2 * cb->size : 4096;
+    unsigned char *newdata;
+    while (offset + size > newsize)
+      newsize *= 2;
+    newdata = (unsigned char*)realloc(cb->data, newsize);
+    if (newdata == NULL) {
+      cb->error = 1;
+      return 0;
+    }
+    cb->data = newdata;
+    cb->size = newsize;
+  }
+  if (offset > cb->top)
+    memset(cb->data + cb->top, 0, offset - cb->top);
+  memcpy(cb->data + offset, src, size);
+  cb->top = offset + size;
+  return offset;
+}
+
+/** cache_setptr() stores an offset in a pointer field in the cache buffer, and
+ *  records that field in the relocation table. An offset of 0 is stored as a
+ *  NULL pointer (and needs no relocation).
+ */
+static void cache_setptr(CACHE_BUFFER *cb, size_t slot, size_t target)
+{
+  uintptr_t value = (uintptr_t)target;
+
+  assert(cb != NULL);
+  if (cb->error)
+    return;
+  assert(slot + sizeof(uintptr_t) <= cb->top);
+  memcpy(cb->data + slot, &value, sizeof value);
+  if (target == 0)
+    return;
+  if (cb->reloc_count >= cb->reloc_size) {
+    size_t newsize = (cb->reloc_size > 0) ? 2 * cb->reloc_size : 256;
+    uint32_t *newrelocs = (uint32_t*)realloc(cb->relocs, newsize * sizeof(uint32_t));
+    if (newrelocs == NULL) {
+      cb->error = 1;
+      return;
+    }
+    cb->relocs = newrelocs;
+    cb->reloc_size = newsize;
+  }
+  cb->relocs[cb->reloc_count++] = (uint32_t)slot;
+}
+
+static size_t cache_getptr(const CACHE_BUFFER *cb, size_t slot)
+{
+  uintptr_t value;
+  memcpy(&value, cb->data + slot, sizeof value);
+  return (size_t)value;
+}
+
+static size_t cache_string(CACHE_BUFFER *cb, const char *str)
+{
+  if (str == NULL)
+    return 0;
+  return cache_alloc(cb, str, strlen(str) + 1);
+}
+
+/** cache_keylist() stores a list of key/value pairs, including its root, and
+ *  returns the offset of the root.
+ */
+static size_t cache_keylist(CACHE_BUFFER *cb, const CTF_KEYVALUE *root)
+{
+  const CTF_KEYVALUE *item;
+  size_t offs_root, offs_prev;
+
+  assert(root != NULL);
+  offs_root = offs_prev = cache_alloc(cb, root, sizeof(CTF_KEYVALUE));
+  for (item = root->next; item != NULL && !cb->error; item = item->next) {
+    size_t offs = cache_alloc(cb, item, sizeof(CTF_KEYVALUE));
+    cache_setptr(cb, offs_prev + offsetof(CTF_KEYVALUE, next), offs);
+    offs_prev = offs;
+  }
+  cache_setptr(cb, offs_prev + offsetof(CTF_KEYVALUE, next), 0);
+  return offs_root;
+}
+
+static size_t cache_typechain(CACHE_BUFFER *cb, const CTF_TYPE *first);
+
+/** cache_typedata() patches the pointer fields in a type that was already
+ *  copied into the cache buffer (except the "next" field).
+ */
+static void cache_typedata(CACHE_BUFFER *cb, size_t offs, const CTF_TYPE *type)
+{
+  size_t sub;
+
+  assert(type != NULL);
+  cache_setptr(cb, offs + offsetof(CTF_TYPE, identifier), cache_string(cb, type->identifier));
+  cache_setptr(cb, offs + offsetof(CTF_TYPE, selector), cache_string(cb, type->selector));
+  sub = 0;
+  if (type->fields != NULL) {
+    sub = cache_alloc(cb, type->fields, sizeof(CTF_TYPE));
+    cache_typedata(cb, sub, type->fields);
+    cache_setptr(cb, sub + offsetof(CTF_TYPE, next), cache_typechain(cb, type->fields->next));
+  }
+  cache_setptr(cb, offs + offsetof(CTF_TYPE, fields), sub);
+  cache_setptr(cb, offs + offsetof(CTF_TYPE, keys), (type->keys != NULL) ? cache_keylist(cb, type->keys) : 0);
+}
+
+/** cache_typechain() stores a list of types (starting at the first item, not
+ *  the root) and returns the offset of the first item.
+ */
+static size_t cache_typechain(CACHE_BUFFER *cb, const CTF_TYPE *first)
+{
+  const CTF_TYPE *item;
+  size_t offs_first = 0, offs_prev = 0;
+
+  for (item = first; item != NULL && !cb->error; item = item->next) {
+    size_t offs = cache_alloc(cb, item, sizeof(CTF_TYPE));
+    cache_typedata(cb, offs, item);
+    if (offs_prev != 0)
+      cache_setptr(cb, offs_prev + offsetof(CTF_TYPE, next), offs);
+    else
+      offs_first = offs;
+    offs_prev = offs;
+  }
+  if (offs_prev != 0)
+    cache_setptr(cb, offs_prev + offsetof(CTF_TYPE, next), 0);
+  return offs_first;
+}
+
+/** cache_typeoffset() looks up a type from the global type list in the cache
+ *  buffer (by walking the list in memory and the list in the cache in
+ *  parallel).
+ */
+static size_t cache_typeoffset(const CACHE_BUFFER *cb, size_t offs_first, const CTF_TYPE *type)
+{
+  const CTF_TYPE *item;
+  size_t offs = offs_first;
+
+  for (item = type_root.next; item != NULL && offs != 0; item = item->next) {
+    if (item == type)
+      return offs;
+    offs = cache_getptr(cb, offs + offsetof(CTF_TYPE, next));
+  }
+  return 0;
+}
+
+/** cache_save() writes the parsed metadata to the cache file. Failure to write
+ *  the cache is not an error; it only means that the next load is slower.
+ */
+static int cache_save(void)
+{
+  CACHE_BUFFER cb;
+  CACHE_HEADER header;
+  const CTF_CLOCK *clock;
+  const CTF_STREAM *stream;
+  const CTF_EVENT *event;
+  size_t offs, offs_prev, offs_types;
+  FILE *fp;
+  int result = 0;
+
+  if (cache_filename == NULL)
+    return 0;
+
+  memset(&cb, 0, sizeof cb);
+  memset(&header, 0, sizeof header);
+  header.magic = CACHE_MAGIC;
+  header.version = CACHE_VERSION;
+  header.ptrsize = (uint16_t)sizeof(void*);
+  header.layout = cache_layout();
+  header.hash = cache_hash;
+  header.filesize = cache_filesize;
+  header.trace = ctf_trace;
+  header.packet = ctf_packet;
+  cache_alloc(&cb, &header, sizeof header); /* reserve space for the header */
+
+  offs_types = cache_typechain(&cb, type_root.next);
+  cache_setptr(&cb, offsetof(CACHE_HEADER, types), offs_types);
+
+  offs_prev = 0;
+  for (clock = ctf_clock_root.next; clock != NULL && !cb.error; clock = clock->next) {
+    offs = cache_alloc(&cb, clock, sizeof(CTF_CLOCK));
+    cache_setptr(&cb, (offs_prev != 0) ? offs_prev + offsetof(CTF_CLOCK, next) : offsetof(CACHE_HEADER, clocks), offs);
+    cache_setptr(&cb, offs + offsetof(CTF_CLOCK, next), 0);
+    offs_prev = offs;
+  }
+
+  offs_prev = 0;
+  for (stream = ctf_stream_root.next; stream != NULL && !cb.error; stream = stream->next) {
+    offs = cache_alloc(&cb, stream, sizeof(CTF_STREAM));
+    cache_setptr(&cb, (offs_prev != 0) ? offs_prev + offsetof(CTF_STREAM, next) : offsetof(CACHE_HEADER, streams), offs);
+    cache_setptr(&cb, offs + offsetof(CTF_STREAM, next), 0);
+    cache_setptr(&cb, offs + offsetof(CTF_STREAM, clock), (stream->clock != NULL) ? cache_typeoffset(&cb, offs_types, stream->clock) : 0);
+    offs_prev = offs;
+  }
+
+  offs_prev = 0;
+  for (event = ctf_event_root.next; event != NULL && !cb.error; event = event->next) {
+    const CTF_EVENT_FIELD *field;
+    size_t offs_field;
+    offs = cache_alloc(&cb, event, sizeof(CTF_EVENT));
+    cache_setptr(&cb, (offs_prev != 0) ? offs_prev + offsetof(CTF_EVENT, next) : offsetof(CACHE_HEADER, events), offs);
+    cache_setptr(&cb, offs + offsetof(CTF_EVENT, next), 0);
+    /* the root of the field list is embedded in the event */
+    offs_field = offs + offsetof(CTF_EVENT, field_root);
+    cache_setptr(&cb, offs_field + offsetof(CTF_EVENT_FIELD, type) + offsetof(CTF_TYPE, next), 0);
+    cache_typedata(&cb, offs_field + offsetof(CTF_EVENT_FIELD, type), &event->field_root.type);
+    for (field = event->field_root.next; field != NULL && !cb.error; field = field->next) {
+      size_t offs_next = cache_alloc(&cb, field, sizeof(CTF_EVENT_FIELD));
+      cache_setptr(&cb, offs_field + offsetof(CTF_EVENT_FIELD, next), offs_next);
+      offs_field = offs_next;
+      cache_setptr(&cb, offs_field + offsetof(CTF_EVENT_FIELD, type) + offsetof(CTF_TYPE, next), 0);
+      cache_typedata(&cb, offs_field + offsetof(CTF_EVENT_FIELD, type), &field->type);
+    }
+    cache_setptr(&cb, offs_field + offsetof(CTF_EVENT_FIELD, next), 0);
+    offs_prev = offs;
+  }
+
+  /* append the relocation table, then complete the header */
+  if (!cb.error) {
+    size_t count = cb.reloc_count;
+    offs = (count > 0) ? cache_alloc(&cb, cb.relocs, count * sizeof(uint32_t)) : cb.top;
+    if (!cb.error) {
+      CACHE_HEADER *hdr = (CACHE_HEADER*)cb.data;
+      hdr->reloc_offset = (uint32_t)offs;
+      hdr->reloc_count = (uint32_t)count;
+      hdr->blobsize = (uint32_t)cb.top;
+      fp = fopen(cache_filename, "wb");
+      if (fp != NULL) {
+        result = (fwrite(cb.data, 1, cb.top, fp) == cb.top);
+        fclose(fp);
+        if (!result)
+          remove(cache_filename);
+      }
+    }
+  }
+
+  if (cb.data != NULL)
+    free((void*)cb.data);
+  if (cb.relocs != NULL)
+    free((void*)cb.relocs);
+  return result;
+}
+
+/** cache_load() reads the cache file, verifies that it matches the TSDL file,
+ *  and relocates all pointers. On success, the metadata lists are set to the
+ *  structures in the cache block.
+ */
+static int cache_load(void)
+{
+  FILE *fp;
+  long size;
+  unsigned char *blob;
+  CACHE_HEADER *hdr;
+  const uint32_t *relocs;
+  uint32_t idx;
+
+  if (cache_filename == NULL)
+    return 0;
+  fp = fopen(cache_filename, "rb");
+  if (fp == NULL)
+    return 0;
+  fseek(fp, 0, SEEK_END);
+  size = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+  if (size < (long)sizeof(CACHE_HEADER)) {
+    fclose(fp);
+    return 0;
+  }
+  blob = (unsigned char*)malloc(size);
+  if (blob == NULL) {
+    fclose(fp);
+    return 0;
+  }
+  if (fread(blob, 1, size, fp) != (size_t)size) {
+    fclose(fp);
+    free((void*)blob);
+    return 0;
+  }
+  fclose(fp);
+
+  hdr = (CACHE_HEADER*)blob;
+  if (hdr->magic != CACHE_MAGIC || hdr->version != CACHE_VERSION
+      || hdr->ptrsize != sizeof(void*) || hdr->layout != cache_layout()
+      || hdr->hash != cache_hash || hdr->filesize != cache_filesize
+      || hdr->blobsize != (uint32_t)size
+      || hdr->reloc_offset + (size_t)hdr->reloc_count * sizeof(uint32_t) > (size_t)size)
+  {
+    free((void*)blob);
+    return 0;
+  }
+
+  /* pointer fix-up */
+  relocs = (const uint32_t*)(blob + hdr->reloc_offset);
+  for (idx = 0; idx < hdr->reloc_count; idx++) {
+    uintptr_t value;
+    if (relocs[idx] + sizeof(uintptr_t) > hdr->reloc_offset)
+      break;
+    memcpy(&value, blob + relocs[idx], sizeof value);
+    if (value >= hdr->reloc_offset)
+      break;
+    value = (uintptr_t)(blob + value);
+    memcpy(blob + relocs[idx], &value, sizeof value);
+  }
+  if (idx < hdr->reloc_count) {
+    free((void*)blob); /* corrupt cache file */
+    return 0;
+  }
+
+  ctf_trace = hdr->trace;
+  ctf_packet = hdr->packet;
+  type_root.next = hdr->types;
+  ctf_clock_root.next = hdr->clocks;
+  ctf_stream_root.next = hdr->streams;
+  ctf_event_root.next = hdr->events;
+  cache_blob = blob;
+  return 1;
+}
+
+/** ctf_parse_setcache() enables or disables the cache for the parsed metadata.
+ *  When enabled, ctf_parse_init() first looks for a cache file next to the
+ *  TSDL file (with ".cache" appended to the filename), and uses it if it was
+ *  made from a TSDL file with the same contents. After a successful parse,
+ *  ctf_parse_run() (re-)creates the cache file.
+ */
+void ctf_parse_setcache(int enable)
+{
+  cache_enabled = enable;
+}
+
 /** ctf_parse_init() initializes the TSDL parser and sets up default types.
  *  It retuns 1 on success and 0 on error; the error message has then already
  *  been issued via ctf_error_notify().
+ *
+ *  If the cache is enabled (see ctf_parse_setcache()) and a valid cache exists
+ *  for the file, the metadata is loaded from the cache, and ctf_parse_run()
+ *  returns immediately.
  */
 int ctf_parse_init(const char *filename)
 {
+  if (cache_filename != NULL) {
+    free((void*)cache_filename);
+    cache_filename = NULL;
+  }
+  if (cache_enabled && cache_filehash(filename, &cache_hash, &cache_filesize)) {
+    cache_filename = (char*)malloc((strlen(filename) + 7) * sizeof(char));
+    if (cache_filename != NULL) {
+      strcpy(cache_filename, filename);
+      strcat(cache_filename, ".cache");
+      if (cache_load())
+        return 1;
+    }
+  }
+
   if (!readline_init(filename))
     return 0; /* error message already set via ctf_error() */
   if (!token_init())
@@ -1899,10 +2425,24 @@ void ctf_parse_cleanup(void)
 {
   readline_cleanup();
   token_cleanup();
-  clock_cleanup();
-  stream_cleanup();
-  event_cleanup();
-  type_cleanup(&type_root);
+  if (cache_blob != NULL) {
+    /* all structures are in a single block */
+    free((void*)cache_blob);
+    cache_blob = NULL;
+    type_root.next = NULL;
+    ctf_clock_root.next = NULL;
+    ctf_stream_root.next = NULL;
+    ctf_event_root.next = NULL;
+  } else {
+    clock_cleanup();
+    stream_cleanup();
+    event_cleanup();
+    type_cleanup(&type_root);
+  }
+  if (cache_filename != NULL) {
+    free((void*)cache_filename);
+    cache_filename = NULL;
+  }
   memset(&ctf_trace, 0, sizeof ctf_trace); /* to reset the active streams mask */
 }
 
@@ -1914,6 +2454,9 @@ int ctf_parse_run(void)
 {
   int tok;
 
+  if (cache_blob != NULL)
+    return 1;   /* metadata was loaded from the cache */
+
   while ((tok = token_next()) != TOK_EOF) {
     switch (tok) {
     case TOK_ENV:
@@ -1950,6 +2493,8 @@ int ctf_parse_run(void)
       ctf_error(CTFERR_SYNTAX_MAIN);
     }
   }
+  if (error_count == 0 && cache_enabled)
+    cache_save();
   return error_count == 0;
 }
 
@@ -65,6 +65,11 @@ enum {
   BYTEORDER_BE,
 };
 
+enum {
+  ENCODING_CTF = 0,     /* fields in their declared size */
+  ENCODING_COMPACT,     /* variable-length integers, delta timestamps, interned strings */
+};
+
 #define CTF_NAME_LENGTH   64
 #define CTF_UUID_LENGTH   16
 #define CTF_BASE_ADDR     255
@@ -95,6 +100,7 @@ typedef struct tagCTF_TRACE_GLOBAL {
   uint8_t major;
   uint8_t minor;
   uint8_t byte_order;
+  uint8_t encoding;
   uint8_t uuid[CTF_UUID_LENGTH];
   uint32_t stream_mask; /* bit mask of which streams are active */
 } CTF_TRACE_GLOBAL;
@@ -150,6 +156,7 @@ typedef struct tagCTF_EVENT {
 
 int ctf_error_notify(int code, int linenr, const char *message); /* must be implemented in the calling application */
 
+const CTF_TRACE_GLOBAL *trace_global(void);
 const CTF_PACKET_HEADER *packet_header(void);
 
 const CTF_CLOCK *clock_by_name(const char *name);
@@ -165,9 +172,12 @@ int event_count(int stream_id);
 const CTF_EVENT *event_next(const CTF_EVENT *event);
 const CTF_EVENT *event_by_id(int event_id);
 
+uint32_t ctf_metadata_hash(void);
+
 int ctf_parse_init(const char *filename);
 void ctf_parse_cleanup(void);
 int ctf_parse_run(void);
+void ctf_parse_setcache(int enable);
 
 #endif /* _PARSETSDL_H */
 
@@ -22,6 +22,7 @@
 #else
   #include <stdio.h>
   #include <fcntl.h>
+  #include <poll.h>
   #include <termios.h>
   #include <unistd.h>
   #include <sys/ioctl.h>
@@ -37,7 +38,10 @@
 static HCOM comport[MAX_COMPORTS];
 static int initialized = 0;
 
-#if !defined _WIN32
+#if defined _WIN32
+  static unsigned char peekbyte[MAX_COMPORTS]; /* byte read by rs232_wait() */
+  static int peeked[MAX_COMPORTS];
+#else
   #define INVALID_HANDLE_VALUE (-1)
   static struct termios oldtio;
 #endif /* _WIN32 */
@@ -99,6 +103,7 @@ HCOM* rs232_open(const char *port, unsigned baud, int databits, int stopbits, in
     }
     if (*hCom == INVALID_HANDLE_VALUE)
       return NULL;
+    peeked[hCom - comport] = 0;
 
     GetCommState(*hCom,&dcb);
     /* first set the baud rate only, because this may fail for a non-standard
@@ -272,7 +277,19 @@ size_t rs232_recv(HCOM *hCom, unsigned char *buffer, size_t size)
   if (rs232_isopen(hCom)) {
     #if defined _WIN32
       DWORD read = 0;
-      if (!ReadFile(*hCom, buffer, size, &read, NULL)) {
+      size_t count = 0;
+      int idx = (int)(hCom - comport);
+      if (peeked[idx] && size > 0) {
+        /* first return the byte that rs232_wait() read, then only read more
+           if more is available (so that ReadFile() does not wait) */
+        COMSTAT comstat;
+        DWORD errors;
+        buffer[count++] = peekbyte[idx];
+        peeked[idx] = 0;
+        if (!ClearCommError(*hCom, &errors, &comstat) || comstat.cbInQue == 0)
+          return count;
+      }
+      if (!ReadFile(*hCom, buffer + count, size - count, &read, NULL)) {
         DWORD error = GetLastError();
         if (error == ERROR_INVALID_HANDLE)
           *hCom = INVALID_HANDLE_VALUE; /* mark as invalid without attempting to close the handle */
@@ -280,7 +297,7 @@ size_t rs232_recv(HCOM *hCom, unsigned char *buffer, size_t size)
           rs232_close(hCom);
         read = 0;
       }
-      return (size_t)read;
+      return count + (size_t)read;
     #else /* _WIN32 */
       int num = (int)read(*hCom, buffer, size);
       if (num < 0) {
@@ -293,6 +310,65 @@ size_t rs232_recv(HCOM *hCom, unsigned char *buffer, size_t size)
   return 0;
 }
 
+/** rs232_wait() waits until data is available on the port.
+ *
+ *  \param hCom     The handle to the port.
+ *  \param timeout  The maximum time to wait, in milliseconds. If -1, the
+ *                  function waits indefinitely.
+ *
+ *  \return 1 if data is available, 0 on timeout (or error).
+ *
+ *  \note On Linux, an error condition on the port (e.g. the device was
+ *        unplugged) also ends the wait; the next rs232_recv() then closes
+ *        the port.
+ *  \note On Windows, the function blocks in ReadFile() on a single byte, with
+ *        the time-out of the port set to the time-out of the wait. The byte is
+ *        kept, and returned by the next call to rs232_recv().
+ */
+int rs232_wait(HCOM *hCom, int timeout)
+{
+  if (!rs232_isopen(hCom))
+    return 0;
+  #if defined _WIN32
+    {
+      /* a port that is opened for synchronous I/O cannot wait for an event
+         with a timeout, but a read can; so read the first byte that arrives,
+         with the time-outs of the port adjusted for this read (if the
+         time-outs are all zero, ReadFile() waits indefinitely) */
+      COMMTIMEOUTS saved, commtimeouts;
+      COMSTAT comstat;
+      DWORD errors, read;
+      int idx = (int)(hCom - comport);
+      if (peeked[idx])
+        return 1;
+      if (!ClearCommError(*hCom, &errors, &comstat))
+        return 0;
+      if (comstat.cbInQue > 0)
+        return 1;
+      if (timeout == 0 || !GetCommTimeouts(*hCom, &saved))
+        return 0;
+      commtimeouts = saved;
+      commtimeouts.ReadIntervalTimeout        = 0;
+      commtimeouts.ReadTotalTimeoutMultiplier = 0;
+      commtimeouts.ReadTotalTimeoutConstant   = (timeout > 0) ? (DWORD)timeout : 0;
+      SetCommTimeouts(*hCom, &commtimeouts);
+      read = 0;
+      if (ReadFile(*hCom, &peekbyte[idx], 1, &read, NULL) && read == 1)
+        peeked[idx] = 1;
+      SetCommTimeouts(*hCom, &saved);
+      return peeked[idx];
+    }
+  #else /* _WIN32 */
+    {
+      struct pollfd pfd;
+      pfd.fd = *hCom;
+      pfd.events = POLLIN;
+      pfd.revents = 0;
+      return poll(&pfd, 1, timeout) > 0;
+    }
+  #endif /* _WIN32 */
+}
+
 void rs232_flush(HCOM *hCom)
 {
   if (rs232_isopen(hCom)) {
@@ -38,6 +38,7 @@ void   rs232_close(HCOM *hCom);
 int    rs232_isopen(HCOM *hCom);
 size_t rs232_xmit(HCOM *hCom, const unsigned char *buffer, size_t size);
 size_t rs232_recv(HCOM *hCom, unsigned char *buffer, size_t size);
+int    rs232_wait(HCOM *hCom, int timeout);
 void   rs232_flush(HCOM *hCom);
 void   rs232_break(HCOM *hCom);
 void   rs232_dtr(HCOM *hCom, int set);
@@ -28,6 +28,7 @@
   #include <netdb.h>
   #include <unistd.h>
   #include <arpa/inet.h>
+  #include <netinet/tcp.h>
   #define SOCKET_ERROR  (-1)
 #endif
 #include "bmp-scan.h"
@@ -188,6 +189,7 @@ int closesocket(SOCKET s)
 int tcpip_open(const char *ip_address)
 {
   struct sockaddr_in server;
+  int nodelay = 1;
   #if defined _WIN32 || defined WIN32
     unsigned long mode = 1;
   #endif
@@ -208,6 +210,9 @@ int tcpip_open(const char *ip_address)
   #else
     fcntl(GdbSocket, F_SETFL, O_NONBLOCK);
   #endif
+  /* disable the Nagle algorithm: the RSP exchanges small packets (and single
+     byte acks), which would otherwise be held back until the delayed ACK */
+  setsockopt(GdbSocket, IPPROTO_TCP, TCP_NODELAY, (const char*)&nodelay, sizeof nodelay);
 
   server.sin_addr.s_addr = inet_addr(ip_address);
   server.sin_family = AF_INET;
@@ -255,3 +260,24 @@ size_t tcpip_recv(unsigned char *buffer, size_t size)
   return (result >= 0) ? result : 0;
 }
 
+/** tcpip_wait() waits until data is available on the socket (or until the
+ *  connection is closed by the peer).
+ *
+ *  \param timeout  The maximum time to wait, in milliseconds. If -1, the
+ *                  function waits indefinitely.
+ *
+ *  \return 1 if data is available, 0 on timeout (or error).
+ */
+int tcpip_wait(int timeout)
+{
+  fd_set fdset;
+  struct timeval tv;
+
+  assert(tcpip_isopen());
+  FD_ZERO(&fdset);
+  FD_SET(GdbSocket, &fdset);
+  tv.tv_sec = timeout / 1000;
+  tv.tv_usec = (timeout % 1000) * 1000;
+  return select(GdbSocket + 1, &fdset, NULL, NULL, (timeout >= 0) ? &tv : NULL) == 1;
+}
+
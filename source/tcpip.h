@@ -44,6 +44,7 @@ int tcpip_close(void);
 int tcpip_isopen(void);
 size_t tcpip_xmit(const unsigned char *buffer, size_t size);
 size_t tcpip_recv(unsigned char *buffer, size_t size);
+int tcpip_wait(int timeout);
 
 /* general purpose functions */
 unsigned long getlocalip(char *ip_address);
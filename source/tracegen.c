@@ -64,6 +64,9 @@ typedef struct tagPATHLIST {
 #define FLAG_STREAMID   0x0008
 #define FLAG_C99        0x0010
 #define FLAG_NO_INSTR   0x0020
+#define FLAG_DIRECT     0x0040
+#define FLAG_COMPACT    0x0080
+#define FLAG_DECODER    0x0100
 
 
 int ctf_error_notify(int code, int linenr, const char *message)
@@ -246,7 +249,9 @@ void generate_prototypes(FILE *fp, unsigned flags, const char *trace_func,
   }
 
   assert(trace_func != NULL && strlen(trace_func) > 0);
-  if (flags & FLAG_STREAMID)
+  if (flags & FLAG_DIRECT)
+    {}  /* no transmit function when writing to the ITM ports directly */
+  else if (flags & FLAG_STREAMID)
     fprintf(fp, "void %s(int stream_id, const unsigned char *data, unsigned size);\n", trace_func);
   else
     fprintf(fp, "void %s(const unsigned char *data, unsigned size);\n", trace_func);
@@ -472,6 +477,892 @@ void generate_funcstubs(FILE *fp, unsigned flags, const char *trace_func,
   fprintf(fp, "#endif /* NTRACE */\n");
 }
 
+/* For the direct ITM stubs, the bytes of the trace message are packed into
+   32-bit words at generation time, for as far as the positions are known (up
+   to the first string parameter). The WORDPACK structure holds the expression
+   for the word that is being built. */
+typedef struct tagWORDPACK {
+  char expr[512];       /* expression for the variable parts of the word */
+  uint32_t constant;    /* constant bytes in the word */
+  int bytes;            /* number of bytes in the word so far */
+} WORDPACK;
+
+static void wordpack_flush(FILE *fp, WORDPACK *pack, const char *channel)
+{
+  assert(pack != NULL);
+  if (pack->bytes == 0)
+    return;
+  fprintf(fp, "    trace_itm_u32(%s, ", channel);
+  if (strlen(pack->expr) == 0)
+    fprintf(fp, "0x%08lxUL", (unsigned long)pack->constant);
+  else if (pack->constant != 0)
+    fprintf(fp, "0x%08lxUL | %s", (unsigned long)pack->constant, pack->expr);
+  else
+    fprintf(fp, "%s", pack->expr);
+  fprintf(fp, ");\n");
+  pack->expr[0] = '\0';
+  pack->constant = 0;
+  pack->bytes = 0;
+}
+
+static void wordpack_const(FILE *fp, WORDPACK *pack, const char *channel, const unsigned char *data, int size)
+{
+  assert(pack != NULL);
+  while (size-- > 0) {
+    pack->constant |= (uint32_t)*data++ << (8 * pack->bytes);
+    if (++pack->bytes == 4)
+      wordpack_flush(fp, pack, channel);
+  }
+}
+
+/** wordpack_value() adds a variable to the word(s). The expression in "value"
+ *  must be an unsigned integer of exactly "size" bytes (so that no masking is
+ *  needed).
+ */
+static void wordpack_value(FILE *fp, WORDPACK *pack, const char *channel, const char *value, int size)
+{
+  int pos = 0;
+
+  assert(pack != NULL);
+  while (pos < size) {
+    char piece[128];
+    int chunk = 4 - pack->bytes;
+    if (chunk > size - pos)
+      chunk = size - pos;
+    if (pos == 0 && strncmp(value, "(uint32_t)", 10) == 0)
+      strlcpy(piece, value, sizearray(piece));
+    else if (pos == 0)
+      sprintf(piece, "(uint32_t)%s", value);
+    else
+      sprintf(piece, "(uint32_t)(%s >> %d)", value, 8 * pos);
+    if (strlen(pack->expr) > 0)
+      strlcat(pack->expr, " | ", sizearray(pack->expr));
+    strlcat(pack->expr, piece, sizearray(pack->expr));
+    if (pack->bytes > 0) {
+      sprintf(piece, " << %d", 8 * pack->bytes);
+      strlcat(pack->expr, piece, sizearray(pack->expr));
+    }
+    pos += chunk;
+    pack->bytes += chunk;
+    if (pack->bytes == 4)
+      wordpack_flush(fp, pack, channel);
+  }
+}
+
+/* uint_type() returns the unsigned integer type for a size in bytes */
+static const char *uint_type(int bytes)
+{
+  static const char *types[] = { "uint8_t", "uint16_t", NULL, "uint32_t", NULL, NULL, NULL, "uint64_t" };
+  assert(bytes >= 1 && bytes <= 8 && types[bytes - 1] != NULL);
+  return types[bytes - 1];
+}
+
+/** field_bits() returns an expression for the value of an integer, enum or
+ *  floating-point field, cast to an unsigned integer type of the field's size.
+ *  Floating-point values must first have been copied into a variable with a
+ *  "_bits" suffix.
+ */
+static const char *field_bits(const CTF_EVENT_FIELD *field, char *expr)
+{
+  if (field->type.typeclass == CLASS_FLOAT)
+    sprintf(expr, "%s_bits", field->name);
+  else
+    sprintf(expr, "(%s)%s", uint_type(field->type.size / 8), field->name);
+  return expr;
+}
+
+void generate_funcstubs_direct(FILE *fp, unsigned flags, const char *timestamp_func, const char *headerfile)
+{
+  const CTF_EVENT *evt;
+  const char *attrib = (flags & FLAG_NO_INSTR) ? "__attribute__((no_instrument_function))\n" : "";
+
+  /* file header */
+  assert(fp != NULL);
+  assert(headerfile != NULL && strlen(headerfile) > 0);
+  fprintf(fp, "/*\n"
+              " * Trace functions implementation file, generated by tracegen\n"
+              " *\n"
+              " * The functions write directly to the ITM stimulus ports. The device header\n"
+              " * (with the CMSIS definitions for ITM) must be included via the header file.\n"
+              " */\n"
+              "#ifndef NTRACE\n"
+              "#include <stdint.h>\n"
+              "#include <string.h>\n"
+              "#include \"%s\"\n\n", headerfile);
+  if ((flags & FLAG_STREAMID) == 0)
+    fprintf(fp, "#if !defined TRACEGEN_CHANNEL\n"
+                "  #define TRACEGEN_CHANNEL 0\n"
+                "#endif\n\n");
+  fprintf(fp, "#define trace_itm_enabled(ch) ((ITM->TCR & ITM_TCR_ITMENA) != 0UL && (ITM->TER & (1UL << (ch))) != 0UL)\n\n");
+  fprintf(fp, "%sstatic void trace_itm_u32(int channel, uint32_t value)\n"
+              "{\n"
+              "  while (ITM->PORT[channel].u32 == 0UL)\n"
+              "    __NOP();\n"
+              "  ITM->PORT[channel].u32 = value;\n"
+              "}\n\n", attrib);
+  fprintf(fp, "%sstatic void trace_itm_put(int channel, uint32_t *word, unsigned *shift, uint32_t value, unsigned size)\n"
+              "{\n"
+              "  while (size-- > 0) {\n"
+              "    *word |= (value & 0xff) << *shift;\n"
+              "    value >>= 8;\n"
+              "    *shift += 8;\n"
+              "    if (*shift >= 32) {\n"
+              "      trace_itm_u32(channel, *word);\n"
+              "      *word = *shift = 0;\n"
+              "    }\n"
+              "  }\n"
+              "}\n\n", attrib);
+  fprintf(fp, "%sstatic void trace_itm_bytes(int channel, uint32_t *word, unsigned *shift, const unsigned char *data, unsigned size)\n"
+              "{\n"
+              "  while (size-- > 0)\n"
+              "    trace_itm_put(channel, word, shift, *data++, 1);\n"
+              "}\n\n", attrib);
+  fprintf(fp, "%sstatic void trace_itm_sz(int channel, uint32_t *word, unsigned *shift, const char *str)\n"
+              "{\n"
+              "  do\n"
+              "    trace_itm_put(channel, word, shift, (unsigned char)*str, 1);\n"
+              "  while (*str++ != '\\0');\n"
+              "}\n\n", attrib);
+
+  for (evt = event_next(NULL); evt != NULL; evt = event_next(evt)) {
+    const CTF_PACKET_HEADER *pkthdr = packet_header();
+    const CTF_STREAM *stream = stream_by_id(evt->stream_id);
+    const CTF_EVENT_HEADER *evthdr = (stream != NULL) ? &stream->event : NULL;
+    const CTF_EVENT_FIELD *field;
+    char channel[32], expr[128];
+    WORDPACK pack;
+    int streaming;
+
+    if (flags & FLAG_STREAMID)
+      sprintf(channel, "%d", (stream != NULL) ? stream->stream_id : 0);
+    else
+      strcpy(channel, "TRACEGEN_CHANNEL");
+
+    generate_functionheader(fp, evt, flags);
+    fprintf(fp, "\n{\n");
+    fprintf(fp, "  if (trace_itm_enabled(%s)) {\n", channel);
+    /* the timestamp and floating-point parameters are copied into variables
+       first */
+    if (evthdr != NULL && evthdr->header.timestamp_size > 0) {
+      char typedesc[64];
+      assert(stream->clock != NULL);
+      assert(timestamp_func != NULL && strlen(timestamp_func) > 0);
+      fprintf(fp, "    %s tstamp = %s();\n", type_to_string(stream->clock, typedesc, sizearray(typedesc)), timestamp_func);
+    }
+    for (field = evt->field_root.next; field != NULL; field = field->next)
+      if (field->type.typeclass == CLASS_FLOAT)
+        fprintf(fp, "    %s %s_bits;\n", uint_type(field->type.size / 8), field->name);
+    for (field = evt->field_root.next; field != NULL && field->type.typeclass != CLASS_STRING; field = field->next)
+      {}
+    if (field != NULL)
+      fprintf(fp, "    uint32_t word;\n"
+                  "    unsigned shift;\n");
+    for (field = evt->field_root.next; field != NULL; field = field->next)
+      if (field->type.typeclass == CLASS_FLOAT)
+        fprintf(fp, "    memcpy(&%s_bits, &%s, %u);\n", field->name, field->name, field->type.size / 8);
+
+    /* the constant part of the header */
+    memset(&pack, 0, sizeof pack);
+    assert(pkthdr != NULL);
+    switch (pkthdr->header.magic_size) {
+    case 8:
+      wordpack_const(fp, &pack, channel, (const unsigned char*)"\xc1", 1);
+      break;
+    case 16:
+      wordpack_const(fp, &pack, channel, (const unsigned char*)"\xc1\x1f", 2);
+      break;
+    case 32:
+      wordpack_const(fp, &pack, channel, (const unsigned char*)"\xc1\x1f\xfc\xc1", 4);
+      break;
+    }
+    if (pkthdr->header.streamid_size > 0) {
+      unsigned long val = (stream != NULL) ? stream->stream_id : 0;
+      wordpack_const(fp, &pack, channel, (unsigned char*)&val, pkthdr->header.streamid_size / 8);
+    }
+    if (evthdr != NULL && evthdr->header.id_size > 0)
+      wordpack_const(fp, &pack, channel, (unsigned char*)&evt->id, evthdr->header.id_size / 8);
+    if (evthdr != NULL && evthdr->header.timestamp_size > 0) {
+      int bytes = evthdr->header.timestamp_size / 8;
+      sprintf(expr, "(%s)tstamp", uint_type(bytes));
+      wordpack_value(fp, &pack, channel, expr, bytes);
+    }
+
+    /* the parameters; up to the first string, the words are packed here, after
+       a string, the words are packed at run time */
+    streaming = 0;
+    for (field = evt->field_root.next; field != NULL; field = field->next) {
+      int bytes = field->type.size / 8;
+      if (field->type.typeclass == CLASS_STRING) {
+        if (!streaming) {
+          /* transfer the partial word to the run-time variables */
+          fprintf(fp, "    word = ");
+          if (strlen(pack.expr) == 0 && pack.constant == 0)
+            fprintf(fp, "0");
+          else if (strlen(pack.expr) == 0)
+            fprintf(fp, "0x%08lxUL", (unsigned long)pack.constant);
+          else if (pack.constant != 0)
+            fprintf(fp, "0x%08lxUL | %s", (unsigned long)pack.constant, pack.expr);
+          else
+            fprintf(fp, "%s", pack.expr);
+          fprintf(fp, ";\n    shift = %d;\n", 8 * pack.bytes);
+          streaming = 1;
+        }
+        fprintf(fp, "    trace_itm_sz(%s, &word, &shift, %s);\n", channel, field->name);
+      } else if (field->type.typeclass == CLASS_STRUCT) {
+        if (streaming) {
+          fprintf(fp, "    trace_itm_bytes(%s, &word, &shift, (const unsigned char*)%s, %d);\n", channel, field->name, bytes);
+        } else {
+          int idx;
+          for (idx = 0; idx < bytes; idx++) {
+            sprintf(expr, "((const unsigned char*)%s)[%d]", field->name, idx);
+            wordpack_value(fp, &pack, channel, expr, 1);
+          }
+        }
+      } else {
+        field_bits(field, expr);
+        if (streaming) {
+          if (bytes > 4) {
+            fprintf(fp, "    trace_itm_put(%s, &word, &shift, (uint32_t)%s, 4);\n", channel, expr);
+            fprintf(fp, "    trace_itm_put(%s, &word, &shift, (uint32_t)(%s >> 32), %d);\n", channel, expr, bytes - 4);
+          } else {
+            fprintf(fp, "    trace_itm_put(%s, &word, &shift, %s, %d);\n", channel, expr, bytes);
+          }
+        } else {
+          wordpack_value(fp, &pack, channel, expr, bytes);
+        }
+      }
+    }
+    if (streaming)
+      fprintf(fp, "    if (shift > 0)\n"
+                  "      trace_itm_u32(%s, word);\n", channel);
+    else
+      wordpack_flush(fp, &pack, channel);
+    fprintf(fp, "  }\n"
+                "}\n\n");
+  }
+
+  /* file trailer */
+  fprintf(fp, "#endif /* NTRACE */\n");
+}
+
+/** generate_funcstubs_compact() generates the trace functions for the compact
+ *  encoding: integers are stored as LEB128 varints, timestamps are stored as
+ *  deltas from the previous timestamp in the same stream (with a periodic
+ *  absolute timestamp, for resynchronization), and constant strings are
+ *  interned (sent once, then referred to by a slot number; the strings are
+ *  sent again every 64 messages with strings). The packet magic
+ *  differs from that of the standard encoding, so that the decoder can detect
+ *  the encoding of each packet.
+ */
+void generate_funcstubs_compact(FILE *fp, unsigned flags, const char *trace_func,
+                                const char *timestamp_func, const char *headerfile)
+{
+  const char *attrib = (flags & FLAG_NO_INSTR) ? "__attribute__((no_instrument_function))\n" : "";
+  const CTF_PACKET_HEADER *pkthdr = packet_header();
+  const CTF_EVENT *evt;
+  const CTF_EVENT_FIELD *field;
+  const CTF_STREAM *stream;
+  int need_sleb = 0, need_sleb64 = 0, need_uleb64 = 0, need_str = 0, need_bytes = 0;
+  int max_streamid = -1;
+  int seqnr;
+
+  /* check which encoding functions are needed */
+  for (evt = event_next(NULL); evt != NULL; evt = event_next(evt)) {
+    for (field = evt->field_root.next; field != NULL; field = field->next) {
+      switch (field->type.typeclass) {
+      case CLASS_INTEGER:
+      case CLASS_ENUM:
+        if (field->type.flags & TYPEFLAG_SIGNED) {
+          if (field->type.size > 32)
+            need_sleb64 = 1;
+          else
+            need_sleb = 1;
+        } else if (field->type.size > 32) {
+          need_uleb64 = 1;
+        }
+        break;
+      case CLASS_STRING:
+        need_str = 1;
+        break;
+      default:
+        need_bytes = 1;
+      }
+    }
+  }
+  for (seqnr = 0; (stream = stream_by_seqnr(seqnr)) != NULL; seqnr++) {
+    if (stream->event.header.id_size > 0)
+      need_bytes = 1;   /* for the header */
+    if (stream->event.header.timestamp_size > 0) {
+      need_uleb64 = 1;  /* for the absolute timestamp */
+      if (stream->stream_id > max_streamid)
+        max_streamid = stream->stream_id;
+    }
+  }
+  assert(pkthdr != NULL);
+  if (pkthdr->header.magic_size > 0 || pkthdr->header.streamid_size > 0)
+    need_bytes = 1;
+
+  /* file header */
+  assert(fp != NULL);
+  assert(headerfile != NULL && strlen(headerfile) > 0);
+  fprintf(fp, "/*\n"
+              " * Trace functions implementation file, generated by tracegen\n"
+              " *\n"
+              " * The trace messages use the compact encoding.\n");
+  if (flags & FLAG_DIRECT)
+    fprintf(fp, " * The functions write directly to the ITM stimulus ports. The device header\n"
+                " * (with the CMSIS definitions for ITM) must be included via the header file.\n");
+  fprintf(fp, " */\n"
+              "#ifndef NTRACE\n"
+              "#include <stdint.h>\n"
+              "#include <string.h>\n");
+  if ((flags & (FLAG_C99 | FLAG_DIRECT)) == 0)
+    fprintf(fp, "#include <alloca.h>\n");
+  fprintf(fp, "#include \"%s\"\n\n", headerfile);
+  if ((flags & (FLAG_STREAMID | FLAG_DIRECT)) == FLAG_DIRECT)
+    fprintf(fp, "#if !defined TRACEGEN_CHANNEL\n"
+                "  #define TRACEGEN_CHANNEL 0\n"
+                "#endif\n");
+  if (need_str)
+    fprintf(fp, "#if !defined TRACEGEN_STRINGS\n"
+                "  #define TRACEGEN_STRINGS 32  /* size of the interned string table, power of 2, max. 64 */\n"
+                "#endif\n"
+                "#if !defined TRACEGEN_IS_CONST\n"
+                "  #define TRACEGEN_IS_CONST(s) ((uintptr_t)(s) < 0x20000000UL) /* code region (Flash/ROM) */\n"
+                "#endif\n"
+                "/* The interned string table is updated while a message is built, and the\n"
+                " * message must be sent before another trace function uses the table; the\n"
+                " * functions with string parameters therefore run with interrupts disabled\n"
+                " * (Cortex-M, GCC). Define both macros as empty if the trace functions are\n"
+                " * never called from an interrupt handler. */\n"
+                "#if !defined TRACEGEN_LOCK\n"
+                "  #define TRACEGEN_LOCK(key)   __asm volatile (\"mrs %%0, primask\\n\\tcpsid i\" : \"=r\" (key) : : \"memory\")\n"
+                "  #define TRACEGEN_UNLOCK(key) __asm volatile (\"msr primask, %%0\" : : \"r\" (key) : \"memory\")\n"
+                "#endif\n");
+  fprintf(fp, "\n");
+
+  /* output functions */
+  if (flags & FLAG_DIRECT) {
+    fprintf(fp, "#define trace_itm_enabled(ch) ((ITM->TCR & ITM_TCR_ITMENA) != 0UL && (ITM->TER & (1UL << (ch))) != 0UL)\n\n");
+    fprintf(fp, "typedef struct tagTRACE_OUT {\n"
+                "  int channel;\n"
+                "  uint32_t word;\n"
+                "  unsigned shift;\n"
+                "} TRACE_OUT;\n\n");
+    fprintf(fp, "%sstatic void trace_out_byte(TRACE_OUT *out, unsigned char value)\n"
+                "{\n"
+                "  out->word |= (uint32_t)value << out->shift;\n"
+                "  out->shift += 8;\n"
+                "  if (out->shift >= 32) {\n"
+                "    while (ITM->PORT[out->channel].u32 == 0UL)\n"
+                "      __NOP();\n"
+                "    ITM->PORT[out->channel].u32 = out->word;\n"
+                "    out->word = out->shift = 0;\n"
+                "  }\n"
+                "}\n\n", attrib);
+  } else {
+    fprintf(fp, "typedef struct tagTRACE_OUT {\n"
+                "  unsigned char *buffer;\n"
+                "  unsigned length;\n"
+                "} TRACE_OUT;\n\n");
+    fprintf(fp, "%sstatic void trace_out_byte(TRACE_OUT *out, unsigned char value)\n"
+                "{\n"
+                "  out->buffer[out->length++] = value;\n"
+                "}\n\n", attrib);
+  }
+  if (need_bytes)
+    fprintf(fp, "%sstatic void trace_out_bytes(TRACE_OUT *out, const unsigned char *data, unsigned size)\n"
+                "{\n"
+                "  while (size-- > 0)\n"
+                "    trace_out_byte(out, *data++);\n"
+                "}\n\n", attrib);
+  fprintf(fp, "%sstatic void trace_out_uleb(TRACE_OUT *out, uint32_t value)\n"
+              "{\n"
+              "  while (value >= 0x80) {\n"
+              "    trace_out_byte(out, (unsigned char)(value | 0x80));\n"
+              "    value >>= 7;\n"
+              "  }\n"
+              "  trace_out_byte(out, (unsigned char)value);\n"
+              "}\n\n", attrib);
+  if (need_uleb64)
+    fprintf(fp, "%sstatic void trace_out_uleb64(TRACE_OUT *out, uint64_t value)\n"
+                "{\n"
+                "  while (value >= 0x80) {\n"
+                "    trace_out_byte(out, (unsigned char)(value | 0x80));\n"
+                "    value >>= 7;\n"
+                "  }\n"
+                "  trace_out_byte(out, (unsigned char)value);\n"
+                "}\n\n", attrib);
+  if (need_sleb)
+    fprintf(fp, "%sstatic void trace_out_sleb(TRACE_OUT *out, int32_t value)\n"
+                "{\n"
+                "  while (value < -0x40 || value >= 0x40) {\n"
+                "    trace_out_byte(out, (unsigned char)(value | 0x80));\n"
+                "    value >>= 7;\n"
+                "  }\n"
+                "  trace_out_byte(out, (unsigned char)(value & 0x7f));\n"
+                "}\n\n", attrib);
+  if (need_sleb64)
+    fprintf(fp, "%sstatic void trace_out_sleb64(TRACE_OUT *out, int64_t value)\n"
+                "{\n"
+                "  while (value < -0x40 || value >= 0x40) {\n"
+                "    trace_out_byte(out, (unsigned char)(value | 0x80));\n"
+                "    value >>= 7;\n"
+                "  }\n"
+                "  trace_out_byte(out, (unsigned char)(value & 0x7f));\n"
+                "}\n\n", attrib);
+  if (max_streamid >= 0) {
+    fprintf(fp, "typedef struct tagTRACE_TSTAMP {\n"
+                "  uint64_t previous;\n"
+                "  unsigned char count;\n"
+                "} TRACE_TSTAMP;\n"
+                "static TRACE_TSTAMP trace_tstamp[%d];\n\n", max_streamid + 1);
+    fprintf(fp, "%sstatic void trace_out_tstamp(TRACE_OUT *out, TRACE_TSTAMP *state, uint64_t tstamp)\n"
+                "{\n"
+                "  uint64_t delta = tstamp - state->previous;\n"
+                "  if ((state->count++ & 0x3f) == 0 || delta >= 0x80000000UL)\n"
+                "    trace_out_uleb64(out, (tstamp << 1) | 1); /* absolute timestamp */\n"
+                "  else\n"
+                "    trace_out_uleb(out, (uint32_t)delta << 1);\n"
+                "  state->previous = tstamp;\n"
+                "}\n\n", attrib);
+  }
+  if (need_str) {
+    fprintf(fp, "static const char *trace_strtab[TRACEGEN_STRINGS];\n"
+                "static unsigned char trace_strcount;\n\n");
+    fprintf(fp, "%sstatic void trace_str_resync(void)\n"
+                "{\n"
+                "  /* every 64 messages with strings, all strings are defined again, for a\n"
+                "     host that attached late (or that missed a definition) */\n"
+                "  if ((trace_strcount++ & 0x3f) == 0)\n"
+                "    memset((void*)trace_strtab, 0, sizeof trace_strtab);\n"
+                "}\n\n", attrib);
+    fprintf(fp, "%sstatic void trace_out_str(TRACE_OUT *out, const char *str)\n"
+                "{\n"
+                "  if (TRACEGEN_IS_CONST(str)) {\n"
+                "    unsigned slot = ((uintptr_t)str >> 2) & (TRACEGEN_STRINGS - 1);\n"
+                "    if (trace_strtab[slot] == str) {\n"
+                "      trace_out_uleb(out, 2 * slot + 1);  /* reference to interned string */\n"
+                "      return;\n"
+                "    }\n"
+                "    trace_strtab[slot] = str;\n"
+                "    trace_out_uleb(out, 2 * slot + 2);    /* define interned string */\n"
+                "  } else {\n"
+                "    trace_out_byte(out, 0);               /* literal string */\n"
+                "  }\n"
+                "  do\n"
+                "    trace_out_byte(out, (unsigned char)*str);\n"
+                "  while (*str++ != '\\0');\n"
+                "}\n\n", attrib);
+  }
+
+  for (evt = event_next(NULL); evt != NULL; evt = event_next(evt)) {
+    const CTF_EVENT_HEADER *evthdr;
+    char channel[32], xmit_call[40];
+    int headersz, maxsz, stringcount, idx;
+
+    stream = stream_by_id(evt->stream_id);
+    evthdr = (stream != NULL) ? &stream->event : NULL;
+    if (flags & FLAG_STREAMID) {
+      sprintf(channel, "%d", (stream != NULL) ? stream->stream_id : 0);
+      sprintf(xmit_call, "%s(%d, ", trace_func, (stream != NULL) ? stream->stream_id : 0);
+    } else {
+      strcpy(channel, "TRACEGEN_CHANNEL");
+      sprintf(xmit_call, "%s(", trace_func);
+    }
+
+    /* the maximum size of the encoded message (excluding the string lengths) */
+    headersz = pkthdr->header.magic_size / 8 + pkthdr->header.streamid_size / 8;
+    if (evthdr != NULL)
+      headersz += evthdr->header.id_size / 8;
+    maxsz = headersz;
+    if (evthdr != NULL && evthdr->header.timestamp_size > 0)
+      maxsz += 10;
+    stringcount = 0;
+    for (field = evt->field_root.next; field != NULL; field = field->next) {
+      if (field->type.typeclass == CLASS_STRING) {
+        maxsz += 3;   /* tag (ULEB128, 2 bytes for tags >= 128) + zero terminator */
+        stringcount++;
+      } else if (field->type.typeclass == CLASS_INTEGER || field->type.typeclass == CLASS_ENUM) {
+        maxsz += (field->type.size > 32) ? 10 : 5;
+      } else {
+        maxsz += field->type.size / 8;
+      }
+    }
+
+    generate_functionheader(fp, evt, flags);
+    fprintf(fp, "\n{\n");
+    if (headersz > 0) {
+      unsigned long val;
+      fprintf(fp, "  static const unsigned char header[%d] = {", headersz);
+      switch (pkthdr->header.magic_size) {
+      case 8:
+        fprintf(fp, "0xc2");
+        break;
+      case 16:
+        fprintf(fp, "0xc2, 0x2f");
+        break;
+      case 32:
+        fprintf(fp, "0xc2, 0x2f, 0xfc, 0xc2");
+        break;
+      }
+      idx = pkthdr->header.magic_size / 8;
+      if (pkthdr->header.streamid_size > 0) {
+        if (idx > 0)
+          fprintf(fp, ", ");
+        val = (stream != NULL) ? stream->stream_id : 0;
+        dumphex(fp, (unsigned char*)&val, pkthdr->header.streamid_size / 8);
+        idx += pkthdr->header.streamid_size / 8;
+      }
+      if (evthdr != NULL && evthdr->header.id_size > 0) {
+        if (idx > 0)
+          fprintf(fp, ", ");
+        dumphex(fp, (unsigned char*)&evt->id, evthdr->header.id_size / 8);
+      }
+      fprintf(fp, " };\n");
+    }
+    fprintf(fp, "  TRACE_OUT out;\n");
+    if (stringcount > 0)
+      fprintf(fp, "  uint32_t key;\n");
+    if (flags & FLAG_DIRECT) {
+      fprintf(fp, "  if (!trace_itm_enabled(%s))\n"
+                  "    return;\n", channel);
+      fprintf(fp, "  out.channel = %s;\n"
+                  "  out.word = out.shift = 0;\n", channel);
+    } else {
+      if (stringcount > 0) {
+        fprintf(fp, "  unsigned totallength = ");
+        idx = 0;
+        for (field = evt->field_root.next; field != NULL; field = field->next) {
+          if (field->type.typeclass == CLASS_STRING) {
+            if (idx++ > 0)
+              fprintf(fp, " + ");
+            fprintf(fp, "strlen(%s)", field->name);
+          }
+        }
+        fprintf(fp, ";\n");
+      }
+      if ((flags & FLAG_C99) == 0 || stringcount == 0)
+        fprintf(fp, "  unsigned char buffer[%d%s];\n", maxsz, (stringcount > 0) ? " + totallength" : "");
+      else
+        fprintf(fp, "  unsigned char *buffer = alloca(%d + totallength);\n", maxsz);
+      fprintf(fp, "  out.buffer = buffer;\n"
+                  "  out.length = 0;\n");
+    }
+    if (stringcount > 0)
+      fprintf(fp, "  TRACEGEN_LOCK(key);\n"
+                  "  trace_str_resync();\n");
+    if (headersz > 0)
+      fprintf(fp, "  trace_out_bytes(&out, header, %d);\n", headersz);
+    if (evthdr != NULL && evthdr->header.timestamp_size > 0) {
+      assert(stream != NULL && stream->clock != NULL);
+      assert(timestamp_func != NULL && strlen(timestamp_func) > 0);
+      fprintf(fp, "  trace_out_tstamp(&out, &trace_tstamp[%d], %s());\n", stream->stream_id, timestamp_func);
+    }
+    for (field = evt->field_root.next; field != NULL; field = field->next) {
+      switch (field->type.typeclass) {
+      case CLASS_INTEGER:
+      case CLASS_ENUM:
+        if (field->type.flags & TYPEFLAG_SIGNED)
+          fprintf(fp, "  trace_out_sleb%s(&out, %s);\n", (field->type.size > 32) ? "64" : "", field->name);
+        else
+          fprintf(fp, "  trace_out_uleb%s(&out, %s);\n", (field->type.size > 32) ? "64" : "", field->name);
+        break;
+      case CLASS_STRING:
+        fprintf(fp, "  trace_out_str(&out, %s);\n", field->name);
+        break;
+      case CLASS_STRUCT:
+        fprintf(fp, "  trace_out_bytes(&out, (const unsigned char*)%s, %u);\n", field->name, field->type.size / 8);
+        break;
+      default:
+        fprintf(fp, "  trace_out_bytes(&out, (const unsigned char*)&%s, %u);\n", field->name, field->type.size / 8);
+      }
+    }
+    if (flags & FLAG_DIRECT)
+      fprintf(fp, "  while (out.shift > 0)\n"
+                  "    trace_out_byte(&out, 0); /* pad the last word */\n");
+    else
+      fprintf(fp, "  %sbuffer, out.length);\n", xmit_call);
+    if (stringcount > 0)
+      fprintf(fp, "  TRACEGEN_UNLOCK(key);\n");
+    fprintf(fp, "}\n\n");
+  }
+
+  /* file trailer */
+  fprintf(fp, "#endif /* NTRACE */\n");
+}
+
+/** decoder_typesize() returns the size in bytes of a field in the fixed layout
+ *  (the non-compact encoding), or -1 if the field does not have a fixed size.
+ */
+static int decoder_typesize(const CTF_TYPE *type)
+{
+  switch (type->typeclass) {
+  case CLASS_INTEGER:
+  case CLASS_ENUM:
+    if (type->size != 8 && type->size != 16 && type->size != 32 && type->size != 64)
+      return -1;
+    if (type->typeclass == CLASS_ENUM && type->size > 32)
+      return -1;
+    return type->size / 8;
+  case CLASS_FLOAT:
+    if (type->size != 32 && type->size != 64)
+      return -1;
+    return type->size / 8;
+  case CLASS_STRUCT:
+    if (type->size % 8 != 0 || type->size == 0)
+      return -1;
+    if (type->fields != NULL) {
+      const CTF_TYPE *sub;
+      for (sub = type->fields->next; sub != NULL && sub->size / 8 > 0; sub = sub->next)
+        if (decoder_typesize(sub) < 0)
+          return -1;
+    }
+    return type->size / 8;
+  }
+  return -1;  /* strings & variants */
+}
+
+static int decoder_payloadsize(const CTF_EVENT *evt)
+{
+  const CTF_EVENT_FIELD *field;
+  int total = 0;
+  for (field = evt->field_root.next; field != NULL; field = field->next) {
+    int size = decoder_typesize(&field->type);
+    if (size < 0)
+      return -1;
+    total += size;
+  }
+  return total;
+}
+
+static void decoder_putstr(FILE *fp, const char *text)
+{
+  fprintf(fp, "      pos = put_str(text, size, pos, \"");
+  while (*text != '\0') {
+    if (*text == '"' || *text == '\\')
+      fputc('\\', fp);
+    fputc(*text++, fp);
+  }
+  fprintf(fp, "\");\n");
+}
+
+/** decoder_field() generates the code that formats a single field, in the
+ *  same way as format_field() in decodectf.c.
+ */
+static void decoder_field(FILE *fp, const char *name, const CTF_TYPE *type, int offset)
+{
+  int base = (type->base < 2 || type->base > 16) ? 10 : type->base;
+  int bytes = type->size / 8;
+
+  fprintf(fp, "      pos = put_str(text, size, pos, \"%s = \");\n", name);
+  switch (type->typeclass) {
+  case CLASS_INTEGER:
+    if (type->size > 32) {
+      fprintf(fp, "      memcpy(&u64, payload + %d, 8);\n", offset);
+      if ((type->flags & TYPEFLAG_SIGNED) && base == 10)
+        fprintf(fp, "      pos = put_int(text, size, pos, (int64_t)u64);\n");
+      else
+        fprintf(fp, "      pos = put_uint(text, size, pos, u64, %d);\n", base);
+    } else {
+      fprintf(fp, "      u32 = 0;\n"
+                  "      memcpy(&u32, payload + %d, %d);\n", offset, bytes);
+      if (type->base == CTF_BASE_ADDR) {
+        fprintf(fp, "      if (lookup != NULL && lookup(u32, sym, sizeof sym))\n"
+                    "        pos = put_str(text, size, pos, sym);\n"
+                    "      else\n"
+                    "        pos = put_uint(text, size, pos, u32, 16);\n");
+      } else if (type->flags & TYPEFLAG_SIGNED) {
+        const char *cast = (bytes == 1) ? "(int8_t)" : (bytes == 2) ? "(int16_t)" : "(int32_t)";
+        if (base == 10)
+          fprintf(fp, "      pos = put_int(text, size, pos, %su32);\n", cast);
+        else
+          fprintf(fp, "      pos = put_uint(text, size, pos, (uint32_t)(int32_t)%su32, %d);\n", cast, base);
+      } else {
+        fprintf(fp, "      pos = put_uint(text, size, pos, u32, %d);\n", base);
+      }
+    }
+    break;
+
+  case CLASS_FLOAT:
+    if (type->size > 32)
+      fprintf(fp, "      memcpy(&f64, payload + %d, 8);\n"
+                  "      sprintf(sym, \"%%f\", f64);\n", offset);
+    else
+      fprintf(fp, "      memcpy(&f32, payload + %d, 4);\n"
+                  "      sprintf(sym, \"%%f\", (double)f32);\n", offset);
+    fprintf(fp, "      pos = put_str(text, size, pos, sym);\n");
+    break;
+
+  case CLASS_ENUM: {
+    const CTF_KEYVALUE *kv, *prev;
+    fprintf(fp, "      u32 = 0;\n"
+                "      memcpy(&u32, payload + %d, %d);\n", offset, bytes);
+    fprintf(fp, "      switch ((int32_t)u32) {\n");
+    for (kv = type->keys->next; kv != NULL; kv = kv->next) {
+      if (kv->value < INT32_MIN || kv->value > INT32_MAX)
+        continue;
+      for (prev = type->keys->next; prev != kv && prev->value != kv->value; prev = prev->next)
+        {}
+      if (prev != kv)
+        continue; /* duplicate value, the first name matches */
+      fprintf(fp, "      case %ld:\n  ", kv->value);
+      decoder_putstr(fp, kv->name);
+      fprintf(fp, "        break;\n");
+    }
+    fprintf(fp, "      default:\n"
+                "        sprintf(sym, \"(%%d)\", (int)(int32_t)u32);\n"
+                "        pos = put_str(text, size, pos, sym);\n"
+                "      }\n");
+    break;
+  } /* case */
+
+  case CLASS_STRUCT:
+    fprintf(fp, "      pos = put_str(text, size, pos, \"{ \");\n");
+    if (type->fields != NULL) {
+      const CTF_TYPE *sub;
+      for (sub = type->fields->next; sub != NULL && sub->size / 8 > 0; sub = sub->next) {
+        if (sub != type->fields->next)
+          fprintf(fp, "      pos = put_str(text, size, pos, \", \");\n");
+        decoder_field(fp, sub->identifier, sub, offset);
+        offset += sub->size / 8;
+      }
+    }
+    fprintf(fp, "      pos = put_str(text, size, pos, \" }\");\n");
+    break;
+
+  default:
+    assert(0);
+  }
+}
+
+/** generate_decoder() creates a host-side decoder that is specialized for the
+ *  metadata: each event with a fixed layout gets hard-coded field extraction
+ *  and formatting. The decoder is built as a shared library (with the base name
+ *  of the TSDL file), and decodectf.c loads it if the metadata hash matches.
+ */
+void generate_decoder(FILE *fp, const char *tsdlfile)
+{
+  const CTF_EVENT *evt;
+  const CTF_EVENT_FIELD *field;
+  char basename[_MAX_PATH], *ptr;
+  int offset;
+
+  #if defined _WIN32
+    ptr = (char*)tsdlfile;
+    if (strrchr(ptr, '\\') != NULL)
+      ptr = strrchr(ptr, '\\') + 1;
+    if (strrchr(ptr, '/') != NULL)
+      ptr = strrchr(ptr, '/') + 1;
+  #else
+    ptr = strrchr(tsdlfile, '/');
+    ptr = (ptr != NULL) ? ptr + 1 : (char*)tsdlfile;
+  #endif
+  strlcpy(basename, ptr, sizearray(basename));
+  if ((ptr = strrchr(basename, '.')) != NULL)
+    *ptr = '\0';
+
+  /* file header */
+  fprintf(fp, "/*\n"
+              " * Trace decoder, specialized for the metadata in %s.\n"
+              " * This file is generated by tracegen; build it as a shared library\n"
+              " * (%s.so or %s.dll) and store it next to the TSDL file.\n"
+              " */\n\n", tsdlfile, basename, basename);
+  fprintf(fp, "#include <stdint.h>\n"
+              "#include <stdio.h>\n"
+              "#include <string.h>\n\n");
+  fprintf(fp, "#if defined _WIN32\n"
+              "  #define TRACEGEN_EXPORT __declspec(dllexport)\n"
+              "#else\n"
+              "  #define TRACEGEN_EXPORT\n"
+              "#endif\n\n");
+
+  /* support functions */
+  fprintf(fp, "static size_t put_str(char *text, size_t size, size_t pos, const char *str)\n"
+              "{\n"
+              "  for ( ; *str != '\\0'; str++, pos++)\n"
+              "    if (pos + 1 < size)\n"
+              "      text[pos] = *str;\n"
+              "  if (size > 0)\n"
+              "    text[(pos < size) ? pos : size - 1] = '\\0';\n"
+              "  return pos;\n"
+              "}\n\n");
+  fprintf(fp, "static size_t put_uint(char *text, size_t size, size_t pos, uint64_t value, int base)\n"
+              "{\n"
+              "  char str[72];\n"
+              "  int idx = sizeof str - 1;\n"
+              "  str[idx] = '\\0';\n"
+              "  do {\n"
+              "    int rem = (int)(value %% base);\n"
+              "    str[--idx] = (char)((rem > 9) ? (rem - 10) + 'a' : rem + '0');\n"
+              "    value /= base;\n"
+              "  } while (value != 0);\n"
+              "  return put_str(text, size, pos, str + idx);\n"
+              "}\n\n");
+  fprintf(fp, "static size_t put_int(char *text, size_t size, size_t pos, int64_t value)\n"
+              "{\n"
+              "  if (value < 0) {\n"
+              "    pos = put_str(text, size, pos, \"-\");\n"
+              "    return put_uint(text, size, pos, (uint64_t)0 - (uint64_t)value, 10);\n"
+              "  }\n"
+              "  return put_uint(text, size, pos, (uint64_t)value, 10);\n"
+              "}\n\n");
+
+  /* metadata hash */
+  fprintf(fp, "TRACEGEN_EXPORT uint32_t tracegen_metadata_hash(void)\n"
+              "{\n"
+              "  return 0x%08lxu;\n"
+              "}\n\n", (unsigned long)ctf_metadata_hash());
+
+  /* payload sizes */
+  fprintf(fp, "/* returns the size of the payload of the event, or -1 if the payload does not\n"
+              "   have a fixed layout (which must then be decoded by the generic decoder) */\n");
+  fprintf(fp, "TRACEGEN_EXPORT int tracegen_payload_size(int event_id)\n"
+              "{\n"
+              "  switch (event_id) {\n");
+  for (evt = event_next(NULL); evt != NULL; evt = event_next(evt)) {
+    int size = decoder_payloadsize(evt);
+    if (size > 0 && event_by_id(evt->id) == evt)
+      fprintf(fp, "  case %d: return %d; /* %s */\n", evt->id, size, evt->name);
+  }
+  fprintf(fp, "  }\n"
+              "  return -1;\n"
+              "}\n\n");
+
+  /* formatting */
+  fprintf(fp, "/* formats the payload of the event in text; returns the length of the text\n"
+              "   (which may exceed the size of the buffer), or -1 on failure */\n");
+  fprintf(fp, "TRACEGEN_EXPORT int tracegen_format(int event_id, const unsigned char *payload, char *text, size_t size,\n"
+              "                                    int (*lookup)(uint32_t address, char *symbol, size_t size))\n"
+              "{\n"
+              "  size_t pos = 0;\n"
+              "  uint32_t u32;\n"
+              "  uint64_t u64;\n"
+              "  float f32;\n"
+              "  double f64;\n"
+              "  char sym[128];\n\n"
+              "  (void)u32; (void)u64; (void)f32; (void)f64; (void)sym; (void)lookup;\n"
+              "  switch (event_id) {\n");
+  for (evt = event_next(NULL); evt != NULL; evt = event_next(evt)) {
+    if (decoder_payloadsize(evt) <= 0 || event_by_id(evt->id) != evt)
+      continue;
+    fprintf(fp, "  case %d: /* %s */\n", evt->id, evt->name);
+    offset = 0;
+    for (field = evt->field_root.next; field != NULL; field = field->next) {
+      if (field != evt->field_root.next)
+        fprintf(fp, "      pos = put_str(text, size, pos, \", \");\n");
+      decoder_field(fp, field->name, &field->type, offset);
+      offset += field->type.size / 8;
+    }
+    fprintf(fp, "      break;\n");
+  }
+  fprintf(fp, "  default:\n"
+              "    return -1;\n"
+              "  }\n"
+              "  return (int)pos;\n"
+              "}\n");
+}
+
 static void usage(int status)
 {
   printf("tragegen - generate C source & header files from TSDL specifications,"
@@ -479,6 +1370,13 @@ static void usage(int status)
          "Usage: tracegen [options] inputfile\n\n"
          "Options:\n"
          "-c99      Generate C99-compatible code (default is C90).\n"
+         "-compact  Use the compact encoding (variable-length integers, delta time\n"
+         "          stamps, interned strings); also set with \"encoding = compact;\"\n"
+         "          in the trace block of the TSDL file.\n"
+         "-decoder  Also generate a host-side decoder, specialized for the TSDL file;\n"
+         "          it is written to a file with the suffix _decoder.c (bmtrace only\n"
+         "          loads it when decoder plug-ins are enabled in its settings).\n"
+         "-direct   Generate code that writes directly to the ITM stimulus ports.\n"
          "-fs=name  Set the name for the time stamp function, default = trace_timestamp\n"
          "-fx=name  Set the name for the trace transmit function, default = trace_xmit\n"
          "-i=path   Generate an #include <...> directive with this path.\n"
@@ -525,6 +1423,16 @@ int main(int argc, char *argv[])
       case 'c':
         if (strcmp(argv[idx]+1, "c99") == 0)
           opt_flags |= FLAG_C99;
+        else if (strcmp(argv[idx]+1, "compact") == 0)
+          opt_flags |= FLAG_COMPACT;
+        else
+          unknown_option(argv[idx]);
+        break;
+      case 'd':
+        if (strcmp(argv[idx]+1, "direct") == 0)
+          opt_flags |= FLAG_DIRECT;
+        else if (strcmp(argv[idx]+1, "decoder") == 0)
+          opt_flags |= FLAG_DECODER;
         else
           unknown_option(argv[idx]);
         break;
@@ -618,6 +1526,11 @@ int main(int argc, char *argv[])
     FILE *fp;
     int done_msg = 1;
 
+    if (trace_global()->encoding == ENCODING_COMPACT)
+      opt_flags |= FLAG_COMPACT;
+    else if ((opt_flags & FLAG_COMPACT) && packet_header()->header.magic_size == 0)
+      fprintf(stderr, "Warning: without a packet header, the compact encoding must also be set in the TSDL file.\n");
+
     strlcat(outfile, ".h", sizearray(outfile));
     fp = fopen(outfile, "wt");
     if (fp != NULL) {
@@ -636,7 +1549,12 @@ int main(int argc, char *argv[])
       /* temporarily rename the extension back to .h */
       assert(ptr != NULL && *(ptr + 1) == 'c');
       *(ptr + 1) = 'h';
-      generate_funcstubs(fp, opt_flags, trace_func, timestamp_func, outfile);
+      if (opt_flags & FLAG_COMPACT)
+        generate_funcstubs_compact(fp, opt_flags, trace_func, timestamp_func, outfile);
+      else if (opt_flags & FLAG_DIRECT)
+        generate_funcstubs_direct(fp, opt_flags, timestamp_func, outfile);
+      else
+        generate_funcstubs(fp, opt_flags, trace_func, timestamp_func, outfile);
       assert(ptr != NULL && *(ptr + 1) == 'h');
       *(ptr + 1) = 'c';
       fclose(fp);
@@ -645,6 +1563,21 @@ int main(int argc, char *argv[])
       done_msg = 0;
     }
 
+    if (opt_flags & FLAG_DECODER) {
+      ptr = strrchr(outfile, '.');
+      assert(ptr != NULL);
+      *ptr = '\0';
+      strlcat(outfile, "_decoder.c", sizearray(outfile));
+      fp = fopen(outfile, "wt");
+      if (fp != NULL) {
+        generate_decoder(fp, infile);
+        fclose(fp);
+      } else {
+        fprintf(stderr, "Error writing file \"%s\", error %d.\n", outfile, errno);
+        done_msg = 0;
+      }
+    }
+
     if (done_msg)
       printf("Generated \"%s\".\n", outfile);
   }